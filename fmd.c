@@ -38,8 +38,11 @@
 #include "sorthdr.h"
 
 #define PATH_SZ 1000
+/*
+ * The path is last so that only as much of it as is used gets saved (see
+ * fmdLength()).
+ */
 typedef struct _this_file_dat {
-    unsigned char path[PATH_SZ+1];
     unsigned char owner[FIELD_SZ+1];
     unsigned char group[FIELD_SZ+1];
     off_t size;
@@ -47,6 +50,7 @@ typedef struct _this_file_dat {
     char dt[FIELD_SZ+1];
     /* message digest information */
     unsigned char sha256[SHA256_SZ+1];
+    unsigned char path[PATH_SZ+1];
 } this_file_dat;
 
 int get_this_stat_data (const char *file, this_file_dat *fdp)
@@ -155,6 +159,79 @@ int fmdCompare (void *p1, void *p2)
     return (strcmp ((char *)(fd1->path), (char *)(fd2->path)));
 }
 
+size_t fmdLength (void *p)
+{
+    this_file_dat *fdp = (this_file_dat*)p;
+    return offsetof (this_file_dat, path) + strlen ((char *)fdp->path) + 1;
+}
+
+/*
+ * This is how this_file_dat was laid out before the path was moved to the
+ * end.  The .dat files written then were saved with nsort_save(), a whole
+ * record at a time, so fmd_get() can tell them by their magic number.
+ */
+typedef struct _this_file_dat_v1 {
+    unsigned char path[PATH_SZ+1];
+    unsigned char owner[FIELD_SZ+1];
+    unsigned char group[FIELD_SZ+1];
+    off_t size;
+    unsigned char mode[FIELD_SZ+1];
+    char dt[FIELD_SZ+1];
+    /* message digest information */
+    unsigned char sha256[SHA256_SZ+1];
+} this_file_dat_v1;
+
+/*
+ * Read the sorted data in save_name into srt.  The records of a file with
+ * the old layout are moved into the new one; a file of fixed records that
+ * are not the size of either is turned down with SORT_LIST_BADFILE rather
+ * than being misread.
+ */
+int fmd_get (nsort_t *srt, char *save_name)
+{
+    nsort_store_t ts;
+    this_file_dat_v1 *old;
+    this_file_dat *fdp;
+    nsort_link_t *lnk;
+    FILE *fp;
+
+    memset (&ts, 0, sizeof (nsort_store_t));
+    fp = fopen (save_name, "r");
+    if (fp != NULL) {
+        if (fread (&ts, sizeof (nsort_store_t), 1, fp) != 1)
+            ts.thisMagic = 0;
+        fclose (fp);
+    }
+    if (nsort_get (srt, fmdCompare, save_name) == _ERROR_)
+        return _ERROR_;
+    if (ts.thisMagic != DEFAULT_MAGIC)
+        return _OK_;
+    if (ts.size != (int)sizeof (this_file_dat_v1)) {
+        nsort_del (srt, 0);
+        srt->sortError = SORT_LIST_BADFILE;
+        return _ERROR_;
+    }
+    for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next) {
+        fdp = calloc (1, sizeof (this_file_dat));
+        if (fdp == NULL) {
+            nsort_del (srt, 0);
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        old = lnk->data;
+        memcpy (fdp->path, old->path, sizeof (fdp->path));
+        memcpy (fdp->owner, old->owner, sizeof (fdp->owner));
+        memcpy (fdp->group, old->group, sizeof (fdp->group));
+        fdp->size = old->size;
+        memcpy (fdp->mode, old->mode, sizeof (fdp->mode));
+        memcpy (fdp->dt, old->dt, sizeof (fdp->dt));
+        memcpy (fdp->sha256, old->sha256, sizeof (fdp->sha256));
+        free (lnk->data);
+        lnk->data = fdp;
+    }
+    return _OK_;
+}
+
 /*
  * 1. Check to see if there is a .dat file.
  *    a. If so, open it and add to it.
@@ -198,7 +275,7 @@ int fmd_add (char *fname)
     strncat (save_name, ".dat", PATH_MAX);
     printf ("DEBUG: save_name = %s\n", save_name);
     if (fexists (save_name)) {
-        ret = nsort_get (srt, fmdCompare, save_name);
+        ret = fmd_get (srt, save_name);
         if (ret == _ERROR_) {
             nsort_show_sort_error (srt, str, ERROR_SIZE);
             printf ("\n\n***Error: fmd_add, line %d, reading sort file: %s\n", __LINE__, str);
@@ -228,23 +305,21 @@ int fmd_add (char *fname)
             printf ("\n***Warning: \"%s\" does not exist...ignoring\n", cp);
             continue;
         }
-        fdp = malloc (sizeof (this_file_dat));
-        if (fdp == NULL) {
-            printf ("\n***Error: fmd_add, line %d, could not allocate %zu bites\n", __LINE__, sizeof (this_file_dat));
-            return  -1;
-        }
-        memset (fdp, 0, sizeof (this_file_dat));
-        lnk = (nsort_link_t*)malloc (sizeof (nsort_link_t));
+        /* a zeroed this_file_dat, allocated the way the sort frees it */
+        lnk = nsort_new_link (srt, NULL, sizeof (this_file_dat));
         if (lnk == NULL) {
             printf ("\n***Error: fmd_add, line %d, allocating nsort_link_t %zu bites\n", __LINE__, sizeof (nsort_link_t));
             nsort_del (srt, 0);
             nsort_destroy (srt);
             return -1;
         }
+        fdp = lnk->data;
         // printf ("DEBUG: cp = %s\n", cp);
         ret = get_this_stat_data (cp, fdp);
-        if (ret)
+        if (ret) {
+            nsort_free_link (srt, lnk, sizeof (this_file_dat));
             continue;
+        }
         /*
         if (fdp->mode[0] != 'd') {
             fdp->crc = crc64sum (cp);
@@ -255,13 +330,11 @@ int fmd_add (char *fname)
         if (shsum == NULL)
             return -1;
         strncpy ((char*)fdp->sha256, (char*)shsum, 2*SHA256_DIGEST_LENGTH);
-        lnk->data = fdp;
         ret = nsort_add_item (srt, lnk);
         if (ret == _ERROR_) {
             if (srt->sortError == SORT_UNIQUE) {
                 srt->sortError = SORT_NOERROR;
-                free (fdp);
-                free (lnk);
+                nsort_free_link (srt, lnk, sizeof (this_file_dat));
                 printf ("N/A: File %s already in sorted list\n", cp);
                 continue;
             }
@@ -271,10 +344,10 @@ int fmd_add (char *fname)
             ctr ++;
         }
     }
-    ret = nsort_save (srt, "Store sorted file and MD information", sizeof (this_file_dat), save_name); 
+    ret = nsort_save_var (srt, "Store sorted file and MD information", fmdLength, save_name);
     if (ret == _ERROR_) {
         nsort_show_sort_error (srt, str, ERROR_SIZE);
-        printf ("\n***Error: fmd_add, line %d, nsort_save(): %s\n", __LINE__, str);
+        printf ("\n***Error: fmd_add, line %d, nsort_save_var(): %s\n", __LINE__, str);
         return -1;
     }
     printf ("Added %d items to sorted list\n", ctr);
@@ -324,7 +397,7 @@ int fmd_check (char *fname)
         return -1;
     }
     if (fexists (save_name)) {
-        ret = nsort_get (srt, fmdCompare, save_name);
+        ret = fmd_get (srt, save_name);
         if (ret == _ERROR_) {
             nsort_show_sort_error (srt, str, ERROR_SIZE);
             printf ("\n\n***Error: fmd_check, line %d, reading sort file: %s\n", __LINE__, str);
@@ -424,7 +497,7 @@ int fmd_list (char *fname)
         return -1;
     }
     if (fexists (save_name)) {
-        ret = nsort_get (srt, fmdCompare, save_name);
+        ret = fmd_get (srt, save_name);
         if (ret == _ERROR_) {
             nsort_show_sort_error (srt, str, ERROR_SIZE);
             printf ("\n***Error: fmd_list, line %d, reading sort file: %s\n", __LINE__, str);
@@ -121,6 +121,9 @@ extern "C" {
 /* Define to 1 if you have the `strtol' function. */
 #define HAVE_STRTOL 1
 
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#define HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/stat.h> header file. */
 #define HAVE_SYS_STAT_H 1
 
@@ -221,6 +224,9 @@ extern "C" {
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #if !defined(__CINT__)
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
@@ -242,6 +248,19 @@ extern "C" {
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_STDDEF_H
+#include <stddef.h>
+#endif
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifndef XXH_INLINE_ALL
+#define XXH_INLINE_ALL
+#endif
+#include "xxhash.h"
 
     /*
      * @DocInclude LICENSE.tex
@@ -411,6 +430,13 @@ extern "C" {
 
 #define NSORT_NODE_LEVEL 10
 #define DEFAULT_MAGIC 0xea37beefUL
+#define NSORT_MAP_MAGIC 0xea37bee5UL
+#define NSORT_VAR_MAGIC 0xea37bee7UL
+#define NSORT_FRONT_MAGIC 0xea37bee9UL
+#define NSORT_HASH_MAGIC 0xea37beebUL
+#ifndef NSORT_VAR_ALIGN
+#define NSORT_VAR_ALIGN 8
+#endif
 #define NSORT_MIDPOINT 6
 #define NSORT_OUTPOINT 10
 #define NSORT_RESTRUCT 5
@@ -462,6 +488,8 @@ extern "C" {
         SORT_LIST_BADFILE,      /* bad list file */
         SORT_UNIQUE,            /* unique constraint violated */
         SORT_CORRUPT,           /* corrupt data detected */
+        SORT_FROZEN,            /* sort is frozen (read-only) */
+        SORT_BUSY,              /* a save is already going on */
         /* Add new ones here */
         SORT_UNSPECIFIED        /* unspecified error */
     } nsort_error_t;
@@ -482,9 +510,14 @@ extern "C" {
  * \begin{enumerate}
  *
  * \item nsort_link_t
+ * \item nsort_arena_t
  * \item nsort_list_t
  * \item nsort_node_t
  * \item nsort_store_t
+ * \item nsort_map_store_t
+ * \item nsort_map_t
+ * \item nsort_front_store_t
+ * \item nsort_front_t
  * \item nsort_node_level_t
  * \item nsort_t
  * \item nsort_hash_t
@@ -534,18 +567,96 @@ extern "C" {
  * the ``number'' member or the ``data'' member of nsort_link_t objects.  These need
  * to be set for each link by the application.
  *
+ * \subsubsection{nsort_arena_t}
+ * \index{nsort_arena_t}
+ *
+ * The nsort_arena_t type is used to carve small allocations (links, nodes,
+ * record payloads and hash keys) out of large slabs of memory.  It is defined as follows:
+ * [Verbatim] */
+
+#ifndef NSORT_ARENA_SLAB
+#define NSORT_ARENA_SLAB (64*1024)
+#endif
+#ifndef NSORT_ARENA_MAX_SLAB
+#define NSORT_ARENA_MAX_SLAB (16*1024*1024)
+#endif
+#ifndef NSORT_ARENA_ALIGN
+#define NSORT_ARENA_ALIGN 16
+#endif
+
+    typedef struct _nsort_slab_t {
+        struct _nsort_slab_t *next;
+        size_t size;
+        size_t used;
+        void *map;
+        size_t mapLength;
+    } nsort_slab_t;
+
+    typedef struct _nsort_arena_t {
+        nsort_slab_t *slabs;
+        size_t slabSize;
+        size_t numSlabs;
+        size_t bytesAlloc;
+        size_t bytesUsed;
+        void *freeNodes[NSORT_NODE_LEVEL + 1];
+    } nsort_arena_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * An arena is attached to a list (and through the list, to an nsort) with
+ * nsort_list_use_arena() or nsort_use_arena().  Once it is attached, nodes are
+ * taken from the arena instead of the heap, and links allocated with
+ * nsort_new_link() live in the arena along with their data.  Everything in an
+ * arena is released at once when the list or nsort that owns it is deleted, so
+ * tearing down a large nsort costs one free() per slab instead of two or three
+ * per record.
+ *
+ * The following are descriptions of each of the elements of the nsort_arena_t object:
+ *
+ * \begin{itemize}
+ *
+ * \item [slabs] This is the chain of slabs, most recently allocated first.  Each
+ * slab has an nsort_slab_t header followed by the memory that is handed out.
+ * A slab whose ``map'' is set has no memory to hand out (its size is 0); it
+ * stands for a file of ``mapLength'' bytes that nsort_get_arena() has mapped
+ * into memory (see nsort_save_map()), so the mapping is let go with the rest
+ * of the arena.
+ *
+ * \item [slabSize] This is the size of the next slab to allocate.  It starts at
+ * the size given to nsort_list_use_arena() (NSORT_ARENA_SLAB if that is 0) and
+ * doubles with every slab up to NSORT_ARENA_MAX_SLAB, so the number of slabs
+ * grows with the logarithm of the size of the data.
+ *
+ * \item [numSlabs, bytesAlloc, bytesUsed] These are statistics.  They give the
+ * number of slabs, the total size of the slabs and the number of bytes that
+ * have been handed out.  They should only be read by the application.
+ *
+ * \item [freeNodes] These are stacks of index nodes that have been released and
+ * can be reused, one for each node height.  They are not to be touched by the
+ * application.
+ *
+ * \end{itemize}
+ *
  * \subsubsection{nsort_list_t}
  * \index{nsort_list_t}
  *
  * The next data type is the nsort_list_t type and it is defined as follows:
  * [Verbatim] */
 
+#define NSORT_SYNC_NONE 0
+#define NSORT_SYNC_DATA 1
+#define NSORT_SYNC_FULL 2
+
     typedef struct _nsort_list_t {
         nsort_error_t listError;
         struct _nsort_link_t *head;
         struct _nsort_link_t *tail;
         struct _nsort_link_t *current;
         size_t number;
+        nsort_arena_t *arena;
+        int syncPolicy;
         struct _nsort_list_t *__n;
         struct _nsort_list_t *__p;
     } nsort_list_t;
@@ -573,6 +684,14 @@ extern "C" {
  * This should only be read by the application; if it is altered, it will result in
  * corruption errors.
  *
+ * \item [arena] The arena item is NULL unless nsort_list_use_arena() (or
+ * nsort_use_arena()) has been called for the list.  If it is set, the list owns the
+ * arena and it is freed when the list is deleted.
+ *
+ * \item [syncPolicy] The syncPolicy item says what is done to get the data onto the
+ * disk when the list (or the nsort that owns it) is saved.  It is NSORT_SYNC_NONE
+ * unless nsort_list_set_sync() (or nsort_set_sync()) has been called for the list.
+ *
  * \item [__n, __p] The __n and __p items are used to link the list into a global list
  * so they can be managed as part of the system.  These are only set when the list is
  * created or deleted and should not be changed by your application.
@@ -585,9 +704,50 @@ extern "C" {
         struct _nsort_node_t *prev;
         struct _nsort_node_t *next;
         nsort_link_t *here;
+        unsigned long prefix;
+        size_t count;
+        int height;
         struct _nsort_node_t *level[NSORT_NODE_LEVEL];
     } nsort_node_t;
 
+#define NSORT_NODE_SIZE(h) \
+    (offsetof(nsort_node_t, level) + \
+     (size_t)(h) * (sizeof(nsort_node_t *) + sizeof(size_t)))
+
+/*
+ * The span of a node on level i, which is kept just past its level pointers.
+ */
+#define NSORT_SPAN(node, i) \
+    (((size_t *) (void *) ((node)->level + (node)->height))[i])
+
+/*
+ * Set the link a node is on, along with its prefix.
+ */
+#define NSORT_SET_HERE(srt, node, lnk) \
+    ((node)->here = (lnk), \
+     (node)->prefix = NSORT_PREFIX(srt, (node)->here->data))
+
+/*
+ * The prefix of ``data'', or 0 if the sort doesn't have a prefix function.
+ */
+#define NSORT_PREFIX(srt, data) \
+    (((srt)->prefix != 0) ? (srt)->prefix(data) : 0UL)
+
+/*
+ * Compare ``key'', whose prefix is ``pfx'', with the item a node is on.  The
+ * compare function is only called if the prefixes are the same.
+ */
+#define NSORT_NODE_CMP(srt, key, pfx, node) \
+    (((srt)->prefix != 0 && (pfx) != (node)->prefix) ? \
+     (((pfx) < (node)->prefix) ? -1 : 1) : \
+     (srt)->compare((key), (node)->here->data))
+
+#if defined(__GNUC__)
+#define NSORT_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define NSORT_PREFETCH(p)
+#endif
+
 /* [EndDoc] */
 /*
  * [BeginDoc]
@@ -609,8 +769,28 @@ extern "C" {
  *
  * \item [here] The here item points to a link in the doubly-linked list.
  *
+ * \item [prefix] If the sort has a prefix function (see nsort_set_prefix()), this is
+ * the prefix of here->data, so most of the compares made while walking the index
+ * are decided without leaving the node.
+ *
+ * \item [count] This is the number of links from here up to the here of the next
+ * node.  It is kept so that the position of an item in the sort can be found
+ * without walking the list (see nsort_rank()).  It is not kept for the last node.
+ *
+ * \item [height] This is the number of level pointers the node has room for.  Only
+ * the sentinels and the first node have all NSORT_NODE_LEVEL of them; the other
+ * nodes are allocated with NSORT_NODE_SIZE(height) bytes, which is enough for the
+ * levels they are on plus one, so that they can be moved up a level as items are
+ * added.  Most nodes are on no level at all and take 64 bytes (on a 64 bit
+ * machine) instead of 208.
+ *
  * \item [level] The level item is an array of node pointers used to provide levels
- * of indexing.  See the source code to understand how this is accomplished.
+ * of indexing.  A node on level i is also on every level below it and
+ * level[i] points to the next node on that level (or to srt->tail).  The first
+ * node is on every level.  See the source code to understand how this is
+ * accomplished.  Past the level pointers of a node (but for the sentinels)
+ * are its spans; NSORT_SPAN(node, i) is the number of links from here up to the
+ * here of level[i], and like count it is not kept when level[i] is srt->tail.
  *
  * \end{itemize}
  *
@@ -679,6 +859,222 @@ extern "C" {
  * There are elements of the nsort_store_t object that are not used by the nsort routines but
  * are provided for higher-level applications to use.
  *
+ * \subsubsection{nsort_map_store_t}
+ * \index{nsort_map_store_t}
+ *
+ * A file written by nsort_save_map() starts with an nsort_store_t whose
+ * thisMagic is NSORT_MAP_MAGIC, followed by an nsort_map_store_t that tells
+ * where everything else in the file is.  It is defined as follows:
+ * [Verbatim] */
+
+#ifndef NSORT_MAP_LEVELS
+#define NSORT_MAP_LEVELS 8
+#endif
+#ifndef NSORT_MAP_PAGE
+#define NSORT_MAP_PAGE 4096
+#endif
+#ifndef NSORT_MAP_MIN_EVERY
+#define NSORT_MAP_MIN_EVERY 16
+#endif
+
+    typedef struct _nsort_map_store_t {
+        size_t number;
+        size_t size;
+        size_t every;
+        size_t length;
+        int numLevels;
+        size_t count[NSORT_MAP_LEVELS];
+        size_t offset[NSORT_MAP_LEVELS];
+    } nsort_map_store_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The records are stored in sorted order, starting on a page boundary, and
+ * the index is stored after them.  The index is a set of levels, each of which
+ * is a copy of every ``every''th entry of the level below it, the records being
+ * level 0, so that a search reads about a page of each level and then a page
+ * of records.  The following are descriptions of the elements of the
+ * nsort_map_store_t object:
+ *
+ * \begin{itemize}
+ *
+ * \item [number] This is the number of records.  It is here as well as in the
+ * nsort_store_t because that one is an int.
+ *
+ * \item [size] This is the size of each record.
+ *
+ * \item [every] This is the number of entries of a level that each entry of the
+ * level above it stands for.  It is NSORT_MAP_PAGE / size, but no less than
+ * NSORT_MAP_MIN_EVERY.
+ *
+ * \item [length] This is the length of the whole file.
+ *
+ * \item [numLevels] This is the number of levels, counting the records.  There
+ * are enough that the top one has no more than ``every'' entries, up to
+ * NSORT_MAP_LEVELS.
+ *
+ * \item [count, offset] These are the number of entries on each level and
+ * where each level starts in the file.
+ *
+ * \end{itemize}
+ *
+ * \subsubsection{nsort_map_t}
+ * \index{nsort_map_t}
+ *
+ * The nsort_map_t type is used to search a file written by nsort_save_map()
+ * where it lies, without reading it in.  It is defined as follows:
+ * [Verbatim] */
+
+    typedef struct _nsort_map_t {
+        nsort_store_t store;
+        char *base;
+        size_t length;
+        size_t number;
+        size_t size;
+        size_t every;
+        int numLevels;
+        size_t count[NSORT_MAP_LEVELS];
+        char *level[NSORT_MAP_LEVELS];
+        int (*compare)(void *, void *);
+    } nsort_map_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * An nsort_map_t is set up by nsort_map_open() and let go by nsort_map_close().
+ * The following are descriptions of the elements of the nsort_map_t object:
+ *
+ * \begin{itemize}
+ *
+ * \item [store] This is a copy of the nsort_store_t at the top of the file, for
+ * the description and the time stamp.
+ *
+ * \item [base, length] This is where the file is mapped and how long it is.
+ *
+ * \item [number, size, every, numLevels, count] These are the same as the items
+ * of the nsort_map_store_t of the file.
+ *
+ * \item [level] This is where each level of the file is in memory; level[0] is
+ * the first record.
+ *
+ * \item [compare] This is the compare function the records were sorted with.
+ *
+ * \end{itemize}
+ *
+ * These should only be read by the application.
+ *
+ * \subsubsection{nsort_front_store_t}
+ * \index{nsort_front_store_t}
+ *
+ * A file written by nsort_save_front() starts with an nsort_store_t whose
+ * thisMagic is NSORT_FRONT_MAGIC, followed by an nsort_front_store_t that
+ * tells how the keys in it are laid out.  It is defined as follows:
+ * [Verbatim] */
+
+#ifndef NSORT_FRONT_BLOCK
+#define NSORT_FRONT_BLOCK 16
+#endif
+
+    typedef struct _nsort_front_store_t {
+        size_t number;
+        size_t every;
+        size_t numBlocks;
+        size_t maxLength;
+        size_t rawLength;
+        size_t length;
+    } nsort_front_store_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The keys are strings and are stored front-coded in sorted order, in blocks
+ * of ``every'' keys.  The first key of a block is stored whole, with its
+ * terminator.  Each of the others is stored as the number of bytes it shares
+ * with the key before it, in 7 bit groups with the top bit set on all but the
+ * last, followed by the rest of the key and its terminator.  The headers are
+ * followed by a table of where each block starts in the key area and then by
+ * the key area itself, so a search can go straight to the first key of any
+ * block.  Keys that share long prefixes, like the paths of the files in a
+ * directory tree, take a fraction of the room they take whole.  The following are
+ * descriptions of the elements of the nsort_front_store_t object:
+ *
+ * \begin{itemize}
+ *
+ * \item [number] This is the number of keys.
+ *
+ * \item [every] This is the number of keys in each block.  It is
+ * NSORT_FRONT_BLOCK (16 unless it is defined otherwise).
+ *
+ * \item [numBlocks] This is the number of blocks, and of entries in the table.
+ *
+ * \item [maxLength] This is the length of the longest key, counting its
+ * terminator.
+ *
+ * \item [rawLength] This is the length of all the keys whole, counting their
+ * terminators.
+ *
+ * \item [length] This is the length of the key area.
+ *
+ * \end{itemize}
+ *
+ * \subsubsection{nsort_front_t}
+ * \index{nsort_front_t}
+ *
+ * The nsort_front_t type holds a set of front-coded keys in memory and is used
+ * to search them.  It is defined as follows:
+ * [Verbatim] */
+
+    typedef struct _nsort_front_t {
+        nsort_store_t store;
+        char *base;
+        size_t length;
+        int mapped;
+        size_t number;
+        size_t every;
+        size_t numBlocks;
+        size_t maxLength;
+        size_t rawLength;
+        size_t *block;
+        char *keys;
+        size_t keyLength;
+        int (*compare)(void *, void *);
+    } nsort_front_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * An nsort_front_t is set up from a sort by nsort_front_build() or from a file
+ * written by nsort_save_front() by nsort_front_open(), and is let go by
+ * nsort_front_close().  Either way it holds the same thing a file does, so it
+ * takes about as much memory as the file.  The following are descriptions of
+ * the elements of the nsort_front_t object:
+ *
+ * \begin{itemize}
+ *
+ * \item [store] This is a copy of the nsort_store_t at the top of the file, for
+ * the description and the time stamp.
+ *
+ * \item [base, length, mapped] This is where the keys and their headers are in
+ * memory and how long they are.  If ``mapped'' is set, they are a file mapped
+ * into memory; otherwise they were allocated by nsort_front_build().
+ *
+ * \item [number, every, numBlocks, maxLength, rawLength] These are the same as
+ * the items of the nsort_front_store_t.
+ *
+ * \item [block] This is the table of where each block starts in ``keys''.
+ *
+ * \item [keys, keyLength] This is the key area and its length.
+ *
+ * \item [compare] This is the compare function the keys were sorted with.
+ *
+ * \end{itemize}
+ *
+ * These should only be read by the application.
  *
  * [Verbatim] */
 
@@ -710,6 +1106,60 @@ extern "C" {
  * 
  * \end{itemize}
  *
+ * [Verbatim] */
+
+    typedef struct _nsort_geometry_t {
+        int levels;
+        int fanout;
+        int midpoint;
+        int outpoint;
+        int restructThresh;
+        size_t outThresh;
+        size_t critThresh;
+        int autoTune;
+    } nsort_geometry_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_geometry_t}
+ * \index{nsort_geometry_t}
+ *
+ * The nsort_geometry_t data type holds the shape of the index of an nsort_t object
+ * and when it is rebuilt.  Every nsort_t has its own, which starts out with the
+ * values of the NSORT_ macros by the same names (see nsort_geometry_defaults()) and
+ * can be changed with nsort_set_geometry().  The following are descriptions of its
+ * elements:
+ *
+ * \begin{itemize}
+ *
+ * \item [levels] This is the number of levels the index is built with, from 1 to
+ * NSORT_NODE_LEVEL.  A small sort is searched faster with fewer levels and a very
+ * large one needs all of them.
+ *
+ * \item [fanout] When the index is rebuilt, there is a node on every fanout links
+ * and every fanout nodes on a level go up to the next level.  A bigger fanout makes
+ * a smaller index that takes more compares to search.  The default is NSORT_RESTRUCT.
+ *
+ * \item [midpoint,outpoint] As items are added, the index is kept up in place.
+ * When an add walks past outpoint links (or nodes on a level) without finding a
+ * node (or a node on the level above), the one it passed at midpoint gets one.
+ *
+ * \item [restructThresh,outThresh,critThresh] An operation that takes more than
+ * outThresh compares counts against the index, and when restructThresh of them
+ * have been counted, the index is rebuilt.  One that takes more than critThresh
+ * compares has the index rebuilt right away.
+ *
+ * \item [autoTune] If this is TRUE, the geometry is worked out by the nsort
+ * routines as the sort is used.  Each time the index is rebuilt, levels is set from
+ * the number of items, midpoint and outpoint from fanout and the thresholds from
+ * the number of compares the operations took just after the last rebuild.  The
+ * number of levels is also raised as items are added, without waiting for a
+ * rebuild.  Only fanout is left as it was given.
+ *
+ * \end{itemize}
+ *
  * [Verbatim] */
 
     typedef struct _nsort_t {
@@ -717,7 +1167,10 @@ extern "C" {
         nsort_node_t *head;
         nsort_node_t *tail;
         nsort_node_t *current;
+        nsort_node_t *finger[NSORT_NODE_LEVEL + 1];
+        int fingerMiss;
         size_t numNodes;
+        size_t preCount;
         int nodeLevel;
         int isUnique;
         int manageAllocs;
@@ -726,6 +1179,15 @@ extern "C" {
         int thresh;
         size_t numRestruct;
         int (*compare)(void *, void *);
+        unsigned long (*prefix)(void *);
+        nsort_geometry_t geometry;
+        size_t tuneOps;
+        size_t tuneCompares;
+        size_t tuneNext;
+        int isFrozen;
+        struct _nsort_sync_t *sync;
+        struct _nsort_rebuild_t *rebuild;
+        struct _nsort_snapshot_t *snapshot;
 #ifdef NSORT_STATS
         double traversal_time;
 #endif
@@ -752,8 +1214,19 @@ extern "C" {
  * \item [current] The current item is a pointer to the ``current'' member of the list.
  * Certain functions act on the node list based on the value of the current member.
  *
+ * \item [finger,fingerMiss] The finger item holds the node nsort_add_item() stopped at on the
+ * list of nodes (finger[0]) and on each level of the index (finger[i+1] for level[i]) the
+ * last time it searched it.  The next add starts from there instead of from the top of
+ * the index, so an item that goes near the last one added takes a few compares.
+ * finger[0] is NULL when there is nothing to start from, which is also how an add that
+ * fails after moving some of the fingers drops them.  fingerMiss counts the adds in a
+ * row the finger didn't help.
+ *
  * \item [numNodes] This is the number of nodes that are in the node list.
  *
+ * \item [preCount] This is the number of links before the here of the first node.  With
+ * the count and spans of the nodes, it gives the position of any item in the sort.
+ *
  * \item [nodeLevel] This item is not used by the nsort routines and is provided for
  * higher level applications to use.
  *
@@ -790,6 +1263,34 @@ extern "C" {
  * The compare function is very important and will determine how the data elements in
  * the list are ``sorted''.
  *
+ * \item [prefix] This item is NULL unless it has been set by nsort_set_prefix(), in
+ * which case it points to a function that returns a number for a data element
+ * that is kept in each node of the index, so that most of the compares are done
+ * without calling the compare function.
+ *
+ * \item [geometry] This item is the shape of the index (see nsort_geometry_t).  It
+ * should only be changed with nsort_set_geometry().
+ *
+ * \item [tuneOps,tuneCompares,tuneNext] These items are used by the auto-tuning
+ * (see nsort_geometry_t).  The first two are the number of operations done just
+ * after the last rebuild and the compares they took, and tuneNext is the number of
+ * items at which another level is needed.
+ *
+ * \item [isFrozen] This item is TRUE between calls to nsort_freeze() and nsort_thaw().
+ * While it is set, the object can not be changed and searches on it are safe to do from
+ * any number of threads at once.  It should only be read by the application.
+ *
+ * \item [sync] This item is NULL unless nsort_sync_init() has been called on the object,
+ * in which case it points to the locks that make the object safe to use from more than
+ * one thread.
+ *
+ * \item [rebuild] This item is NULL unless the index is being restructured a step at
+ * a time, in which case it holds the state of the new index (see
+ * nsort_restructure_step()).
+ *
+ * \item [snapshot] This item is NULL unless a save started by nsort_save_async() is
+ * going on or has not been waited for with nsort_save_wait().
+ *
  * \item [traversal_time] This item is only defined if NSORT_STATS is defined.  You
  * should be advised that #defining NSORT_STATS slows down the performance of the sort
  * routines greatly, almost to the point where it becomes unuseable.
@@ -803,26 +1304,137 @@ extern "C" {
  * fairly simple to use, although how the indexing is done during adds is not at all
  * trivial and I don't make an attempt to explain it in detail.  You can figure that
  * out by reading the source.
+ *
+ * \subsubsection{nsort_sync_t}
+ * \index{nsort_sync_t}
+ *
+ * The nsort_sync_t data type holds the locks of an nsort_t object that is shared
+ * between threads.  It is allocated by nsort_sync_init() and hung off of srt->sync.
+ * The lock item is held for reading by searches and for writing while the list or
+ * index is changed.  The writer item is held by a thread for the whole of a change,
+ * so writers take turns among themselves without keeping readers out while they
+ * get ready (for example, while an index is rebuilt).
+ *
+ * [Verbatim] */
+
+#ifdef HAVE_PTHREAD_H
+    typedef struct _nsort_sync_t {
+        pthread_rwlock_t lock;
+        pthread_mutex_t writer;
+    } nsort_sync_t;
+#endif
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_rebuild_t}
+ * \index{nsort_rebuild_t}
+ *
+ * The nsort_rebuild_t data type holds a new index for an nsort_t while it is built
+ * a few links at a time, alongside the index that searches are using.  The head
+ * item is the sentinel of the new node list and last is its last node (or head).
+ * The lastLevel and count items are the last node on each level and the number of
+ * nodes on the level below since it, linkCount is the number of links from the
+ * last node up to the cursor (the count of the last node) and preCount the number
+ * of links before the first one.  The cursor item is the next link to be looked
+ * at; it is NULL once the new index has been swapped in, after which oldNodes
+ * holds the nodes of the old index that are still to be freed.  These are
+ * private to the nsort routines.
+ *
+ * [Verbatim] */
+
+    typedef struct _nsort_rebuild_t {
+        nsort_node_t head;
+        nsort_node_t *last;
+        nsort_node_t *lastLevel[NSORT_NODE_LEVEL];
+        int count[NSORT_NODE_LEVEL];
+        size_t linkCount;
+        size_t preCount;
+        nsort_link_t *cursor;
+        size_t numNodes;
+        nsort_node_t *oldNodes;
+    } nsort_rebuild_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_t}
+ * \index{nsort_cursor_t}
+ *
+ * The nsort_cursor_t data type marks a place in the list of an nsort_t object so
+ * that a range of items can be scanned (see nsort_cursor_init()).  The srt item
+ * is the sort and link is the link the cursor is on, which is srt->lh->tail when
+ * it has gone past the last item and srt->lh->head when it has gone back past the
+ * first one.  The ahead item is a link up to NSORT_CURSOR_AHEAD links past link
+ * and gap is how far past it is; as the cursor goes forward, the data of the
+ * link at ahead is prefetched so that it is in the cache by the time the cursor
+ * gets there.  A cursor is good for as long as the sort is not changed.
+ *
+ * [Verbatim] */
+
+#ifndef NSORT_CURSOR_AHEAD
+#define NSORT_CURSOR_AHEAD 8
+#endif
+
+    typedef struct _nsort_cursor_t {
+        nsort_t *srt;
+        nsort_link_t *link;
+        nsort_link_t *ahead;
+        int gap;
+    } nsort_cursor_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
 *
 * \subsubsection{nsort_hash_t}
 * \index{nsort_hash_t}
 *
-* The nsort_hash_t data type is used to create a high-performance hash.  Basically,
-* you can add several hundred thousand items to an nsort_hash_t object (of length
-* 5-40 bytes) in about half a second and search for each of those items in the hash
-* in under a second.  This is probably overkill in an application where you only have
-* a few thousand items to hash; however, it is robust enough to do the job.
+* The nsort_hash_t data type is used to create a high-performance hash.  It is an
+* open addressing hash table that grows as items are added to it.  The slots of
+* the table are kept in groups of NSORT_HASH_GROUP, and each slot has a control
+* byte that is NSORT_HASH_EMPTY, NSORT_HASH_DELETED (a slot whose key was
+* removed) or the low 7 bits of the hash of the key in
+* it, so a search looks at a whole group of control bytes at once (with SSE2, if
+* it is there) and only compares the keys whose control byte, stored 64-bit hash
+* and length match.  Keys are strings of any bytes, and each one can have a value
+* that goes with it, so the hash can be used as a set or as a map.  Several
+* million keys can be added and searched for in a second or two.
 *
 * [Verbatim] */
 
-#define NSORT_HASH_SIZE 151
+#define NSORT_HASH_GROUP 16
+#define NSORT_HASH_EMPTY 0x80
+#define NSORT_HASH_DELETED 0xfe
+#define NSORT_HASH_CAPACITY 1024
+#define NSORT_HASH_LOAD 0.875
+
+    typedef struct _nsort_hash_slot_t {
+        uint64_t hash;
+        char *key;
+        void *value;
+    } nsort_hash_slot_t;
+
+#define NSORT_HASH_KEYLEN(key) (((size_t *) (key))[-1])
 
     typedef struct _nsort_hash_t {
         nsort_error_t hashError;
         int number;
         int numCompares;
         unsigned int (*hash)(const char *);
-        nsort_t *srts[NSORT_HASH_SIZE];
+        uint64_t (*hash64)(const void *, size_t);
+        int (*compare)(void *, void *);
+        double maxLoad;
+        size_t capacity;
+        size_t grow;
+        size_t deleted;
+        unsigned char *ctrl;
+        nsort_hash_slot_t *slots;
+        char *map;
+        size_t mapLength;
+        nsort_arena_t *arena;
     } nsort_hash_t;
 
 /* [EndDoc] */
@@ -844,12 +1456,148 @@ extern "C" {
  * \item [numCompares] This item reflects the number of compares that were needed
  * for the most recent search or insert.
  *
- * \item [hash] This is a pointer to a hash function.  There is one provided that
- * is good with strings; however, if you want to use another, you can.
+ * \item [hash] This is a pointer to a string hash function given to
+ * nsort_hash_init(), or NULL.  If it is set, it is used instead of hash64 by
+ * the functions that take strings, and the functions that take keys can't be
+ * used.  The value it returns is mixed before it is used, so it doesn't have to
+ * spread its bits itself.
+ *
+ * \item [hash64] This is the 64-bit hash function the keys are hashed with.  It
+ * is nsort_hash_xxh3() unless another is set with nsort_hash_set_function().
+ *
+ * \item [compare] This is the compare function a key in the hash is checked
+ * against the key being searched for with, once their hashes and lengths match.
+ * Only whether it returns 0 matters.  If it is NULL, the bytes are compared.
+ *
+ * \item [maxLoad] This is the share of the slots of the table that can be used
+ * before the table is doubled in size.
+ *
+ * \item [capacity] This is the number of slots in the table, which is a power of
+ * 2 and a multiple of NSORT_HASH_GROUP.
+ *
+ * \item [grow] This is the number of items (and removed slots) that makes the
+ * table grow when it is reached.
+ *
+ * \item [deleted] This is the number of slots whose keys were removed.  They
+ * are used again by keys that are added, and are cleared out when the table is
+ * rebuilt.
+ *
+ * \item [ctrl] This is the array of control bytes, one for each slot.
+ *
+ * \item [slots] This is the array of slots.  Each one holds a key, the hash of
+ * it and the value that goes with it, so keys whose hash doesn't match are
+ * passed over without a compare and the table can grow without hashing the keys
+ * again.  The keys are copies, with a NUL after them, and the length of a key
+ * is kept in front of it, where NSORT_HASH_KEYLEN() gets it.
+ *
+ * \item [map, mapLength] These are the file a hash was read from with
+ * nsort_hash_get() and its length, or NULL.  The table and the keys are left
+ * where they lie in it until the table grows or the keys are removed.
+ *
+ * \item [arena] This is NULL unless nsort_hash_use_arena() has been called for
+ * the hash.  If it is set, the copies of the keys are packed into it instead of
+ * being allocated one at a time, and it is freed when the hash is deleted.
+ *
+ * \end{itemize}
+ *
+ * \subsubsection{nsort_hash_cursor_t}
+ * \index{nsort_hash_cursor_t}
+ *
+ * The nsort_hash_cursor_t type is used to go through the keys of a hash with
+ * nsort_hash_cursor_next(), in the order of the slots they are in.  It is
+ * defined as follows:
+ * [Verbatim] */
+
+    typedef struct _nsort_hash_cursor_t {
+        nsort_hash_t *hsh;
+        size_t slot;
+    } nsort_hash_cursor_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The hsh item is the hash and slot is the slot the next key is looked for
+ * from.
+ *
+ * \subsubsection{nsort_hash_store_t}
+ * \index{nsort_hash_store_t}
+ *
+ * A file written by nsort_hash_save() starts with an nsort_store_t whose
+ * thisMagic is NSORT_HASH_MAGIC, followed by an nsort_hash_store_t.  It is
+ * defined as follows:
+ * [Verbatim] */
+
+    typedef struct _nsort_hash_store_t {
+        size_t number;
+        size_t capacity;
+        size_t deleted;
+        size_t keyLength;
+        double maxLoad;
+    } nsort_hash_store_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The headers are followed by the control bytes and the slots of the table
+ * just as they are in memory, except that the key of each slot is where the key
+ * is in the key area that comes after them.  Each key in the key area is its
+ * length as a size_t, its bytes and a NUL, padded out to a size_t.  The items
+ * of the nsort_hash_store_t are the number of keys, the number of slots, the
+ * number of removed slots, the length of the key area and the maximum load of
+ * the hash.
+ *
+ * \subsubsection{nsort_shash_t}
+ * \index{nsort_shash_t}
+ *
+ * The nsort_shash_t data type is a hash that can be shared by threads.  It is
+ * made up of a number of shards, each of which is an nsort_hash_t with a lock
+ * of its own, and a key goes in the shard picked by the high bits of its hash.
+ * A thread only holds the lock of one shard, and only while it probes that
+ * shard (the key is hashed before the lock is taken), so threads that are
+ * adding and searching for different keys seldom wait for each other.
+ *
+ * [Verbatim] */
+
+#define NSORT_SHASH_SHARDS 64
+#define NSORT_SHASH_MAX 65536
+
+    typedef struct _nsort_shash_shard_t {
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_t lock;
+#endif
+        nsort_hash_t hsh;
+        char pad[64];
+    } nsort_shash_shard_t;
+
+    typedef struct _nsort_shash_t {
+        nsort_error_t hashError;
+        int numShards;
+        uint64_t (*hash64)(const void *, size_t);
+        nsort_shash_shard_t *shards;
+    } nsort_shash_t;
+
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The following are descriptions of each of the elements of the nsort_shash_t
+ * object:
+ *
+ * \begin{itemize}
+ *
+ * \item [hashError] This item is the error of nsort_shash_init(),
+ * nsort_shash_set_function() and nsort_shash_use_arena().  The functions that
+ * threads call return their errors instead.
+ *
+ * \item [numShards] This item is the number of shards, a power of 2.
  *
- * \item [srts] This is the array of nsort objects that are the actual buckets for
- * the hash.  NSORT_HASH_SIZE is the number of these that will be allocated and it
- * should be a prime number.
+ * \item [hash64] This is the 64-bit hash function of the keys.
+ *
+ * \item [shards] This is the array of shards.  Each one is a lock and a hash,
+ * and the pad keeps the locks of shards next to each other off of one cache
+ * line.
  *
  * \end{itemize}
  *
@@ -1754,6 +2502,10 @@ extern "C" {
     int nsort_show_list_error(nsort_list_t * lh, char *str, size_t len);
     int nsort_show_sort_error(nsort_t * srt, char *str, size_t len);
     int nsort_text_file_split(char **cpp, int maxnum, char *ln, int ch);
+    int nsort_arena_init(nsort_arena_t * ar, size_t slabSize);
+    void *nsort_arena_alloc(nsort_arena_t * ar, size_t size);
+    int nsort_arena_release(nsort_arena_t * ar, void *ptr, size_t size);
+    int nsort_arena_del(nsort_arena_t * ar);
     nsort_list_t *nsort_list_create(void);
     int nsort_list_destroy(nsort_list_t * lh);
     int nsort_list_init(nsort_list_t * nlh);
@@ -1761,6 +2513,12 @@ extern "C" {
     int nsort_list_insert_link(nsort_list_t * lh, nsort_link_t * lnk);
     nsort_link_t *nsort_list_remove_link(nsort_list_t * lh);
     int nsort_list_clear(nsort_list_t * lh);
+    int nsort_list_use_arena(nsort_list_t * lh, size_t slabSize);
+    int nsort_list_set_sync(nsort_list_t * lh, int policy);
+    nsort_link_t *nsort_list_new_link(nsort_list_t * lh, void *data,
+                                      size_t size);
+    int nsort_list_free_link(nsort_list_t * lh, nsort_link_t * lnk,
+                             size_t size);
     size_t nsort_list_write_block(int fd, off_t where, size_t reclen,
                                   nsort_list_t * lh);
     int nsort_list_read_block(nsort_list_t * lh, int fd, off_t where,
@@ -1773,32 +2531,99 @@ extern "C" {
     int nsort_list_merge_sorted(nsort_list_t * mrg, nsort_list_t * l1,
                                 nsort_list_t * l2, int (*compare)(void *,
                                                                   void *));
+    int nsort_list_msort(nsort_list_t * lh, int (*compare)(void *, void *));
+    int nsort_list_merge_many(nsort_list_t * dst, nsort_list_t ** lists,
+                              int k, int (*compare)(void *, void *));
+    int nsort_list_merge_many_parallel(nsort_list_t * dst,
+                                       nsort_list_t ** lists, int k,
+                                       int (*compare)(void *, void *),
+                                       int nthreads);
     nsort_t *nsort_create(void);
     int nsort_destroy(nsort_t * srt);
     int nsort_init(nsort_t * srtp, int (*compare)(void *, void *),
                    int isUnique, int manageAllocs);
     int nsort_del(nsort_t * srt, void (*delFunc)(void *));
+    int nsort_use_arena(nsort_t * srt, size_t slabSize);
+    int nsort_set_sync(nsort_t * srt, int policy);
+    nsort_link_t *nsort_new_link(nsort_t * srt, void *data, size_t size);
+    int nsort_free_link(nsort_t * srt, nsort_link_t * lnk, size_t size);
     int nsort_new_node(nsort_t * srt, nsort_node_t * prevNode,
                        nsort_node_t * nextNode, nsort_link_t * here);
     int nsort_add_item(nsort_t * srt, nsort_link_t * lnk);
+    int nsort_add_items(nsort_t * srt, nsort_link_t ** lnks, size_t num,
+                        nsort_error_t * errs);
     int nsort_restructure_nodes(nsort_t * srt);
     nsort_link_t *nsort_find_item(nsort_t * srt, nsort_link_t * lnk);
     nsort_link_t *nsort_query_item(nsort_t * srt, nsort_link_t * lnk);
-    int nsort_store(nsort_t * srt, nsort_store_t * ts,
+    int nsort_rank(nsort_t * srt, nsort_link_t * lnk, size_t * rank);
+    nsort_link_t *nsort_select(nsort_t * srt, size_t k);
+    int nsort_count_range(nsort_t * srt, nsort_link_t * lo, nsort_link_t * hi,
+                          size_t * count);
+    int nsort_cursor_init(nsort_cursor_t * cur, nsort_t * srt);
+    nsort_link_t *nsort_cursor_first(nsort_cursor_t * cur);
+    nsort_link_t *nsort_cursor_last(nsort_cursor_t * cur);
+    nsort_link_t *nsort_cursor_lower_bound(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk);
+    nsort_link_t *nsort_cursor_upper_bound(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk);
+    nsort_link_t *nsort_cursor_next(nsort_cursor_t * cur);
+    nsort_link_t *nsort_cursor_prev(nsort_cursor_t * cur);
+    size_t nsort_cursor_read(nsort_cursor_t * cur, void **data, size_t num);
+    int nsort_freeze(nsort_t * srt);
+    int nsort_thaw(nsort_t * srt);
+#ifdef HAVE_PTHREAD_H
+    int nsort_sync_init(nsort_t * srt);
+    int nsort_sync_del(nsort_t * srt);
+#endif
+    int nsort_restructure_step(nsort_t * srt, size_t budget);
+    int nsort_set_prefix(nsort_t * srt, unsigned long (*prefix)(void *));
+    void nsort_geometry_defaults(nsort_geometry_t * geo);
+    int nsort_set_geometry(nsort_t * srt, const nsort_geometry_t * geo);
+    unsigned long nsort_prefix_string(void *data);
+    int nsort_store(nsort_t * srt, nsort_store_t * ts,
                     int reclen, char *fname);
     int nsort_save(nsort_t * srt, const char *desc, int reclen,
                    char *fname);
+    int nsort_save_async(nsort_t * srt, const char *desc, int reclen,
+                         char *fname, void (*callback)(nsort_t *,
+                                                       nsort_error_t,
+                                                       void *), void *arg);
+    int nsort_save_wait(nsort_t * srt);
     int nsort_retrieve(nsort_t * srt, nsort_store_t * ts,
                        const char *fname, long magic);
     int nsort_get(nsort_t * srt, int (*compare)(void *, void *),
                   const char *fname);
+    int nsort_get_arena(nsort_t * srt, int (*compare)(void *, void *),
+                        const char *fname);
     int nsort_get_all(nsort_t * srt, int (*compare)(void *, void *),
                       const char *fname, char *desc, char *timestamp);
+    int nsort_save_map(nsort_t * srt, const char *desc, int reclen,
+                       char *fname);
+    int nsort_map_open(nsort_map_t * map, int (*compare)(void *, void *),
+                       const char *fname);
+    size_t nsort_map_lower_bound(nsort_map_t * map, void *key);
+    size_t nsort_map_upper_bound(nsort_map_t * map, void *key);
+    void *nsort_map_record(nsort_map_t * map, size_t i);
+    void *nsort_map_find(nsort_map_t * map, void *key);
+    int nsort_map_close(nsort_map_t * map);
+    int nsort_save_var(nsort_t * srt, const char *desc,
+                       size_t (*reclen)(void *), char *fname);
+    int nsort_save_front(nsort_t * srt, const char *desc, char *fname);
+    int nsort_front_build(nsort_front_t * fc, nsort_t * srt);
+    int nsort_front_open(nsort_front_t * fc, int (*compare)(void *, void *),
+                         const char *fname);
+    size_t nsort_front_lower_bound(nsort_front_t * fc, const char *key);
+    size_t nsort_front_upper_bound(nsort_front_t * fc, const char *key);
+    size_t nsort_front_find(nsort_front_t * fc, const char *key);
+    char *nsort_front_key(nsort_front_t * fc, size_t i, char *buf);
+    int nsort_front_close(nsort_front_t * fc);
     nsort_link_t *nsort_remove_item(nsort_t * srt, nsort_link_t * lnk);
     int nsort_node_levels(nsort_t * srt, nsort_node_level_t * lvl);
     nsort_list_t *nsort_sort_to_list(nsort_t * srt);
     int nsort_list_to_sort(nsort_t * srt, nsort_list_t * lh,
                            int (*cmp)(void *, void *));
+    int nsort_build_sorted(nsort_t * srt, void **data, size_t n,
+                           int (*cmp)(void *, void *), int check);
     unsigned long nsort_hash_function(register const unsigned char *key);
     int nsort_show_hash_error(nsort_hash_t * hsh, char *str, size_t len);
     nsort_hash_t *nsort_hash_create(void);
@@ -1806,8 +2631,47 @@ extern "C" {
     int nsort_hash_init(nsort_hash_t * hsh,
                         int (*compare)(void *, void *),
                         unsigned int (*hash)(const char *));
+    int nsort_hash_init_size(nsort_hash_t * hsh,
+                             int (*compare)(void *, void *),
+                             unsigned int (*hash)(const char *),
+                             size_t capacity, double maxLoad);
+    uint64_t nsort_hash_xxh3(const void *key, size_t len);
+    int nsort_hash_set_function(nsort_hash_t * hsh,
+                                uint64_t (*hash)(const void *, size_t));
     int nsort_hash_add_item(nsort_hash_t * hsh, const char *item);
     char *nsort_hash_find_item(nsort_hash_t * hsh, const char *item);
+    int nsort_hash_add_key(nsort_hash_t * hsh, const void *key, size_t len,
+                           void *value);
+    int nsort_hash_put_key(nsort_hash_t * hsh, const void *key, size_t len,
+                           void *value);
+    const char *nsort_hash_find_key(nsort_hash_t * hsh, const void *key,
+                                    size_t len, void **value);
+    int nsort_hash_use_arena(nsort_hash_t * hsh, size_t slabSize);
+    int nsort_hash_remove_item(nsort_hash_t * hsh, const char *item);
+    int nsort_hash_remove_key(nsort_hash_t * hsh, const void *key,
+                              size_t len, void **value);
+    int nsort_hash_cursor_init(nsort_hash_cursor_t * cur, nsort_hash_t * hsh);
+    const char *nsort_hash_cursor_next(nsort_hash_cursor_t * cur,
+                                       size_t * len, void **value);
+    int nsort_hash_save(nsort_hash_t * hsh, const char *desc,
+                        const char *fname);
+    int nsort_hash_get(nsort_hash_t * hsh, int (*compare)(void *, void *),
+                       uint64_t (*hash)(const void *, size_t),
+                       const char *fname);
+    nsort_shash_t *nsort_shash_create(void);
+    int nsort_shash_destroy(nsort_shash_t * sh);
+    int nsort_shash_init(nsort_shash_t * sh, int (*compare)(void *, void *),
+                         int numShards, size_t capacity, double maxLoad);
+    int nsort_shash_set_function(nsort_shash_t * sh,
+                                 uint64_t (*hash)(const void *, size_t));
+    int nsort_shash_use_arena(nsort_shash_t * sh, size_t slabSize);
+    nsort_error_t nsort_shash_add_key(nsort_shash_t * sh, const void *key,
+                                      size_t len, void *value,
+                                      void **existing);
+    const char *nsort_shash_find_key(nsort_shash_t * sh, const void *key,
+                                     size_t len, void **value);
+    size_t nsort_shash_number(nsort_shash_t * sh);
+    int nsort_shash_del(nsort_shash_t * sh);
     int nsort_hash_del(nsort_hash_t * hsh);
 
 #ifndef HEADER_ONLY
@@ -1818,11 +2682,17 @@ extern "C" {
     extern int bsort_num_compare;
     int bqsort(void *base_ptr, int total_elems, int size,
                int (*cmp)(void *, void *));
+    int bqsort_parallel(void *base_ptr, int total_elems, int size,
+                        int (*cmp)(void *, void *), int nthreads);
     int nsort_qsort(nsort_t * srt, void *base, size_t numItems,
                     size_t recSize, int (*qcompare)(void *, void *),
                     int (*scompare)(void *, void *));
     int nsort_list_qsort(nsort_t * srt, nsort_list_t * lh, size_t recSize,
                          int (*compare)(void *, void *));
+    int nsort_list_qsort_parallel(nsort_t * srt, nsort_list_t * lh,
+                                  size_t recSize,
+                                  int (*compare)(void *, void *),
+                                  int nthreads);
 
 /*
  * <<<<<<<<<<<<<<<<<<<<====================>>>>>>>>>>>>>>>>>>>  
@@ -1907,6 +2777,165 @@ extern "C" {
                                 int reclen, char *fname);
     static int nsort_list_retrieve(nsort_list_t * lh, nsort_store_t * ts,
                                    const char *fname, long magic);
+    static void nsort_list_take_arena(nsort_list_t * dst,
+                                      nsort_list_t * src);
+    static void nsort_list_msort_merge(nsort_link_t ** runHead,
+                                       nsort_link_t ** runTail,
+                                       size_t *runLen, int k,
+                                       int (*compare)(void *, void *));
+    static int nsort_merge_beats(nsort_link_t ** cur, nsort_link_t ** end,
+                                 int a, int b,
+                                 int (*compare)(void *, void *));
+    static size_t nsort_list_merge_range(nsort_link_t ** cur,
+                                         nsort_link_t ** end, int *tree,
+                                         int k, nsort_link_t * prev,
+                                         nsort_link_t ** last,
+                                         int (*compare)(void *, void *));
+    static void nsort_list_merge_done(nsort_list_t * dst,
+                                      nsort_list_t ** lists, int k);
+    static void nsort_link_msort(nsort_link_t ** lnks, nsort_link_t ** tmp,
+                                 size_t num, int (*cmp)(void *, void *));
+    static int nsort_build_shell(nsort_t * srt, size_t n, size_t extra);
+    static int nsort_build_links(nsort_t * srt, void **data, char *base,
+                                 size_t recSize, const size_t * off,
+                                 size_t n, int copy);
+    static int nsort_copy_links(nsort_t * srt, char *base, size_t recSize,
+                                const size_t * off, size_t n);
+    static int nsort_retrieve_file(nsort_t * srt, nsort_store_t * ts,
+                                   const char *fname, long magic,
+                                   int inArena);
+    static int nsort_get_file(nsort_t * srt, int (*compare)(void *, void *),
+                              const char *fname, int inArena);
+    static void *nsort_map_file(const char *fname, size_t * length,
+                                int writable);
+    static void nsort_unmap_file(void *base, size_t length);
+    static int nsort_arena_add_map(nsort_arena_t * ar, void *base,
+                                   size_t length);
+    static void *nsort_arena_carve(nsort_arena_t * ar, size_t size,
+                                   size_t align);
+    static int nsort_arena_give_back(nsort_arena_t * ar, void *ptr,
+                                     size_t size);
+    static int nsort_arena_owns(nsort_arena_t * ar, void *ptr);
+    static nsort_error_t nsort_map_setup(nsort_map_t * map, char *base,
+                                         size_t length);
+    static int nsort_retrieve_map(nsort_t * srt, nsort_store_t * ts,
+                                  const char *fname, int inArena);
+    static size_t nsort_map_bound(nsort_map_t * map, void *key, int upper);
+    static void nsort_store_stamp(nsort_store_t * ts, unsigned long magic,
+                                  const char *desc);
+    static char *nsort_save_name(const char *fname);
+    static nsort_error_t nsort_save_finish(char *tmpName, const char *fname,
+                                           int ok);
+    static int nsort_read_all(int fd, void *buf, size_t len);
+    static int nsort_retrieve_var(nsort_t * srt, nsort_store_t * ts, int fd,
+                                  int inArena);
+    static size_t nsort_front_varint(unsigned char *out, size_t v);
+    static const char *nsort_front_next(const char *p, const char *end,
+                                        char *buf, size_t * len,
+                                        size_t maxLength, int first);
+    static nsort_error_t nsort_front_setup(nsort_front_t * fc, char *base,
+                                           size_t length);
+    static size_t nsort_front_bound(nsort_front_t * fc, const char *key,
+                                    int upper);
+    static int nsort_retrieve_front(nsort_t * srt, nsort_store_t * ts,
+                                    const char *fname, int inArena);
+    static nsort_node_t *nsort_alloc_node(nsort_t * srt, int height);
+    static nsort_link_t *nsort_lower_bound(nsort_t * srt, void *data);
+    static nsort_link_t *nsort_upper_bound(nsort_t * srt, void *data);
+    static nsort_link_t *nsort_cursor_seek(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk, int upper);
+    static void nsort_cursor_step(nsort_cursor_t * cur);
+    static void nsort_release_nodes(nsort_t * srt);
+    static void nsort_free_node(nsort_t * srt, nsort_node_t * node);
+    static void nsort_free_chain(nsort_t * srt, nsort_node_t * node);
+    static int nsort_build_index(nsort_t * srt, nsort_node_t * head,
+                                 nsort_node_t ** lastp, size_t * nump);
+    static int nsort_restructure_check(nsort_t * srt);
+    static void nsort_auto_tune(nsort_t * srt);
+    static int nsort_rebuild_step(nsort_t * srt, size_t budget);
+    static void nsort_rebuild_cancel(nsort_t * srt);
+    static int nsort_rebuild_add(nsort_t * srt, nsort_rebuild_t * rb,
+                                 nsort_link_t * lnk);
+    static size_t *nsort_count_of(nsort_t * srt, nsort_rebuild_t * rb,
+                                  nsort_node_t * node);
+    static void nsort_count_link(nsort_t * srt, nsort_rebuild_t * rb,
+                                 nsort_node_t * node, nsort_node_t ** cover,
+                                 int add);
+    static nsort_node_t *nsort_locate_link(nsort_t * srt,
+                                           nsort_node_t * head,
+                                           nsort_link_t * lnk,
+                                           nsort_node_t ** cover,
+                                           nsort_node_t ** prevp);
+    static int nsort_link_before(nsort_t * srt, nsort_link_t * lnk,
+                                 nsort_link_t * cursor);
+    static int nsort_unindex_node(nsort_t * srt, nsort_rebuild_t * rb,
+                                  nsort_link_t * lnk);
+    static void nsort_unindex_link(nsort_t * srt, nsort_link_t * lnk);
+    static void nsort_rebuild_count(nsort_t * srt, nsort_link_t * lnk);
+    static nsort_link_t *nsort_find_pure(nsort_t * srt, nsort_link_t * lnk);
+    static nsort_link_t *nsort_query_pure(nsort_t * srt, nsort_link_t * lnk);
+    static size_t nsort_rank_pure(nsort_t * srt, void *data, int orEqual,
+                                  nsort_link_t ** linkp);
+    static nsort_link_t *nsort_select_pure(nsort_t * srt, size_t k);
+    static nsort_node_t *nsort_finger_search(nsort_t * srt, void *data,
+                                             unsigned long pfx, int *level);
+    static int nsort_add_item_nolock(nsort_t * srt, nsort_link_t * lnk);
+    static int nsort_insert_item_nolock(nsort_t * srt, nsort_link_t * lnk);
+    static void nsort_split_span(nsort_t * srt, nsort_node_t * node,
+                                 nsort_node_t * midnode, int level,
+                                 size_t dist);
+    static int nsort_add_items_nolock(nsort_t * srt, nsort_link_t ** lnks,
+                                      size_t num, nsort_error_t * errs,
+                                      int *rebuild);
+    static int nsort_restructure_nolock(nsort_t * srt);
+    static nsort_link_t *nsort_find_item_nolock(nsort_t * srt,
+                                                nsort_link_t * lnk);
+    static nsort_link_t *nsort_query_item_nolock(nsort_t * srt,
+                                                 nsort_link_t * lnk);
+    static nsort_link_t *nsort_remove_item_nolock(nsort_t * srt,
+                                                  nsort_link_t * lnk);
+#ifdef HAVE_PTHREAD_H
+    static int nsort_sync_rebuild(nsort_t * srt);
+    static int nsort_sync_add_item(nsort_t * srt, nsort_link_t * lnk);
+    static int nsort_sync_add_items(nsort_t * srt, nsort_link_t ** lnks,
+                                    size_t num, nsort_error_t * errs);
+    static nsort_link_t *nsort_sync_remove_item(nsort_t * srt,
+                                                nsort_link_t * lnk);
+    static int nsort_sync_thresh(nsort_t * srt);
+    static uint64_t nsort_hash_mix(uint64_t h);
+    static unsigned int nsort_hash_match(const unsigned char *ctrl,
+                                         unsigned char tag);
+    static int nsort_hash_first(unsigned int mask);
+    static size_t nsort_hash_probe(nsort_hash_t * hsh, const void *key,
+                                   size_t len, uint64_t hash);
+    static size_t nsort_hash_free_slot(nsort_hash_t * hsh, uint64_t hash);
+    static int nsort_hash_resize(nsort_hash_t * hsh, size_t capacity);
+    static uint64_t nsort_hash_item_hash(nsort_hash_t * hsh,
+                                         const char *item, size_t len);
+    static int nsort_hash_insert(nsort_hash_t * hsh, const void *key,
+                                 size_t len, uint64_t hash, void *value,
+                                 int replace);
+    static int nsort_hash_place(nsort_hash_t * hsh, const void *key,
+                                size_t len, uint64_t hash, void *value);
+    static int nsort_hash_mapped(nsort_hash_t * hsh, const void *p);
+    static void nsort_hash_free_key(nsort_hash_t * hsh, char *key);
+    static void nsort_hash_remove_slot(nsort_hash_t * hsh, size_t i);
+    static nsort_error_t nsort_hash_setup(nsort_hash_t * hsh, char *base,
+                                          size_t length);
+#endif
+    static void bq_swap(char *a, char *b, size_t size, int swaptype);
+    static char *bq_med3(char *a, char *b, char *c,
+                         int (*cmp)(void *, void *));
+    static void bq_heapsort(char *lo, size_t n, size_t size, int swaptype,
+                            int (*cmp)(void *, void *));
+    static void bq_insertion(char *lo, char *hi, size_t size, int swaptype,
+                             int (*cmp)(void *, void *));
+    static int bq_presorted(char *lo, char *hi, size_t size, int swaptype,
+                            int (*cmp)(void *, void *), int reverse);
+    static int nsort_list_qsort_threads(nsort_t * srt, nsort_list_t * lh,
+                                        size_t recSize,
+                                        int (*compare)(void *, void *),
+                                        int nthreads);
 
 /*
  * Uncomment this to get libdmalloc debugging
@@ -1941,6 +2970,8 @@ extern "C" {
         "bad list file",        /* SORT_LIST_BADFILE */
         "unique constraint violated",   /* SORT_UNIQUE */
         "corrupt data detected",    /* SORT_CORRUPT */
+        "sort is frozen",       /* SORT_FROZEN */
+        "a save is already going on",   /* SORT_BUSY */
         /* Add new ones here */
         "unspecified sort error",   /* SORT_UNSPECIFIED */
         NULL
@@ -2446,6 +3477,219 @@ extern "C" {
         return counter;
     }
 
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_arena_init}
+ * \index{nsort_arena_init}
+ *
+ * [Verbatim] */
+
+    int nsort_arena_init(nsort_arena_t * ar, size_t slabSize)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_arena_init() function initializes the arena given by ``ar''.  The
+ * ``slabSize'' parameter is the size of the first slab that will be allocated;
+ * if it is 0, NSORT_ARENA_SLAB is used.  No memory is allocated until the first
+ * call to nsort_arena_alloc().  Most applications will not call this directly;
+ * they will call nsort_list_use_arena() or nsort_use_arena() instead.  This
+ * function returns _OK_ on success or _ERROR_ if ``ar'' is NULL.
+ *
+ * [EndDoc]
+ */
+    {
+        if (ar == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        memset(ar, 0, sizeof(nsort_arena_t));
+        ar->slabSize = (slabSize == 0) ? NSORT_ARENA_SLAB : slabSize;
+        return _OK_;
+    }
+
+#define NSORT_ARENA_ROUND(s) \
+    (((s) + NSORT_ARENA_ALIGN - 1) & ~((size_t) NSORT_ARENA_ALIGN - 1))
+#define NSORT_SLAB_HDR NSORT_ARENA_ROUND(sizeof(nsort_slab_t))
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_arena_alloc}
+ * \index{nsort_arena_alloc}
+ *
+ * [Verbatim] */
+
+    void *nsort_arena_alloc(nsort_arena_t * ar, size_t size)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_arena_alloc() function returns ``size'' bytes from the arena given
+ * by ``ar'', aligned to NSORT_ARENA_ALIGN.  The memory can not be freed
+ * individually (see nsort_arena_release() for the one exception); it is freed
+ * all at once by nsort_arena_del().  If a new slab is needed and can not be
+ * allocated, NULL is returned and the global error is set to SORT_NOMEMORY.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_arena_carve(ar, NSORT_ARENA_ROUND(size),
+                                 NSORT_ARENA_ALIGN);
+    }
+
+/*
+ * Carve ``size'' bytes, which is a multiple of ``align'', out of the arena
+ * at the next multiple of ``align'' in the current slab, or out of a new slab.
+ * nsort_arena_alloc() carves everything at NSORT_ARENA_ALIGN, and the hash
+ * packs its keys tighter, at the alignment of a size_t.
+ */
+    static void *nsort_arena_carve(nsort_arena_t * ar, size_t size,
+                                   size_t align) {
+        nsort_slab_t *slab;
+        size_t ssize, off = 0;
+        void *p;
+
+        slab = ar->slabs;
+        if (slab != 0)
+            off = (slab->used + align - 1) & ~(align - 1);
+        if (slab == 0 || slab->size < off || slab->size - off < size) {
+            off = 0;
+            ssize = ar->slabSize;
+            if (size > ssize)
+                ssize = size;
+            slab = (nsort_slab_t *) malloc(NSORT_SLAB_HDR + ssize);
+            if (slab == 0) {
+                set_sortError(SORT_NOMEMORY);
+                return 0;
+            }
+            slab->size = ssize;
+            slab->used = 0;
+            slab->map = 0;
+            slab->mapLength = 0;
+            if (ssize > ar->slabSize && ar->slabs != 0) {
+                /*
+                 * An oversized request gets a slab of its own.  Keep it
+                 * behind the current slab so the room left there is still
+                 * used.
+                 */
+                slab->next = ar->slabs->next;
+                ar->slabs->next = slab;
+            }
+            else {
+                slab->next = ar->slabs;
+                ar->slabs = slab;
+                if (ar->slabSize < NSORT_ARENA_MAX_SLAB)
+                    ar->slabSize *= 2;
+            }
+            ar->numSlabs++;
+            ar->bytesAlloc += ssize;
+        }
+        p = (char *) slab + NSORT_SLAB_HDR + off;
+        ar->bytesUsed += off + size - slab->used;
+        slab->used = off + size;
+        return p;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_arena_release}
+ * \index{nsort_arena_release}
+ *
+ * [Verbatim] */
+
+    int nsort_arena_release(nsort_arena_t * ar, void *ptr, size_t size)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_arena_release() function gives back the memory at ``ptr'' if, and
+ * only if, it was the last allocation of ``size'' bytes from the arena given by
+ * ``ar''.  This is the common case when an item is allocated, rejected by
+ * nsort_add_item() and thrown away.  It returns _OK_ if the memory was given
+ * back or _ERROR_ if it was not, in which case it stays in the arena until
+ * the arena is deleted.  No error is set in either case.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_arena_give_back(ar, ptr, NSORT_ARENA_ROUND(size));
+    }
+
+/*
+ * Give back the ``size'' bytes at ``ptr'', as they were carved, if they are
+ * the last thing carved from the arena.
+ */
+    static int nsort_arena_give_back(nsort_arena_t * ar, void *ptr,
+                                     size_t size) {
+        nsort_slab_t *slab = ar->slabs;
+
+        if (slab == 0 || slab->used < size ||
+            (char *) slab + NSORT_SLAB_HDR + slab->used - size != ptr)
+            return _ERROR_;
+        slab->used -= size;
+        ar->bytesUsed -= size;
+        return _OK_;
+    }
+
+/*
+ * Return TRUE if ``ptr'' points into one of the slabs of the arena, or into
+ * a file that was mapped into it.
+ */
+    static int nsort_arena_owns(nsort_arena_t * ar, void *ptr) {
+        nsort_slab_t *slab;
+        char *p = (char *) ptr;
+
+        for (slab = ar->slabs; slab != 0; slab = slab->next) {
+            if (p >= (char *) slab + NSORT_SLAB_HDR &&
+                p < (char *) slab + NSORT_SLAB_HDR + slab->size)
+                return TRUE;
+            if (slab->map != 0 && p >= (char *) slab->map &&
+                p < (char *) slab->map + slab->mapLength)
+                return TRUE;
+        }
+        return FALSE;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_arena_del}
+ * \index{nsort_arena_del}
+ *
+ * [Verbatim] */
+
+    int nsort_arena_del(nsort_arena_t * ar)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_arena_del() function frees every slab that belongs to the arena
+ * given by ``ar''.  Any pointer that was returned by nsort_arena_alloc() is
+ * invalid after this.  The arena itself is left initialized and can be used
+ * again.  This function always returns _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_slab_t *slab, *next;
+
+        for (slab = ar->slabs; slab != 0; slab = next) {
+            next = slab->next;
+            if (slab->map != 0)
+                nsort_unmap_file(slab->map, slab->mapLength);
+            free(slab);
+        }
+        ar->slabs = 0;
+        ar->numSlabs = 0;
+        ar->bytesAlloc = 0;
+        ar->bytesUsed = 0;
+        memset(ar->freeNodes, 0, sizeof(ar->freeNodes));
+        return _OK_;
+    }
+
 /*
  * [BeginDoc]
  *
@@ -2629,7 +3873,8 @@ extern "C" {
  * The nsort_list_del() function basically undoes what the nsort_list_init()
  * function did.  It frees the memory that was allocated to allow the
  * list header to be used.  It is an error to call nsort_list_del() on a list
- * that is not empty.
+ * that is not empty.  If the list has an arena, the arena and everything that
+ * was allocated from it are freed too.
  *
  * [EndDoc]
  */
@@ -2640,6 +3885,11 @@ extern "C" {
             lh->listError = SORT_LIST_NOTEMPTY;
             return _ERROR_;
         }
+        if (lh->arena != 0) {
+            nsort_arena_del(lh->arena);
+            free(lh->arena);
+            lh->arena = 0;
+        }
 
 #ifdef DEBUG
 
@@ -2812,13 +4062,23 @@ extern "C" {
  * It removes each link and calls free to free lnk->data and lnk.  This does not
  * check to insure that these are allocated on the heap, so if you have a list
  * with links or data that are allocated in a group, you should not call this
- * function.  The nsort_list_clear() function returns _OK_ when it is completed;
- * it does not return an error condition under any circumstance.
+ * function.  If the list has an arena, the links are assumed to have come from
+ * nsort_list_new_link(); they are dropped without being visited and the slabs
+ * of the arena are freed.  The nsort_list_clear() function returns _OK_ when it
+ * is completed; it does not return an error condition under any circumstance.
  *
  * [EndDoc]
  */
     {
         nsort_link_t *lnk;
+        if (lh->arena != 0) {
+            lh->head->next = lh->tail;
+            lh->tail->prev = lh->head;
+            lh->current = lh->head;
+            lh->number = 0;
+            nsort_arena_del(lh->arena);
+            return _OK_;
+        }
         if (nsort_list_is_empty(lh))
             return _OK_;
         nsort_list_first_link(lh);
@@ -2834,211 +4094,416 @@ extern "C" {
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_write_block}
- * \index{nsort_list_write_block}
+ * \subsubsection{nsort_list_use_arena}
+ * \index{nsort_list_use_arena}
  *
  * [Verbatim] */
 
-    size_t nsort_list_write_block(int fd, off_t where, size_t reclen,
-                                  nsort_list_t * lh)
+    int nsort_list_use_arena(nsort_list_t * lh, size_t slabSize)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_write_block() function allocates a memory buffer
- * that is of size reclen*lh->number.  Then, it copies the data from
- * every lnk->data member in the list to the memory buffer.  Then
- * this memory buffer gets written at offset where from the beginning
- * of the file.  This function returns _OK_ if it is successful or
- * _ERROR_ on error.  The following are descriptions of each of the
- * parameters:
- *
- * \begin{itemize}
- *
- * \item [fd] This parameter is the file descriptor of an open file.
+ * The nsort_list_use_arena() function attaches an arena to the list given by
+ * ``lh''.  The list must be initialized and empty.  The ``slabSize'' parameter
+ * is the size of the first slab (0 selects NSORT_ARENA_SLAB).  From then on,
+ * nsort_list_new_link() carves links and their data out of the arena, and
+ * nsort_list_del() frees the whole arena at once.  Calling this on a list that
+ * already has an arena does nothing.  This function returns _OK_ on success or
+ * _ERROR_ with the error in lh->listError.
  *
- * \item [where] This parameter is the offset from the beginning of the
- * file that the writing will occur.
+ * [EndDoc]
+ */
+    {
+        if (lh->arena != 0)
+            return _OK_;
+        if (lh->number != 0) {
+            lh->listError = SORT_LIST_NOTEMPTY;
+            return _ERROR_;
+        }
+        lh->arena = (nsort_arena_t *) malloc(sizeof(nsort_arena_t));
+        if (lh->arena == 0) {
+            lh->listError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        nsort_arena_init(lh->arena, slabSize);
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
  *
- * \item [reclen]  This is the length of each item that is being stored
- * in the list.  The data items have to be of equal lengths to be stored
- * to file using this function.
+ * \subsubsection{nsort_list_set_sync}
+ * \index{nsort_list_set_sync}
  *
- * \item [lh] This is the list header containing the data to be stored.
+ * [Verbatim] */
+
+    int nsort_list_set_sync(nsort_list_t * lh, int policy)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
  *
- * \end{itemize}
+ * The nsort_list_set_sync() function sets what is done to get the data onto
+ * the disk when the list given by ``lh'' is saved.  With NSORT_SYNC_NONE (the
+ * default) the data is left to the system to write out when it likes, which
+ * is the fastest but can lose the file if the system goes down soon after.  With
+ * NSORT_SYNC_DATA the save waits for the data to reach the disk with
+ * fdatasync() (fsync() where there is no fdatasync()), and with NSORT_SYNC_FULL
+ * it waits for the data and everything about the file with fsync().  This
+ * function returns _OK_ on success or _ERROR_ with SORT_PARAM in lh->listError
+ * if ``policy'' is not one of these.
  *
  * [EndDoc]
  */
     {
-        char *pdata;
-        unsigned int i;
-        nsort_link_t *lnk;
-        off_t rtn;
-        size_t totlen;
-        int status = 0;         /* generates a warning... disregard */
-
-        totlen = reclen * lh->number;
-        if (status) {
-        }
-        nsort_file_seek_begin(fd, where, status);
-        if (nsort_check_error())
-            return (size_t) _ERROR_;
-        pdata = (char *) malloc(totlen);
-        if (0 == pdata) {
-            lh->listError = SORT_NOMEMORY;
-            return (size_t) _ERROR_;
-        }
-        lnk = lh->head->next;
-        for (i = 0; i < lh->number; i++) {
-            memcpy((void *) (pdata + (i * reclen)), lnk->data, reclen);
-            lnk = lnk->next;
+        if (policy != NSORT_SYNC_NONE && policy != NSORT_SYNC_DATA &&
+            policy != NSORT_SYNC_FULL) {
+            lh->listError = SORT_PARAM;
+            return _ERROR_;
         }
-        nsort_file_write(fd, pdata, totlen, rtn);
-        if (nsort_check_error())
-            return (size_t) _ERROR_;
-        nsort_file_flush(fd);
-        if (nsort_check_error())
-            return (size_t) _ERROR_;
-        free(pdata);
-        return (size_t) rtn;
+        lh->syncPolicy = policy;
+        return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_read_block}
- * \index{nsort_list_read_block}
+ * \subsubsection{nsort_list_new_link}
+ * \index{nsort_list_new_link}
  *
  * [Verbatim] */
 
-    int nsort_list_read_block(nsort_list_t * lh, int fd, off_t where,
-                              size_t reclen, size_t numrecs)
+    nsort_link_t *nsort_list_new_link(nsort_list_t * lh, void *data,
+                                      size_t size)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_read_block() function allocates a buffer on the heap of
- * size reclen*numrecs.  Then, it reads the data from the file given by ``fd''
- * from ``where'' bytes from the beginning of the file.  Then, it breaks this
- * data up into numrecs chunks and uses these to populate the list ``lh'' with.
- * It is assumed that lh is an empty list whose purpose is to contain the 
- * data from the file.  If it is not empty, the data from the file will be appended
- * to the end of the list.  All the links and data objects for the list are
- * individually allocated on the heap.  It is a critical error if there is not
- * enough memory to complete this function.
- * This function returns _OK_ on success and _ERROR_ on error.
+ * The nsort_list_new_link() function allocates a link for the list given by
+ * ``lh''.  If ``size'' is greater than 0, ``size'' bytes of data are allocated
+ * with the link and lnk->data points at them; the bytes are copied from ``data''
+ * or zeroed if ``data'' is NULL.  If ``size'' is 0, lnk->data is simply set to
+ * ``data''.  If the list has an arena, the link and its data come from one
+ * contiguous piece of the arena; otherwise they are allocated with malloc(),
+ * exactly as the rest of the nsort routines expect, so the link can be freed
+ * with nsort_list_free_link() or by nsort_list_clear() either way.  The link
+ * is not inserted into the list.  NULL is returned if the allocation fails and
+ * lh->listError is set to SORT_NOMEMORY.
  *
  * [EndDoc]
  */
     {
-        char *pdata;
         nsort_link_t *lnk;
-        unsigned int i;
-        int j, num;
-        size_t totlen;
-        int status;
         void *vp;
 
-        nsort_file_seek_begin(fd, where, status);
-        if (nsort_check_error())
-            return _ERROR_;
-        totlen = reclen * numrecs;
-        pdata = (char *) malloc(totlen);
-        if (pdata == NULL) {
-            lh->listError = SORT_NOMEMORY;
-            return _ERROR_;
-        }
-        nsort_file_read(fd, pdata, totlen, status);
-        if (nsort_check_error()) {
-            free(pdata);
-            return _ERROR_;
-        }
-        status = nsort_list_init(lh);
-        if (status == _ERROR_) {
-            return _ERROR_;
+        if (lh->arena != 0) {
+            lnk = (nsort_link_t *) nsort_arena_alloc(lh->arena,
+                                                    sizeof(nsort_link_t) +
+                                                    size);
+            if (lnk == 0) {
+                lh->listError = SORT_NOMEMORY;
+                return 0;
+            }
+            vp = (size > 0) ? (char *) lnk + sizeof(nsort_link_t) : data;
         }
-        for (i = 0; i < numrecs; i++) {
-            vp = malloc(reclen);
+        else {
             lnk = (nsort_link_t *) malloc(sizeof(nsort_link_t));
-            if (0 == vp || 0 == lnk) {
-                if (vp != 0)
-                    free(vp);
-                num = lh->number;
-                for (j = 0; j < num; j++) {
-                    lnk = nsort_list_remove_link(lh);
-                    free(lnk->data);
-                    free(lnk);
-                }
-                free(pdata);
+            if (lnk == 0) {
                 lh->listError = SORT_NOMEMORY;
-                return _ERROR_;
+                return 0;
             }
-            memcpy(vp, (void *) (pdata + (i * reclen)), reclen);
-            lnk->data = vp;
-            nsort_list_last_link(lh);
-            status = nsort_list_insert_link(lh, lnk);
-            if (_ERROR_ == status) {
-                free(pdata);
-                free(lnk);
-                free(vp);
-                num = lh->number;
-                for (j = 0; j < num; j++) {
-                    lnk = nsort_list_remove_link(lh);
-                    free(lnk->data);
+            vp = data;
+            if (size > 0) {
+                vp = malloc(size);
+                if (vp == 0) {
                     free(lnk);
+                    lh->listError = SORT_NOMEMORY;
+                    return 0;
                 }
-                return _ERROR_;
             }
         }
-        free(pdata);
-        return _OK_;
+        if (size > 0) {
+            if (data != 0)
+                memcpy(vp, data, size);
+            else
+                memset(vp, 0, size);
+        }
+        lnk->next = lnk->prev = 0;
+        lnk->number = 0;
+        lnk->data = vp;
+        return lnk;
     }
 
 /*
- * I don't want this function being used by end-users.  They should
- * use nsort_list_save().  Therefore, I am not going to document it.
- */
-    static int nsort_list_store(nsort_list_t * lh, nsort_store_t * ts,
-                                int reclen, char *fname) {
-        int fd;
-        off_t offset = 0L;
-        long status;
-        off_t num;
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_free_link}
+ * \index{nsort_list_free_link}
+ *
+ * [Verbatim] */
 
-        ts->number = lh->number;
-        ts->size = reclen;
-        nsort_file_create(fname, fd);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
+    int nsort_list_free_link(nsort_list_t * lh, nsort_link_t * lnk,
+                             size_t size)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_free_link() function frees a link that was allocated with
+ * nsort_list_new_link() and is not in a list.  The ``size'' parameter must be
+ * the same as the one that was given to nsort_list_new_link().  If the list has
+ * an arena, the memory is only given back if it was the last thing allocated
+ * (see nsort_arena_release()); otherwise it stays in the arena until the list is
+ * deleted.  This function always returns _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+        if (lh->arena != 0) {
+            nsort_arena_release(lh->arena, lnk, sizeof(nsort_link_t) + size);
+            return _OK_;
         }
-        nsort_file_close(fd);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
+        if (size > 0)
+            free(lnk->data);
+        free(lnk);
+        return _OK_;
+    }
+
+#ifndef NSORT_WRITE_BUFFER
+#define NSORT_WRITE_BUFFER (1024*1024)
+#endif
+
+/*
+ * A writer streams data to a file through two buffers of NSORT_WRITE_BUFFER
+ * bytes.  One of them is filled while the other is written out with pwrite()
+ * by a thread of the writer's own, so the memory it takes doesn't grow with
+ * the size of what is written and the disk is kept busy while the data is
+ * gathered.  Without threads (or if the thread can't be started) a buffer is
+ * written out as soon as it is full.
+ */
+    typedef struct _nsort_writer_t {
+        int fd;
+        off_t where;
+        char *buf[2];
+        int cur;
+        size_t used;
+        size_t written;
+        nsort_error_t error;
+#ifdef HAVE_PTHREAD_H
+        int threaded;
+        int quit;
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        char *pending;
+        size_t pendingLen;
+        off_t pendingAt;
+#endif
+    } nsort_writer_t;
+
+/*
+ * Write ``len'' bytes from ``buf'' at ``where'' in the file, going around
+ * again if the system writes less than it is asked to.  The error is
+ * returned (SORT_NOERROR if there was none).
+ */
+    static nsort_error_t nsort_writer_pwrite(nsort_writer_t * w,
+                                             const char *buf, size_t len,
+                                             off_t where) {
+        ssize_t n;
+
+        while (len > 0) {
+            n = pwrite(w->fd, buf, len, where);
+            if (n < 0 && EINTR == errno)
+                continue;
+            if (n < 0)
+                return (EACCES == errno) ? SORT_FDENIED :
+                    (EBADF == errno) ? SORT_FEBADF : SORT_ERRNO;
+            if (n == 0)
+                return SORT_FRDWR;
+            buf += n;
+            len -= (size_t) n;
+            where += n;
+            w->written += (size_t) n;
+        }
+        return SORT_NOERROR;
+    }
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * The writer thread writes out each buffer it is handed until it is told to
+ * quit.
+ */
+    static void *nsort_writer_thread(void *arg) {
+        nsort_writer_t *w = (nsort_writer_t *) arg;
+        nsort_error_t error;
+        char *buf;
+        size_t len;
+        off_t where;
+
+        pthread_mutex_lock(&w->lock);
+        for (;;) {
+            while (w->pending == 0 && !w->quit)
+                pthread_cond_wait(&w->cond, &w->lock);
+            if (w->pending == 0)
+                break;
+            buf = w->pending;
+            len = w->pendingLen;
+            where = w->pendingAt;
+            error = w->error;
+            pthread_mutex_unlock(&w->lock);
+            if (error == SORT_NOERROR)
+                error = nsort_writer_pwrite(w, buf, len, where);
+            pthread_mutex_lock(&w->lock);
+            if (w->error == SORT_NOERROR)
+                w->error = error;
+            w->pending = 0;
+            pthread_cond_broadcast(&w->cond);
+        }
+        pthread_mutex_unlock(&w->lock);
+        return 0;
+    }
+#endif
+
+/*
+ * Get ``w'' ready to write to ``fd'' starting at ``where''.  The global error
+ * is set if the buffers can't be allocated.
+ */
+    static int nsort_writer_open(nsort_writer_t * w, int fd, off_t where) {
+        memset(w, 0, sizeof(nsort_writer_t));
+        w->fd = fd;
+        w->where = where;
+        w->error = SORT_NOERROR;
+        w->buf[0] = (char *) malloc(NSORT_WRITE_BUFFER);
+        w->buf[1] = (char *) malloc(NSORT_WRITE_BUFFER);
+        if (w->buf[0] == 0 || w->buf[1] == 0) {
+            free(w->buf[0]);
+            free(w->buf[1]);
+            set_sortError(SORT_NOMEMORY);
             return _ERROR_;
         }
-        nsort_file_open(fname, fd);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
+#ifdef HAVE_PTHREAD_H
+        if (pthread_mutex_init(&w->lock, 0) != 0)
+            return _OK_;
+        if (pthread_cond_init(&w->cond, 0) == 0) {
+            if (pthread_create(&w->thread, 0, nsort_writer_thread, w) == 0) {
+                w->threaded = TRUE;
+                return _OK_;
+            }
+            pthread_cond_destroy(&w->cond);
         }
-        nsort_file_write(fd, ts, sizeof(nsort_store_t), status);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
+        pthread_mutex_destroy(&w->lock);
+#endif
+        return _OK_;
+    }
+
+/*
+ * Write out the buffer being filled, or hand it to the writer thread once
+ * it is done with the other one.  _ERROR_ is returned once a write has
+ * failed.
+ */
+    static int nsort_writer_flush(nsort_writer_t * w) {
+        nsort_error_t error;
+
+        if (w->used > 0) {
+#ifdef HAVE_PTHREAD_H
+            if (w->threaded) {
+                pthread_mutex_lock(&w->lock);
+                while (w->pending != 0)
+                    pthread_cond_wait(&w->cond, &w->lock);
+                w->pending = w->buf[w->cur];
+                w->pendingLen = w->used;
+                w->pendingAt = w->where;
+                pthread_cond_broadcast(&w->cond);
+                error = w->error;
+                pthread_mutex_unlock(&w->lock);
+                w->where += (off_t) w->used;
+                w->used = 0;
+                w->cur ^= 1;
+                return (error == SORT_NOERROR) ? _OK_ : _ERROR_;
+            }
+#endif
+            if (w->error == SORT_NOERROR)
+                w->error = nsort_writer_pwrite(w, w->buf[w->cur], w->used,
+                                               w->where);
+            w->where += (off_t) w->used;
+            w->used = 0;
         }
-        offset += status;
-        num = nsort_list_write_block(fd, offset, reclen, lh);
-        nsort_file_close(fd);
-        if (nsort_check_error())
-            return _ERROR_;
-        if (num != (off_t) (reclen * lh->number)) {
-            lh->listError = SORT_FRDWR;
+        return (w->error == SORT_NOERROR) ? _OK_ : _ERROR_;
+    }
+
+/*
+ * Add ``len'' bytes from ``data'' (zeros if data is NULL) to what ``w'' is
+ * writing.
+ */
+    static int nsort_writer_put(nsort_writer_t * w, const void *data,
+                                size_t len) {
+        size_t n;
+
+        while (len > 0) {
+            if (w->used == NSORT_WRITE_BUFFER &&
+                nsort_writer_flush(w) == _ERROR_)
+                return _ERROR_;
+            n = NSORT_WRITE_BUFFER - w->used;
+            if (n > len)
+                n = len;
+            if (data != 0) {
+                memcpy(w->buf[w->cur] + w->used, data, n);
+                data = (const char *) data + n;
+            }
+            else
+                memset(w->buf[w->cur] + w->used, 0, n);
+            w->used += n;
+            len -= n;
+        }
+        return _OK_;
+    }
+
+/*
+ * Write out what is left, wait for the writer thread to finish and sync the
+ * file according to ``policy'' (one of the NSORT_SYNC_ values).  The buffers
+ * are freed whatever happens, and the first error is returned.  This doesn't
+ * touch the global error, so it can be called from a thread of its own.
+ */
+    static nsort_error_t nsort_writer_finish(nsort_writer_t * w, int policy) {
+        int status;
+
+        nsort_writer_flush(w);
+#ifdef HAVE_PTHREAD_H
+        if (w->threaded) {
+            pthread_mutex_lock(&w->lock);
+            w->quit = TRUE;
+            pthread_cond_broadcast(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+            pthread_join(w->thread, 0);
+            pthread_cond_destroy(&w->cond);
+            pthread_mutex_destroy(&w->lock);
+            w->threaded = FALSE;
+        }
+#endif
+        if (w->error == SORT_NOERROR && policy != NSORT_SYNC_NONE) {
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+            if (policy == NSORT_SYNC_DATA)
+                status = fdatasync(w->fd);
+            else
+#endif
+                status = fsync(w->fd);
+            if (status != 0)
+                w->error = (EBADF == errno) ? SORT_FEBADF : SORT_ERRNO;
+        }
+        free(w->buf[0]);
+        free(w->buf[1]);
+        w->buf[0] = w->buf[1] = 0;
+        return w->error;
+    }
+
+/*
+ * nsort_writer_finish(), with the global error set if anything failed.
+ */
+    static int nsort_writer_close(nsort_writer_t * w, int policy) {
+        nsort_error_t error;
+
+        error = nsort_writer_finish(w, policy);
+        if (error != SORT_NOERROR) {
+            set_sortError(error);
             return _ERROR_;
         }
         return _OK_;
@@ -3047,269 +4512,574 @@ extern "C" {
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_save}
- * \index{nsort_list_save}
+ * \subsubsection{nsort_list_write_block}
+ * \index{nsort_list_write_block}
  *
  * [Verbatim] */
 
-    int nsort_list_save(nsort_list_t * lh, const char *desc, int size,
-                        char *file)
+    size_t nsort_list_write_block(int fd, off_t where, size_t reclen,
+                                  nsort_list_t * lh)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_save() function saves the data that is stored in the list ``lh''
- * to the file given by the name ``file''.  If a file of that name doesn't exist, it
- * will be created.  If it does exist, the contents of the file will be overwritten.
- * \footnote{This will happen without any warning, so be careful.}  This function
- * uses reentrant safe library calls to get a time stamp; if these library calls are
- * not available in your implementation, you may have to use the unsafe versions and
- * lessen the thread-safety of your application.  The following are descriptions for
- * the parameters to this function:
+ * The nsort_list_write_block() function writes the data from every
+ * lnk->data member in the list, reclen bytes of each, one after the other
+ * at offset where from the beginning of the file.  The data is streamed
+ * out through two buffers of NSORT_WRITE_BUFFER bytes (1MB unless it is
+ * defined otherwise): one is filled while the other is written with
+ * pwrite() by a thread of its own, so the memory it takes is the same however
+ * long the list is and the writing starts as soon as the first buffer is
+ * full.  Once all of it is written the file is synced according to the
+ * sync policy of the list (see nsort_list_set_sync()), and the file offset is
+ * left at the end of the data.  This function returns the number of bytes
+ * written if it is successful or (size_t)_ERROR_ on error.  The following are
+ * descriptions of each of the parameters:
  *
  * \begin{itemize}
  *
- * \item [lh] This is a list header for the list that contains the data.
+ * \item [fd] This parameter is the file descriptor of an open file.
  *
- * \item [desc] This is a string that contains a description that gets stamped into
- * the file at the top of the file, along with a time stamp and a magic number that
- * identifies this as a stored list.  This string can be just about anything up to
- * 127 characters in length.
+ * \item [where] This parameter is the offset from the beginning of the
+ * file that the writing will occur.
  *
- * \item [size]  This is the size of each of the records stored in the list.
+ * \item [reclen]  This is the length of each item that is being stored
+ * in the list.  The data items have to be of equal lengths to be stored
+ * to file using this function.
  *
- * \item [file] This is the name of the file to store the list in.  If a file with
- * this name already exists, it will get overwritten.
+ * \item [lh] This is the list header containing the data to be stored.
  *
  * \end{itemize}
  *
- * nsort_list_save() returns _OK_ if it is successful and _ERROR_ if it is not.
- * If it is not successful, lh->listError will hold the error and you can use
- * nsort_show_list_error() to get a description of the error.
- *
  * [EndDoc]
  */
     {
-        time_t now;
-        struct tm result;
-        nsort_store_t *ts;
-        char tstamp[27];
-        char *cp;
+        nsort_writer_t w;
+        nsort_link_t *lnk;
+        size_t i;
+        off_t rtn;
         int status;
 
-        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
-        if (0 == ts) {
+        if (nsort_writer_open(&w, fd, where) == _ERROR_) {
+            set_sortError(SORT_NOERROR);
             lh->listError = SORT_NOMEMORY;
-            return _ERROR_;
+            return (size_t) _ERROR_;
         }
-        memset(ts, 0, sizeof(nsort_store_t));
-        ts->thisMagic = DEFAULT_MAGIC;
-        if (desc != 0)
-            strncpy(ts->description, desc, 127);
-        time(&now);
-        localtime_r(&now, &result);
-        asctime_r(&result, tstamp);
-        cp = strchr(tstamp, '\n');
-        if (cp != 0)
-            *cp = '\0';
-        strcpy(ts->timeStamp, tstamp);
-        status = nsort_list_store(lh, ts, size, file);
-        free(ts);
-        return status;
+        status = _OK_;
+        lnk = lh->head->next;
+        for (i = 0; i < lh->number && status == _OK_; i++) {
+            status = nsort_writer_put(&w, lnk->data, reclen);
+            lnk = lnk->next;
+        }
+        if (nsort_writer_close(&w, lh->syncPolicy) == _ERROR_)
+            return (size_t) _ERROR_;
+        nsort_file_seek_begin(fd, where + (off_t) w.written, rtn);
+        if (nsort_check_error() || rtn != where + (off_t) w.written)
+            return (size_t) _ERROR_;
+        return w.written;
     }
 
+#ifndef NSORT_SNAPSHOT_CHUNK
+#define NSORT_SNAPSHOT_CHUNK 1024
+#endif
 
 /*
- * Don't document this.  I want users to use nsort_list_get().
+ * A save started by nsort_save_async() works from a snapshot of the sort:
+ * the data pointers of the links, in order, taken while nothing could change
+ * the sort.  The records are written out from them by a thread of its own
+ * while the sort goes on being changed.  Adding a link doesn't touch the
+ * records of the snapshot, but removing one gives the application the right
+ * to free its data, so before a link is taken out, a record that is still
+ * to be written is copied and the snapshot is pointed at the copy (see
+ * nsort_snapshot_keep()).  The thread writes the records a chunk at a time
+ * under ``lock'', and ``done'' is the number it has got through, so records
+ * it has written are never copied.  The file is written as ``tmpName'' and
+ * renamed to ``fname'' when it is done (see nsort_save_name()).
  */
-    static int nsort_list_retrieve(nsort_list_t * lh, nsort_store_t * ts,
-                                   const char *fname, long magic) {
+    typedef struct _nsort_snapshot_t {
+        struct _nsort_t *srt;
+        nsort_writer_t w;
         int fd;
-        int status;
+        char *fname;
+        char *tmpName;
+        int syncPolicy;
+        size_t reclen;
+        size_t number;
+        size_t done;
+        void **data;
+        char *copies;
+        nsort_error_t error;
+        void (*callback)(struct _nsort_t *, nsort_error_t, void *);
+        void *arg;
+#ifdef HAVE_PTHREAD_H
+        int threaded;
+        pthread_t thread;
+        pthread_mutex_t lock;
+#endif
+    } nsort_snapshot_t;
 
-        nsort_file_open(fname, fd);
-        if (nsort_check_error())
-            return _ERROR_;
-        nsort_file_read(fd, ts, sizeof(nsort_store_t), status);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
-        }
-        if (ts->thisMagic != (unsigned long) magic) {
-            nsort_file_close(fd);
-            set_sortError(SORT_NOERROR);
-            lh->listError = SORT_LIST_BADFILE;
-            return _ERROR_;
-        }
-        status =
-            nsort_list_read_block(lh, fd, sizeof(nsort_store_t), ts->size,
-                                  ts->number);
-        if (status == _ERROR_) {
-            if (nsort_check_error()) {
-                lh->listError = get_sortError();
-                set_sortError(SORT_NOERROR);
+#define NSORT_SNAPSHOT_HDR NSORT_ARENA_ROUND(sizeof(char *))
+
+/*
+ * Called before ``lnk'' is taken out of ``srt'', with nothing else changing
+ * the sort (the writer lock is held if it is synchronized).  If a save
+ * started by nsort_save_async() still has to write the record of the link,
+ * the record is copied and the snapshot is pointed at the copy, so the link
+ * and its data can be freed as soon as the remove returns.  The record is
+ * found by a binary search of the part of the snapshot that is still to be
+ * written.  _ERROR_ is returned, with srt->sortError set, if the copy can't
+ * be allocated.
+ */
+    static int nsort_snapshot_keep(nsort_t * srt, nsort_link_t * lnk) {
+        nsort_snapshot_t *snap = srt->snapshot;
+        size_t lo, hi, mid;
+        char *copy;
+        int status = _OK_;
+
+        if (snap == 0)
+            return _OK_;
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&snap->lock);
+#endif
+        lo = snap->done;
+        hi = snap->number;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (srt->compare(snap->data[mid], lnk->data) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        while (lo < snap->number && snap->data[lo] != lnk->data &&
+               srt->compare(snap->data[lo], lnk->data) == 0)
+            lo++;
+        if (lo < snap->number && snap->data[lo] == lnk->data) {
+            copy = (char *) malloc(NSORT_SNAPSHOT_HDR + snap->reclen);
+            if (copy == 0) {
+                srt->sortError = SORT_NOMEMORY;
+                status = _ERROR_;
             }
             else {
-                lh->listError = SORT_UNSPECIFIED;
+                *(char **) copy = snap->copies;
+                snap->copies = copy;
+                memcpy(copy + NSORT_SNAPSHOT_HDR, lnk->data, snap->reclen);
+                snap->data[lo] = copy + NSORT_SNAPSHOT_HDR;
             }
-            nsort_file_close(fd);
-            return _ERROR_;
         }
-        nsort_file_close(fd);
-        if (nsort_check_error()) {
-            lh->listError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
-        }
-        return _OK_;
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&snap->lock);
+#endif
+        return status;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_get}
- * \index{nsort_list_get}
+ * \subsubsection{nsort_list_read_block}
+ * \index{nsort_list_read_block}
  *
  * [Verbatim] */
 
-    int nsort_list_get(nsort_list_t * lh, char *file)
+    int nsort_list_read_block(nsort_list_t * lh, int fd, off_t where,
+                              size_t reclen, size_t numrecs)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_get function get's the data that is stored in ``file'' and stores it
- * in the list given by ``lh''.  The following are the parameters to this function:
- *
- * \begin{itemize}
- *
- * \item [lh] This is the list header for the list that is to get the contents of the
- * file.  The number of items and the size of each item is stored in the header that
- * was stamped into the file when it was created.
- *
- * \item [file] This parameter is the name of a file to open and get the data from.
- * It is an error if the file doesn't exist or if this file is
- * not a stored list.
- *
- * \end{itemize}
- *
- * This function returns _OK_ if it is successful and _ERROR_ if not.  If it returns
- * _ERROR_, lh->listError will contain the error and you can get a description of it
- * by calling nsort_show_list_error().
+ * The nsort_list_read_block() function allocates a buffer on the heap of
+ * size reclen*numrecs.  Then, it reads the data from the file given by ``fd''
+ * from ``where'' bytes from the beginning of the file.  Then, it breaks this
+ * data up into numrecs chunks and uses these to populate the list ``lh'' with.
+ * It is assumed that lh is an empty list whose purpose is to contain the 
+ * data from the file.  If it is not empty, the data from the file will be appended
+ * to the end of the list.  All the links and data objects for the list are
+ * individually allocated on the heap, even if the list had an arena, since
+ * it is set up again here and the callers of nsort_list_get() free them one
+ * at a time.  It is a critical error if there is not enough memory to
+ * complete this function.
+ * This function returns _OK_ on success and _ERROR_ on error.
  *
  * [EndDoc]
  */
     {
-        nsort_store_t *ts;
-        int status;
-
-        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
-        if (0 == ts) {
-            set_sortError(SORT_NOMEMORY);
+        char *pdata;
+        nsort_link_t *lnk;
+        unsigned int i;
+        int j, num;
+        size_t totlen;
+        int status;
+        void *vp;
+
+        nsort_file_seek_begin(fd, where, status);
+        if (nsort_check_error())
+            return _ERROR_;
+        totlen = reclen * numrecs;
+        pdata = (char *) malloc(totlen);
+        if (pdata == NULL) {
+            lh->listError = SORT_NOMEMORY;
             return _ERROR_;
         }
-        memset(ts, 0, sizeof(nsort_store_t));
-        status = nsort_list_retrieve(lh, ts, file, DEFAULT_MAGIC);
-        free(ts);
-        return status;
+        nsort_file_read(fd, pdata, totlen, status);
+        if (nsort_check_error()) {
+            free(pdata);
+            return _ERROR_;
+        }
+        status = nsort_list_init(lh);
+        if (status == _ERROR_) {
+            return _ERROR_;
+        }
+        for (i = 0; i < numrecs; i++) {
+            vp = malloc(reclen);
+            lnk = (nsort_link_t *) malloc(sizeof(nsort_link_t));
+            if (0 == vp || 0 == lnk) {
+                if (vp != 0)
+                    free(vp);
+                num = lh->number;
+                for (j = 0; j < num; j++) {
+                    lnk = nsort_list_remove_link(lh);
+                    free(lnk->data);
+                    free(lnk);
+                }
+                free(pdata);
+                lh->listError = SORT_NOMEMORY;
+                return _ERROR_;
+            }
+            memcpy(vp, (void *) (pdata + (i * reclen)), reclen);
+            lnk->data = vp;
+            nsort_list_last_link(lh);
+            status = nsort_list_insert_link(lh, lnk);
+            if (_ERROR_ == status) {
+                free(pdata);
+                free(lnk);
+                free(vp);
+                num = lh->number;
+                for (j = 0; j < num; j++) {
+                    lnk = nsort_list_remove_link(lh);
+                    free(lnk->data);
+                    free(lnk);
+                }
+                return _ERROR_;
+            }
+        }
+        free(pdata);
+        return _OK_;
+    }
+
+/*
+ * I don't want this function being used by end-users.  They should
+ * use nsort_list_save().  Therefore, I am not going to document it.
+ */
+    static int nsort_list_store(nsort_list_t * lh, nsort_store_t * ts,
+                                int reclen, char *fname) {
+        int fd;
+        off_t offset = 0L;
+        long status;
+        off_t num;
+
+        ts->number = lh->number;
+        ts->size = reclen;
+        nsort_file_create(fname, fd);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        nsort_file_close(fd);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        nsort_file_open(fname, fd);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        nsort_file_write(fd, ts, sizeof(nsort_store_t), status);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        offset += status;
+        num = nsort_list_write_block(fd, offset, reclen, lh);
+        nsort_file_close(fd);
+        if (nsort_check_error())
+            return _ERROR_;
+        if (num != (off_t) (reclen * lh->number)) {
+            lh->listError = SORT_FRDWR;
+            return _ERROR_;
+        }
+        return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_get_all}
- * \index{nsort_list_get_all}
+ * \subsubsection{nsort_list_save}
+ * \index{nsort_list_save}
  *
  * [Verbatim] */
 
-    int nsort_list_get_all(nsort_list_t * lh, char *file, char *desc,
-                           char *timestamp)
+    int nsort_list_save(nsort_list_t * lh, const char *desc, int size,
+                        char *file)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_get_all() function is the same functionally as nsort_list_get()
- * except that it allows you to retrieve from the stored file the description and
- * the timestamp.  The following are the parameters for this function:
+ * The nsort_list_save() function saves the data that is stored in the list ``lh''
+ * to the file given by the name ``file''.  If a file of that name doesn't exist, it
+ * will be created.  If it does exist, the contents of the file will be overwritten.
+ * \footnote{This will happen without any warning, so be careful.}  This function
+ * uses reentrant safe library calls to get a time stamp; if these library calls are
+ * not available in your implementation, you may have to use the unsafe versions and
+ * lessen the thread-safety of your application.  The following are descriptions for
+ * the parameters to this function:
  *
  * \begin{itemize}
  *
- * \item [lh] This is the list header for the list that is to get the contents of the
- * file.  The number of items and the size of each item is stored in the header that
- * was stamped into the file when it was created.
+ * \item [lh] This is a list header for the list that contains the data.
  *
- * \item [file] This parameter is the name of a file to open and get the data from.
- * It is an error if the file doesn't exist or if this file is
- * not a stored list.
+ * \item [desc] This is a string that contains a description that gets stamped into
+ * the file at the top of the file, along with a time stamp and a magic number that
+ * identifies this as a stored list.  This string can be just about anything up to
+ * 127 characters in length.
  *
- * \item [desc] This is a pointer to a character array that should have enough space
- * to store a description, up to 127 bytes.
+ * \item [size]  This is the size of each of the records stored in the list.
  *
- * \item [timestamp] This is a pointer to a character array that should have enough
- * space to store a time stamp, 26 bytes.
+ * \item [file] This is the name of the file to store the list in.  If a file with
+ * this name already exists, it will get overwritten.
  *
  * \end{itemize}
  *
+ * nsort_list_save() returns _OK_ if it is successful and _ERROR_ if it is not.
+ * If it is not successful, lh->listError will hold the error and you can use
+ * nsort_show_list_error() to get a description of the error.
+ *
  * [EndDoc]
  */
     {
+        time_t now;
+        struct tm result;
         nsort_store_t *ts;
+        char tstamp[27];
+        char *cp;
         int status;
 
         ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
         if (0 == ts) {
-            set_sortError(SORT_NOMEMORY);
+            lh->listError = SORT_NOMEMORY;
             return _ERROR_;
         }
         memset(ts, 0, sizeof(nsort_store_t));
-        status = nsort_list_retrieve(lh, ts, file, DEFAULT_MAGIC);
-#ifndef __clang__
-#if defined (__GNUC__)
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstringop-truncation"
-#endif
-#endif
-        strncpy((char *) desc, (char *) ts->description, 127);
-        strncpy((char *) timestamp, (char *) ts->timeStamp, 26);
-#ifndef __clang__
-#if defined (__GNUC__)
-#pragma GCC diagnostic pop
-#endif
-#endif
+        ts->thisMagic = DEFAULT_MAGIC;
+        if (desc != 0)
+            strncpy(ts->description, desc, 127);
+        time(&now);
+        localtime_r(&now, &result);
+        asctime_r(&result, tstamp);
+        cp = strchr(tstamp, '\n');
+        if (cp != 0)
+            *cp = '\0';
+        strcpy(ts->timeStamp, tstamp);
+        status = nsort_list_store(lh, ts, size, file);
         free(ts);
         return status;
     }
 
-// XXX l1 and l2 must be deleted by the caller although the links they contain
-// will be moved.  The mrg parameter should be an allocated list but not initialized.
+
+/*
+ * Don't document this.  I want users to use nsort_list_get().
+ */
+    static int nsort_list_retrieve(nsort_list_t * lh, nsort_store_t * ts,
+                                   const char *fname, long magic) {
+        int fd;
+        int status;
+
+        nsort_file_open(fname, fd);
+        if (nsort_check_error())
+            return _ERROR_;
+        nsort_file_read(fd, ts, sizeof(nsort_store_t), status);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        if (ts->thisMagic != (unsigned long) magic) {
+            nsort_file_close(fd);
+            set_sortError(SORT_NOERROR);
+            lh->listError = SORT_LIST_BADFILE;
+            return _ERROR_;
+        }
+        status =
+            nsort_list_read_block(lh, fd, sizeof(nsort_store_t), ts->size,
+                                  ts->number);
+        if (status == _ERROR_) {
+            if (nsort_check_error()) {
+                lh->listError = get_sortError();
+                set_sortError(SORT_NOERROR);
+            }
+            else {
+                lh->listError = SORT_UNSPECIFIED;
+            }
+            nsort_file_close(fd);
+            return _ERROR_;
+        }
+        nsort_file_close(fd);
+        if (nsort_check_error()) {
+            lh->listError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_merge_sorted}
- * \index{nsort_list_merge_sorted}
+ * \subsubsection{nsort_list_get}
+ * \index{nsort_list_get}
  *
  * [Verbatim] */
 
-    int nsort_list_merge_sorted(nsort_list_t * mrg, nsort_list_t * l1,
-                                nsort_list_t * l2, int (*compare)(void *,
-                                                                  void *))
+    int nsort_list_get(nsort_list_t * lh, char *file)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_merge_sorted() function merges sorted lists given by ``l1'' and
- * ``l2'' and stores them in ``mrg''.  The following are the parameters for the
- * function:
+ * The nsort_list_get function get's the data that is stored in ``file'' and stores it
+ * in the list given by ``lh''.  The following are the parameters to this function:
  *
  * \begin{itemize}
  *
- * \item [mrg] This parameter is the list header of a list that is to get all the
- * items from the l1 and l2 lists.  It should be an empty, initialized list created
- * just for this purpose.
- *
- * \item [l1] This parameter is the list header of the first list that is to be
- * merged.  After this function completes, this list is empty and needs to be
- * deleted.
+ * \item [lh] This is the list header for the list that is to get the contents of the
+ * file.  The number of items and the size of each item is stored in the header that
+ * was stamped into the file when it was created.
+ *
+ * \item [file] This parameter is the name of a file to open and get the data from.
+ * It is an error if the file doesn't exist or if this file is
+ * not a stored list.
+ *
+ * \end{itemize}
+ *
+ * This function returns _OK_ if it is successful and _ERROR_ if not.  If it returns
+ * _ERROR_, lh->listError will contain the error and you can get a description of it
+ * by calling nsort_show_list_error().
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t *ts;
+        int status;
+
+        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
+        if (0 == ts) {
+            set_sortError(SORT_NOMEMORY);
+            return _ERROR_;
+        }
+        memset(ts, 0, sizeof(nsort_store_t));
+        status = nsort_list_retrieve(lh, ts, file, DEFAULT_MAGIC);
+        free(ts);
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_get_all}
+ * \index{nsort_list_get_all}
+ *
+ * [Verbatim] */
+
+    int nsort_list_get_all(nsort_list_t * lh, char *file, char *desc,
+                           char *timestamp)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_get_all() function is the same functionally as nsort_list_get()
+ * except that it allows you to retrieve from the stored file the description and
+ * the timestamp.  The following are the parameters for this function:
+ *
+ * \begin{itemize}
+ *
+ * \item [lh] This is the list header for the list that is to get the contents of the
+ * file.  The number of items and the size of each item is stored in the header that
+ * was stamped into the file when it was created.
+ *
+ * \item [file] This parameter is the name of a file to open and get the data from.
+ * It is an error if the file doesn't exist or if this file is
+ * not a stored list.
+ *
+ * \item [desc] This is a pointer to a character array that should have enough space
+ * to store a description, up to 127 bytes.
+ *
+ * \item [timestamp] This is a pointer to a character array that should have enough
+ * space to store a time stamp, 26 bytes.
+ *
+ * \end{itemize}
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t *ts;
+        int status;
+
+        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
+        if (0 == ts) {
+            set_sortError(SORT_NOMEMORY);
+            return _ERROR_;
+        }
+        memset(ts, 0, sizeof(nsort_store_t));
+        status = nsort_list_retrieve(lh, ts, file, DEFAULT_MAGIC);
+#ifndef __clang__
+#if defined (__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstringop-truncation"
+#endif
+#endif
+        strncpy((char *) desc, (char *) ts->description, 127);
+        strncpy((char *) timestamp, (char *) ts->timeStamp, 26);
+#ifndef __clang__
+#if defined (__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+        free(ts);
+        return status;
+    }
+
+// XXX l1 and l2 must be deleted by the caller although the links they contain
+// will be moved.  The mrg parameter should be an allocated list but not initialized.
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_merge_sorted}
+ * \index{nsort_list_merge_sorted}
+ *
+ * [Verbatim] */
+
+    int nsort_list_merge_sorted(nsort_list_t * mrg, nsort_list_t * l1,
+                                nsort_list_t * l2, int (*compare)(void *,
+                                                                  void *))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_merge_sorted() function merges sorted lists given by ``l1'' and
+ * ``l2'' and stores them in ``mrg''.  The following are the parameters for the
+ * function:
+ *
+ * \begin{itemize}
+ *
+ * \item [mrg] This parameter is the list header of a list that is to get all the
+ * items from the l1 and l2 lists.  It should be an empty, initialized list created
+ * just for this purpose.
+ *
+ * \item [l1] This parameter is the list header of the first list that is to be
+ * merged.  After this function completes, this list is empty and needs to be
+ * deleted.  If it had an arena, the arena now belongs to ``mrg''.
  *
  * \item [l2] This parameter is the list header of the second list that is to be
  * merged.  The contents of this list, as well as those of the first list, must
@@ -3376,105 +5146,775 @@ extern "C" {
         l2->head->next = l2->tail;
         l2->tail->prev = l2->head;
         l2->number = 0;
+        nsort_list_take_arena(mrg, l1);
+        nsort_list_take_arena(mrg, l2);
         return _OK_;
     }
 
+/*
+ * Natural runs shorter than NSORT_LIST_MSORT_RUN are made up to that length
+ * by insertion before they are merged.  NSORT_LIST_MSORT_STACK bounds the
+ * number of runs waiting to be merged; the run lengths on the stack grow at
+ * least as fast as the Fibonacci numbers, so it is far more than any list
+ * will need.
+ */
+#define NSORT_LIST_MSORT_RUN 8
+#define NSORT_LIST_MSORT_STACK 96
+
 /*
  * [BeginDoc]
  *
- * \subsubsection{returnClean}
- * \index{returnClean}
+ * \subsubsection{nsort_list_msort}
+ * \index{nsort_list_msort}
  *
  * [Verbatim] */
 
-    void returnClean(void *p)
+    int nsort_list_msort(nsort_list_t * lh, int (*compare)(void *, void *))
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The returnClean function is a stub that is passed to nsort_del when the
- * elements of the list (the links and data objects) are not allocated
- * individually on the heap.  It doesn't do anything.
+ * The nsort_list_msort() function sorts the list given by ``lh'' in place with
+ * ``compare'', which is called with the data of two links.  It is a natural
+ * merge sort: the list is cut into the runs that are already in order (runs in
+ * strictly descending order are turned around as they are found), and the runs
+ * are merged pairwise by relinking the links, so no record is copied or moved
+ * and the only extra memory is a small stack of runs on the C stack.  A list
+ * that is already sorted costs one pass and one compare per link.
+ *
+ * The sort is stable.  Links that compare equal keep the order they had, so a
+ * list can be sorted by a secondary key and then by a primary key to get it in
+ * order by both.
+ *
+ * The list should not belong to an nsort when it is sorted, since the index of
+ * the nsort would be left pointing at the wrong links.  Use
+ * nsort_sort_to_list() to get the list back from an nsort first and
+ * nsort_list_to_sort() to build an nsort around the list afterward.
+ * lh->current is left at the head of the list.
+ *
+ * This function returns _OK_ if it succeeds and _ERROR_ if ``compare'' is not
+ * given, in which case lh->listError is set to SORT_PARAM.
  *
  * [EndDoc]
  */
     {
-        if (p)
+        nsort_link_t *runHead[NSORT_LIST_MSORT_STACK],
+            *runTail[NSORT_LIST_MSORT_STACK];
+        size_t runLen[NSORT_LIST_MSORT_STACK];
+        nsort_link_t *lnk, *next, *head, *tail, *ins, *prev;
+        size_t len;
+        int top = 0, k;
+
+        if (compare == 0) {
+            lh->listError = SORT_PARAM;
+            return _ERROR_;
+        }
+        lh->current = lh->head;
+        if (lh->head->next == lh->tail || lh->head->next->next == lh->tail)
+            return _OK_;
+
+        /*
+         * The runs are kept as chains of next pointers ending in NULL; the prev
+         * pointers are put back when the last merge is done.
+         */
+        lh->tail->prev->next = 0;
+        lnk = lh->head->next;
+        while (lnk != 0) {
+            head = tail = lnk;
+            lnk = lnk->next;
+            len = 1;
+            if (lnk != 0 && compare(tail->data, lnk->data) > 0) {
+                do {
+                    next = lnk->next;
+                    lnk->next = head;
+                    head = lnk;
+                    lnk = next;
+                    len++;
+                } while (lnk != 0 && compare(head->data, lnk->data) > 0);
+            }
+            else if (lnk != 0) {
+                do {
+                    tail = lnk;
+                    lnk = lnk->next;
+                    len++;
+                } while (lnk != 0 && compare(tail->data, lnk->data) <= 0);
+            }
+            tail->next = 0;
+            while (len < NSORT_LIST_MSORT_RUN && lnk != 0) {
+                next = lnk->next;
+                if (compare(tail->data, lnk->data) <= 0) {
+                    tail->next = lnk;
+                    lnk->next = 0;
+                    tail = lnk;
+                }
+                else if (compare(head->data, lnk->data) > 0) {
+                    lnk->next = head;
+                    head = lnk;
+                }
+                else {
+                    for (ins = head; compare(ins->next->data, lnk->data) <= 0;
+                         ins = ins->next);
+                    lnk->next = ins->next;
+                    ins->next = lnk;
+                }
+                lnk = next;
+                len++;
+            }
+            runHead[top] = head;
+            runTail[top] = tail;
+            runLen[top] = len;
+            top++;
+
+            /*
+             * Merge until the run lengths shrink fast enough going up the
+             * stack (the rules are the ones timsort uses), which keeps the
+             * merges balanced and the stack short.
+             */
+            while (top > 1) {
+                k = top - 2;
+                if ((k > 0 && runLen[k - 1] <= runLen[k] + runLen[k + 1]) ||
+                    (k > 1 && runLen[k - 2] <= runLen[k - 1] + runLen[k])) {
+                    if (runLen[k - 1] < runLen[k + 1])
+                        k--;
+                }
+                else if (runLen[k] > runLen[k + 1])
+                    break;
+                nsort_list_msort_merge(runHead, runTail, runLen, k, compare);
+                if (k + 2 < top) {
+                    runHead[k + 1] = runHead[k + 2];
+                    runTail[k + 1] = runTail[k + 2];
+                    runLen[k + 1] = runLen[k + 2];
+                }
+                top--;
+            }
+        }
+        while (top > 1) {
+            nsort_list_msort_merge(runHead, runTail, runLen, top - 2, compare);
+            top--;
+        }
+
+        prev = lh->head;
+        for (lnk = runHead[0]; lnk != 0; lnk = lnk->next) {
+            lnk->prev = prev;
+            prev->next = lnk;
+            prev = lnk;
+        }
+        prev->next = lh->tail;
+        lh->tail->prev = prev;
+        return _OK_;
+    }
+
+/*
+ * Merge run k + 1 of nsort_list_msort() into run k.  When one run ends before
+ * the other begins, the two are just joined.  Links from run k win ties, which
+ * is what keeps the sort stable.
+ */
+    static void nsort_list_msort_merge(nsort_link_t ** runHead,
+                                       nsort_link_t ** runTail,
+                                       size_t *runLen, int k,
+                                       int (*compare)(void *, void *)) {
+        nsort_link_t *a = runHead[k], *b = runHead[k + 1];
+        nsort_link_t first, *tail = &first;
+
+        runLen[k] += runLen[k + 1];
+        if (compare(runTail[k]->data, b->data) <= 0) {
+            runTail[k]->next = b;
+            runTail[k] = runTail[k + 1];
+            return;
+        }
+        if (compare(a->data, runTail[k + 1]->data) > 0) {
+            runTail[k + 1]->next = a;
+            runHead[k] = b;
             return;
+        }
+        while (a != 0 && b != 0) {
+            if (compare(a->data, b->data) <= 0) {
+                tail->next = a;
+                tail = a;
+                a = a->next;
+            }
+            else {
+                tail->next = b;
+                tail = b;
+                b = b->next;
+            }
+        }
+        if (a != 0) {
+            tail->next = a;
+        }
+        else {
+            tail->next = b;
+            runTail[k] = runTail[k + 1];
+        }
+        runHead[k] = first.next;
     }
 
 /*
- * [BeginDoc]
- *
- * \subsubsection{nsort_create}
- * \index{nsort_create}
- *
- * [Verbatim] */
+ * Whether leaf ``a'' of a merge beats leaf ``b'': its link is smaller, or the
+ * links are equal and it comes from an earlier list, which keeps merges
+ * stable.  A leaf whose list has run out (its link has got to ``end'') loses
+ * to every other.
+ */
+    static int nsort_merge_beats(nsort_link_t ** cur, nsort_link_t ** end,
+                                 int a, int b,
+                                 int (*compare)(void *, void *)) {
+        int status;
+
+        if (cur[a] == end[a])
+            return FALSE;
+        if (cur[b] == end[b])
+            return TRUE;
+        status = compare(cur[a]->data, cur[b]->data);
+        return status < 0 || (status == 0 && a < b);
+    }
 
-    nsort_t *nsort_create(void)
-/* [EndDoc] */
 /*
- * [BeginDoc]
- *
- * The nsort_create() function allocates an item of nsort_t on the heap
- * and returns a pointer to it.  The returned parameter should be destroyed
- * by calling nsort_destroy().  If an error occurs, nsort_create() will return
- * NULL and you can get a description of the error by calling nsort_show_error().
- *
- * [EndDoc]
+ * Merge the k runs of links from cur[i] up to (but not including) end[i]
+ * with a loser tree and link them in after ``prev''.  ``tree'' has room for
+ * 2 * k ints: tree[0] is the leaf that is winning, tree[1] through tree[k-1]
+ * hold the leaf that lost at each node of the tree (the leaves themselves
+ * are nodes k through 2k-1) and the top half is scratch for building it.
+ * Each link costs about log2(k) compares.  The last link is returned in
+ * ``last'' and the number of links merged is returned.
  */
-    {
-        nsort_t *srt;
-        srt = (nsort_t *) malloc(sizeof(nsort_t));
-        if (srt == 0) {
-            set_sortError(SORT_NOMEMORY);
-            return 0;
+    static size_t nsort_list_merge_range(nsort_link_t ** cur,
+                                         nsort_link_t ** end, int *tree,
+                                         int k, nsort_link_t * prev,
+                                         nsort_link_t ** last,
+                                         int (*compare)(void *, void *)) {
+        nsort_link_t *lnk;
+        size_t count = 0;
+        int n, a, b, s;
+
+        if (k == 1)
+            tree[0] = 0;
+        for (n = k - 1; n > 0; n--) {
+            a = (2 * n >= k) ? 2 * n - k : tree[k + 2 * n];
+            b = (2 * n + 1 >= k) ? 2 * n + 1 - k : tree[k + 2 * n + 1];
+            if (nsort_merge_beats(cur, end, b, a, compare)) {
+                s = a;
+                a = b;
+                b = s;
+            }
+            tree[n] = b;
+            if (n == 1)
+                tree[0] = a;
+            else
+                tree[k + n] = a;
+        }
+        for (;;) {
+            s = tree[0];
+            if (cur[s] == end[s])
+                break;
+            lnk = cur[s];
+            cur[s] = lnk->next;
+            prev->next = lnk;
+            lnk->prev = prev;
+            prev = lnk;
+            count++;
+            for (n = (s + k) / 2; n > 0; n /= 2)
+                if (nsort_merge_beats(cur, end, tree[n], s, compare)) {
+                    a = tree[n];
+                    tree[n] = s;
+                    s = a;
+                }
+            tree[0] = s;
+        }
+        *last = prev;
+        return count;
+    }
+
+/*
+ * Empty the k lists that have been merged into ``dst'' and hand their arenas
+ * over to it.
+ */
+    static void nsort_list_merge_done(nsort_list_t * dst,
+                                      nsort_list_t ** lists, int k) {
+        int i;
+
+        for (i = 0; i < k; i++) {
+            lists[i]->head->next = lists[i]->tail;
+            lists[i]->tail->prev = lists[i]->head;
+            lists[i]->current = lists[i]->head;
+            lists[i]->number = 0;
+            nsort_list_take_arena(dst, lists[i]);
         }
-        return srt;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_destroy}
- * \index{nsort_destroy}
+ * \subsubsection{nsort_list_merge_many}
+ * \index{nsort_list_merge_many}
  *
  * [Verbatim] */
 
-    int nsort_destroy(nsort_t * srt)
+    int nsort_list_merge_many(nsort_list_t * dst, nsort_list_t ** lists,
+                              int k, int (*compare)(void *, void *))
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_destroy() function frees the nsort_t object given by ``srt''.
- * It only returns _OK_.
+ * The nsort_list_merge_many() function merges the ``k'' sorted lists in the
+ * array ``lists'' into ``dst'' in one pass.  Like nsort_list_merge_sorted(),
+ * ``dst'' should be an allocated list that has not been initialized, the lists
+ * are empty when the function returns (their arenas, if they have any, now
+ * belong to dst) and the caller still has to delete them.  Any of the lists
+ * may be empty.
+ *
+ * The merge is done with a loser tree, so each link is looked at once and
+ * costs about log2(k) compares, where merging the lists two at a time would
+ * go over the links log2(k) times or more.  The merge is stable: of the links
+ * that compare equal, the ones from lists[0] come first, then the ones from
+ * lists[1], and so on.  The links are moved, not copied.
+ *
+ * This function returns _OK_ if it succeeds.  It returns _ERROR_ with
+ * dst->listError set to SORT_PARAM if ``k'' is less than 1 or ``compare'' is
+ * not given, and to SORT_NOMEMORY if the memory for the tree can't be had; in
+ * either case, the lists are left alone.
  *
  * [EndDoc]
  */
     {
-#ifdef DMALLOC_DEBUGGING
-        if (dmalloc_verify(srt) == DMALLOC_VERIFY_ERROR)
+        nsort_link_t **cur, **end, *last;
+        int *tree;
+        int i;
+
+        if (k < 1 || lists == 0 || compare == 0) {
+            dst->listError = SORT_PARAM;
             return _ERROR_;
-#endif
-        check_pointer(srt);
-        free(srt);
+        }
+        cur = (nsort_link_t **) malloc(2 * (size_t) k *
+                                       sizeof(nsort_link_t *));
+        tree = (int *) malloc(2 * (size_t) k * sizeof(int));
+        if (cur == 0 || tree == 0) {
+            free(cur);
+            free(tree);
+            dst->listError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        if (nsort_list_init(dst) == _ERROR_) {
+            free(cur);
+            free(tree);
+            return _ERROR_;
+        }
+        end = cur + k;
+        for (i = 0; i < k; i++) {
+            cur[i] = lists[i]->head->next;
+            end[i] = lists[i]->tail;
+        }
+        dst->number = nsort_list_merge_range(cur, end, tree, k, dst->head,
+                                             &last, compare);
+        last->next = dst->tail;
+        dst->tail->prev = last;
+        dst->current = last;
+        nsort_list_merge_done(dst, lists, k);
+        free(cur);
+        free(tree);
         return _OK_;
     }
 
+#ifdef HAVE_PTHREAD_H
 /*
- * [BeginDoc]
- *
- * \subsubsection{nsort_init}
- * \index{nsort_init}
- *
- * [Verbatim] */
+ * nsort_list_merge_many_parallel() cuts the key space into one range for each
+ * thread.  Every list is sampled once every ``step'' links, the samples are
+ * sorted and nparts - 1 of them are picked out evenly as splitters, and each
+ * list is cut in front of the first link greater than each splitter.  Range r
+ * of every list then lies between cuts[i][r] and cuts[i][r+1] and the ranges
+ * are merged on their own threads.  The threads run in three rounds (sample,
+ * cut, merge); the work is given out by thread number, so a thread that
+ * can't be started is just run by the caller.
+ */
+#ifndef NSORT_MERGE_PARALLEL_CUTOFF
+#define NSORT_MERGE_PARALLEL_CUTOFF 65536
+#endif
+#define NSORT_MERGE_OVERSAMPLE 32
 
-    int nsort_init(nsort_t * srt, int (*compare)(void *, void *),
-                   int isUnique, int manageAllocs)
-/* [EndDoc] */
-/*
- * [BeginDoc]
- *
+    typedef struct _nsort_merge_t {
+        nsort_list_t **lists;
+        int k;
+        int nparts;
+        int (*compare)(void *, void *);
+        size_t step;
+        nsort_link_t **samples;
+        size_t *sampleAt;
+        nsort_link_t **splitters;
+        nsort_link_t **cuts;
+        nsort_link_t **cur;
+        int *trees;
+        nsort_link_t *first;
+        nsort_link_t **last;
+        size_t *counts;
+    } nsort_merge_t;
+
+    typedef struct _nsort_merge_arg_t {
+        nsort_merge_t *mrg;
+        int id;
+    } nsort_merge_arg_t;
+
+/*
+ * Sample the lists given to this thread.
+ */
+    static void *nsort_merge_sample(void *arg) {
+        nsort_merge_t *mrg = ((nsort_merge_arg_t *) arg)->mrg;
+        nsort_link_t *lnk, **samples;
+        size_t n;
+        int i;
+
+        for (i = ((nsort_merge_arg_t *) arg)->id; i < mrg->k;
+             i += mrg->nparts) {
+            samples = mrg->samples + mrg->sampleAt[i];
+            n = 0;
+            for (lnk = mrg->lists[i]->head->next; lnk != mrg->lists[i]->tail;
+                 lnk = lnk->next)
+                if (n++ % mrg->step == 0)
+                    *samples++ = lnk;
+        }
+        return 0;
+    }
+
+/*
+ * Cut the lists given to this thread at the splitters.  A link equal to a
+ * splitter stays in the range to its left, so all the links that compare
+ * equal end up in the same range.
+ */
+    static void *nsort_merge_cut(void *arg) {
+        nsort_merge_t *mrg = ((nsort_merge_arg_t *) arg)->mrg;
+        nsort_link_t *lnk, **cuts;
+        int i, r;
+
+        for (i = ((nsort_merge_arg_t *) arg)->id; i < mrg->k;
+             i += mrg->nparts) {
+            cuts = mrg->cuts + (size_t) i *(mrg->nparts + 1);
+            lnk = mrg->lists[i]->head->next;
+            cuts[0] = lnk;
+            for (r = 1; r < mrg->nparts; r++) {
+                while (lnk != mrg->lists[i]->tail &&
+                       mrg->compare(lnk->data,
+                                    mrg->splitters[r - 1]->data) <= 0)
+                    lnk = lnk->next;
+                cuts[r] = lnk;
+            }
+            cuts[mrg->nparts] = mrg->lists[i]->tail;
+        }
+        return 0;
+    }
+
+/*
+ * Merge the range given to this thread.  The links it relinks are all in
+ * its own range, so the threads don't get in each other's way.
+ */
+    static void *nsort_merge_part(void *arg) {
+        nsort_merge_t *mrg = ((nsort_merge_arg_t *) arg)->mrg;
+        int r = ((nsort_merge_arg_t *) arg)->id, i;
+        nsort_link_t **cur = mrg->cur + 2 * (size_t) r *mrg->k;
+        nsort_link_t **end = cur + mrg->k;
+
+        for (i = 0; i < mrg->k; i++) {
+            cur[i] = mrg->cuts[(size_t) i * (mrg->nparts + 1) + r];
+            end[i] = mrg->cuts[(size_t) i * (mrg->nparts + 1) + r + 1];
+        }
+        mrg->counts[r] =
+            nsort_list_merge_range(cur, end,
+                                   mrg->trees + 2 * (size_t) r *mrg->k,
+                                   mrg->k, &mrg->first[r], &mrg->last[r],
+                                   mrg->compare);
+        return 0;
+    }
+
+/*
+ * Run one round of nsort_list_merge_many_parallel() on mrg->nparts threads,
+ * the caller being thread 0.
+ */
+    static void nsort_merge_round(nsort_merge_t * mrg, pthread_t * threads,
+                                  nsort_merge_arg_t * args,
+                                  void *(*round)(void *)) {
+        int i, started;
+
+        for (started = 1; started < mrg->nparts; started++)
+            if (pthread_create(&threads[started], 0, round,
+                               &args[started]) != 0)
+                break;
+        for (i = started; i < mrg->nparts; i++)
+            round(&args[i]);
+        round(&args[0]);
+        for (i = 1; i < started; i++)
+            pthread_join(threads[i], 0);
+    }
+#endif
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_merge_many_parallel}
+ * \index{nsort_list_merge_many_parallel}
+ *
+ * [Verbatim] */
+
+    int nsort_list_merge_many_parallel(nsort_list_t * dst,
+                                       nsort_list_t ** lists, int k,
+                                       int (*compare)(void *, void *),
+                                       int nthreads)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_merge_many_parallel() function does what
+ * nsort_list_merge_many() does, using ``nthreads'' threads (the calling
+ * thread being one of them), or one for each processor if nthreads is 0 or
+ * less.  The lists are sampled to pick splitters that cut the keys into one
+ * range for each thread, each list is cut at the splitters, and each thread
+ * merges one range of every list with its own loser tree.  The ranges are
+ * cut between keys, never between links that compare equal, so the result is
+ * exactly the one nsort_list_merge_many() gives.  The compare function has to
+ * be safe to call from more than one thread at once.  With one thread, or
+ * fewer than NSORT_MERGE_PARALLEL_CUTOFF links in all, this is just
+ * nsort_list_merge_many().  The return values are the same as for
+ * nsort_list_merge_many().
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
+        nsort_merge_t mrg;
+        nsort_merge_arg_t *args;
+        pthread_t *threads;
+        nsort_link_t *prev;
+        size_t total = 0, numSamples = 0;
+        int i, r, nparts = nthreads;
+
+        if (k < 1 || lists == 0 || compare == 0) {
+            dst->listError = SORT_PARAM;
+            return _ERROR_;
+        }
+        if (nparts <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+            nparts = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+            if (nparts <= 0)
+                nparts = 1;
+        }
+        for (i = 0; i < k; i++)
+            total += lists[i]->number;
+        if (nparts == 1 || total < NSORT_MERGE_PARALLEL_CUTOFF)
+            return nsort_list_merge_many(dst, lists, k, compare);
+
+        memset(&mrg, 0, sizeof(mrg));
+        mrg.lists = lists;
+        mrg.k = k;
+        mrg.nparts = nparts;
+        mrg.compare = compare;
+        mrg.step = total / ((size_t) nparts * NSORT_MERGE_OVERSAMPLE) + 1;
+        mrg.sampleAt = (size_t *) malloc((size_t) k * sizeof(size_t));
+        if (mrg.sampleAt != 0)
+            for (i = 0; i < k; i++) {
+                mrg.sampleAt[i] = numSamples;
+                numSamples += (lists[i]->number + mrg.step - 1) / mrg.step;
+            }
+        mrg.samples = (nsort_link_t **) malloc((2 * numSamples + 1) *
+                                               sizeof(nsort_link_t *));
+        mrg.splitters = (nsort_link_t **) malloc((size_t) nparts *
+                                                 sizeof(nsort_link_t *));
+        mrg.cuts = (nsort_link_t **) malloc((size_t) k * (nparts + 1) *
+                                            sizeof(nsort_link_t *));
+        mrg.cur = (nsort_link_t **) malloc(2 * (size_t) k * nparts *
+                                           sizeof(nsort_link_t *));
+        mrg.trees = (int *) malloc(2 * (size_t) k * nparts * sizeof(int));
+        mrg.first = (nsort_link_t *) malloc((size_t) nparts *
+                                            sizeof(nsort_link_t));
+        mrg.last = (nsort_link_t **) malloc((size_t) nparts *
+                                            sizeof(nsort_link_t *));
+        mrg.counts = (size_t *) malloc((size_t) nparts * sizeof(size_t));
+        args = (nsort_merge_arg_t *) malloc((size_t) nparts *
+                                            sizeof(nsort_merge_arg_t));
+        threads = (pthread_t *) malloc((size_t) nparts * sizeof(pthread_t));
+        if (mrg.sampleAt == 0 || mrg.samples == 0 || mrg.splitters == 0 ||
+            mrg.cuts == 0 || mrg.cur == 0 || mrg.trees == 0 ||
+            mrg.first == 0 || mrg.last == 0 || mrg.counts == 0 ||
+            args == 0 || threads == 0) {
+            dst->listError = SORT_NOMEMORY;
+            r = _ERROR_;
+            goto done;
+        }
+        if (nsort_list_init(dst) == _ERROR_) {
+            r = _ERROR_;
+            goto done;
+        }
+        for (i = 0; i < nparts; i++) {
+            args[i].mrg = &mrg;
+            args[i].id = i;
+        }
+
+        nsort_merge_round(&mrg, threads, args, nsort_merge_sample);
+        nsort_link_msort(mrg.samples, mrg.samples + numSamples, numSamples,
+                         compare);
+        for (r = 1; r < nparts; r++)
+            mrg.splitters[r - 1] =
+                mrg.samples[(size_t) r * numSamples / nparts];
+        nsort_merge_round(&mrg, threads, args, nsort_merge_cut);
+        nsort_merge_round(&mrg, threads, args, nsort_merge_part);
+
+        prev = dst->head;
+        for (r = 0; r < nparts; r++)
+            if (mrg.counts[r] > 0) {
+                prev->next = mrg.first[r].next;
+                prev->next->prev = prev;
+                prev = mrg.last[r];
+            }
+        prev->next = dst->tail;
+        dst->tail->prev = prev;
+        dst->current = prev;
+        dst->number = total;
+        nsort_list_merge_done(dst, lists, k);
+        r = _OK_;
+
+      done:
+        free(mrg.sampleAt);
+        free(mrg.samples);
+        free(mrg.splitters);
+        free(mrg.cuts);
+        free(mrg.cur);
+        free(mrg.trees);
+        free(mrg.first);
+        free(mrg.last);
+        free(mrg.counts);
+        free(args);
+        free(threads);
+        return r;
+#else
+        return nsort_list_merge_many(dst, lists, k, compare);
+#endif
+    }
+
+/*
+ * Links that live in an arena have to follow the arena.  When links move from
+ * ``src'' to ``dst'' wholesale, the arena of src is handed to dst (or spliced
+ * into the arena dst already has) so that deleting src doesn't pull the
+ * memory out from under dst.  The slabs of src go behind the current slab of
+ * dst so that nsort_arena_release() keeps working on dst.
+ */
+    static void nsort_list_take_arena(nsort_list_t * dst, nsort_list_t * src) {
+        nsort_arena_t *ar = src->arena;
+        nsort_slab_t *slab;
+
+        if (ar == 0)
+            return;
+        src->arena = 0;
+        if (dst->arena == 0) {
+            dst->arena = ar;
+            return;
+        }
+        if (ar->slabs != 0) {
+            if (dst->arena->slabs == 0)
+                dst->arena->slabs = ar->slabs;
+            else {
+                for (slab = ar->slabs; slab->next != 0; slab = slab->next);
+                slab->next = dst->arena->slabs->next;
+                dst->arena->slabs->next = ar->slabs;
+            }
+        }
+        dst->arena->numSlabs += ar->numSlabs;
+        dst->arena->bytesAlloc += ar->bytesAlloc;
+        dst->arena->bytesUsed += ar->bytesUsed;
+        free(ar);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{returnClean}
+ * \index{returnClean}
+ *
+ * [Verbatim] */
+
+    void returnClean(void *p)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The returnClean function is a stub that is passed to nsort_del when the
+ * elements of the list (the links and data objects) are not allocated
+ * individually on the heap.  It doesn't do anything.
+ *
+ * [EndDoc]
+ */
+    {
+        if (p)
+            return;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_create}
+ * \index{nsort_create}
+ *
+ * [Verbatim] */
+
+    nsort_t *nsort_create(void)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_create() function allocates an item of nsort_t on the heap
+ * and returns a pointer to it.  The returned parameter should be destroyed
+ * by calling nsort_destroy().  If an error occurs, nsort_create() will return
+ * NULL and you can get a description of the error by calling nsort_show_error().
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_t *srt;
+        srt = (nsort_t *) malloc(sizeof(nsort_t));
+        if (srt == 0) {
+            set_sortError(SORT_NOMEMORY);
+            return 0;
+        }
+        return srt;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_destroy}
+ * \index{nsort_destroy}
+ *
+ * [Verbatim] */
+
+    int nsort_destroy(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_destroy() function frees the nsort_t object given by ``srt''.
+ * It only returns _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef DMALLOC_DEBUGGING
+        if (dmalloc_verify(srt) == DMALLOC_VERIFY_ERROR)
+            return _ERROR_;
+#endif
+        check_pointer(srt);
+        free(srt);
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_init}
+ * \index{nsort_init}
+ *
+ * [Verbatim] */
+
+    int nsort_init(nsort_t * srt, int (*compare)(void *, void *),
+                   int isUnique, int manageAllocs)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
  * The nsort_init() function prepares the sort object given by ``srt'' to
  * be manipulated by the nsort functions.  The following are the parameters
  * of this function:
@@ -3512,6 +5952,7 @@ extern "C" {
             return _ERROR_;
         }
         memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
         srt->head = (nsort_node_t *) malloc(sizeof(nsort_node_t));
         if (0 == srt->head) {
             srt->sortError = SORT_NOMEMORY;
@@ -3575,25 +6016,53 @@ extern "C" {
  * contained by the list are complex.  In other words, if a single free() doesn't
  * free them up, the delFunc can do that unravelling of the data items.
  *
+ * If the sort has an arena (see nsort_use_arena()), the nodes, links and data
+ * that came from it are freed a slab at a time rather than one by one, and
+ * delFunc is not called on data that lies in the arena.  Links and data that
+ * were allocated some other way and added to the sort are let go the same
+ * way they would be without an arena.
+ *
  * [EndDoc]
  */
     {
-        nsort_node_t *node, *nextNode;
         nsort_link_t *lnk;
 
-        if (srt->head->next != srt->tail) {
-            node = srt->head->next;
-            nextNode = node->next;
-            while (TRUE) {
-                free(node);
-                if (nextNode == srt->tail)
-                    break;
-                node = nextNode;
-                nextNode = node->next;
-            }
-        }
+        nsort_save_wait(srt);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            nsort_sync_del(srt);
+#endif
+        nsort_rebuild_cancel(srt);
         if (!srt->manageAllocs)
             delFunc = returnClean;
+        if (srt->lh->arena != 0) {
+            nsort_arena_t *ar = srt->lh->arena;
+            nsort_link_t *next;
+
+            free(srt->head);
+            free(srt->tail);
+            for (lnk = srt->lh->head->next; lnk != srt->lh->tail;
+                 lnk = next) {
+                next = lnk->next;
+                if (!nsort_arena_owns(ar, lnk->data)) {
+                    if (delFunc)
+                        delFunc(lnk->data);
+                    else
+                        free(lnk->data);
+                }
+                if (srt->manageAllocs && !nsort_arena_owns(ar, lnk))
+                    free(lnk);
+            }
+            srt->lh->head->next = srt->lh->tail;
+            srt->lh->tail->prev = srt->lh->head;
+            srt->lh->current = srt->lh->head;
+            srt->lh->number = 0;
+            nsort_list_del(srt->lh);
+            if (nsort_list_destroy(srt->lh) == _ERROR_)
+                return _ERROR_;
+            return _OK_;
+        }
+        nsort_release_nodes(srt);
         free(srt->head);
         free(srt->tail);
         lnk = nsort_list_remove_link(srt->lh);
@@ -3614,1990 +6083,7797 @@ extern "C" {
     }
 
 /*
- * This function is not part of the API.  Don't document it.
- */
-    int nsort_new_node(nsort_t * srt, nsort_node_t * prevNode,
-                       nsort_node_t * nextNode, nsort_link_t * here) {
-        nsort_node_t *newNode;
-        int i;
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_use_arena}
+ * \index{nsort_use_arena}
+ *
+ * [Verbatim] */
 
-        newNode = (nsort_node_t *) malloc(sizeof(nsort_node_t));
-        if (newNode == 0) {
-            srt->sortError = SORT_NOMEMORY;
+    int nsort_use_arena(nsort_t * srt, size_t slabSize)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_use_arena() function attaches an arena to the sort object given by
+ * ``srt''.  It must be called after nsort_init() and before any items are
+ * added.  Once the arena is attached, the index nodes of the sort come from it,
+ * as do the links (and their data) that are allocated with nsort_new_link().
+ * Adding items then costs one bump of a pointer instead of one or two calls to
+ * malloc(), the items are packed together in memory, and nsort_del() frees the
+ * whole thing a slab at a time.
+ *
+ * If an arena is used with manageAllocs set, every link that is added to the
+ * sort must come from nsort_new_link(); links allocated some other way will not
+ * be freed by nsort_del().  The ``slabSize'' parameter is the size of the first
+ * slab; 0 selects NSORT_ARENA_SLAB.  This function returns _OK_ on success or
+ * _ERROR_ with the error in srt->sortError.
+ *
+ * [EndDoc]
+ */
+    {
+        if (srt->head->next != srt->tail) {
+            srt->sortError = SORT_LIST_NOTEMPTY;
+            return _ERROR_;
+        }
+        if (nsort_list_use_arena(srt->lh, slabSize) == _ERROR_) {
+            srt->sortError = srt->lh->listError;
+            srt->lh->listError = SORT_NOERROR;
             return _ERROR_;
         }
-        newNode->prev = prevNode;
-        newNode->next = nextNode;
-        prevNode->next = newNode;
-        nextNode->prev = newNode;
-        newNode->here = here;
-        for (i = 0; i < NSORT_NODE_LEVEL; i++)
-            newNode->level[i] = srt->tail;
-        srt->current = newNode;
-        srt->numNodes++;
         return _OK_;
     }
 
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_set_sync}
+ * \index{nsort_set_sync}
+ *
+ * [Verbatim] */
 
-#define NSORT_RSTRUCT_THRESH 10
-#define NSORT_OUTPOINT_THRESH (6*(NSORT_NODE_LEVEL*NSORT_OUTPOINT))
-#define NSORT_CRIT_THRESH (500*(NSORT_NODE_LEVEL*NSORT_OUTPOINT))
+    int nsort_set_sync(nsort_t * srt, int policy)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_set_sync() function sets the sync policy of the list of the sort
+ * object ``srt'', which nsort_save(), nsort_save_map() and nsort_save_var()
+ * follow.  The policies are described with nsort_list_set_sync().  This
+ * function returns _OK_ on success or _ERROR_ with the error in srt->sortError.
+ *
+ * [EndDoc]
+ */
+    {
+        if (nsort_list_set_sync(srt->lh, policy) == _ERROR_) {
+            srt->sortError = srt->lh->listError;
+            srt->lh->listError = SORT_NOERROR;
+            return _ERROR_;
+        }
+        return _OK_;
+    }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_add_item}
- * \index{nsort_add_item}
+ * \subsubsection{nsort_new_link}
+ * \index{nsort_new_link}
  *
  * [Verbatim] */
 
-    int nsort_add_item(nsort_t * srt, nsort_link_t * lnk)
+    nsort_link_t *nsort_new_link(nsort_t * srt, void *data, size_t size)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_add_item() function is the most complex function that is part
- * of the nsort routines.  It's function is to add the item given by ``lnk''
- * to the sort object given by ``srt''.  The item will be added in a sorted
- * manner according to the compare function that was provided in the call
- * to nsort_init() function.  The complexity of this function arises from the
- * fact that the indexing must be built in the ``srt'' object as items are
- * added and that this must be done in the most efficient manner possible.
- *
- * While the function definition for this function is complex, using the function
- * is relatively trivial.  Simply allocate a link (lnk), point it's data member
- * to the data object you want to add to the srt object, and call nsort_add_item()
- * with the two parameters.  nsort_add_item() returns _OK_ if it is successful.
- * Otherwise, _ERROR_ is returned and you can call nsort_show_sort_error() to
- * get a description of the error.
+ * The nsort_new_link() function allocates a link for the sort object given by
+ * ``srt'' by calling nsort_list_new_link() on srt->lh.  See
+ * nsort_list_new_link() for a description of ``data'' and ``size''.  It returns
+ * NULL if there is an error and the error is in srt->sortError.
  *
  * [EndDoc]
  */
     {
-        register int status;
-        register nsort_link_t *link;
-        nsort_link_t *midpoint = 0;
-        int linkCount;
-        register nsort_node_t *node;
-        nsort_node_t *midnode = 0;
-        nsort_node_t *oldLevel[NSORT_NODE_LEVEL];
-        register int nodeCount = 0;
-        int i;
-#ifdef NSORT_STATS
-        double t1, t2;
-#endif
-
-        if (srt->numCompares > NSORT_CRIT_THRESH) {
-            srt->thresh = 0;
-            status = nsort_restructure_nodes(srt);
-            if (status == _ERROR_)
-                return _ERROR_;
-        }
-        else if (srt->numCompares > NSORT_OUTPOINT_THRESH) {
-            ++srt->thresh;
-            if (srt->thresh > NSORT_RSTRUCT_THRESH) {
-                srt->thresh = 0;
-                status = nsort_restructure_nodes(srt);
-                if (status == _ERROR_)
-                    return _ERROR_;
-            }
-        }
-        srt->numCompares = 0;
-#ifdef NSORT_STATS
-        srt->traversal_time = 0.0;
-#endif
-        if (srt->head->next == srt->tail) {
-            if (srt->lh->head->next == srt->lh->tail) {
-                srt->lh->current = srt->lh->head;
-                nsort_list_insert_link(srt->lh, lnk);
-                return _OK_;
-            }
-            status = srt->compare(lnk->data, srt->lh->head->next->data);
-            srt->numCompares++;
-            if (status < 0) {
-                srt->lh->current = srt->lh->head;
-                nsort_list_insert_link(srt->lh, lnk);
-                return _OK_;
-            }
-            if (status == 0) {
-                if (srt->isUnique) {
-                    srt->sortError = SORT_UNIQUE;
-                    return _ERROR_;
-                }
-                link = srt->lh->head->next;
-                if (link->next->data != 0) {
-                    status = srt->compare(lnk->data, link->next->data);
-                    srt->numCompares++;
-                }
-                while (status == 0 && link->next != srt->lh->tail) {
-                    link = link->next;
-                    if (link->next->data == 0)
-                        break;
-                    status = srt->compare(lnk->data, link->next->data);
-                    srt->numCompares++;
-                }
-                srt->lh->current = link;
-                nsort_list_insert_link(srt->lh, lnk);
-                return _OK_;
-            }
-            status = srt->compare(lnk->data, srt->lh->tail->prev->data);
-            srt->numCompares++;
-            if (status >= 0) {
-                srt->lh->current = srt->lh->tail->prev;
-                nsort_list_insert_link(srt->lh, lnk);
-                return _OK_;
-            }
-            link = srt->lh->head->next;
-            linkCount = 1;
-            while (link != srt->lh->tail) {
-                if (linkCount == NSORT_MIDPOINT) {
-                    midpoint = link;
-                }
-                if (linkCount == NSORT_OUTPOINT) {
-                    status =
-                        nsort_new_node(srt, srt->head, srt->tail,
-                                       midpoint);
-                    if (status == _ERROR_)
-                        return _ERROR_;
-                    // BUGBUG
-                    // I am adding this to fix a persnickity bug that rears it's head only on very
-                    // rare occasions.  This is a kludge that I will remove when I have found the bug
-                    // and squashed it.
-                    /*if (nsort_restructure_nodes (srt) == _ERROR_)
-                     * return _ERROR_; */
-                    // BUGBUG
-                }
-                status = srt->compare(lnk->data, link->data);
-                srt->numCompares++;
-                if (status < 0) {
-                    srt->lh->current = link->prev;
-                    nsort_list_insert_link(srt->lh, lnk);
-                    return _OK_;
-                }
-                link = link->next;
-                linkCount++;
-            }
-            srt->sortError = SORT_CORRUPT;
-            return _ERROR_;
-        }
-        status = srt->compare(lnk->data, srt->lh->head->next->data);
-        srt->numCompares++;
-        if (status < 0) {
-            srt->current = srt->head->next;
-            srt->lh->current = srt->lh->head;
-            nsort_list_insert_link(srt->lh, lnk);
-            return _OK_;
-        }
-        if (status == 0 && srt->isUnique == TRUE) {
-            srt->sortError = SORT_UNIQUE;
-            return _ERROR_;
-        }
-        if (status == 0) {
-            srt->current = srt->head->next;
-            link = srt->lh->head->next;
-            srt->lh->current = link;
-            nsort_list_insert_link(srt->lh, lnk);
-            return _OK_;
-        }
-        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
-        srt->numCompares++;
-        if (status == 0 && srt->isUnique == TRUE) {
-            srt->sortError = SORT_UNIQUE;
-            return _ERROR_;
-        }
-        if (status >= 0) {
-            srt->current = srt->tail->prev;
-            srt->lh->current = srt->lh->tail->prev;
-            nsort_list_insert_link(srt->lh, lnk);
-            return _OK_;
-        }
-#ifdef NSORT_STATS
-        nsort_elapsed(&t1);
-#endif
+        nsort_link_t *lnk;
 
-        node = srt->head->next;
-        while (node->level[NSORT_NODE_LEVEL - 1] != srt->tail) {
-            status =
-                srt->compare(lnk->data,
-                             node->level[NSORT_NODE_LEVEL -
-                                         1]->here->data);
-            srt->numCompares++;
-            if (status == 0 && srt->isUnique == TRUE) {
-                srt->sortError = SORT_UNIQUE;
-                return _ERROR_;
-            }
-            if (status <= 0)
-                break;
-            node = node->level[NSORT_NODE_LEVEL - 1];
-        }
-        for (i = NSORT_NODE_LEVEL - 2; i >= 0; i--) {
-            nodeCount = 0;
-            oldLevel[i + 1] = node;
-            while (node->level[i] != srt->tail) {
-                status =
-                    srt->compare(lnk->data, node->level[i]->here->data);
-                srt->numCompares++;
-                if (status == 0 && srt->isUnique == TRUE) {
-                    srt->sortError = SORT_UNIQUE;
-                    return _ERROR_;
-                }
-                if (status <= 0)
-                    break;
-                node = node->level[i];
-                if (node == node->level[i]) {
-                    srt->sortError = SORT_CORRUPT;
-                    return _ERROR_;
-                }
-                nodeCount++;
-                if (nodeCount == NSORT_MIDPOINT)
-                    midnode = node;
-                if (nodeCount == NSORT_OUTPOINT) {
-                    midnode->level[i + 1] = oldLevel[i + 1]->level[i + 1];
-                    oldLevel[i + 1]->level[i + 1] = midnode;
-                }
-            }
-        }
-#ifdef NSORT_STATS
-        nsort_elapsed(&t2);
-        srt->traversal_time += (t2 - t1);
-        nsort_elapsed(&t1);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
 #endif
-        nodeCount = 0;
-        oldLevel[0] = node;
-        while (node != srt->tail) {
-            status = srt->compare(lnk->data, node->here->data);
-            srt->numCompares++;
-            if (status == 0 && srt->isUnique == TRUE) {
-                srt->sortError = SORT_UNIQUE;
-                return _ERROR_;
-            }
-            if (status <= 0) {
-                goto insertNode;
-            }
-            if (node == node->next) {
-                srt->sortError = SORT_CORRUPT;
-                return _ERROR_;
-            }
-            node = node->next;
-            nodeCount++;
-            if (nodeCount == NSORT_MIDPOINT)
-                midnode = node;
-            if (nodeCount == NSORT_OUTPOINT) {
-                midnode->level[0] = oldLevel[0]->level[0];
-                oldLevel[0]->level[0] = midnode;
-            }
+        lnk = nsort_list_new_link(srt->lh, data, size);
+        if (lnk == 0) {
+            srt->sortError = srt->lh->listError;
+            srt->lh->listError = SORT_NOERROR;
         }
-
-      insertNode:
-
-#ifdef NSORT_STATS
-        nsort_elapsed(&t2);
-        srt->traversal_time += (t2 - t1);
-        nsort_elapsed(&t1);
-#endif
-
-        if (node->prev == srt->head)
-            link = srt->lh->head->next;
-        else
-            link = node->prev->here;
-        linkCount = 0;
-        while (link != srt->lh->tail) {
-            if (linkCount == NSORT_MIDPOINT) {
-                midpoint = link;
-            }
-            if (linkCount == NSORT_OUTPOINT) {
-                linkCount = 0;
-                status = nsort_new_node(srt, node->prev, node, midpoint);
-                if (status == _ERROR_)
-                    return _ERROR_;
-            }
-            status = srt->compare(lnk->data, link->data);
-            srt->numCompares++;
-            if (status == 0 && srt->isUnique == TRUE) {
-                srt->sortError = SORT_UNIQUE;
-                return _ERROR_;
-            }
-            if (status <= 0) {
-                srt->current = node->prev;
-                srt->lh->current = link->prev;
-                nsort_list_insert_link(srt->lh, lnk);
-#ifdef NSORT_STATS
-                nsort_elapsed(&t2);
-                srt->traversal_time += (t2 - t1);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
 #endif
-                return _OK_;
-            }
-            if (link == link->next) {
-                srt->sortError = SORT_CORRUPT;
-                return _ERROR_;
-            }
-            link = link->next;
-            linkCount++;
-        }
-        srt->sortError = SORT_CORRUPT;
-        return _ERROR_;
+        return lnk;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_restructure_nodes}
- * \index{nsort_restructure_nodes}
+ * \subsubsection{nsort_free_link}
+ * \index{nsort_free_link}
  *
  * [Verbatim] */
 
-    int nsort_restructure_nodes(nsort_t * srt)
+    int nsort_free_link(nsort_t * srt, nsort_link_t * lnk, size_t size)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_restructure_nodes() function rebuilds the indexing that is
- * maintained in the ``srt'' object.  This probably does not need to be
- * called by applications, because the nsort routines calls this function
- * as necessary to keep the indexing optimal.  As items are added to an
- * nsort object, they are added in a way that can produce indexing that is
- * suboptimal.  This is specially true if the items that are added are
- * random.\footnote{You will get much better results from the nsort sort
- * routines if you can add items to it that are \emph{almost} ordered rather
- * than randomly ordered items.}  However, statistical data
- * is maintained in the sort
- * object and when a certain threshold has been met a certain number of times,
- * the nsort_restructure_nodes() function is called to rebuild the indexing.
- *
- * This function returns _OK_ on success.  If an error occurs, it will return
- * _ERROR_ and you can use nsort_show_sort_error() to get a description of the
- * error.  If an error occurs here, all further use of the nsort routines on
- * the ``srt'' sort object should be abandoned.
+ * The nsort_free_link() function frees a link that was allocated with
+ * nsort_new_link() but was not added to the sort object, usually because
+ * nsort_add_item() returned SORT_UNIQUE.  It calls nsort_list_free_link() on
+ * srt->lh.
  *
  * [EndDoc]
  */
     {
-        nsort_node_t *node, *nextNode, *oldLNode;
-        nsort_link_t *lnk;
-        int thisNumber = NSORT_RESTRUCT;
         int status;
-        int i;
-        int counter, ctr_lvl[NSORT_NODE_LEVEL];
 
-        for (i = 0; i < NSORT_NODE_LEVEL; i++)
-            ctr_lvl[i] = 0;
-        /* step 1 - remove nodes (if exist) */
-        if (srt->head->next != srt->tail) {
-            node = srt->head->next;
-            nextNode = node->next;
-            while (TRUE) {
-                free(node);
-                if (nextNode == srt->tail)
-                    break;
-                node = nextNode;
-                nextNode = node->next;
-            }
-        }
-        srt->head->prev = 0;
-        srt->head->next = srt->tail;
-        srt->tail->prev = srt->head;
-        srt->tail->next = 0;
-        srt->current = srt->head;
-        srt->numNodes = 0;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
+#endif
+        status = nsort_list_free_link(srt->lh, lnk, size);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
+#endif
+        return status;
+    }
 
-        /* step 2 - rebuild nodes (if necessary) */
-        if (srt->lh->number < (size_t) thisNumber)
-            return _OK_;
-        lnk = srt->lh->head->next;
-        status = nsort_new_node(srt, srt->head, srt->tail, lnk);
-        if (_ERROR_ == status) {
+/*
+ * Allocate a node with room for ``height'' levels.  Nodes come from the
+ * arena of the sort if it has one.  Released nodes are kept on a stack for
+ * each height in the arena (linked through node->next) and reused.
+ */
+    static nsort_node_t *nsort_alloc_node(nsort_t * srt, int height) {
+        nsort_arena_t *ar = srt->lh->arena;
+        nsort_node_t *node;
+
+        if (ar == 0)
+            node = (nsort_node_t *) malloc(NSORT_NODE_SIZE(height));
+        else if (ar->freeNodes[height] != 0) {
+            node = (nsort_node_t *) ar->freeNodes[height];
+            ar->freeNodes[height] = node->next;
+        }
+        else {
+            node = (nsort_node_t *) nsort_arena_alloc(ar,
+                                                      NSORT_NODE_SIZE(height));
+            if (node == 0)
+                set_sortError(SORT_NOERROR);
+        }
+        if (node != 0) {
+            node->height = height;
+            node->count = 0;
+            memset((void *) (node->level + height), 0, (size_t) height * sizeof(size_t));
+        }
+        return node;
+    }
+
+/*
+ * Free (or give back to the arena) every node between srt->head and
+ * srt->tail.  The sentinels are left alone.
+ */
+    static void nsort_release_nodes(nsort_t * srt) {
+        nsort_free_chain(srt, srt->head->next);
+    }
+
+/*
+ * Free (or give back to the arena) a chain of nodes, from ``node'' up to
+ * srt->tail.
+ */
+    static void nsort_free_chain(nsort_t * srt, nsort_node_t * node) {
+        nsort_node_t *nextNode;
+
+        while (node != srt->tail) {
+            nextNode = node->next;
+            nsort_free_node(srt, node);
+            node = nextNode;
+        }
+    }
+
+/*
+ * Free (or give back to the arena) one node.  The finger of nsort_add_item()
+ * could be on it, so it is dropped.
+ */
+    static void nsort_free_node(nsort_t * srt, nsort_node_t * node) {
+        nsort_arena_t *ar = srt->lh->arena;
+
+        srt->finger[0] = 0;
+        if (ar != 0) {
+            node->next = (nsort_node_t *) ar->freeNodes[node->height];
+            ar->freeNodes[node->height] = node;
+        }
+        else
+            free(node);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ *
+ * The first node is on every level.  The node that is put between
+ * ``prevNode'' and ``nextNode'' is on no level yet.  It has room to be moved
+ * up to the first level, and one in every geometry.fanout of them has room for
+ * one more, one in every geometry.fanout of those for one more and so on, so
+ * that nsort_add_item() has nodes it can move up to each level.  If it would
+ * come before the first node, the first node is moved to ``here'' instead and
+ * the new node put after it, on the link the first node was on.  Either way,
+ * srt->current is left on the node before ``nextNode''.  The counts (and the
+ * spans of the first node, if it moves) are split at ``here'', which is found
+ * by walking the links from the here of ``prevNode''.
+ */
+    int nsort_new_node(nsort_t * srt, nsort_node_t * prevNode,
+                       nsort_node_t * nextNode, nsort_link_t * here) {
+        nsort_node_t *newNode;
+        nsort_link_t *link;
+        size_t num = srt->numNodes + 1, dist = 0;
+        int i, height = 1;
+
+        if (prevNode == srt->head && nextNode == srt->tail)
+            height = NSORT_NODE_LEVEL;
+        else
+            for (; height < srt->geometry.levels &&
+                 num % (size_t)srt->geometry.fanout == 0; height++)
+                num /= (size_t)srt->geometry.fanout;
+        newNode = nsort_alloc_node(srt, height);
+        if (newNode == 0) {
+            srt->sortError = SORT_NOMEMORY;
             return _ERROR_;
         }
-        while (lnk != srt->lh->tail) {
-            for (counter = 0; counter < thisNumber && lnk != srt->lh->tail;
-                 counter++, lnk = lnk->next) ;
-            if (lnk == srt->lh->tail)
-                break;
-            status = nsort_new_node(srt, srt->tail->prev, srt->tail, lnk);
-            if (_ERROR_ == status) {
-                return _ERROR_;
-            }
+        for (i = 0; i < newNode->height; i++)
+            newNode->level[i] = srt->tail;
+        link = (prevNode == srt->head) ? srt->lh->head->next : prevNode->here;
+        for (; link != here; link = link->next)
+            dist++;
+        if (prevNode == srt->head && nextNode != srt->tail) {
+            /* nextNode is the first node; it keeps its levels */
+            NSORT_SET_HERE(srt, newNode, nextNode->here);
+            NSORT_SET_HERE(srt, nextNode, here);
+            for (i = 0; i < NSORT_NODE_LEVEL; i++)
+                if (nextNode->level[i] != srt->tail)
+                    NSORT_SPAN(nextNode, i) += srt->preCount - dist;
+            newNode->count = nextNode->count;
+            nextNode->count = srt->preCount - dist;
+            srt->preCount = dist;
+            prevNode = nextNode;
+            nextNode = nextNode->next;
+            srt->current = prevNode;
         }
-        /* step 3 - rebuild indexes */
-        /* traverse the nodes first, building the first high-order index */
-        if (srt->numNodes > (size_t) thisNumber) {
-            node = srt->head->next;
-            oldLNode = node;
-            while (node != srt->tail) {
-                for (counter = 0;
-                     counter < thisNumber && node != srt->tail;
-                     counter++, node = node->next) ;
-                if (node == srt->tail)
-                    break;
-                oldLNode->level[0] = node;
-                oldLNode = node;
-                ctr_lvl[0]++;
-            }
-        }
-        /* Then, traverse subsequent high-order index levels */
-        for (i = 0; i < NSORT_NODE_LEVEL - 1; i++) {
-            if (ctr_lvl[i] > thisNumber) {
-                node = srt->head->next;
-                oldLNode = node;
-                while (node != srt->tail) {
-                    for (counter = 0;
-                         counter < thisNumber && node != srt->tail;
-                         counter++, node = node->level[i]) ;
-                    if (node == srt->tail)
-                        break;
-                    oldLNode->level[i + 1] = node;
-                    oldLNode = node;
-                    ctr_lvl[i + 1]++;
-                }
+        else {
+            if (prevNode == srt->head)
+                srt->preCount = dist;
+            else {
+                newNode->count = prevNode->count - dist;
+                prevNode->count = dist;
             }
+            NSORT_SET_HERE(srt, newNode, here);
+            srt->current = newNode;
         }
-        srt->numRestruct++;
+        newNode->prev = prevNode;
+        newNode->next = nextNode;
+        prevNode->next = newNode;
+        nextNode->prev = newNode;
+        srt->numNodes++;
         return _OK_;
     }
 
-/*
- * [BeginDoc]
- *
- * \subsubsection{nsort_find_item}
- * \index{nsort_find_item}
- *
- * [Verbatim] */
 
-    nsort_link_t *nsort_find_item(nsort_t * srt, nsort_link_t * lnk)
-/* [EndDoc] */
+#define NSORT_RSTRUCT_THRESH 10
+#define NSORT_OUTPOINT_THRESH (6*(NSORT_NODE_LEVEL*NSORT_OUTPOINT))
+#define NSORT_CRIT_THRESH (500*(NSORT_NODE_LEVEL*NSORT_OUTPOINT))
+
 /*
- * [BeginDoc]
- *
- * The nsort_find_item() function finds the first item that is ``equal to''
- * the lnk->data object.\footnote{Equality here is determined by the compare
- * function.  If the compare function returns 0, the items are equal.}
- * The return value is a pointer to an nsort_link_t item.  Basically, this
- * is done so you can find a particular item and then traverse forward or
- * backward in the list from there.  If nsort_find_item() doesn't find an
- * object that is equal to the one being searched for, then it returns NULL.
- * This function also returns NULL if there is an error condition, so if you
- * get a NULL return value, make sure srt->sortError doesn't reflect an error
- * condition.  Note that ``error condition'' means that srt->sortError is
- * greater than 0 (SORT_NOERROR).
- *
- * [EndDoc]
+ * The auto-tuning measures NSORT_TUNE_OPS operations after each rebuild and
+ * sets the thresholds to these multiples of the compares they took.  With
+ * the default geometry these come out close to the defaults above.
  */
-    {
-        int status = 0;
-        register nsort_link_t *link;
-        register nsort_node_t *node;
-        int i;
-#ifdef NSORT_STATS
-        double t1, t2;
+#define NSORT_TUNE_OPS 1024
+#define NSORT_TUNE_OUT 20
+#define NSORT_TUNE_CRIT 2000
+#define NSORT_TUNE_MUL(n, f) \
+    (((n) > (size_t) -1 / (f)) ? (size_t) -1 : (n) * (f))
+
+#ifndef NSORT_RESTRUCT_BUDGET
+#define NSORT_RESTRUCT_BUDGET 64
 #endif
 
-        if (srt->numCompares > NSORT_CRIT_THRESH) {
-            srt->thresh = 0;
-            status = nsort_restructure_nodes(srt);
-            if (status == _ERROR_)
-                return 0;
-        }
-        else if (srt->numCompares > NSORT_OUTPOINT_THRESH) {
-            ++srt->thresh;
-            if (srt->thresh > NSORT_RSTRUCT_THRESH) {
-                srt->thresh = 0;
-                status = nsort_restructure_nodes(srt);
-                if (status == _ERROR_)
-                    return 0;
+/*
+ * Check the restructure thresholds.  Once they are crossed, a new index is
+ * built a step at a time by the operations that follow, each one doing
+ * NSORT_RESTRUCT_BUDGET links worth of work plus as many as it just spent
+ * compares, so an operation that paid for a bad index also speeds up its
+ * repair.  Nothing is ever rebuilt all at once here.
+ */
+    static int nsort_restructure_check(nsort_t * srt) {
+        nsort_geometry_t *geo = &srt->geometry;
+        int start = FALSE;
+
+        if (geo->autoTune) {
+            if (srt->tuneOps < NSORT_TUNE_OPS && srt->rebuild == 0) {
+                srt->tuneOps++;
+                srt->tuneCompares += srt->numCompares;
+            }
+            if (srt->lh->number > srt->tuneNext &&
+                geo->levels < NSORT_NODE_LEVEL) {
+                /* the new level is filled in as items are added */
+                geo->levels++;
+                srt->tuneNext = NSORT_TUNE_MUL(srt->tuneNext,
+                                               (size_t) geo->fanout);
             }
         }
-        srt->numCompares = 0;
-#ifdef NSORT_STATS
-        srt->traversal_time = 0.0;
-        nsort_elapsed(&t1);
+        if (srt->numCompares > geo->critThresh)
+            start = TRUE;
+        else if (srt->numCompares > geo->outThresh)
+            if (++srt->thresh > geo->restructThresh)
+                start = TRUE;
+        if (start)
+            srt->thresh = 0;
+        if (!start && srt->rebuild == 0)
+            return _OK_;
+        if (nsort_rebuild_step(srt, NSORT_RESTRUCT_BUDGET + srt->numCompares)
+            == _ERROR_)
+            return _ERROR_;
+        return _OK_;
+    }
+
+/*
+ * Work out the geometry of a sort that is auto-tuned, just before its index
+ * is rebuilt.  There are enough levels that the top one has no more than
+ * fanout nodes.  The measurement of the operations after the rebuild starts
+ * over.
+ */
+    static void nsort_auto_tune(nsort_t * srt) {
+        nsort_geometry_t *geo = &srt->geometry;
+        size_t fanout = (size_t) geo->fanout, top, base;
+
+        top = srt->lh->number / fanout / fanout;
+        srt->tuneNext = NSORT_TUNE_MUL(NSORT_TUNE_MUL(fanout, fanout), fanout);
+        for (geo->levels = 1; geo->levels < NSORT_NODE_LEVEL && top > fanout;
+             geo->levels++) {
+            top /= fanout;
+            srt->tuneNext = NSORT_TUNE_MUL(srt->tuneNext, fanout);
+        }
+        geo->midpoint = geo->fanout + 1;
+        geo->outpoint = 2 * geo->fanout;
+        if (srt->tuneOps != 0)
+            base = srt->tuneCompares / srt->tuneOps;
+        else
+            base = (size_t) geo->levels * fanout;
+        if (base < fanout)
+            base = fanout;
+        geo->outThresh = NSORT_TUNE_OUT * base;
+        geo->critThresh = NSORT_TUNE_CRIT * base;
+        srt->tuneOps = 0;
+        srt->tuneCompares = 0;
+    }
+
+/*
+ * Do up to ``budget'' links (or nodes) worth of a step at a time rebuild,
+ * starting one if none is under way.  The new index is built on
+ * srt->rebuild->head by nsort_rebuild_add(), the same way
+ * nsort_build_index() builds one all at once.  The links are only read, so
+ * the index in use is good the whole time.  When the cursor reaches the end
+ * of the list, the new index is swapped in and the nodes of the old one are
+ * freed by later steps.  Returns TRUE if there is more to do, FALSE when the
+ * rebuild is finished or _ERROR_.
+ */
+    static int nsort_rebuild_step(nsort_t * srt, size_t budget) {
+        nsort_rebuild_t *rb = srt->rebuild;
+        nsort_node_t *node, *old;
+
+        if (rb == 0) {
+            rb = (nsort_rebuild_t *) malloc(sizeof(nsort_rebuild_t));
+            if (rb == 0) {
+                srt->sortError = SORT_NOMEMORY;
+                return _ERROR_;
+            }
+            memset(rb, 0, sizeof(nsort_rebuild_t));
+            rb->head.next = srt->tail;
+            rb->last = &rb->head;
+            rb->cursor = srt->lh->head->next;
+            srt->rebuild = rb;
+            if (srt->geometry.autoTune)
+                nsort_auto_tune(srt);
+        }
+        while (budget > 0) {
+            budget--;
+            if (rb->oldNodes != 0) {
+                node = rb->oldNodes;
+                rb->oldNodes = (node->next == srt->tail) ? 0 : node->next;
+                nsort_free_node(srt, node);
+                continue;
+            }
+            if (rb->cursor == 0)
+                break;
+            if (rb->cursor == srt->lh->tail) {
+                /* all of the links are covered; swap the new index in */
+#ifdef HAVE_PTHREAD_H
+                if (srt->sync != 0)
+                    pthread_rwlock_wrlock(&srt->sync->lock);
 #endif
-        if (srt->head->next == srt->tail) {
-            link = srt->lh->head->next;
-            while (link != srt->lh->tail) {
-                status = srt->compare(lnk->data, link->data);
-                srt->numCompares++;
-                if (status == 0) {
-                    srt->lh->current = link;
-#ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
+                old = srt->head->next;
+                srt->head->next = rb->head.next;
+                if (rb->head.next != srt->tail)
+                    rb->head.next->prev = srt->head;
+                srt->tail->prev = (rb->last == &rb->head) ? srt->head : rb->last;
+                srt->numNodes = rb->numNodes;
+                srt->preCount = rb->preCount;
+                srt->current = srt->head;
+                srt->finger[0] = 0;
+                srt->numRestruct++;
+#ifdef HAVE_PTHREAD_H
+                if (srt->sync != 0)
+                    pthread_rwlock_unlock(&srt->sync->lock);
 #endif
-                    return link;
-                }
-                link = link->next;
+                rb->head.next = srt->tail;
+                rb->oldNodes = (old == srt->tail) ? 0 : old;
+                rb->cursor = 0;
+                continue;
             }
-            return 0;
+            if (nsort_rebuild_add(srt, rb, rb->cursor) == _ERROR_) {
+                nsort_rebuild_cancel(srt);
+                return _ERROR_;
+            }
+            rb->cursor = rb->cursor->next;
         }
-        status = srt->compare(lnk->data, srt->lh->head->next->data);
-        srt->numCompares++;
-        if (status == 0) {
-            srt->current = srt->head->next;
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return srt->lh->head->next;
+        if (rb->cursor == 0 && rb->oldNodes == 0) {
+            free(rb);
+            srt->rebuild = 0;
+            return FALSE;
         }
-        if (status < 0) {
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return 0;
+        return TRUE;
+    }
+
+/*
+ * Add ``lnk'', the next link of the list, to the index being built on
+ * rb->head.  There is a node on the first link and on every fanout links
+ * after it, and every fanout nodes on a level go up a level, up to the
+ * number of levels in the geometry of the sort.  The
+ * node is allocated with room for the levels it is on plus one, except the
+ * first, which is on all of them.  The span a node is given on a level is
+ * added up from the ones on the level below (or the counts) it passes over.
+ */
+    static int nsort_rebuild_add(nsort_t * srt, nsort_rebuild_t * rb,
+                                 nsort_link_t * lnk) {
+        nsort_node_t *node, *prev;
+        size_t fanout = (size_t) srt->geometry.fanout, span;
+        int levels = srt->geometry.levels;
+        int i, height;
+
+        if (rb->last != &rb->head && rb->linkCount < fanout) {
+            rb->linkCount++;
+            return _OK_;
         }
-        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
-        srt->numCompares++;
-        if (status == 0) {
-            link = srt->lh->tail->prev;
-            while (link != srt->lh->head) {
-                status = srt->compare(lnk->data, link->data);
-                srt->numCompares++;
-                if (status != 0)
+        if (rb->last == &rb->head)
+            height = NSORT_NODE_LEVEL;
+        else {
+            for (height = 0; height < levels; height++)
+                if ((size_t) rb->count[height] + 1 < fanout)
                     break;
-                link = link->prev;
+            if (height < NSORT_NODE_LEVEL)
+                height++;
+        }
+        node = nsort_alloc_node(srt, height);
+        if (node == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        node->prev = rb->last;
+        node->next = srt->tail;
+        NSORT_SET_HERE(srt, node, lnk);
+        for (i = 0; i < height; i++)
+            node->level[i] = srt->tail;
+        if (rb->last == &rb->head) {
+            for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+                rb->lastLevel[i] = node;
+                rb->count[i] = 0;
             }
-            srt->current = srt->tail->prev;
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return link->next;
         }
-        if (status > 0)
-            return 0;
-        node = srt->head->next;
-        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
-            while (node->level[i] != srt->tail) {
-                status =
-                    srt->compare(lnk->data, node->level[i]->here->data);
-                srt->numCompares++;
-                if (status <= 0)
+        else {
+            rb->last->count = rb->linkCount;
+            rb->last->next = node;
+            for (i = 0; i < levels; i++) {
+                if ((size_t)++rb->count[i] < fanout)
                     break;
-                node = node->level[i];
+                rb->count[i] = 0;
+                span = 0;
+                for (prev = rb->lastLevel[i]; prev != node;
+                     prev = (i == 0) ? prev->next : prev->level[i - 1])
+                    span += (i == 0) ? prev->count : NSORT_SPAN(prev, i - 1);
+                NSORT_SPAN(rb->lastLevel[i], i) = span;
+                rb->lastLevel[i]->level[i] = node;
+                rb->lastLevel[i] = node;
             }
         }
-        // BUGBUG
-        status = srt->compare(lnk->data, node->here->data);
-        srt->numCompares++;
-        if (status <= 0) {
-            if (node->prev == srt->head)
-                link = srt->lh->head->next;
-            else
-                link = node->prev->here;
-            while (link != node->here) {
-                status = srt->compare(lnk->data, link->data);
-                if (status == 0) {
-                    srt->current = node->prev;
-                    srt->lh->current = link;
-                    return link;
-                }
-                if (status < 0)
-                    return 0;
-                link = link->next;
+        rb->linkCount = 1;
+        rb->last->next = node;
+        rb->last = node;
+        rb->numNodes++;
+        return _OK_;
+    }
+
+/*
+ * Drop a step at a time rebuild, freeing whatever it had allocated.
+ */
+    static void nsort_rebuild_cancel(nsort_t * srt) {
+        nsort_rebuild_t *rb = srt->rebuild;
+
+        if (rb == 0)
+            return;
+        nsort_free_chain(srt, rb->head.next);
+        if (rb->oldNodes != 0)
+            nsort_free_chain(srt, rb->oldNodes);
+        free(rb);
+        srt->rebuild = 0;
+    }
+
+/*
+ * Where the count of ``node'' is kept in the index of ``rb'' (or in the index
+ * in use if rb is NULL), or NULL if it isn't kept.  For the head it is the
+ * number of links before the first node, and for the last node of an index
+ * being built it is the number of links up to the cursor.
+ */
+    static size_t *nsort_count_of(nsort_t * srt, nsort_rebuild_t * rb,
+                                  nsort_node_t * node) {
+        if (rb != 0) {
+            if (node == &rb->head)
+                return &rb->preCount;
+            if (node == rb->last)
+                return &rb->linkCount;
+        }
+        else if (node == srt->head)
+            return &srt->preCount;
+        if (node->next == srt->tail)
+            return 0;
+        return &node->count;
+    }
+
+/*
+ * Count a link that is put in (``add'' TRUE) or taken out of the list right
+ * after the here of ``node'', in the index of ``rb'' (or the one in use if
+ * rb is NULL).  cover[i] is the last node on level i that is not after node,
+ * or the head if there is none.
+ */
+    static void nsort_count_link(nsort_t * srt, nsort_rebuild_t * rb,
+                                 nsort_node_t * node, nsort_node_t ** cover,
+                                 int add) {
+        nsort_node_t *head = (rb != 0) ? &rb->head : srt->head;
+        size_t *cnt = nsort_count_of(srt, rb, node);
+        int i;
+
+        if (cnt != 0)
+            *cnt = add ? *cnt + 1 : *cnt - 1;
+        for (i = 0; i < NSORT_NODE_LEVEL; i++)
+            if (cover[i] != head && cover[i]->level[i] != srt->tail) {
+                if (add)
+                    NSORT_SPAN(cover[i], i)++;
+                else
+                    NSORT_SPAN(cover[i], i)--;
             }
+    }
+
+/*
+ * Find ``lnk'', a link of the list, in the index hanging off of ``head'',
+ * which must have nodes.  *prevp is set to the last node on a link before
+ * lnk (head if there is none) and cover[i] to the last node on level i that
+ * is not after it (head if there is none).  These are the nodes whose counts
+ * and spans take lnk in.  The descent keeps to nodes that are strictly less
+ * than lnk; from there the links are walked up to lnk, to get past the
+ * nodes on links equal to it.  Returns the node on lnk, or NULL.
+ */
+    static nsort_node_t *nsort_locate_link(nsort_t * srt,
+                                           nsort_node_t * head,
+                                           nsort_link_t * lnk,
+                                           nsort_node_t ** cover,
+                                           nsort_node_t ** prevp) {
+        nsort_node_t *node = head->next, *next;
+        nsort_link_t *link;
+        unsigned long pfx = NSORT_PREFIX(srt, lnk->data);
+        int i;
+
+        if (NSORT_NODE_CMP(srt, lnk->data, pfx, node) <= 0) {
+            for (i = 0; i < NSORT_NODE_LEVEL; i++)
+                cover[i] = head;
+            *prevp = head;
+            link = srt->lh->head->next;
         }
-        // BUGBUG
-        while (node->next != srt->tail) {
-            status = srt->compare(lnk->data, node->next->here->data);
-            srt->numCompares++;
-            if (status <= 0) {
-                link = node->here;
-                if (node == srt->head->next) {
-                    link = srt->lh->head->next;
-                }
-                while (link != node->next->here) {
-                    status = srt->compare(lnk->data, link->data);
-                    srt->numCompares++;
-                    if (status == 0) {
-                        srt->current = node;
-                        srt->lh->current = link;
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return link;
-                    }
-                    if (status < 0) {
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return 0;
-                    }
-                    link = link->next;
-                }
+        else {
+            for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
+                while (node->level[i] != srt->tail &&
+                       NSORT_NODE_CMP(srt, lnk->data, pfx,
+                                      node->level[i]) > 0)
+                    node = node->level[i];
+                cover[i] = node;
             }
+            while (node->next != srt->tail &&
+                   NSORT_NODE_CMP(srt, lnk->data, pfx, node->next) > 0)
+                node = node->next;
+            *prevp = node;
+            link = node->here;
             node = node->next;
         }
-        if (node->next == srt->tail) {
-            link = node->here;
-            while (link != srt->lh->tail) {
-                status = srt->compare(lnk->data, link->data);
-                srt->numCompares++;
-                if (status == 0) {
-                    srt->current = srt->tail->prev;
-                    srt->lh->current = link;
-#ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
-#endif
-                    return link;
+        for (; link != lnk && link != srt->lh->tail; link = link->next) {
+            if (node == srt->tail || link != node->here)
+                continue;
+            for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+                next = (cover[i] == head) ? head->next : cover[i]->level[i];
+                if (next != node)
+                    break;
+                cover[i] = node;
+            }
+            *prevp = node;
+            node = node->next;
+        }
+        return (node != srt->tail && node->here == lnk) ? node : 0;
+    }
+
+/*
+ * TRUE if ``lnk'' comes before ``cursor'' in the list.  The cursor may be
+ * the tail of the list.
+ */
+    static int nsort_link_before(nsort_t * srt, nsort_link_t * lnk,
+                                 nsort_link_t * cursor) {
+        int status;
+
+        if (cursor == srt->lh->tail)
+            return TRUE;
+        status = srt->compare(lnk->data, cursor->data);
+        if (status != 0)
+            return status < 0;
+        for (lnk = lnk->next; lnk != srt->lh->tail; lnk = lnk->next) {
+            if (lnk == cursor)
+                return TRUE;
+            if (srt->compare(lnk->data, cursor->data) != 0)
+                break;
+        }
+        return FALSE;
+    }
+
+/*
+ * Take ``lnk'' out of the index of ``rb'' (or the index in use if rb is
+ * NULL) before it is removed from the list.  The node on it (if there is
+ * one) is moved to the link before, or failing that the link after, unless
+ * there is already a node there, in which case it is unlinked from every
+ * level it is on and freed.  The counts and spans that took lnk in are made
+ * one less, and those of a node that is freed are added to the ones before
+ * it.  The last node of the index and of each level are kept up to date.
+ * Returns TRUE if a node was dropped.
+ */
+    static int nsort_unindex_node(nsort_t * srt, nsort_rebuild_t * rb,
+                                  nsort_link_t * lnk) {
+        nsort_node_t *head = (rb != 0) ? &rb->head : srt->head;
+        nsort_node_t *node, *next, *prev;
+        nsort_node_t *cover[NSORT_NODE_LEVEL];
+        size_t *cnt;
+        int i;
+
+        if (head->next == srt->tail) {
+            if (rb != 0)
+                rb->preCount--;
+            return FALSE;
+        }
+        node = nsort_locate_link(srt, head, lnk, cover, &prev);
+        if (node == 0 || (lnk->prev != srt->lh->head &&
+                          (prev == head || prev->here != lnk->prev))) {
+            /* a node on lnk moves to the link before, in the same counts */
+            nsort_count_link(srt, rb, prev, cover, FALSE);
+            if (node != 0)
+                NSORT_SET_HERE(srt, node, lnk->prev);
+            return FALSE;
+        }
+        next = node->next;
+        if (lnk->next != srt->lh->tail &&
+            ((next != srt->tail && next->here != lnk->next) ||
+             (next == srt->tail && rb == 0))) {
+            for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+                prev = (cover[i] == head) ? head->next : cover[i]->level[i];
+                if (prev != node)
+                    prev = cover[i];
+                if (prev != head && prev->level[i] != srt->tail)
+                    NSORT_SPAN(prev, i)--;
+            }
+            cnt = nsort_count_of(srt, rb, node);
+            if (cnt != 0)
+                (*cnt)--;
+            NSORT_SET_HERE(srt, node, lnk->next);
+            return FALSE;
+        }
+        prev = node->prev;
+        if (prev == head && next != srt->tail) {
+            /*
+             * The first node is on every level and the next one may not have
+             * room for that, so the first node takes its place and the next
+             * one is dropped instead.  lnk is the only link the first node
+             * has.
+             */
+            NSORT_SET_HERE(srt, node, next->here);
+            for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+                if (node->level[i] == next) {
+                    if (next->level[i] != srt->tail)
+                        NSORT_SPAN(node, i) = NSORT_SPAN(next, i);
+                    node->level[i] = next->level[i];
                 }
-                if (status < 0) {
-#ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
-#endif
-                    return 0;
+                else if (node->level[i] != srt->tail)
+                    NSORT_SPAN(node, i)--;
+                if (rb != 0 && rb->lastLevel[i] == next)
+                    rb->lastLevel[i] = node;
+            }
+            if (rb == 0 || next != rb->last)
+                node->count = next->count;
+            prev = node;
+            node = next;
+            next = node->next;
+        }
+        else if (prev != head) {
+            /* lnk is the only link of the node and the one before has one */
+            for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+                if (i < node->height && cover[i]->level[i] == node) {
+                    if (node->level[i] != srt->tail)
+                        NSORT_SPAN(cover[i], i) += NSORT_SPAN(node, i) - 1;
+                    cover[i]->level[i] = node->level[i];
+                    if (rb != 0 && rb->lastLevel[i] == node)
+                        rb->lastLevel[i] = cover[i];
                 }
-                link = link->next;
+                else if (cover[i]->level[i] != srt->tail)
+                    NSORT_SPAN(cover[i], i)--;
             }
+            if (rb != 0 && node == rb->last)
+                rb->linkCount += prev->count - 1;
+            else if (next != srt->tail)
+                prev->count += node->count - 1;
+        }
+        else if (rb != 0)
+            rb->preCount += rb->linkCount - 1;
+        prev->next = next;
+        if (next != srt->tail)
+            next->prev = prev;
+        else if (rb != 0)
+            rb->last = prev;
+        else
+            srt->tail->prev = prev;
+        if (srt->current == node)
+            srt->current = srt->head;
+        nsort_free_node(srt, node);
+        return TRUE;
+    }
+
+/*
+ * Take ``lnk'' out of the index in use and out of the one being built (if
+ * it is before the cursor), so that it can be removed from the list.
+ */
+    static void nsort_unindex_link(nsort_t * srt, nsort_link_t * lnk) {
+        nsort_rebuild_t *rb = srt->rebuild;
+
+        if (nsort_unindex_node(srt, 0, lnk))
+            srt->numNodes--;
+        if (rb == 0 || rb->cursor == 0)
+            return;
+        if (rb->cursor == lnk)
+            rb->cursor = lnk->next;
+        else if (nsort_link_before(srt, lnk, rb->cursor) &&
+                 nsort_unindex_node(srt, rb, lnk))
+            rb->numNodes--;
+    }
+
+/*
+ * Count ``lnk'', which has just been put in the list, in the index being
+ * built if it is before the cursor.
+ */
+    static void nsort_rebuild_count(nsort_t * srt, nsort_link_t * lnk) {
+        nsort_rebuild_t *rb = srt->rebuild;
+        nsort_node_t *cover[NSORT_NODE_LEVEL], *prev;
+
+        if (rb == 0 || rb->cursor == 0 ||
+            !nsort_link_before(srt, lnk, rb->cursor))
+            return;
+        if (rb->head.next == srt->tail) {
+            rb->preCount++;
+            return;
         }
-        return 0;
+        nsort_locate_link(srt, &rb->head, lnk, cover, &prev);
+        nsort_count_link(srt, rb, prev, cover, TRUE);
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_query_item}
- * \index{nsort_query_item}
+ * \subsubsection{nsort_add_item}
+ * \index{nsort_add_item}
  *
  * [Verbatim] */
 
-    nsort_link_t *nsort_query_item(nsort_t * srt, nsort_link_t * lnk)
+    int nsort_add_item(nsort_t * srt, nsort_link_t * lnk)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_query_item() is like nsort_find_item(), except that it only
- * returns a NULL if there is an error.  If it doesn't find an item that
- * is ``equal to'' the lnk->data item, then it returns the link that points
- * the item that would be before lnk->data if it were added to the list.  If
- * NULL is returned, srt->sortError will be set to the error and you can get
- * a description of the error with the nsort_show_sort_error() funciton.
+ * The nsort_add_item() function is the most complex function that is part
+ * of the nsort routines.  It's function is to add the item given by ``lnk''
+ * to the sort object given by ``srt''.  The item will be added in a sorted
+ * manner according to the compare function that was provided in the call
+ * to nsort_init() function.  The complexity of this function arises from the
+ * fact that the indexing must be built in the ``srt'' object as items are
+ * added and that this must be done in the most efficient manner possible.
+ *
+ * While the function definition for this function is complex, using the function
+ * is relatively trivial.  Simply allocate a link (lnk), point it's data member
+ * to the data object you want to add to the srt object, and call nsort_add_item()
+ * with the two parameters.  nsort_add_item() returns _OK_ if it is successful.
+ * Otherwise, _ERROR_ is returned and you can call nsort_show_sort_error() to
+ * get a description of the error.
+ *
+ * The search for where an item goes starts from where the last item was
+ * added and only goes as far up the index as it needs to, so items that come
+ * in nearly sorted order (in either direction) or in clusters take a few
+ * compares each, however big the sort is.  If duplicates are allowed, an
+ * item can go before, after or among the items already in the sort that are
+ * equal to it.
  *
  * [EndDoc]
  */
     {
-        int status;
-        nsort_link_t *link;
-        nsort_node_t *node;
-        int i;
-#ifdef NSORT_STATS
-        double t1, t2;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            return nsort_sync_add_item(srt, lnk);
 #endif
+        return nsort_add_item_nolock(srt, lnk);
+    }
 
-        if (srt->numCompares > NSORT_CRIT_THRESH) {
-            srt->thresh = 0;
-            status = nsort_restructure_nodes(srt);
-            if (status == _ERROR_)
-                return 0;
+/*
+ * Find where the search for ``data'' in nsort_add_item() can start.  The
+ * finger is the node the last add stopped at on the list of nodes and on
+ * each level.  Going up from the list of nodes, the first one with data
+ * between it and the node after it on its level is returned, with ``*level''
+ * set to that level, or -1 if data goes right after finger[0].  The fingers
+ * above it are left where they are, since an item that falls between two
+ * nodes on one level falls between the same nodes on every level above it.
+ * An item near the last one added is found near
+ * the bottom, so it takes a few compares whether the items come in order, in
+ * reverse order or clustered.  If no finger brackets data (or there is none),
+ * the top level is searched as usual and NSORT_NODE_LEVEL - 1 is returned in
+ * ``*level''.  NULL is returned if data is already in a unique sort.
+ *
+ * When the items come in random order, going up costs more compares than
+ * it saves, so after NSORT_FINGER_MISS adds in a row that found their place
+ * within two levels of the top (or above), only one add in NSORT_FINGER_RETRY
+ * tries the finger until one of them is close again (fingerMiss goes from
+ * NSORT_FINGER_MISS + 1 up to NSORT_FINGER_MISS + NSORT_FINGER_RETRY while
+ * the finger is skipped).
+ */
+#ifndef NSORT_FINGER_MISS
+#define NSORT_FINGER_MISS 4
+#endif
+#ifndef NSORT_FINGER_RETRY
+#define NSORT_FINGER_RETRY 64
+#endif
+    static nsort_node_t *nsort_finger_search(nsort_t * srt, void *data,
+                                             unsigned long pfx, int *level) {
+        nsort_node_t *node = srt->finger[0], *next, *right = 0;
+        int status, i, top, below = FALSE;
+
+        *level = NSORT_NODE_LEVEL - 1;
+        if (srt->finger[0] == 0 || srt->fingerMiss > NSORT_FINGER_MISS) {
+            if (srt->fingerMiss > NSORT_FINGER_MISS &&
+                ++srt->fingerMiss >= NSORT_FINGER_MISS + NSORT_FINGER_RETRY)
+                srt->fingerMiss = NSORT_FINGER_MISS;
+            node = srt->head->next;
+            goto topLevel;
         }
-        else if (srt->numCompares > NSORT_OUTPOINT_THRESH) {
-            ++srt->thresh;
-            if (srt->thresh > NSORT_RSTRUCT_THRESH) {
-                srt->thresh = 0;
-                status = nsort_restructure_nodes(srt);
-                if (status == _ERROR_)
-                    return 0;
+        if (node != srt->head && node != srt->tail) {
+            status = NSORT_NODE_CMP(srt, data, pfx, node);
+            srt->numCompares++;
+            if (status == 0 && srt->isUnique == TRUE)
+                goto notUnique;
+            if (status > 0) {
+                next = node->next;
+                if (next != srt->tail) {
+                    status = NSORT_NODE_CMP(srt, data, pfx, next);
+                    srt->numCompares++;
+                    if (status == 0 && srt->isUnique == TRUE)
+                        goto notUnique;
+                }
+                if (next == srt->tail || status <= 0) {
+                    srt->fingerMiss = 0;
+                    *level = -1;
+                    return node;
+                }
+                right = next;
             }
         }
-        srt->numCompares = 0;
-#ifdef NSORT_STATS
-        srt->traversal_time = 0.0;
-        nsort_elapsed(&t1);
-#endif
-        if (srt->head->next == srt->tail) {
-            if (srt->lh->head->next == srt->lh->tail) {
-                srt->sortError = SORT_PARAM;
-                return 0;
+        /*
+         * Each finger is at or after the one above it, so once data is past
+         * one, it is past all of those above it.
+         */
+        for (i = 0; i < NSORT_NODE_LEVEL; i++) {
+            node = srt->finger[i + 1];
+            if (!below) {
+                status = NSORT_NODE_CMP(srt, data, pfx, node);
+                srt->numCompares++;
+                if (status == 0 && srt->isUnique == TRUE)
+                    goto notUnique;
+                if (status <= 0)
+                    continue;
+                below = TRUE;
             }
-            link = srt->lh->head->next;
-            while (link != srt->lh->tail) {
-                status = srt->compare(lnk->data, link->data);
+            next = node->level[i];
+            if (next != srt->tail && next != right) {
+                status = NSORT_NODE_CMP(srt, data, pfx, next);
                 srt->numCompares++;
-                if (status == 0) {
-                    srt->lh->current = link;
-#ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
-#endif
-                    return link;
-                }
-                if (status < 0) {
-                    if (link->prev != srt->lh->head) {
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return link->prev;
-                    }
-                    else {
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return link;
-                    }
-                }
-                link = link->next;
+                if (status == 0 && srt->isUnique == TRUE)
+                    goto notUnique;
+                right = next;
             }
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return srt->lh->tail->prev;
+            else
+                status = (next == srt->tail) ? -1 : 1;
+            if (status <= 0)
+                break;
         }
-        status = srt->compare(lnk->data, srt->lh->head->next->data);
-        srt->numCompares++;
-        if (status == 0) {
-            srt->current = srt->head->next;
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return srt->lh->head->next;
+        for (top = NSORT_NODE_LEVEL - 1; top > 0; top--)
+            if (srt->head->next->level[top] != srt->tail)
+                break;
+        if (i < top - 1)
+            srt->fingerMiss = 0;
+        else
+            srt->fingerMiss++;
+        if (i < NSORT_NODE_LEVEL) {
+            *level = i;
+            return node;
         }
-        if (status < 0) {
+        node = below ? srt->finger[NSORT_NODE_LEVEL] : srt->head->next;
+
+      topLevel:
+        while (node->level[NSORT_NODE_LEVEL - 1] != srt->tail) {
+            NSORT_PREFETCH(node->level[NSORT_NODE_LEVEL - 1]->
+                           level[NSORT_NODE_LEVEL - 1]);
+            status =
+                NSORT_NODE_CMP(srt, data, pfx,
+                               node->level[NSORT_NODE_LEVEL - 1]);
+            srt->numCompares++;
+            if (status == 0 && srt->isUnique == TRUE)
+                goto notUnique;
+            if (status <= 0)
+                break;
+            node = node->level[NSORT_NODE_LEVEL - 1];
+        }
+        srt->finger[NSORT_NODE_LEVEL] = node;
+        return node;
+
+        /* no finger has been moved yet, so they are still good */
+      notUnique:
+        srt->sortError = SORT_UNIQUE;
+        return 0;
+    }
+
+/*
+ * Put ``midnode'', which is ``dist'' links past ``node'', on ``level'' right
+ * after node, splitting the span of node between them.
+ */
+    static void nsort_split_span(nsort_t * srt, nsort_node_t * node,
+                                 nsort_node_t * midnode, int level,
+                                 size_t dist) {
+        if (node->level[level] != srt->tail)
+            NSORT_SPAN(midnode, level) = NSORT_SPAN(node, level) - dist;
+        NSORT_SPAN(node, level) = dist;
+        midnode->level[level] = node->level[level];
+        node->level[level] = midnode;
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static int nsort_add_item_nolock(nsort_t * srt, nsort_link_t * lnk)
+    {
+        if (nsort_insert_item_nolock(srt, lnk) == _ERROR_)
+            return _ERROR_;
+        if (srt->rebuild != 0)
+            nsort_rebuild_count(srt, lnk);
+        return _OK_;
+    }
+
+/*
+ * Put ``lnk'' in the list and the index in use, keeping the counts and
+ * spans of the nodes.  The rest of nsort_add_item_nolock().  Nothing is
+ * added to a count or a span until lnk is in the list, with the fingers
+ * on levels as the covers; moving a node up or adding one only splits
+ * what is already counted, so an add that is turned down leaves the
+ * counts right as long as the fingers are dropped with it.
+ */
+    static int nsort_insert_item_nolock(nsort_t * srt, nsort_link_t * lnk)
+    {
+        register int status;
+        register nsort_link_t *link;
+        nsort_link_t *midpoint = 0;
+        int linkCount;
+        register nsort_node_t *node;
+        nsort_node_t *midnode = 0;
+        nsort_node_t *oldLevel[NSORT_NODE_LEVEL];
+        register int nodeCount = 0;
+        size_t dist, midDist = 0;
+        unsigned long pfx;
+        int i, top;
 #ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
+        double t1, t2;
 #endif
-            return srt->lh->head->next;
+
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            return _ERROR_;
         }
-        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
-        srt->numCompares++;
-        if (status == 0) {
-            if (srt->isUnique) {
+        if (srt->sync == 0 && nsort_restructure_check(srt) == _ERROR_)
+            return _ERROR_;
+        srt->numCompares = 0;
 #ifdef NSORT_STATS
-                nsort_elapsed(&t2);
-                srt->traversal_time += (t2 - t1);
+        srt->traversal_time = 0.0;
 #endif
-                return srt->lh->tail->prev;
+        if (srt->head->next == srt->tail) {
+            if (srt->lh->head->next == srt->lh->tail) {
+                srt->lh->current = srt->lh->head;
+                nsort_list_insert_link(srt->lh, lnk);
+                return _OK_;
             }
-            link = srt->lh->tail->prev;
-            while (link != srt->lh->head) {
+            status = srt->compare(lnk->data, srt->lh->head->next->data);
+            srt->numCompares++;
+            if (status < 0) {
+                srt->lh->current = srt->lh->head;
+                nsort_list_insert_link(srt->lh, lnk);
+                return _OK_;
+            }
+            if (status == 0) {
+                if (srt->isUnique) {
+                    srt->sortError = SORT_UNIQUE;
+                    return _ERROR_;
+                }
+                link = srt->lh->head->next;
+                if (link->next->data != 0) {
+                    status = srt->compare(lnk->data, link->next->data);
+                    srt->numCompares++;
+                }
+                while (status == 0 && link->next != srt->lh->tail) {
+                    link = link->next;
+                    if (link->next->data == 0)
+                        break;
+                    status = srt->compare(lnk->data, link->next->data);
+                    srt->numCompares++;
+                }
+                srt->lh->current = link;
+                nsort_list_insert_link(srt->lh, lnk);
+                return _OK_;
+            }
+            status = srt->compare(lnk->data, srt->lh->tail->prev->data);
+            srt->numCompares++;
+            if (status >= 0) {
+                srt->lh->current = srt->lh->tail->prev;
+                nsort_list_insert_link(srt->lh, lnk);
+                return _OK_;
+            }
+            link = srt->lh->head->next;
+            linkCount = 1;
+            while (link != srt->lh->tail) {
+                if (linkCount == srt->geometry.midpoint) {
+                    midpoint = link;
+                }
+                if (linkCount == srt->geometry.outpoint) {
+                    status =
+                        nsort_new_node(srt, srt->head, srt->tail,
+                                       midpoint);
+                    if (status == _ERROR_)
+                        return _ERROR_;
+                    // BUGBUG
+                    // I am adding this to fix a persnickity bug that rears it's head only on very
+                    // rare occasions.  This is a kludge that I will remove when I have found the bug
+                    // and squashed it.
+                    /*if (nsort_restructure_nodes (srt) == _ERROR_)
+                     * return _ERROR_; */
+                    // BUGBUG
+                }
                 status = srt->compare(lnk->data, link->data);
                 srt->numCompares++;
-                if (status != 0)
-                    break;
-                link = link->prev;
-            }
-            srt->current = srt->tail->prev;
-            if (link->next != srt->lh->tail)
+                if (status < 0) {
+                    srt->lh->current = link->prev;
+                    nsort_list_insert_link(srt->lh, lnk);
+                    return _OK_;
+                }
                 link = link->next;
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return link;
+                linkCount++;
+            }
+            srt->sortError = SORT_CORRUPT;
+            return _ERROR_;
         }
-        if (status > 0) {
+        status = srt->compare(lnk->data, srt->lh->head->next->data);
+        srt->numCompares++;
+        if (status < 0) {
+            srt->current = srt->head->next;
+            srt->lh->current = srt->lh->head;
+            nsort_list_insert_link(srt->lh, lnk);
+            srt->preCount++;
+            return _OK_;
+        }
+        if (status == 0 && srt->isUnique == TRUE) {
+            srt->sortError = SORT_UNIQUE;
+            return _ERROR_;
+        }
+        if (status == 0) {
+            node = srt->head->next;
+            srt->current = node;
+            link = srt->lh->head->next;
+            srt->lh->current = link;
+            nsort_list_insert_link(srt->lh, lnk);
+            if (link != node->here)
+                srt->preCount++;
+            else {
+                if (node->next != srt->tail)
+                    node->count++;
+                for (i = 0; i < NSORT_NODE_LEVEL; i++)
+                    if (node->level[i] != srt->tail)
+                        NSORT_SPAN(node, i)++;
+            }
+            return _OK_;
+        }
+        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
+        srt->numCompares++;
+        if (status == 0 && srt->isUnique == TRUE) {
+            srt->sortError = SORT_UNIQUE;
+            return _ERROR_;
+        }
+        if (status >= 0) {
             srt->current = srt->tail->prev;
+            srt->lh->current = srt->lh->tail->prev;
+            nsort_list_insert_link(srt->lh, lnk);
+            return _OK_;
+        }
 #ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
+        nsort_elapsed(&t1);
 #endif
-            return srt->lh->tail->prev;
+
+        pfx = NSORT_PREFIX(srt, lnk->data);
+        node = nsort_finger_search(srt, lnk->data, pfx, &top);
+        if (node == 0)
+            return _ERROR_;
+        if (top < 0) {
+            /* it goes right after finger[0] */
+            node = node->next;
+            goto insertNode;
         }
-        node = srt->head->next;
-        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
+        /*
+         * The distance (in links) from oldLevel[i + 1] to the node a level
+         * is split at is kept, for the spans of the node that is moved up.
+         */
+        for (i = top - 1; i >= 0; i--) {
+            nodeCount = 0;
+            midnode = 0;
+            dist = 0;
+            oldLevel[i + 1] = node;
             while (node->level[i] != srt->tail) {
-                status =
-                    srt->compare(lnk->data, node->level[i]->here->data);
+                NSORT_PREFETCH(node->level[i]->level[i]);
+                status = NSORT_NODE_CMP(srt, lnk->data, pfx, node->level[i]);
                 srt->numCompares++;
+                if (status == 0 && srt->isUnique == TRUE) {
+                    srt->sortError = SORT_UNIQUE;
+                    goto notAdded;
+                }
                 if (status <= 0)
                     break;
+                dist += NSORT_SPAN(node, i);
                 node = node->level[i];
+                if (node == node->level[i]) {
+                    srt->sortError = SORT_CORRUPT;
+                    goto notAdded;
+                }
+                nodeCount++;
+                /* the first node from the midpoint on that has room */
+                if (nodeCount >= srt->geometry.midpoint && midnode == 0 &&
+                    node->height > i + 1) {
+                    midnode = node;
+                    midDist = dist;
+                }
+                if (nodeCount >= srt->geometry.outpoint && midnode != 0 &&
+                    midnode != srt->head && i + 1 < srt->geometry.levels) {
+                    nsort_split_span(srt, oldLevel[i + 1], midnode, i + 1,
+                                     midDist);
+                    srt->finger[i + 2] = midnode;
+                    midnode = srt->head;        /* one per level */
+                }
             }
+            srt->finger[i + 1] = node;
         }
-        while (node->next != srt->tail) {
-            status = srt->compare(lnk->data, node->next->here->data);
-            srt->numCompares++;
-            if (status <= 0) {
-                link = node->here;
-                if (node == srt->head->next) {
-                    link = srt->lh->head->next;
-                }
-                while (link != node->next->here) {
-                    status = srt->compare(lnk->data, link->data);
-                    srt->numCompares++;
-                    if (status == 0) {
-                        srt->current = node;
-                        srt->lh->current = link;
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return link;
-                    }
-                    if (status < 0) {
-                        srt->current = node;
-                        if (link->prev != srt->lh->head) {
-                            srt->lh->current = link->prev;
-#ifdef NSORT_STATS
-                            nsort_elapsed(&t2);
-                            srt->traversal_time += (t2 - t1);
-#endif
-                            return link->prev;
-                        }
-                        else {
-                            srt->lh->current = link;
 #ifdef NSORT_STATS
-                            nsort_elapsed(&t2);
-                            srt->traversal_time += (t2 - t1);
+        nsort_elapsed(&t2);
+        srt->traversal_time += (t2 - t1);
+        nsort_elapsed(&t1);
 #endif
-                            return link;
-                        }
-                    }
-                    link = link->next;
-                }
+        nodeCount = 0;
+        dist = 0;
+        oldLevel[0] = node;
+        while (node != srt->tail) {
+            NSORT_PREFETCH(node->next);
+            status = NSORT_NODE_CMP(srt, lnk->data, pfx, node);
+            srt->numCompares++;
+            if (status == 0 && srt->isUnique == TRUE) {
+                srt->sortError = SORT_UNIQUE;
+                goto notAdded;
+            }
+            if (status <= 0) {
+                goto insertNode;
             }
+            if (node == node->next) {
+                srt->sortError = SORT_CORRUPT;
+                goto notAdded;
+            }
+            dist += node->count;
             node = node->next;
+            nodeCount++;
+            if (nodeCount == srt->geometry.midpoint) {
+                midnode = node;
+                midDist = dist;
+            }
+            if (nodeCount == srt->geometry.outpoint) {
+                nsort_split_span(srt, oldLevel[0], midnode, 0, midDist);
+                srt->finger[1] = midnode;
+            }
         }
-        if (node->next == srt->tail) {
-            link = node->here;
-            while (link != srt->lh->tail) {
-                status = srt->compare(lnk->data, link->data);
-                srt->numCompares++;
-                if (status == 0) {
-                    srt->current = srt->tail->prev;
-                    srt->lh->current = link;
+
+      insertNode:
+
 #ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
+        nsort_elapsed(&t2);
+        srt->traversal_time += (t2 - t1);
+        nsort_elapsed(&t1);
 #endif
-                    return link;
+
+        if (node->prev == srt->head)
+            link = srt->lh->head->next;
+        else
+            link = node->prev->here;
+        linkCount = 0;
+        while (link != srt->lh->tail) {
+            if (linkCount == srt->geometry.midpoint) {
+                midpoint = link;
+            }
+            if (linkCount == srt->geometry.outpoint) {
+                linkCount = 0;
+                status = nsort_new_node(srt, node->prev, node, midpoint);
+                if (status == _ERROR_)
+                    goto notAdded;
+                node = srt->current->next;
+            }
+            status = srt->compare(lnk->data, link->data);
+            srt->numCompares++;
+            if (status == 0 && srt->isUnique == TRUE) {
+                srt->sortError = SORT_UNIQUE;
+                goto notAdded;
+            }
+            if (status <= 0) {
+                srt->current = node->prev;
+                srt->lh->current = link->prev;
+                nsort_list_insert_link(srt->lh, lnk);
+                if (node->prev == srt->head) {
+                    srt->preCount++;
+                    srt->finger[0] = srt->head->next;
+                }
+                else {
+                    nsort_count_link(srt, 0, node->prev, &srt->finger[1],
+                                     TRUE);
+                    srt->finger[0] = node->prev;
                 }
-                if (status < 0) {
-                    srt->current = node;
-                    if (link->prev != srt->lh->head) {
-                        srt->lh->current = link->prev;
-#ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
-#endif
-                        return link->prev;
-                    }
-                    else {
-                        srt->lh->current = link;
 #ifdef NSORT_STATS
-                        nsort_elapsed(&t2);
-                        srt->traversal_time += (t2 - t1);
+                nsort_elapsed(&t2);
+                srt->traversal_time += (t2 - t1);
 #endif
-                        return link;
-                    }
-                }
-                link = link->next;
+                return _OK_;
+            }
+            if (link == link->next) {
+                srt->sortError = SORT_CORRUPT;
+                goto notAdded;
             }
+            link = link->next;
+            linkCount++;
         }
-        srt->current = srt->tail->prev;
-#ifdef NSORT_STATS
-        nsort_elapsed(&t2);
-        srt->traversal_time += (t2 - t1);
+        srt->sortError = SORT_CORRUPT;
+
+        /*
+         * The descent has moved some of the fingers to where lnk would have
+         * gone and left the others where they were, so they no longer agree
+         * with each other or with finger[0].  Drop them; the next add starts
+         * from the top.
+         */
+      notAdded:
+        srt->finger[0] = 0;
+        return _ERROR_;
+    }
+
+/*
+ * Stable sort of an array of link pointers by lnk->data.  It is a bottom
+ * up merge sort over runs that are first put in order by insertion sort.
+ * ``tmp'' must have room for ``num'' pointers.  Stability is what lets
+ * nsort_add_items() keep the first of equal items in a unique sort, the
+ * one repeated calls to nsort_add_item() would keep.
+ */
+#define NSORT_MSORT_RUN 16
+#ifndef NSORT_BATCH_RATIO
+#define NSORT_BATCH_RATIO 2
 #endif
-        return srt->lh->tail->prev;
+    static void nsort_link_msort(nsort_link_t ** lnks, nsort_link_t ** tmp,
+                                 size_t num, int (*cmp)(void *, void *)) {
+        nsort_link_t **src = lnks, **dst = tmp, **swp, *lnk;
+        size_t i, j, k, lo, mid, hi, width;
+
+        for (lo = 0; lo < num; lo += NSORT_MSORT_RUN) {
+            hi = (lo + NSORT_MSORT_RUN < num) ? lo + NSORT_MSORT_RUN : num;
+            for (i = lo + 1; i < hi; i++) {
+                lnk = lnks[i];
+                for (j = i; j > lo && cmp(lnks[j - 1]->data, lnk->data) > 0;
+                     j--)
+                    lnks[j] = lnks[j - 1];
+                lnks[j] = lnk;
+            }
+        }
+        for (width = NSORT_MSORT_RUN; width < num; width *= 2) {
+            for (lo = 0; lo < num; lo += 2 * width) {
+                mid = (lo + width < num) ? lo + width : num;
+                hi = (lo + 2 * width < num) ? lo + 2 * width : num;
+                i = k = lo;
+                j = mid;
+                while (i < mid && j < hi) {
+                    if (cmp(src[i]->data, src[j]->data) <= 0)
+                        dst[k++] = src[i++];
+                    else
+                        dst[k++] = src[j++];
+                }
+                while (i < mid)
+                    dst[k++] = src[i++];
+                while (j < hi)
+                    dst[k++] = src[j++];
+            }
+            swp = src;
+            src = dst;
+            dst = swp;
+        }
+        if (src != lnks)
+            memcpy(lnks, src, num * sizeof(nsort_link_t *));
     }
 
 /*
- * The user should use nsort_save, so don't document this.
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_add_items}
+ * \index{nsort_add_items}
+ *
+ * [Verbatim] */
+
+    int nsort_add_items(nsort_t * srt, nsort_link_t ** lnks, size_t num,
+                        nsort_error_t * errs)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_add_items() function adds a batch of ``num'' items to the sort
+ * object given by ``srt''.  The ``lnks'' parameter is an array of links that
+ * are set up just as they would be for nsort_add_item().  Rather than walking
+ * the index once per item, the batch is sorted (with a stable merge sort, so
+ * that of equal items, the first one in ``lnks'' is the one a unique sort
+ * keeps), merged into srt->lh in a single forward pass that uses the existing
+ * index to skip ahead, and then the index is rebuilt once with
+ * nsort_restructure_nodes().  Since the rebuild costs time in proportion to
+ * the size of the sort, a batch that is smaller than 1/NSORT_BATCH_RATIO of
+ * the items already in the sort is instead added one item at a time, in
+ * sorted order, with nsort_add_item().  The order of ``lnks'' itself is not
+ * changed.
+ *
+ * The sort ends up with the same items as it would if they were added one at
+ * a time in the order given.  If duplicates are allowed, the order of equal
+ * items among themselves is not specified, just as it is not for
+ * nsort_add_item().  If srt->isUnique is set, an item is rejected if it is
+ * equal to an item already in the sort or to an item earlier in the batch.
+ * Rejected links are left alone for the caller to free.
+ *
+ * If ``errs'' is not NULL, it must have room for ``num'' entries; errs[i] is
+ * set to SORT_NOERROR if lnks[i] was added and to SORT_UNIQUE if it was
+ * rejected.  The function returns _OK_ if every item was added.  If any item was
+ * rejected, the others are still added, srt->sortError is set to SORT_UNIQUE
+ * and _ERROR_ is returned.  For any other error, _ERROR_ is returned and the
+ * error can be displayed with nsort_show_sort_error().  If that error is
+ * SORT_NOMEMORY from setting up the batch, nothing was added; otherwise, as
+ * with nsort_add_item(), further use of ``srt'' should be abandoned.
+ *
+ * [EndDoc]
  */
-    int nsort_store(nsort_t * srt, nsort_store_t * ts, int reclen,
-                    char *fname) {
+    {
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            return nsort_sync_add_items(srt, lnks, num, errs);
+#endif
+        return nsort_add_items_nolock(srt, lnks, num, errs, 0);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static int nsort_add_items_nolock(nsort_t * srt, nsort_link_t ** lnks,
+                                      size_t num, nsort_error_t * errs,
+                                      int *rebuild)
+    {
+        nsort_link_t **sorted, *link, *lnk, *last = 0;
+        nsort_node_t *finger[NSORT_NODE_LEVEL + 1];
+        nsort_node_t *node, *next, *first;
+        nsort_list_t *lh = srt->lh;
+        size_t i, numRejected = 0;
+        unsigned long pfx;
+        int status, moved, l;
+
+        if (lnks == 0) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            return _ERROR_;
+        }
+        if (num == 0)
+            return _OK_;
+        sorted = (nsort_link_t **) malloc(2 * num * sizeof(nsort_link_t *));
+        if (sorted == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memcpy(sorted, lnks, num * sizeof(nsort_link_t *));
+        nsort_link_msort(sorted, sorted + num, num, srt->compare);
+
+        if (num * NSORT_BATCH_RATIO < lh->number) {
+            /*
+             * Rebuilding the index costs time in proportion to the size of
+             * the sort.  For a batch that is small next to it, adding the
+             * (now ordered) items one at a time is cheaper.
+             */
+            for (i = 0; i < num; i++) {
+                lnk = sorted[i];
+                if (nsort_add_item_nolock(srt, lnk) == _ERROR_) {
+                    if (srt->sortError != SORT_UNIQUE) {
+                        free(sorted);
+                        return _ERROR_;
+                    }
+                    srt->sortError = SORT_NOERROR;
+                    lnk->next = lnk->prev = 0;
+                    numRejected++;
+                }
+            }
+            goto report;
+        }
+
+        /*
+         * The index is left alone until the batch is in, so it is still
+         * good for finding where each item goes.  Since the items come in
+         * order, a finger is kept on each level (finger[0] is the chain of
+         * nodes, finger[i+1] is level[i]; NULL means before the first node)
+         * and every finger only ever moves forward.
+         */
+        for (l = 0; l <= NSORT_NODE_LEVEL; l++)
+            finger[l] = 0;
+        first = srt->head->next;
+        link = lh->head->next;
+        for (i = 0; i < num; i++) {
+            lnk = sorted[i];
+            pfx = NSORT_PREFIX(srt, lnk->data);
+            moved = FALSE;
+            for (l = NSORT_NODE_LEVEL; l >= 0; l--) {
+                node = moved ? finger[l + 1] : finger[l];
+                while (TRUE) {
+                    if (node == 0)
+                        next = first;
+                    else
+                        next = (l == 0) ? node->next : node->level[l - 1];
+                    if (next == srt->tail ||
+                        NSORT_NODE_CMP(srt, lnk->data, pfx, next) < 0)
+                        break;
+                    node = next;
+                    moved = TRUE;
+                }
+                finger[l] = node;
+            }
+            if (moved)
+                link = finger[0]->here;
+            status = 1;
+            if (srt->isUnique && last != 0 &&
+                srt->compare(lnk->data, last->data) == 0)
+                status = 0;
+            while (status != 0 && link != lh->tail) {
+                status = srt->compare(lnk->data, link->data);
+                if (status < 0 || (status == 0 && srt->isUnique))
+                    break;
+                link = link->next;
+                status = 1;
+            }
+            if (status == 0 && srt->isUnique) {
+                /* A link that was not inserted is left unlinked. */
+                lnk->next = lnk->prev = 0;
+                numRejected++;
+                continue;
+            }
+            lh->current = link->prev;
+            nsort_list_insert_link(lh, lnk);
+            last = lnk;
+        }
+        srt->numCompares = 0;
+        srt->thresh = 0;
+        if (rebuild != 0)
+            *rebuild = TRUE;
+        else if (nsort_restructure_nolock(srt) == _ERROR_) {
+            free(sorted);
+            return _ERROR_;
+        }
+
+      report:
+        free(sorted);
+        if (errs != 0)
+            for (i = 0; i < num; i++)
+                errs[i] = (lnks[i]->next == 0) ? SORT_UNIQUE : SORT_NOERROR;
+        if (numRejected != 0) {
+            srt->sortError = SORT_UNIQUE;
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * Build a complete index (nodes and levels) for srt->lh all at once, the
+ * same way a step at a time rebuild does, and hang it off of ``head''.  The
+ * nodes end at srt->tail, but srt->tail->prev is not touched; the last node
+ * is returned in *lastp (head if there are none) and the number of nodes in
+ * *nump.  Nothing that the current index uses is changed, so this can be
+ * done while other threads search the sort.
+ */
+    static int nsort_build_index(nsort_t * srt, nsort_node_t * head,
+                                 nsort_node_t ** lastp, size_t * nump) {
+        nsort_rebuild_t rb;
+        nsort_link_t *lnk;
+
+        head->next = srt->tail;
+        *lastp = head;
+        *nump = 0;
+        if (srt->geometry.autoTune)
+            nsort_auto_tune(srt);
+        if (srt->lh->number < (size_t) srt->geometry.fanout)
+            return _OK_;
+        memset(&rb, 0, sizeof(nsort_rebuild_t));
+        rb.head.next = srt->tail;
+        rb.last = &rb.head;
+        for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next)
+            if (nsort_rebuild_add(srt, &rb, lnk) == _ERROR_) {
+                nsort_free_chain(srt, rb.head.next);
+                return _ERROR_;
+            }
+        if (rb.head.next == srt->tail)
+            return _OK_;
+        head->next = rb.head.next;
+        head->next->prev = head;
+        *lastp = rb.last;
+        *nump = rb.numNodes;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_restructure_nodes}
+ * \index{nsort_restructure_nodes}
+ *
+ * [Verbatim] */
+
+    int nsort_restructure_nodes(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_restructure_nodes() function rebuilds the indexing that is
+ * maintained in the ``srt'' object.  This probably does not need to be
+ * called by applications, because the nsort routines calls this function
+ * as necessary to keep the indexing optimal.  As items are added to an
+ * nsort object, they are added in a way that can produce indexing that is
+ * suboptimal.  This is specially true if the items that are added are
+ * random.\footnote{You will get much better results from the nsort sort
+ * routines if you can add items to it that are \emph{almost} ordered rather
+ * than randomly ordered items.}  However, statistical data
+ * is maintained in the sort
+ * object and when a certain threshold has been met a certain number of times,
+ * the indexing is rebuilt a step at a time as the object is used (see
+ * nsort_restructure_step()).  Calling nsort_restructure_nodes() rebuilds all
+ * of it at once, dropping any step at a time rebuild that is under way.
+ *
+ * This function returns _OK_ on success.  If an error occurs, it will return
+ * _ERROR_ and you can use nsort_show_sort_error() to get a description of the
+ * error.  If an error occurs here, all further use of the nsort routines on
+ * the ``srt'' sort object should be abandoned.
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
         int status;
 
-        ts->isUnique = srt->isUnique;
-        ts->manageAllocs = srt->manageAllocs;
-        status = nsort_list_store(srt->lh, ts, reclen, fname);
-        Assert(status != _ERROR_);
-        if (_ERROR_ == status) {
-            if (nsort_check_list_error(srt->lh))
-                srt->sortError = srt->lh->listError;
-            else if (nsort_check_error())
-                srt->sortError = get_sortError();
+        if (srt->sync != 0) {
+            pthread_mutex_lock(&srt->sync->writer);
+            if (srt->isFrozen) {
+                srt->sortError = SORT_FROZEN;
+                status = _ERROR_;
+            }
             else
-                srt->sortError = SORT_UNSPECIFIED;
+                status = nsort_sync_rebuild(srt);
+            pthread_mutex_unlock(&srt->sync->writer);
+            return status;
+        }
+#endif
+        return nsort_restructure_nolock(srt);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static int nsort_restructure_nolock(nsort_t * srt)
+    {
+        nsort_node_t *last;
+        size_t num;
+
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
             return _ERROR_;
         }
-        return _OK_;
+        /* step 1 - remove nodes (if exist) */
+        nsort_rebuild_cancel(srt);
+        nsort_release_nodes(srt);
+        srt->head->prev = 0;
+        srt->head->next = srt->tail;
+        srt->tail->prev = srt->head;
+        srt->tail->next = 0;
+        srt->current = srt->head;
+        srt->numNodes = 0;
+
+        /* steps 2 and 3 - rebuild nodes and indexes (if necessary) */
+        if (nsort_build_index(srt, srt->head, &last, &num) == _ERROR_)
+            return _ERROR_;
+        srt->tail->prev = last;
+        srt->numNodes = num;
+        srt->preCount = 0;
+        srt->numRestruct++;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_restructure_step}
+ * \index{nsort_restructure_step}
+ *
+ * [Verbatim] */
+
+    int nsort_restructure_step(nsort_t * srt, size_t budget)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_restructure_step() function does up to ``budget'' links worth of
+ * work on rebuilding the index of the sort object given by ``srt''.  A new
+ * index is built alongside the one that is in use, a piece at a time, and
+ * swapped in when it covers the whole list; the nodes of the old index are
+ * then freed a piece at a time as well.  The add, find, query and remove
+ * functions do a small step of this on their own once the restructure
+ * thresholds are crossed, so that no single call has to wait for the whole
+ * index to be rebuilt.  An application can call nsort_restructure_step() when
+ * it is idle to get that work out of the way.  If no rebuild is under way, one
+ * is started if the index looks like it needs it (the thresholds have been
+ * crossed, or the number of nodes is far from one for every fanout links;
+ * see nsort_geometry_t).  The size of the steps done by the other functions is set by
+ * NSORT_RESTRUCT_BUDGET.
+ *
+ * This function returns 1 if there is more work to do, 0 (_OK_) if the index
+ * is finished or _ERROR_ if an error occurs, in which case srt->sortError has
+ * the error.  So, a loop like the following finishes all of the work:
+ *
+ * \begin{verbatim}
+ *     while ((status = nsort_restructure_step(srt, 1000)) > 0)
+ *         ;
+ * \end{verbatim}
+ *
+ * [EndDoc]
+ */
+    {
+        size_t ideal;
+        int status;
+
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
+#endif
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            status = _ERROR_;
+        }
+        else {
+            ideal = srt->lh->number / (size_t) srt->geometry.fanout;
+            if (srt->rebuild == 0 && srt->thresh == 0 &&
+                srt->numCompares <= srt->geometry.outThresh &&
+                srt->numNodes <= 2 * ideal + 1 && 2 * srt->numNodes + 1 >= ideal)
+                status = _OK_;
+            else {
+                srt->thresh = 0;
+                status = nsort_rebuild_step(srt, budget);
+            }
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
+#endif
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_set_prefix}
+ * \index{nsort_set_prefix}
+ *
+ * [Verbatim] */
+
+    int nsort_set_prefix(nsort_t * srt, unsigned long (*prefix)(void *))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_set_prefix() function gives the sort object ``srt'' a prefix
+ * function.  The prefix of every item the index is on is kept in its node, and
+ * when the index is searched, the prefix of the item being looked for is worked
+ * out once and compared with those.  The compare function is only called when
+ * the prefixes are the same, so most of the steps of a search never have to look
+ * at the data the nodes are on.  The prefix function has to agree with the
+ * compare function: if compare(a, b) is less than 0, prefix(a) can not be more
+ * than prefix(b).  A prefix that is the same for every item is allowed (it just
+ * doesn't help) and one that tells every item apart is best.  The
+ * nsort_prefix_string() function is provided for items that are strings sorted
+ * with strcmp().  Passing NULL for ``prefix'' turns it off.
+ *
+ * The prefixes of the nodes in the index are set by this function, which can
+ * be called at any time, but not while the object is frozen.  The prefix
+ * function is cleared by nsort_init(), nsort_get() and the other functions that
+ * set up the object, so it has to be set again after them.  This function
+ * returns _OK_ or _ERROR_ if the object is frozen.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_node_t *node;
+        int status = _OK_;
+
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0) {
+            pthread_mutex_lock(&srt->sync->writer);
+            pthread_rwlock_wrlock(&srt->sync->lock);
+        }
+#endif
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            status = _ERROR_;
+        }
+        else {
+            srt->prefix = prefix;
+            for (node = srt->head->next; node != srt->tail; node = node->next)
+                NSORT_SET_HERE(srt, node, node->here);
+            if (srt->rebuild != 0)
+                for (node = srt->rebuild->head.next; node != srt->tail;
+                     node = node->next)
+                    NSORT_SET_HERE(srt, node, node->here);
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0) {
+            pthread_rwlock_unlock(&srt->sync->lock);
+            pthread_mutex_unlock(&srt->sync->writer);
+        }
+#endif
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_prefix_string}
+ * \index{nsort_prefix_string}
+ *
+ * [Verbatim] */
+
+    unsigned long nsort_prefix_string(void *data)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_prefix_string() function is a prefix function (see
+ * nsort_set_prefix()) for data that is a nul terminated string sorted with
+ * strcmp().  It returns the first sizeof(unsigned long) characters of the
+ * string, the first one in the high order byte, with zeros past the end of a
+ * shorter string.
+ *
+ * [EndDoc]
+ */
+    {
+        const unsigned char *cp = (const unsigned char *) data;
+        unsigned long pfx = 0;
+        size_t i;
+
+        for (i = 0; i < sizeof(unsigned long); i++) {
+            pfx <<= 8;
+            if (*cp != '\0')
+                pfx |= *cp++;
+        }
+        return pfx;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_geometry_defaults}
+ * \index{nsort_geometry_defaults}
+ *
+ * [Verbatim] */
+
+    void nsort_geometry_defaults(nsort_geometry_t * geo)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_geometry_defaults() function fills in ``geo'' with the geometry an
+ * nsort_t object gets from nsort_init(): NSORT_NODE_LEVEL levels, a fanout of
+ * NSORT_RESTRUCT, NSORT_MIDPOINT and NSORT_OUTPOINT, the NSORT_RSTRUCT_THRESH,
+ * NSORT_OUTPOINT_THRESH and NSORT_CRIT_THRESH thresholds and no auto-tuning.  It
+ * is a good place to start before changing the items that matter to an
+ * application and calling nsort_set_geometry().
+ *
+ * [EndDoc]
+ */
+    {
+        geo->levels = NSORT_NODE_LEVEL;
+        geo->fanout = NSORT_RESTRUCT;
+        geo->midpoint = NSORT_MIDPOINT;
+        geo->outpoint = NSORT_OUTPOINT;
+        geo->restructThresh = NSORT_RSTRUCT_THRESH;
+        geo->outThresh = NSORT_OUTPOINT_THRESH;
+        geo->critThresh = NSORT_CRIT_THRESH;
+        geo->autoTune = FALSE;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_set_geometry}
+ * \index{nsort_set_geometry}
+ *
+ * [Verbatim] */
+
+    int nsort_set_geometry(nsort_t * srt, const nsort_geometry_t * geo)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_set_geometry() function gives the sort object ``srt'' the index
+ * geometry ``geo'' (see nsort_geometry_t).  It is meant to be called right after
+ * nsort_init(), but it can be called at any time the object isn't frozen; if
+ * there is already an index, it is rebuilt with the new geometry.  If
+ * geo->autoTune is TRUE, the rest of the items are worked out right away for the
+ * number of items in the sort (only fanout is used as given), and again each
+ * time the index is rebuilt, so something like the following is all that's
+ * needed for a sort that could end up with a few items or with millions:
+ *
+ * \begin{verbatim}
+ *     nsort_geometry_t geo;
+ *
+ *     nsort_geometry_defaults(&geo);
+ *     geo.autoTune = TRUE;
+ *     nsort_set_geometry(srt, &geo);
+ * \end{verbatim}
+ *
+ * Like the prefix function, the geometry goes back to the defaults in
+ * nsort_init(), nsort_get() and the other functions that set up the object.
+ * This function returns _OK_ on success.  If levels is not from 1 to
+ * NSORT_NODE_LEVEL, fanout is less than 2, midpoint is not at least 1 and less
+ * than outpoint or a threshold is less than 1, srt->sortError is set to
+ * SORT_PARAM and _ERROR_ is returned.  It is also an error if the object is
+ * frozen.
+ *
+ * [EndDoc]
+ */
+    {
+        int status = _OK_;
+
+        if (geo == 0 || geo->levels < 1 || geo->levels > NSORT_NODE_LEVEL ||
+            geo->fanout < 2 || geo->midpoint < 1 ||
+            geo->midpoint >= geo->outpoint || geo->restructThresh < 1 ||
+            geo->outThresh < 1 || geo->critThresh < 1) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
+#endif
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            status = _ERROR_;
+        }
+        else {
+            srt->geometry = *geo;
+            srt->thresh = 0;
+            srt->tuneOps = 0;
+            srt->tuneCompares = 0;
+            if (geo->autoTune)
+                nsort_auto_tune(srt);
+            if (srt->head->next != srt->tail) {
+#ifdef HAVE_PTHREAD_H
+                if (srt->sync != 0)
+                    status = nsort_sync_rebuild(srt);
+                else
+#endif
+                    status = nsort_restructure_nolock(srt);
+            }
+            else
+                nsort_rebuild_cancel(srt);
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
+#endif
+        return status;
+    }
+
+/*
+ * Find the first link that is not less than ``data''; srt->lh->tail is
+ * returned if there is none.  Unlike the find and query functions, this
+ * writes nothing at all, which is what makes frozen lookups safe to run
+ * concurrently.  The descent keeps to nodes whose here is strictly less than
+ * data, so a run of duplicates is entered from its beginning.
+ */
+    static nsort_link_t *nsort_lower_bound(nsort_t * srt, void *data) {
+        nsort_node_t *node = srt->head->next;
+        nsort_link_t *link;
+        unsigned long pfx = NSORT_PREFIX(srt, data);
+        int i;
+
+        if (node == srt->tail || NSORT_NODE_CMP(srt, data, pfx, node) <= 0)
+            link = srt->lh->head->next;
+        else {
+            for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--)
+                while (node->level[i] != srt->tail) {
+                    NSORT_PREFETCH(node->level[i]->level[i]);
+                    if (NSORT_NODE_CMP(srt, data, pfx, node->level[i]) <= 0)
+                        break;
+                    node = node->level[i];
+                }
+            while (node->next != srt->tail &&
+                   NSORT_NODE_CMP(srt, data, pfx, node->next) > 0)
+                node = node->next;
+            link = node->here->next;
+        }
+        while (link != srt->lh->tail && srt->compare(data, link->data) > 0)
+            link = link->next;
+        return link;
+    }
+
+/*
+ * Find the first link that is greater than ``data''; srt->lh->tail is
+ * returned if there is none.  This is nsort_lower_bound() with the descent
+ * going past the nodes equal to data as well, so it lands at the end of a
+ * run of duplicates instead of its beginning.
+ */
+    static nsort_link_t *nsort_upper_bound(nsort_t * srt, void *data) {
+        nsort_node_t *node = srt->head->next;
+        nsort_link_t *link;
+        unsigned long pfx = NSORT_PREFIX(srt, data);
+        int i;
+
+        if (node == srt->tail || NSORT_NODE_CMP(srt, data, pfx, node) < 0)
+            link = srt->lh->head->next;
+        else {
+            for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--)
+                while (node->level[i] != srt->tail) {
+                    NSORT_PREFETCH(node->level[i]->level[i]);
+                    if (NSORT_NODE_CMP(srt, data, pfx, node->level[i]) < 0)
+                        break;
+                    node = node->level[i];
+                }
+            while (node->next != srt->tail &&
+                   NSORT_NODE_CMP(srt, data, pfx, node->next) >= 0)
+                node = node->next;
+            link = node->here->next;
+        }
+        while (link != srt->lh->tail && srt->compare(data, link->data) >= 0)
+            link = link->next;
+        return link;
+    }
+
+/*
+ * The frozen and concurrent versions of nsort_find_item() and
+ * nsort_query_item().  They give the same answers but write nothing.
+ */
+    static nsort_link_t *nsort_find_pure(nsort_t * srt, nsort_link_t * lnk) {
+        nsort_link_t *link = nsort_lower_bound(srt, lnk->data);
+
+        if (link != srt->lh->tail && srt->compare(lnk->data, link->data) == 0)
+            return link;
+        return 0;
+    }
+
+    static nsort_link_t *nsort_query_pure(nsort_t * srt, nsort_link_t * lnk) {
+        nsort_link_t *link;
+
+        if (srt->lh->head->next == srt->lh->tail) {
+            srt->sortError = SORT_PARAM;
+            return 0;
+        }
+        link = nsort_lower_bound(srt, lnk->data);
+        if (link == srt->lh->tail)
+            return link->prev;
+        if (link->prev != srt->lh->head &&
+            srt->compare(lnk->data, link->data) != 0)
+            return link->prev;
+        return link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_find_item}
+ * \index{nsort_find_item}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_find_item(nsort_t * srt, nsort_link_t * lnk)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_find_item() function finds the first item that is ``equal to''
+ * the lnk->data object.\footnote{Equality here is determined by the compare
+ * function.  If the compare function returns 0, the items are equal.}
+ * The return value is a pointer to an nsort_link_t item.  Basically, this
+ * is done so you can find a particular item and then traverse forward or
+ * backward in the list from there.  If nsort_find_item() doesn't find an
+ * object that is equal to the one being searched for, then it returns NULL.
+ * This function also returns NULL if there is an error condition, so if you
+ * get a NULL return value, make sure srt->sortError doesn't reflect an error
+ * condition.  Note that ``error condition'' means that srt->sortError is
+ * greater than 0 (SORT_NOERROR).
+ *
+ * If ``srt'' has been frozen with nsort_freeze(), nsort_find_item() does not
+ * change anything in ``srt'' (not even the statistics or currency pointers), so
+ * it can be called from any number of threads at once without locking.
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
+        nsort_link_t *link;
+#endif
+
+        if (srt->isFrozen)
+            return nsort_find_pure(srt, lnk);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0) {
+            pthread_rwlock_rdlock(&srt->sync->lock);
+            link = nsort_find_pure(srt, lnk);
+            pthread_rwlock_unlock(&srt->sync->lock);
+            return link;
+        }
+#endif
+        return nsort_find_item_nolock(srt, lnk);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static nsort_link_t *nsort_find_item_nolock(nsort_t * srt,
+                                                nsort_link_t * lnk)
+    {
+        int status = 0;
+        register nsort_link_t *link;
+        register nsort_node_t *node;
+        unsigned long pfx;
+        int i;
+#ifdef NSORT_STATS
+        double t1, t2;
+#endif
+
+        if (srt->sync == 0 && nsort_restructure_check(srt) == _ERROR_)
+            return 0;
+        srt->numCompares = 0;
+#ifdef NSORT_STATS
+        srt->traversal_time = 0.0;
+        nsort_elapsed(&t1);
+#endif
+        if (srt->head->next == srt->tail) {
+            link = srt->lh->head->next;
+            while (link != srt->lh->tail) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status == 0) {
+                    srt->lh->current = link;
+#ifdef NSORT_STATS
+                    nsort_elapsed(&t2);
+                    srt->traversal_time += (t2 - t1);
+#endif
+                    return link;
+                }
+                link = link->next;
+            }
+            return 0;
+        }
+        status = srt->compare(lnk->data, srt->lh->head->next->data);
+        srt->numCompares++;
+        if (status == 0) {
+            srt->current = srt->head->next;
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return srt->lh->head->next;
+        }
+        if (status < 0) {
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return 0;
+        }
+        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
+        srt->numCompares++;
+        if (status == 0) {
+            link = srt->lh->tail->prev;
+            while (link != srt->lh->head) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status != 0)
+                    break;
+                link = link->prev;
+            }
+            srt->current = srt->tail->prev;
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return link->next;
+        }
+        if (status > 0)
+            return 0;
+        pfx = NSORT_PREFIX(srt, lnk->data);
+        node = srt->head->next;
+        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
+            while (node->level[i] != srt->tail) {
+                NSORT_PREFETCH(node->level[i]->level[i]);
+                status = NSORT_NODE_CMP(srt, lnk->data, pfx, node->level[i]);
+                srt->numCompares++;
+                if (status <= 0)
+                    break;
+                node = node->level[i];
+            }
+        }
+        // BUGBUG
+        status = srt->compare(lnk->data, node->here->data);
+        srt->numCompares++;
+        if (status <= 0) {
+            if (node->prev == srt->head)
+                link = srt->lh->head->next;
+            else
+                link = node->prev->here;
+            while (link != node->here) {
+                status = srt->compare(lnk->data, link->data);
+                if (status == 0) {
+                    srt->current = node->prev;
+                    srt->lh->current = link;
+                    return link;
+                }
+                if (status < 0)
+                    return 0;
+                link = link->next;
+            }
+        }
+        // BUGBUG
+        while (node->next != srt->tail) {
+            status = NSORT_NODE_CMP(srt, lnk->data, pfx, node->next);
+            srt->numCompares++;
+            if (status <= 0) {
+                link = node->here;
+                if (node == srt->head->next) {
+                    link = srt->lh->head->next;
+                }
+                while (link != node->next->here) {
+                    status = srt->compare(lnk->data, link->data);
+                    srt->numCompares++;
+                    if (status == 0) {
+                        srt->current = node;
+                        srt->lh->current = link;
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link;
+                    }
+                    if (status < 0) {
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return 0;
+                    }
+                    link = link->next;
+                }
+            }
+            node = node->next;
+        }
+        if (node->next == srt->tail) {
+            link = node->here;
+            while (link != srt->lh->tail) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status == 0) {
+                    srt->current = srt->tail->prev;
+                    srt->lh->current = link;
+#ifdef NSORT_STATS
+                    nsort_elapsed(&t2);
+                    srt->traversal_time += (t2 - t1);
+#endif
+                    return link;
+                }
+                if (status < 0) {
+#ifdef NSORT_STATS
+                    nsort_elapsed(&t2);
+                    srt->traversal_time += (t2 - t1);
+#endif
+                    return 0;
+                }
+                link = link->next;
+            }
+        }
+        return 0;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_query_item}
+ * \index{nsort_query_item}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_query_item(nsort_t * srt, nsort_link_t * lnk)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_query_item() is like nsort_find_item(), except that it only
+ * returns a NULL if there is an error.  If it doesn't find an item that
+ * is ``equal to'' the lnk->data item, then it returns the link that points
+ * the item that would be before lnk->data if it were added to the list.  If
+ * NULL is returned, srt->sortError will be set to the error and you can get
+ * a description of the error with the nsort_show_sort_error() funciton.
+ * Like nsort_find_item(), this function is safe to call from many threads at
+ * once without locking if ``srt'' is frozen.
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
+        nsort_link_t *link;
+#endif
+
+        if (srt->isFrozen)
+            return nsort_query_pure(srt, lnk);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0) {
+            pthread_rwlock_rdlock(&srt->sync->lock);
+            link = nsort_query_pure(srt, lnk);
+            pthread_rwlock_unlock(&srt->sync->lock);
+            return link;
+        }
+#endif
+        return nsort_query_item_nolock(srt, lnk);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static nsort_link_t *nsort_query_item_nolock(nsort_t * srt,
+                                                 nsort_link_t * lnk)
+    {
+        int status;
+        nsort_link_t *link;
+        nsort_node_t *node;
+        unsigned long pfx;
+        int i;
+#ifdef NSORT_STATS
+        double t1, t2;
+#endif
+
+        if (srt->sync == 0 && nsort_restructure_check(srt) == _ERROR_)
+            return 0;
+        srt->numCompares = 0;
+#ifdef NSORT_STATS
+        srt->traversal_time = 0.0;
+        nsort_elapsed(&t1);
+#endif
+        if (srt->head->next == srt->tail) {
+            if (srt->lh->head->next == srt->lh->tail) {
+                srt->sortError = SORT_PARAM;
+                return 0;
+            }
+            link = srt->lh->head->next;
+            while (link != srt->lh->tail) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status == 0) {
+                    srt->lh->current = link;
+#ifdef NSORT_STATS
+                    nsort_elapsed(&t2);
+                    srt->traversal_time += (t2 - t1);
+#endif
+                    return link;
+                }
+                if (status < 0) {
+                    if (link->prev != srt->lh->head) {
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link->prev;
+                    }
+                    else {
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link;
+                    }
+                }
+                link = link->next;
+            }
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return srt->lh->tail->prev;
+        }
+        status = srt->compare(lnk->data, srt->lh->head->next->data);
+        srt->numCompares++;
+        if (status == 0) {
+            srt->current = srt->head->next;
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return srt->lh->head->next;
+        }
+        if (status < 0) {
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return srt->lh->head->next;
+        }
+        status = srt->compare(lnk->data, srt->lh->tail->prev->data);
+        srt->numCompares++;
+        if (status == 0) {
+            if (srt->isUnique) {
+#ifdef NSORT_STATS
+                nsort_elapsed(&t2);
+                srt->traversal_time += (t2 - t1);
+#endif
+                return srt->lh->tail->prev;
+            }
+            link = srt->lh->tail->prev;
+            while (link != srt->lh->head) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status != 0)
+                    break;
+                link = link->prev;
+            }
+            srt->current = srt->tail->prev;
+            if (link->next != srt->lh->tail)
+                link = link->next;
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return link;
+        }
+        if (status > 0) {
+            srt->current = srt->tail->prev;
+#ifdef NSORT_STATS
+            nsort_elapsed(&t2);
+            srt->traversal_time += (t2 - t1);
+#endif
+            return srt->lh->tail->prev;
+        }
+        pfx = NSORT_PREFIX(srt, lnk->data);
+        node = srt->head->next;
+        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
+            while (node->level[i] != srt->tail) {
+                NSORT_PREFETCH(node->level[i]->level[i]);
+                status = NSORT_NODE_CMP(srt, lnk->data, pfx, node->level[i]);
+                srt->numCompares++;
+                if (status <= 0)
+                    break;
+                node = node->level[i];
+            }
+        }
+        while (node->next != srt->tail) {
+            status = NSORT_NODE_CMP(srt, lnk->data, pfx, node->next);
+            srt->numCompares++;
+            if (status <= 0) {
+                link = node->here;
+                if (node == srt->head->next) {
+                    link = srt->lh->head->next;
+                }
+                while (link != node->next->here) {
+                    status = srt->compare(lnk->data, link->data);
+                    srt->numCompares++;
+                    if (status == 0) {
+                        srt->current = node;
+                        srt->lh->current = link;
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link;
+                    }
+                    if (status < 0) {
+                        srt->current = node;
+                        if (link->prev != srt->lh->head) {
+                            srt->lh->current = link->prev;
+#ifdef NSORT_STATS
+                            nsort_elapsed(&t2);
+                            srt->traversal_time += (t2 - t1);
+#endif
+                            return link->prev;
+                        }
+                        else {
+                            srt->lh->current = link;
+#ifdef NSORT_STATS
+                            nsort_elapsed(&t2);
+                            srt->traversal_time += (t2 - t1);
+#endif
+                            return link;
+                        }
+                    }
+                    link = link->next;
+                }
+            }
+            node = node->next;
+        }
+        if (node->next == srt->tail) {
+            link = node->here;
+            while (link != srt->lh->tail) {
+                status = srt->compare(lnk->data, link->data);
+                srt->numCompares++;
+                if (status == 0) {
+                    srt->current = srt->tail->prev;
+                    srt->lh->current = link;
+#ifdef NSORT_STATS
+                    nsort_elapsed(&t2);
+                    srt->traversal_time += (t2 - t1);
+#endif
+                    return link;
+                }
+                if (status < 0) {
+                    srt->current = node;
+                    if (link->prev != srt->lh->head) {
+                        srt->lh->current = link->prev;
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link->prev;
+                    }
+                    else {
+                        srt->lh->current = link;
+#ifdef NSORT_STATS
+                        nsort_elapsed(&t2);
+                        srt->traversal_time += (t2 - t1);
+#endif
+                        return link;
+                    }
+                }
+                link = link->next;
+            }
+        }
+        srt->current = srt->tail->prev;
+#ifdef NSORT_STATS
+        nsort_elapsed(&t2);
+        srt->traversal_time += (t2 - t1);
+#endif
+        return srt->lh->tail->prev;
+    }
+
+/*
+ * The number of items that are less than ``data'' (or, if ``orEqual'' is
+ * TRUE, not greater than it), with *linkp set to the first link after them.
+ * The descent adds up the counts and spans of the nodes it goes past and
+ * the links are walked from the node it ends on.  Like nsort_lower_bound(),
+ * this writes nothing.
+ */
+    static size_t nsort_rank_pure(nsort_t * srt, void *data, int orEqual,
+                                  nsort_link_t ** linkp) {
+        nsort_node_t *node = srt->head->next;
+        nsort_link_t *link;
+        unsigned long pfx = NSORT_PREFIX(srt, data);
+        size_t rank = 0;
+        int limit = orEqual ? -1 : 0;
+        int i;
+
+        if (node == srt->tail || NSORT_NODE_CMP(srt, data, pfx, node) <= limit)
+            link = srt->lh->head->next;
+        else {
+            rank = srt->preCount;
+            for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--)
+                while (node->level[i] != srt->tail) {
+                    NSORT_PREFETCH(node->level[i]->level[i]);
+                    if (NSORT_NODE_CMP(srt, data, pfx, node->level[i]) <= limit)
+                        break;
+                    rank += NSORT_SPAN(node, i);
+                    node = node->level[i];
+                }
+            while (node->next != srt->tail &&
+                   NSORT_NODE_CMP(srt, data, pfx, node->next) > limit) {
+                rank += node->count;
+                node = node->next;
+            }
+            link = node->here->next;
+            rank++;
+        }
+        while (link != srt->lh->tail && srt->compare(data, link->data) > limit) {
+            link = link->next;
+            rank++;
+        }
+        *linkp = link;
+        return rank;
+    }
+
+/*
+ * The link that has ``k'' links before it.  The descent goes past every
+ * node whose count or span would not take it past k, then the links are
+ * walked.  This writes nothing.
+ */
+    static nsort_link_t *nsort_select_pure(nsort_t * srt, size_t k) {
+        nsort_node_t *node = srt->head->next;
+        nsort_link_t *link;
+        size_t pos = 0;
+        int i;
+
+        if (node == srt->tail || k < srt->preCount)
+            link = srt->lh->head->next;
+        else {
+            pos = srt->preCount;
+            for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--)
+                while (node->level[i] != srt->tail &&
+                       pos + NSORT_SPAN(node, i) <= k) {
+                    pos += NSORT_SPAN(node, i);
+                    node = node->level[i];
+                }
+            while (node->next != srt->tail && pos + node->count <= k) {
+                pos += node->count;
+                node = node->next;
+            }
+            link = node->here;
+        }
+        for (; pos < k; pos++)
+            link = link->next;
+        return link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_rank}
+ * \index{nsort_rank}
+ *
+ * [Verbatim] */
+
+    int nsort_rank(nsort_t * srt, nsort_link_t * lnk, size_t * rank)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_rank() function puts the number of items that come before ``lnk''
+ * in the sort ``srt'' in ``rank'', so the first item has a rank of 0 and the last
+ * one a rank of srt->lh->number - 1.  ``lnk'' must be a link that is in the sort.
+ * Each node of the index keeps the number of links between it and the next
+ * node on the list of nodes and on each level it is on, so the rank is added
+ * up on the way down the index and costs about what nsort_find_item() does,
+ * plus a step for each item equal to lnk that comes before it.  The function
+ * returns _OK_, or _ERROR_ with srt->sortError set to SORT_PARAM if ``lnk''
+ * is not in the sort.
+ *
+ * Like the functions that search, nsort_rank(), nsort_select() and
+ * nsort_count_range() change nothing in ``srt'', so they are safe to call from
+ * many threads at once if it is frozen.  If nsort_sync_init() has been called,
+ * they take the read lock, as nsort_find_item() does, so they run alongside
+ * the searches and each other and only wait for a change that is being made
+ * to the sort to finish.  On a sort that is frozen or synchronized, they
+ * don't set srt->sortError either, since other threads may be reading the
+ * sort at the same time; the return value is the only sign of an error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_link_t *link;
+        size_t num;
+        int status = _OK_;
+
+        if (srt == 0 || lnk == 0 || rank == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_rdlock(&srt->sync->lock);
+#endif
+        num = nsort_rank_pure(srt, lnk->data, FALSE, &link);
+        while (link != lnk) {
+            if (link == srt->lh->tail ||
+                srt->compare(lnk->data, link->data) != 0) {
+                status = _ERROR_;
+                break;
+            }
+            link = link->next;
+            num++;
+        }
+        *rank = num;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_unlock(&srt->sync->lock);
+#endif
+        if (status == _ERROR_ && srt->sync == 0 && !srt->isFrozen)
+            srt->sortError = SORT_PARAM;
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_select}
+ * \index{nsort_select}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_select(nsort_t * srt, size_t k)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_select() function returns the link of the item in the sort ``srt''
+ * that has ``k'' items before it (the one nsort_rank() gives a rank of k).
+ * Like nsort_rank(), it goes down the index instead of walking the list, so
+ * the millionth item of a sort takes about as long to get as the first.  The
+ * item at a percentile ``p'' (0 to 100) of a sort that is not empty is
+ * nsort_select(srt, (srt->lh->number - 1) * p / 100), so the median and the
+ * p99 of a sort come cheap.  If ``k'' is not less than the number of items in
+ * the sort, NULL is returned and srt->sortError is set to SORT_PARAM.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_link_t *link = 0;
+
+        if (srt == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_rdlock(&srt->sync->lock);
+#endif
+        if (k < srt->lh->number)
+            link = nsort_select_pure(srt, k);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_unlock(&srt->sync->lock);
+#endif
+        if (link == 0 && srt->sync == 0 && !srt->isFrozen)
+            srt->sortError = SORT_PARAM;
+        return link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_count_range}
+ * \index{nsort_count_range}
+ *
+ * [Verbatim] */
+
+    int nsort_count_range(nsort_t * srt, nsort_link_t * lo, nsort_link_t * hi,
+                          size_t * count)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_count_range() function puts the number of items in the sort
+ * ``srt'' that are not less than lo->data and not greater than hi->data in
+ * ``count''.  As with nsort_find_item(), ``lo'' and ``hi'' only need their
+ * data set and do not have to be in the sort.  If ``lo'' is NULL, the count
+ * starts at the first item, and if ``hi'' is NULL, it goes to the last one.  It
+ * takes two descents of the index, no matter how many items are in the range.
+ * This function returns _OK_, or _ERROR_ if ``srt'' or ``count'' is NULL.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_link_t *link;
+        size_t first = 0, last;
+
+        if (srt == 0 || count == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_rdlock(&srt->sync->lock);
+#endif
+        if (lo != 0)
+            first = nsort_rank_pure(srt, lo->data, FALSE, &link);
+        last = srt->lh->number;
+        if (hi != 0)
+            last = nsort_rank_pure(srt, hi->data, TRUE, &link);
+        *count = (last > first) ? last - first : 0;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_unlock(&srt->sync->lock);
+#endif
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_init}
+ * \index{nsort_cursor_init}
+ *
+ * [Verbatim] */
+
+    int nsort_cursor_init(nsort_cursor_t * cur, nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_init() function sets up the cursor ``cur'' to scan the sort
+ * ``srt'' and puts it on the first item.  A cursor is a place in the sort that
+ * can be set with a search (see nsort_cursor_lower_bound() and
+ * nsort_cursor_upper_bound()) and moved from there a link at a time, or many
+ * links at a time with nsort_cursor_read(), so a range scan does not have to
+ * search again each time it starts over.  The cursor is just a pointer into
+ * the list; it is good for as long as nothing is added to or removed from the
+ * sort, and a cursor on a frozen sort can be used by one thread while others
+ * use theirs.  Nothing has to be done to get rid of a cursor.  This function
+ * returns _OK_, or _ERROR_ if ``cur'' or ``srt'' is NULL.
+ *
+ * [EndDoc]
+ */
+    {
+        if (cur == 0 || srt == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        cur->srt = srt;
+        nsort_cursor_first(cur);
+        return _OK_;
+    }
+
+/*
+ * Put the cursor on the first link not less than (or, if ``upper'' is TRUE,
+ * greater than) lnk->data.  The search is done the way nsort_find_item()
+ * does it on a frozen sort, so it writes nothing.
+ */
+    static nsort_link_t *nsort_cursor_seek(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk, int upper) {
+        nsort_t *srt;
+        nsort_link_t *link;
+
+        if (cur == 0 || cur->srt == 0 || lnk == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        srt = cur->srt;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_rdlock(&srt->sync->lock);
+#endif
+        link = upper ? nsort_upper_bound(srt, lnk->data) :
+            nsort_lower_bound(srt, lnk->data);
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0 && !srt->isFrozen)
+            pthread_rwlock_unlock(&srt->sync->lock);
+#endif
+        cur->link = cur->ahead = link;
+        cur->gap = 0;
+        return (link == srt->lh->tail) ? 0 : link;
+    }
+
+/*
+ * Move the cursor to the next link.  The ahead link moves with it and, until
+ * it is NSORT_CURSOR_AHEAD links out, a second time, prefetching the data of
+ * each link it gets to.
+ */
+    static void nsort_cursor_step(nsort_cursor_t * cur) {
+        nsort_link_t *tail = cur->srt->lh->tail;
+        int steps = (cur->gap < NSORT_CURSOR_AHEAD) ? 2 : 1;
+
+        cur->link = cur->link->next;
+        cur->gap--;
+        while (steps-- > 0 && cur->ahead != tail) {
+            cur->ahead = cur->ahead->next;
+            cur->gap++;
+            if (cur->ahead != tail)
+                NSORT_PREFETCH(cur->ahead->data);
+        }
+        if (cur->gap < 0) {
+            cur->ahead = cur->link;
+            cur->gap = 0;
+        }
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_first}
+ * \index{nsort_cursor_first}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_first(nsort_cursor_t * cur)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_first() function puts the cursor ``cur'' on the first item
+ * of its sort and returns its link.  NULL is returned if the sort is empty (or
+ * if ``cur'' is NULL, in which case the error is set to SORT_PARAM).
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_list_t *lh;
+
+        if (cur == 0 || cur->srt == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        lh = cur->srt->lh;
+        cur->link = cur->ahead = lh->head->next;
+        cur->gap = 0;
+        return (cur->link == lh->tail) ? 0 : cur->link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_last}
+ * \index{nsort_cursor_last}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_last(nsort_cursor_t * cur)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_last() function puts the cursor ``cur'' on the last item of
+ * its sort and returns its link, for a scan that goes backward with
+ * nsort_cursor_prev().  NULL is returned if the sort is empty.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_list_t *lh;
+
+        if (cur == 0 || cur->srt == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        lh = cur->srt->lh;
+        cur->link = cur->ahead = lh->tail->prev;
+        cur->gap = 0;
+        return (cur->link == lh->head) ? 0 : cur->link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_lower_bound}
+ * \index{nsort_cursor_lower_bound}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_lower_bound(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_lower_bound() function puts the cursor ``cur'' on the first
+ * item of its sort that is not less than lnk->data and returns its link.  If
+ * there are items equal to lnk->data, that is the first of them, the same one
+ * nsort_find_item() finds.  As with nsort_find_item(), only the data of ``lnk''
+ * needs to be set.  If every item is less than lnk->data, the cursor is put past
+ * the last item and NULL is returned.  The search changes nothing in the sort,
+ * so it can be done on a frozen sort from any number of threads.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_cursor_seek(cur, lnk, FALSE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_upper_bound}
+ * \index{nsort_cursor_upper_bound}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_upper_bound(nsort_cursor_t * cur,
+                                           nsort_link_t * lnk)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_upper_bound() function puts the cursor ``cur'' on the first
+ * item of its sort that is greater than lnk->data and returns its link, or
+ * puts it past the last item and returns NULL if there is none.  The items from
+ * nsort_cursor_lower_bound() of a key up to nsort_cursor_upper_bound() of it
+ * are the ones equal to it, and the items from the lower bound of one key up
+ * to the upper bound of another are the ones nsort_count_range() counts.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_cursor_seek(cur, lnk, TRUE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_next}
+ * \index{nsort_cursor_next}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_next(nsort_cursor_t * cur)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_next() function moves the cursor ``cur'' to the next item
+ * and returns its link.  NULL is returned when the cursor goes past the last
+ * item, where it stays; if it is before the first item (after
+ * nsort_cursor_prev() has gone past it), it moves to the first one.  On a long
+ * scan forward the data of the items a few links ahead of the cursor is
+ * prefetched (NSORT_CURSOR_AHEAD of them), so it is already in the cache when
+ * the cursor gets to it.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_list_t *lh;
+
+        if (cur == 0 || cur->srt == 0 || cur->link == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        lh = cur->srt->lh;
+        if (cur->link == lh->tail)
+            return 0;
+        nsort_cursor_step(cur);
+        return (cur->link == lh->tail) ? 0 : cur->link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_prev}
+ * \index{nsort_cursor_prev}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_cursor_prev(nsort_cursor_t * cur)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_prev() function moves the cursor ``cur'' back to the item
+ * before the one it is on and returns its link.  NULL is returned when it goes
+ * back past the first item, where it stays until it is moved forward again.
+ * There is no prefetching going backward.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_list_t *lh;
+
+        if (cur == 0 || cur->srt == 0 || cur->link == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        lh = cur->srt->lh;
+        if (cur->link == lh->head)
+            return 0;
+        cur->link = cur->ahead = cur->link->prev;
+        cur->gap = 0;
+        return (cur->link == lh->head) ? 0 : cur->link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_cursor_read}
+ * \index{nsort_cursor_read}
+ *
+ * [Verbatim] */
+
+    size_t nsort_cursor_read(nsort_cursor_t * cur, void **data, size_t num)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_cursor_read() function puts the data pointers of up to ``num''
+ * items into the ``data'' array, starting with the item the cursor ``cur'' is on,
+ * and leaves the cursor on the item after the last one read.  It returns the
+ * number of items read, which is less than num only if the end of the sort was
+ * reached, so a range can be read in batches with
+ *
+ * \begin{verbatim}
+ * nsort_cursor_lower_bound(&cur, &lo);
+ * while ((n = nsort_cursor_read(&cur, (void **)buf, 256)) > 0)
+ *   ...
+ * \end{verbatim}
+ *
+ * stopping at the first item of a batch that is past the range.  The data is
+ * prefetched as with nsort_cursor_next().  0 is returned (with the error set to
+ * SORT_PARAM) if ``cur'' or ``data'' is NULL.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_link_t *tail;
+        size_t n = 0;
+
+        if (cur == 0 || cur->srt == 0 || cur->link == 0 || data == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        tail = cur->srt->lh->tail;
+        if (cur->link == cur->srt->lh->head)
+            nsort_cursor_step(cur);
+        while (n < num && cur->link != tail) {
+            data[n++] = cur->link->data;
+            nsort_cursor_step(cur);
+        }
+        return n;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_freeze}
+ * \index{nsort_freeze}
+ *
+ * [Verbatim] */
+
+    int nsort_freeze(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_freeze() function makes the sort object given by ``srt'' read-only.
+ * The index is rebuilt first so it is as good as it can be, since nothing will
+ * rebuild it while the object is frozen.  After that, nsort_add_item(),
+ * nsort_add_items(), nsort_remove_item() and nsort_restructure_nodes() fail
+ * with SORT_FROZEN, and nsort_find_item() and nsort_query_item() change nothing
+ * in the object.  That means any number of threads can search a frozen nsort
+ * at the same time with no locking at all.  It is up to the application to
+ * make sure that no thread is still searching when the object is thawed or
+ * deleted, and that it does not change srt->lh directly with the list functions.
+ * Freezing an object that is already frozen does nothing.  This function
+ * returns _OK_ on success or _ERROR_ if the index could not be rebuilt.
+ *
+ * [EndDoc]
+ */
+    {
+        if (srt->isFrozen)
+            return _OK_;
+        if (srt->head->next != srt->tail || srt->lh->number > 0)
+            if (nsort_restructure_nodes(srt) == _ERROR_)
+                return _ERROR_;
+        srt->numCompares = 0;
+        srt->thresh = 0;
+        srt->isFrozen = TRUE;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_thaw}
+ * \index{nsort_thaw}
+ *
+ * [Verbatim] */
+
+    int nsort_thaw(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_thaw() function undoes nsort_freeze(), so the sort object given by
+ * ``srt'' can be changed again.  It must not be called while other threads are
+ * still searching ``srt''.  It always returns _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+        srt->isFrozen = FALSE;
+        srt->numCompares = 0;
+        srt->thresh = 0;
+        return _OK_;
+    }
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_sync_init}
+ * \index{nsort_sync_init}
+ *
+ * [Verbatim] */
+
+    int nsort_sync_init(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_sync_init() function makes the sort object given by ``srt'' safe to
+ * use from more than one thread at a time, even while it is being changed.
+ * Afterwards, nsort_find_item() and nsort_query_item() only take a shared (read)
+ * lock and change nothing in the object, so searches run in parallel.
+ * nsort_add_item(), nsort_add_items(), nsort_remove_item(), nsort_new_link() and
+ * nsort_free_link() are serialized with respect to each other.  The ones that
+ * change the sort also take the write lock while they change the list and the
+ * index, so searches wait for the item that is being put in or taken out (or,
+ * for nsort_add_items(), for the whole batch).  That is a simplification:
+ * writers don't only keep out each other, but the wait is about as long as a
+ * search, and it is the rebuilding of the index that takes long.  When the
+ * index needs to be rebuilt, whether because the automatic thresholds were
+ * crossed, because a link that a node points to was removed or because
+ * nsort_restructure_nodes() was called, the new index is built off to the side
+ * while searches go on using the old one; readers are only kept out for the
+ * moment it takes to swap it in.  The lock favors writers where the C library
+ * allows that, so a steady stream of searches can't starve the writers.
+ *
+ * Some things are not covered.  The srt->sortError item is shared by all of the
+ * threads, so it can only be trusted when one thread is using the object.  Links
+ * returned by a search can be removed (and freed) by another thread at any time,
+ * so the application has to make sure that doesn't happen to a link it is still
+ * looking at.  Don't change srt->lh with the list functions, and don't call
+ * nsort_freeze(), nsort_thaw() or nsort_del() while other threads are using the
+ * object.  Searches on a synchronized object don't count compares, so only
+ * writes can trigger an automatic restructure.
+ *
+ * This function should be called after nsort_init() (and nsort_use_arena(), if
+ * it is used) and before the object is shared.  Calling it on an object that is
+ * already synchronized does nothing.  It returns _OK_ on success or _ERROR_ if
+ * the locks could not be allocated or initialized, in which case the error is
+ * in srt->sortError.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_sync_t *sync;
+        pthread_rwlockattr_t attr;
+        int status;
+
+        if (srt->sync != 0)
+            return _OK_;
+        sync = (nsort_sync_t *) malloc(sizeof(nsort_sync_t));
+        if (sync == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np(&attr,
+                                      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        status = pthread_rwlock_init(&sync->lock, &attr);
+        pthread_rwlockattr_destroy(&attr);
+        if (status != 0) {
+            free(sync);
+            srt->sortError = SORT_FNOLOCK;
+            return _ERROR_;
+        }
+        if (pthread_mutex_init(&sync->writer, 0) != 0) {
+            pthread_rwlock_destroy(&sync->lock);
+            free(sync);
+            srt->sortError = SORT_FNOLOCK;
+            return _ERROR_;
+        }
+        srt->sync = sync;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_sync_del}
+ * \index{nsort_sync_del}
+ *
+ * [Verbatim] */
+
+    int nsort_sync_del(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_sync_del() function undoes nsort_sync_init(), destroying the locks
+ * of the sort object given by ``srt''.  No other thread may be using the object
+ * when it is called.  nsort_del() calls it if it is needed.  It always returns
+ * _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+        if (srt->sync == 0)
+            return _OK_;
+        pthread_rwlock_destroy(&srt->sync->lock);
+        pthread_mutex_destroy(&srt->sync->writer);
+        free(srt->sync);
+        srt->sync = 0;
+        return _OK_;
+    }
+
+/*
+ * Rebuild the index of a synchronized sort without keeping searches out while
+ * it is done.  The new index is built on a scratch head from the current list,
+ * then swapped in under the write lock.  Once the write lock is released no
+ * search can be looking at the old nodes, so they are freed then.  The writer
+ * mutex must be held.
+ */
+    static int nsort_sync_rebuild(nsort_t * srt) {
+        nsort_node_t shadow;
+        nsort_node_t *old, *last;
+        size_t num;
+
+        nsort_rebuild_cancel(srt);
+        memset(&shadow, 0, sizeof(nsort_node_t));
+        if (nsort_build_index(srt, &shadow, &last, &num) == _ERROR_)
+            return _ERROR_;
+        pthread_rwlock_wrlock(&srt->sync->lock);
+        old = srt->head->next;
+        srt->head->next = shadow.next;
+        if (shadow.next != srt->tail)
+            shadow.next->prev = srt->head;
+        srt->tail->prev = (last == &shadow) ? srt->head : last;
+        srt->numNodes = num;
+        srt->preCount = 0;
+        srt->current = srt->head;
+        srt->finger[0] = 0;
+        srt->numRestruct++;
+        pthread_rwlock_unlock(&srt->sync->lock);
+        nsort_free_chain(srt, old);
+        return _OK_;
+    }
+
+/*
+ * The restructure thresholds, checked before the write lock is taken.  A
+ * step of the new index is built without keeping searches out; only the
+ * swap at the end takes the write lock.
+ */
+    static int nsort_sync_thresh(nsort_t * srt) {
+        int status;
+
+        status = nsort_restructure_check(srt);
+        srt->numCompares = 0;
+        return status;
+    }
+
+/*
+ * The synchronized versions of nsort_add_item(), nsort_add_items() and
+ * nsort_remove_item().
+ */
+    static int nsort_sync_add_item(nsort_t * srt, nsort_link_t * lnk) {
+        int status;
+
+        pthread_mutex_lock(&srt->sync->writer);
+        if (srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            status = _ERROR_;
+        }
+        else
+            status = nsort_sync_thresh(srt);
+        if (status == _OK_) {
+            pthread_rwlock_wrlock(&srt->sync->lock);
+            status = nsort_add_item_nolock(srt, lnk);
+            pthread_rwlock_unlock(&srt->sync->lock);
+        }
+        pthread_mutex_unlock(&srt->sync->writer);
+        return status;
+    }
+
+    static int nsort_sync_add_items(nsort_t * srt, nsort_link_t ** lnks,
+                                    size_t num, nsort_error_t * errs) {
+        int rebuild = FALSE;
+        int status;
+
+        pthread_mutex_lock(&srt->sync->writer);
+        pthread_rwlock_wrlock(&srt->sync->lock);
+        status = nsort_add_items_nolock(srt, lnks, num, errs, &rebuild);
+        pthread_rwlock_unlock(&srt->sync->lock);
+        if (rebuild && nsort_sync_rebuild(srt) == _ERROR_)
+            status = _ERROR_;
+        pthread_mutex_unlock(&srt->sync->writer);
+        return status;
+    }
+
+    static nsort_link_t *nsort_sync_remove_item(nsort_t * srt,
+                                                nsort_link_t * lnk) {
+        nsort_link_t *link = 0;
+
+        if (lnk == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        pthread_mutex_lock(&srt->sync->writer);
+        if (srt->isFrozen)
+            srt->sortError = SORT_FROZEN;
+        else if (lnk->next == 0 || lnk->prev == 0)
+            srt->sortError = SORT_CORRUPT;
+        else if (nsort_sync_thresh(srt) == _OK_ &&
+                 nsort_snapshot_keep(srt, lnk) == _OK_) {
+            pthread_rwlock_wrlock(&srt->sync->lock);
+            nsort_unindex_link(srt, lnk);
+            srt->lh->current = lnk;
+            link = nsort_list_remove_link(srt->lh);
+            pthread_rwlock_unlock(&srt->sync->lock);
+            if (link == 0)
+                srt->sortError = SORT_CORRUPT;
+        }
+        pthread_mutex_unlock(&srt->sync->writer);
+        return link;
+    }
+#endif
+
+/*
+ * The user should use nsort_save, so don't document this.
+ */
+    int nsort_store(nsort_t * srt, nsort_store_t * ts, int reclen,
+                    char *fname) {
+        int status;
+
+        ts->isUnique = srt->isUnique;
+        ts->manageAllocs = srt->manageAllocs;
+        status = nsort_list_store(srt->lh, ts, reclen, fname);
+        Assert(status != _ERROR_);
+        if (_ERROR_ == status) {
+            if (nsort_check_list_error(srt->lh))
+                srt->sortError = srt->lh->listError;
+            else if (nsort_check_error())
+                srt->sortError = get_sortError();
+            else
+                srt->sortError = SORT_UNSPECIFIED;
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * Fill in the nsort_store_t ``ts'' that goes at the top of a file with the
+ * magic number, the description and the time it is saved.
+ */
+    static void nsort_store_stamp(nsort_store_t * ts, unsigned long magic,
+                                  const char *desc) {
+        time_t now;
+        struct tm result;
+        char tstamp[27];
+        char *cp;
+
+        memset(ts, 0, sizeof(nsort_store_t));
+        ts->thisMagic = magic;
+        if (desc)
+            strncpy(ts->description, desc, 127);
+        time(&now);
+        localtime_r(&now, &result);
+        asctime_r(&result, tstamp);
+        cp = strchr(tstamp, '\n');
+        if (cp != 0)
+            *cp = '\0';
+        strcpy(ts->timeStamp, tstamp);
+    }
+
+#ifndef NSORT_SAVE_SUFFIX
+#define NSORT_SAVE_SUFFIX ".tmp"
+#endif
+
+/*
+ * A save writes to the name of the file with NSORT_SAVE_SUFFIX on the end
+ * and renames it to the name it was given once it has been written (see
+ * nsort_save_finish()), so the file that is there already is never cut short
+ * under a mapping of it, and is left as it was if the save fails.  Return
+ * that name in memory from malloc(), or NULL if there is none.
+ */
+    static char *nsort_save_name(const char *fname) {
+        char *tmpName;
+
+        tmpName = (char *) malloc(strlen(fname) + sizeof(NSORT_SAVE_SUFFIX));
+        if (tmpName != 0) {
+            strcpy(tmpName, fname);
+            strcat(tmpName, NSORT_SAVE_SUFFIX);
+        }
+        return tmpName;
+    }
+
+/*
+ * Rename the file ``tmpName'' that a save wrote to ``fname'' if ``ok'' is
+ * TRUE, or remove it if not, and free ``tmpName'', which may be NULL.  The
+ * global error is not touched, since a save may finish in a thread of its
+ * own; the error of a rename that fails is returned instead.
+ */
+    static nsort_error_t nsort_save_finish(char *tmpName, const char *fname,
+                                           int ok) {
+        nsort_error_t error = SORT_NOERROR;
+
+        if (tmpName == 0)
+            return SORT_NOERROR;
+        if (ok && rename(tmpName, fname) != 0) {
+            if (EACCES == errno)
+                error = SORT_FDENIED;
+            else if (ENOENT == errno)
+                error = SORT_FNOFILE;
+            else
+                error = SORT_ERRNO;
+        }
+        if (!ok || error != SORT_NOERROR)
+            unlink(tmpName);
+        free(tmpName);
+        return error;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save}
+ * \index{nsort_save}
+ *
+ * [Verbatim] */
+
+    int nsort_save(nsort_t * srt, const char *desc, int reclen,
+                   char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save() funciton saves the contents of the list managed by
+ * ``srt'' to a file.  The parameters to this function are as follows:
+ *
+ * \begin{itemize}
+ *
+ * \item [srt] This parameter is an nsort header object that is to be
+ * saved to disk.  The data contained in the srt->lh list is stored
+ * in the file.
+ *
+ * \item [desc] The desc item is the same as the desc parameter for the
+ * nsort_list_save() function.  It is a string that can be up to 127 bytes
+ * long.
+ *
+ * \item [reclen] This parameter is the length of each record that is to
+ * be saved.
+ *
+ * \item [fname] This is the name of the file to save the data to.  This
+ * file will be created if it doesn't exist.  If another file exists with that
+ * name, it will be destroyed and the data irrevocably lost.  The data is
+ * written to a file named ``fname'' with ``.tmp'' on the end, which is renamed
+ * to ``fname'' once it has all been written, so the file that was there is
+ * left as it was if the save fails, and a sort can be saved to the file that
+ * nsort_get_arena() mapped it from.
+ *
+ * \end{itemize}
+ *
+ * Every record takes up ``reclen'' bytes in the file.  If the records are
+ * not all the same length, nsort_save_var() writes a file that is only as big
+ * as the data.
+ *
+ * nsort_save() returns _OK_ if it is successful or _ERROR_ if an error
+ * occurs.  If there is an error, srt->sortError will contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t *ts;
+        char *tmpName;
+        nsort_error_t error;
+        int status;
+
+        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
+        if (0 == ts) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        tmpName = nsort_save_name(fname);
+        if (0 == tmpName) {
+            free(ts);
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        nsort_store_stamp(ts, DEFAULT_MAGIC, desc);
+        status = nsort_store(srt, ts, reclen, tmpName);
+        free(ts);
+        error = nsort_save_finish(tmpName, fname, status == _OK_);
+        if (error != SORT_NOERROR) {
+            srt->sortError = error;
+            return _ERROR_;
+        }
+        return status;
+    }
+
+/*
+ * Write the records of a snapshot, a chunk at a time, finish the file and
+ * call the callback.  This runs in the thread started by nsort_save_async()
+ * (or in the caller, if the thread couldn't be started), so it only touches
+ * the snapshot.
+ */
+    static void nsort_snapshot_write(nsort_snapshot_t * snap) {
+        nsort_error_t error, moved;
+        size_t i, end;
+        int status = _OK_;
+
+        for (i = 0; i < snap->number && status == _OK_;) {
+            end = i + NSORT_SNAPSHOT_CHUNK;
+            if (end > snap->number)
+                end = snap->number;
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_lock(&snap->lock);
+#endif
+            for (; i < end && status == _OK_; i++)
+                status = nsort_writer_put(&snap->w, snap->data[i],
+                                          snap->reclen);
+            snap->done = (status == _OK_) ? i : snap->number;
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_unlock(&snap->lock);
+#endif
+        }
+        error = nsort_writer_finish(&snap->w, snap->syncPolicy);
+        if (close(snap->fd) != 0 && error == SORT_NOERROR)
+            error = (EBADF == errno) ? SORT_FEBADF : SORT_ERRNO;
+        moved = nsort_save_finish(snap->tmpName, snap->fname,
+                                  error == SORT_NOERROR);
+        snap->tmpName = 0;
+        if (error == SORT_NOERROR)
+            error = moved;
+        snap->error = error;
+        if (snap->callback != 0)
+            snap->callback(snap->srt, error, snap->arg);
+    }
+
+#ifdef HAVE_PTHREAD_H
+    static void *nsort_snapshot_thread(void *arg) {
+        nsort_snapshot_write((nsort_snapshot_t *) arg);
+        return 0;
+    }
+#endif
+
+/*
+ * Let go of a snapshot and everything it holds.
+ */
+    static void nsort_snapshot_free(nsort_snapshot_t * snap) {
+        char *copy;
+
+        while (snap->copies != 0) {
+            copy = snap->copies;
+            snap->copies = *(char **) copy;
+            free(copy);
+        }
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_destroy(&snap->lock);
+#endif
+        free(snap->fname);
+        free(snap->tmpName);
+        free(snap->data);
+        free(snap);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save_async}
+ * \index{nsort_save_async}
+ *
+ * [Verbatim] */
+
+    int nsort_save_async(nsort_t * srt, const char *desc, int reclen,
+                         char *fname, void (*callback)(nsort_t *,
+                                                       nsort_error_t,
+                                                       void *), void *arg)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save_async() function saves the contents of the sort object
+ * ``srt'' to the file ``fname'' like nsort_save() does, but it returns as
+ * soon as the save is under way and the file is written by a thread of its
+ * own, so the sort can go on being searched and changed while it is saved.
+ * The ``desc'', ``reclen'' and ``fname'' parameters are the same as the ones
+ * for nsort_save(), and the file is the same as the one nsort_save() would
+ * have written at the moment nsort_save_async() was called.
+ *
+ * To get that, the data pointers of the links are copied into an array,
+ * which costs a pointer for each record and is done while nothing can change
+ * the sort (if the sort is synchronized, the writer lock is held for it, so
+ * searches carry on).  Links added afterwards are not saved.  A link that is
+ * removed while the save is going on has its record copied first if it is
+ * still to be written, so its data can be freed as usual as soon as
+ * nsort_remove_item() returns it; the copies are freed when the save is done.
+ * The records must not be changed in place while the save is going on.
+ *
+ * When the file has been written (and synced, according to the sync policy
+ * of the sort; see nsort_set_sync()), ``callback'' is called, if it is not
+ * NULL, from the thread that wrote the file, with the sort, SORT_NOERROR or
+ * the error that stopped the save, and ``arg''.  Either way, nsort_save_wait()
+ * has to be called to wait for the save and let go of what it holds before
+ * another save can be started.  nsort_del() waits for a save that is still
+ * going on.  Where there are no threads, the file is written before
+ * nsort_save_async() returns.
+ *
+ * nsort_save_async() returns _OK_ if the save was started or _ERROR_ if it
+ * could not be, in which case srt->sortError will contain the error.  It is
+ * SORT_BUSY if a save is already going on.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_snapshot_t *snap;
+        nsort_store_t ts;
+        nsort_link_t *lnk;
+        size_t i;
+        int fd = -1;
+
+        if (reclen <= 0 || srt->lh->number > (size_t) 0x7fffffff) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        snap = (nsort_snapshot_t *) malloc(sizeof(nsort_snapshot_t));
+        if (snap == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(snap, 0, sizeof(nsort_snapshot_t));
+        snap->srt = srt;
+        snap->reclen = (size_t) reclen;
+        snap->syncPolicy = srt->lh->syncPolicy;
+        snap->callback = callback;
+        snap->arg = arg;
+#ifdef HAVE_PTHREAD_H
+        if (pthread_mutex_init(&snap->lock, 0) != 0) {
+            free(snap);
+            srt->sortError = SORT_FNOLOCK;
+            return _ERROR_;
+        }
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
+#endif
+        if (srt->snapshot != 0)
+            srt->sortError = SORT_BUSY;
+        else {
+            snap->number = srt->lh->number;
+            snap->data = (void **) malloc((snap->number + 1) *
+                                          sizeof(void *));
+            if (snap->data == 0)
+                srt->sortError = SORT_NOMEMORY;
+            else {
+                for (lnk = srt->lh->head->next, i = 0; i < snap->number;
+                     lnk = lnk->next, i++)
+                    snap->data[i] = lnk->data;
+                srt->snapshot = snap;
+            }
+        }
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
+#endif
+        if (srt->snapshot != snap) {
+            nsort_snapshot_free(snap);
+            return _ERROR_;
+        }
+
+        nsort_store_stamp(&ts, DEFAULT_MAGIC, desc);
+        ts.isUnique = srt->isUnique;
+        ts.manageAllocs = srt->manageAllocs;
+        ts.number = (int) snap->number;
+        ts.size = reclen;
+        snap->fname = strdup(fname);
+        snap->tmpName = nsort_save_name(fname);
+        if (snap->fname == 0 || snap->tmpName == 0)
+            set_sortError(SORT_NOMEMORY);
+        else
+            nsort_file_create(snap->tmpName, fd);
+        if (!nsort_check_error()) {
+            if (nsort_writer_open(&snap->w, fd, 0) == _ERROR_) {
+                nsort_file_close(fd);
+            }
+            else if (nsort_writer_put(&snap->w, &ts, sizeof(nsort_store_t))
+                     == _ERROR_) {
+                set_sortError(nsort_writer_finish(&snap->w, NSORT_SYNC_NONE));
+                nsort_file_close(fd);
+            }
+        }
+        if (nsort_check_error()) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            nsort_save_finish(snap->tmpName, fname, FALSE);
+            snap->tmpName = 0;
+            nsort_save_wait(srt);
+            return _ERROR_;
+        }
+        snap->fd = fd;
+#ifdef HAVE_PTHREAD_H
+        if (pthread_create(&snap->thread, 0, nsort_snapshot_thread, snap) ==
+            0) {
+            snap->threaded = TRUE;
+            return _OK_;
+        }
+#endif
+        nsort_snapshot_write(snap);
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save_wait}
+ * \index{nsort_save_wait}
+ *
+ * [Verbatim] */
+
+    int nsort_save_wait(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save_wait() function waits for the save started by
+ * nsort_save_async() on the sort object ``srt'' to finish, and lets go of the
+ * snapshot and the copies of the records it took.  Only one thread should wait
+ * for a save.  It returns _OK_ if the file was written (or if there is no save
+ * to wait for) or _ERROR_ if it was not, in which case srt->sortError will
+ * contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_snapshot_t *snap = srt->snapshot;
+        nsort_error_t error;
+
+        if (snap == 0)
+            return _OK_;
+#ifdef HAVE_PTHREAD_H
+        if (snap->threaded)
+            pthread_join(snap->thread, 0);
+        if (srt->sync != 0)
+            pthread_mutex_lock(&srt->sync->writer);
+#endif
+        srt->snapshot = 0;
+#ifdef HAVE_PTHREAD_H
+        if (srt->sync != 0)
+            pthread_mutex_unlock(&srt->sync->writer);
+#endif
+        error = snap->error;
+        nsort_snapshot_free(snap);
+        if (error != SORT_NOERROR) {
+            srt->sortError = error;
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+#ifndef NSORT_READ_CHUNK
+#define NSORT_READ_CHUNK (1024*1024*1024)
+#endif
+
+/*
+ * Read ``len'' bytes from ``fd'' into ``buf'', NSORT_READ_CHUNK bytes at a
+ * time.  The global error is set if the read fails or comes up short.
+ */
+    static int nsort_read_all(int fd, void *buf, size_t len) {
+        size_t done, n;
+        int status;
+
+        for (done = 0; done < len; done += n) {
+            n = len - done;
+            if (n > NSORT_READ_CHUNK)
+                n = NSORT_READ_CHUNK;
+            nsort_file_read(fd, (char *) buf + done, n, status);
+            if (status <= 0 && !nsort_check_error())
+                set_sortError(SORT_FRDWR);
+            if (nsort_check_error())
+                return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * Do not document this as part of the API.
+ *
+ * Every link and record of the sort is allocated on its own, the way
+ * nsort_get() has always done it, so the caller can free them one at a time.
+ */
+    int nsort_retrieve(nsort_t * srt, nsort_store_t * ts,
+                       const char *fname, long magic) {
+        return nsort_retrieve_file(srt, ts, fname, magic, FALSE);
+    }
+
+/*
+ * The body of nsort_retrieve() and nsort_get_arena().  The records are read
+ * straight into an arena, and the links and nodes are laid out after them
+ * with nsort_build_links(), so a sort comes back from a file in a handful
+ * of allocations however many records it has.  Unless ``inArena'' is TRUE,
+ * the records are then copied out to links of their own and the arena is
+ * let go (see nsort_copy_links()).
+ */
+    static int nsort_retrieve_file(nsort_t * srt, nsort_store_t * ts,
+                                   const char *fname, long magic,
+                                   int inArena) {
+        char *base = 0;
+        size_t num, recSize;
+        int fd, status;
+
+        nsort_file_open(fname, fd);
+        if (nsort_check_error()) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        nsort_file_read(fd, ts, sizeof(nsort_store_t), status);
+        if (!nsort_check_error() && ts->thisMagic == NSORT_MAP_MAGIC &&
+            (unsigned long) magic == DEFAULT_MAGIC) {
+            nsort_file_close(fd);
+            set_sortError(SORT_NOERROR);
+            return nsort_retrieve_map(srt, ts, fname, inArena);
+        }
+        if (!nsort_check_error() && ts->thisMagic == NSORT_FRONT_MAGIC &&
+            (unsigned long) magic == DEFAULT_MAGIC) {
+            nsort_file_close(fd);
+            set_sortError(SORT_NOERROR);
+            return nsort_retrieve_front(srt, ts, fname, inArena);
+        }
+        if (!nsort_check_error() && ts->thisMagic == NSORT_VAR_MAGIC &&
+            (unsigned long) magic == DEFAULT_MAGIC) {
+            status = nsort_retrieve_var(srt, ts, fd, inArena);
+            nsort_file_close(fd);
+            set_sortError(SORT_NOERROR);
+            return status;
+        }
+        if (!nsort_check_error() &&
+            (ts->thisMagic != (unsigned long) magic || ts->number < 0 ||
+             ts->size < 0))
+            set_sortError(SORT_LIST_BADFILE);
+        if (nsort_check_error()) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            nsort_file_close(fd);
+            return _ERROR_;
+        }
+        num = (size_t) ts->number;
+        recSize = (size_t) ts->size;
+        if (nsort_build_shell(srt, num,
+                              NSORT_ARENA_ROUND(num * recSize)) == _ERROR_) {
+            nsort_file_close(fd);
+            return _ERROR_;
+        }
+        if (num * recSize > 0) {
+            base = (char *) nsort_arena_alloc(srt->lh->arena, num * recSize);
+            if (base == 0) {
+                set_sortError(SORT_NOERROR);
+                srt->sortError = SORT_NOMEMORY;
+                nsort_file_close(fd);
+                return _ERROR_;
+            }
+        }
+        if (nsort_read_all(fd, base, num * recSize) == _ERROR_) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            nsort_file_close(fd);
+            return _ERROR_;
+        }
+        nsort_file_close(fd);
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+        return nsort_build_links(srt, 0, base, recSize, 0, num, !inArena);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_get}
+ * \index{nsort_get}
+ *
+ * [Verbatim] */
+
+    int nsort_get(nsort_t * srt, int (*compare)(void *, void *),
+                  const char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_get() function reads populates the nsort object ``srt'' with
+ * the contents of the data in the file given by  ``fname''.  The following
+ * are the parameters for this function:
+ *
+ * \begin{itemize}
+ *
+ * \item [srt] This parameter is the nsort object.  It should be created
+ * with a call to nsort_create() just for the purpose of storing the data
+ * that is retrieved from the file by this function.  It will be initialized
+ * here.
+ *
+ * \item [compare] This is the compare function that will determine the sort
+ * order.  It should be the same compare function that was used to sort the
+ * data that was stored in the file in the first place.
+ *
+ * \item [fname] This parameter is the name of the file to read the data
+ * from.  The file is opened read-only and the data is read and used to
+ * populate the in memory objects.
+ *
+ * \end{itemize}
+ *
+ * Each record is given a link and a block of memory of its own from
+ * malloc(), so a link that is removed from the sort can be freed with
+ * free(), along with its data, and nsort_del() with manageAllocs set frees
+ * them the same way, calling ``delFunc'' if one is given.  A file written by
+ * nsort_save_var() is read like one written by nsort_save(), except that
+ * each record is only as long as it was when it was saved, the keys of a
+ * file written by nsort_save_front() are decoded whole, and the records of a
+ * file written by nsort_save_map() are copied out of it, so the file is not
+ * held open.  nsort_get_arena() gets a sort back faster, at the cost of
+ * these rules.
+ *
+ * The nsort_get() function returns _OK_ if it is successful or _ERROR_
+ * if there is an error.  On error, you can get a description of the
+ * error by calling nsort_show_sort_error().
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_get_file(srt, compare, fname, FALSE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_get_arena}
+ * \index{nsort_get_arena}
+ *
+ * [Verbatim] */
+
+    int nsort_get_arena(nsort_t * srt, int (*compare)(void *, void *),
+                        const char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_get_arena() function does what nsort_get() does, with the same
+ * parameters, but the records are read from the file in one piece into an
+ * arena (see nsort_use_arena()), and the links and index are laid out behind
+ * them the way nsort_build_sorted() does it, so getting a sort back costs
+ * little more than reading the file.  If the file was written by
+ * nsort_save_map(), it is mapped into memory instead of being read, and the
+ * links point at the records where they lie in the mapping (which is
+ * private, so changing a record does not change the file).
+ *
+ * Since the records, links and nodes all live in the arena, nsort_del()
+ * frees them a slab at a time, and ``delFunc'' is not called on the records
+ * that are in the arena.  A link that is removed from the sort has to be let
+ * go with nsort_free_link(), not free(), and links that are added should
+ * come from nsort_new_link().  The function returns _OK_ if it is successful
+ * or _ERROR_ with the error in srt->sortError.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_get_file(srt, compare, fname, TRUE);
+    }
+
+/*
+ * The body of nsort_get() and nsort_get_arena().
+ */
+    static int nsort_get_file(nsort_t * srt, int (*compare)(void *, void *),
+                              const char *fname, int inArena) {
+        nsort_store_t *ts;
+        int status;
+
+        memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
+        srt->compare = compare;
+
+        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
+        if (0 == ts) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+
+        status = nsort_retrieve_file(srt, ts, fname, DEFAULT_MAGIC, inArena);
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+        free(ts);
+        if (status == _ERROR_) {
+            if (srt->lh != 0)
+                nsort_del(srt, 0);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_get_all}
+ * \index{nsort_get_all}
+ *
+ * [Verbatim] */
+
+    int nsort_get_all(nsort_t * srt, int (*compare)(void *, void *),
+                      const char *fname, char *desc, char *timestamp)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_get_all() function is similar to the nsort_get function except
+ * that it copies the description and the time stamp that are stored in the
+ * file to ``desc'' and ``timestamp'' respectively.  The following are the
+ * parameters for this function:
+ *
+ * \begin{itemize}
+ *
+ * \item [srt] This parameter is the nsort object.  It should be created
+ * with a call to nsort_create() just for the purpose of storing the data
+ * that is retrieved from the file by this function.  It will be initialized
+ * here.
+ *
+ * \item [compare] This is the compare function that will determine the sort
+ * order.  It should be the same compare function that was used to sort the
+ * data that was stored in the file in the first place.
+ *
+ * \item [fname] This parameter is the name of the file to read the data
+ * from.  The file is opened read-only and the data is read and used to
+ * populate the in memory objects.
+ *
+ * \item [desc] This parameter should be a character array with enough
+ * storage to hold 127 characters.  The description that was put in the
+ * file when it was stored will be copied to this.
+ *
+ * \item [timestamp] This parameter should be a character array with
+ * enough storage to hold 26 characters.  The time stamp that was put
+ * in the file when it was stored will be copied to this.
+ *
+ * \end{itemize}
+ *
+ * The nsort_get_all() function returns _OK_ if it succeeds and _ERROR_ if there
+ * is an error.  On error, you can get a description of what went wrong
+ * by calling the nsort_show_sort_error() function.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t *ts;
+        int status;
+
+        memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
+        srt->compare = compare;
+
+        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
+        if (0 == ts) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+
+        status = nsort_retrieve(srt, ts, fname, DEFAULT_MAGIC);
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+#ifndef __clang__
+#if defined (__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstringop-truncation"
+#endif
+#endif
+        strncpy(desc, ts->description, 127);
+        strncpy(timestamp, ts->timeStamp, 26);
+#ifndef __clang__
+#if defined (__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+        free(ts);
+        if (status == _ERROR_) {
+            if (srt->lh != 0)
+                nsort_del(srt, 0);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * Map the file ``fname'' into memory and return where it is, with its length
+ * in *length.  If ``writable'' is set, the mapping is private, so it can be
+ * written to without changing the file.  Pages are only read in when they are
+ * touched.  Where there is no mmap(), the file is read into memory instead.
+ * NULL is returned, with the global error set, if this fails.
+ */
+    static void *nsort_map_file(const char *fname, size_t * length,
+                                int writable) {
+        struct stat sbuf;
+        void *base;
+        int fd;
+
+        nsort_file_open(fname, fd);
+        if (nsort_check_error())
+            return 0;
+        if (fstat(fd, &sbuf) != 0 || sbuf.st_size <= 0) {
+            nsort_file_close(fd);
+            set_sortError(SORT_LIST_BADFILE);
+            return 0;
+        }
+        *length = (size_t) sbuf.st_size;
+#ifdef HAVE_SYS_MMAN_H
+        base = mmap(0, *length, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+        if (base == MAP_FAILED) {
+            base = 0;
+            set_sortError((ENOMEM == errno) ? SORT_NOMEMORY : SORT_ERRNO);
+        }
+#else
+        (void) writable;
+        base = malloc(*length);
+        if (base == 0)
+            set_sortError(SORT_NOMEMORY);
+        else if (nsort_read_all(fd, base, *length) == _ERROR_) {
+            free(base);
+            base = 0;
+        }
+#endif
+        nsort_file_close(fd);
+        return base;
+    }
+
+/*
+ * Let go of a file mapped by nsort_map_file().
+ */
+    static void nsort_unmap_file(void *base, size_t length) {
+#ifdef HAVE_SYS_MMAN_H
+        munmap(base, length);
+#else
+        (void) length;
+        free(base);
+#endif
+    }
+
+/*
+ * Put a slab in the arena ``ar'' that stands for the mapping of ``length''
+ * bytes at ``base'', so that the mapping is let go when the arena is deleted.
+ * The slab has no memory to hand out, so it goes behind the current slab.
+ */
+    static int nsort_arena_add_map(nsort_arena_t * ar, void *base,
+                                   size_t length) {
+        nsort_slab_t *slab;
+
+        slab = (nsort_slab_t *) malloc(NSORT_SLAB_HDR);
+        if (slab == 0) {
+            set_sortError(SORT_NOMEMORY);
+            return _ERROR_;
+        }
+        slab->size = 0;
+        slab->used = 0;
+        slab->map = base;
+        slab->mapLength = length;
+        if (ar->slabs != 0) {
+            slab->next = ar->slabs->next;
+            ar->slabs->next = slab;
+        }
+        else {
+            slab->next = 0;
+            ar->slabs = slab;
+        }
+        ar->numSlabs++;
+        return _OK_;
+    }
+
+/*
+ * Check the headers of a file of ``length'' bytes mapped at ``base'' and
+ * fill in ``map'' from them.  SORT_LIST_BADFILE is returned if the file was
+ * not written by nsort_save_map() or has been cut short.
+ */
+    static nsort_error_t nsort_map_setup(nsort_map_t * map, char *base,
+                                         size_t length) {
+        nsort_map_store_t ms;
+        size_t hdr = sizeof(nsort_store_t) + sizeof(nsort_map_store_t);
+        int i;
+
+        if (length < hdr)
+            return SORT_LIST_BADFILE;
+        memcpy(&map->store, base, sizeof(nsort_store_t));
+        memcpy(&ms, base + sizeof(nsort_store_t), sizeof(nsort_map_store_t));
+        if (map->store.thisMagic != NSORT_MAP_MAGIC || ms.length != length ||
+            ms.size == 0 || ms.every < 2 || ms.numLevels < 1 ||
+            ms.numLevels > NSORT_MAP_LEVELS || ms.count[0] != ms.number)
+            return SORT_LIST_BADFILE;
+        for (i = 0; i < ms.numLevels; i++) {
+            if (ms.offset[i] < hdr || ms.offset[i] > length ||
+                ms.count[i] > (length - ms.offset[i]) / ms.size ||
+                (i > 0 &&
+                 ms.count[i] != (ms.count[i - 1] + ms.every - 1) / ms.every))
+                return SORT_LIST_BADFILE;
+            map->count[i] = ms.count[i];
+            map->level[i] = base + ms.offset[i];
+        }
+        map->base = base;
+        map->length = length;
+        map->number = ms.number;
+        map->size = ms.size;
+        map->every = ms.every;
+        map->numLevels = ms.numLevels;
+        return SORT_NOERROR;
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ *
+ * nsort_get() of a file written by nsort_save_map().  The file is mapped
+ * and the links are pointed at the records where they lie, so nothing but
+ * the links and the index is read into memory, and the records are only
+ * read in from the file as they are touched.  The mapping belongs to the
+ * arena of the sort from then on, and unless ``inArena'' is TRUE the
+ * records are copied out of it and it is let go straight away.
+ */
+    static int nsort_retrieve_map(nsort_t * srt, nsort_store_t * ts,
+                                  const char *fname, int inArena) {
+        nsort_map_t map;
+        nsort_error_t err;
+        size_t length = 0;
+        char *base;
+
+        base = (char *) nsort_map_file(fname, &length, TRUE);
+        if (base == 0) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        memset(&map, 0, sizeof(nsort_map_t));
+        err = nsort_map_setup(&map, base, length);
+        if (err != SORT_NOERROR) {
+            nsort_unmap_file(base, length);
+            srt->sortError = err;
+            return _ERROR_;
+        }
+        memcpy(ts, &map.store, sizeof(nsort_store_t));
+        if (nsort_build_shell(srt, map.number, 0) == _ERROR_) {
+            nsort_unmap_file(base, length);
+            return _ERROR_;
+        }
+        if (nsort_arena_add_map(srt->lh->arena, base, length) == _ERROR_) {
+            nsort_unmap_file(base, length);
+            set_sortError(SORT_NOERROR);
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+        return nsort_build_links(srt, 0, map.level[0], map.size, 0,
+                                 map.number, !inArena);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save_map}
+ * \index{nsort_save_map}
+ *
+ * [Verbatim] */
+
+    int nsort_save_map(nsort_t * srt, const char *desc, int reclen,
+                       char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save_map() function saves the contents of the sort object
+ * ``srt'' to the file ``fname'' like nsort_save() does, but in a form that can
+ * be used where it lies once it is mapped into memory.  The records are
+ * written in order starting on a page boundary, and an index of the records is
+ * written after them (see nsort_map_store_t).  The parameters are the same as
+ * the ones for nsort_save().
+ *
+ * A file written this way can be read back with nsort_get() or
+ * nsort_get_all(), which tell it from a file written by nsort_save() by its
+ * magic number.  nsort_get_arena() goes further: rather than reading the
+ * records in, it maps the file and points the links at the records where they
+ * lie, so getting even a very large sort back costs the links and the index
+ * and nothing more, and the records are read in from the file by the system
+ * as they are used.  A file can also be searched without building a sort at
+ * all with nsort_map_open().  Like nsort_save(), nsort_save_map() writes the
+ * file under another name and renames it to ``fname'' when it is done, so a
+ * sort that nsort_get_arena() mapped from ``fname'' can be saved back to it.
+ *
+ * nsort_save_map() returns _OK_ if it is successful or _ERROR_ if an error
+ * occurs, in which case srt->sortError will contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t ts;
+        nsort_map_store_t ms;
+        nsort_writer_t w;
+        nsort_link_t *lnk;
+        char *fences = 0, *level[NSORT_MAP_LEVELS], *cp;
+        size_t stride[NSORT_MAP_LEVELS];
+        size_t size, i, where, len;
+        char *tmpName;
+        nsort_error_t error;
+        int fd = -1, j, k, status = _OK_;
+
+        if (reclen <= 0) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        memset(&ms, 0, sizeof(nsort_map_store_t));
+        size = (size_t) reclen;
+        ms.number = srt->lh->number;
+        ms.size = size;
+        ms.every = NSORT_MAP_PAGE / size;
+        if (ms.every < NSORT_MAP_MIN_EVERY)
+            ms.every = NSORT_MAP_MIN_EVERY;
+        ms.count[0] = ms.number;
+        stride[0] = 1;
+        for (k = 1; k < NSORT_MAP_LEVELS && ms.count[k - 1] > ms.every; k++) {
+            ms.count[k] = (ms.count[k - 1] + ms.every - 1) / ms.every;
+            stride[k] = stride[k - 1] * ms.every;
+        }
+        ms.numLevels = k;
+        where = NSORT_ARENA_ROUND(sizeof(nsort_store_t) +
+                                  sizeof(nsort_map_store_t));
+        where = (where + NSORT_MAP_PAGE - 1) / NSORT_MAP_PAGE * NSORT_MAP_PAGE;
+        for (k = 0; k < ms.numLevels; k++) {
+            ms.offset[k] = where;
+            where = NSORT_ARENA_ROUND(where + ms.count[k] * size);
+        }
+        ms.length = ms.offset[ms.numLevels - 1] +
+            ms.count[ms.numLevels - 1] * size;
+
+        nsort_store_stamp(&ts, NSORT_MAP_MAGIC, desc);
+        ts.isUnique = srt->isUnique;
+        ts.manageAllocs = srt->manageAllocs;
+        ts.number = (ms.number > (size_t) 0x7fffffff) ? -1 : (int) ms.number;
+        ts.size = reclen;
+
+        /* the levels above the records are gathered as they go by */
+        len = 0;
+        for (k = 1; k < ms.numLevels; k++)
+            len += ms.count[k] * size;
+        if (len > 0)
+            fences = (char *) malloc(len);
+        if (len > 0 && fences == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        for (k = 1, cp = fences; k < ms.numLevels; k++) {
+            level[k] = cp;
+            cp += ms.count[k] * size;
+        }
+
+        tmpName = nsort_save_name(fname);
+        if (tmpName == 0)
+            set_sortError(SORT_NOMEMORY);
+        else
+            nsort_file_create(tmpName, fd);
+        if (!nsort_check_error() && nsort_writer_open(&w, fd, 0) == _OK_) {
+            status = nsort_writer_put(&w, &ts, sizeof(nsort_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, &ms, sizeof(nsort_map_store_t));
+            where = sizeof(nsort_store_t) + sizeof(nsort_map_store_t);
+            for (k = 0; k < ms.numLevels && status == _OK_; k++) {
+                status = nsort_writer_put(&w, 0, ms.offset[k] - where);
+                if (k == 0)
+                    for (lnk = srt->lh->head->next, i = 0;
+                         i < ms.number && status == _OK_;
+                         lnk = lnk->next, i++) {
+                        status = nsort_writer_put(&w, lnk->data, size);
+                        for (j = 1; j < ms.numLevels && i % stride[j] == 0;
+                             j++)
+                            memcpy(level[j] + i / stride[j] * size,
+                                   lnk->data, size);
+                    }
+                else if (status == _OK_)
+                    status = nsort_writer_put(&w, level[k],
+                                              ms.count[k] * size);
+                where = ms.offset[k] + ms.count[k] * size;
+            }
+            if (nsort_writer_close(&w, srt->lh->syncPolicy) == _ERROR_)
+                status = _ERROR_;
+        }
+        if (fd >= 0)
+            nsort_file_close(fd);
+        free(fences);
+        error = nsort_save_finish(tmpName, fname,
+                                  !nsort_check_error() && status == _OK_);
+        if (error != SORT_NOERROR)
+            set_sortError(error);
+        if (nsort_check_error() || status == _ERROR_) {
+            srt->sortError = nsort_check_error() ? get_sortError() :
+                SORT_FRDWR;
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_open}
+ * \index{nsort_map_open}
+ *
+ * [Verbatim] */
+
+    int nsort_map_open(nsort_map_t * map, int (*compare)(void *, void *),
+                       const char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_open() function maps the file ``fname'', which must have been
+ * written by nsort_save_map(), into memory and sets up ``map'' to search it
+ * with ``compare'', which should be the compare function the sort was made
+ * with.  Nothing is read from the file but the headers; the pages of the
+ * index and of the records are read in by the system as searches touch them,
+ * which is about a page for each level of the index and one or two pages of
+ * records for each search.  The records can not be changed through ``map''.
+ *
+ * The nsort_map_open() function returns _OK_ if it is successful or _ERROR_
+ * if there is an error, in which case the global error is set and
+ * nsort_show_error() will describe it.  A file that was not written by
+ * nsort_save_map() gives SORT_LIST_BADFILE.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_error_t err;
+        size_t length = 0;
+        char *base;
+
+        if (map == 0 || compare == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        memset(map, 0, sizeof(nsort_map_t));
+        base = (char *) nsort_map_file(fname, &length, FALSE);
+        if (base == 0)
+            return _ERROR_;
+        err = nsort_map_setup(map, base, length);
+        if (err != SORT_NOERROR) {
+            nsort_unmap_file(base, length);
+            memset(map, 0, sizeof(nsort_map_t));
+            set_sortError(err);
+            return _ERROR_;
+        }
+        map->compare = compare;
+        return _OK_;
+    }
+
+/*
+ * The number of records of ``map'' that are less than ``key'' (or, if
+ * ``upper'' is set, not greater than it).  On each level of the index from
+ * the top down, only the block of ``every'' entries under the entry found on
+ * the level above is searched.
+ */
+    static size_t nsort_map_bound(nsort_map_t * map, void *key, int upper) {
+        size_t lo = 0, hi, mid;
+        int i, status;
+
+        hi = map->count[map->numLevels - 1];
+        for (i = map->numLevels - 1;; i--) {
+            while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                status = map->compare(map->level[i] + mid * map->size, key);
+                if (status < 0 || (upper && status == 0))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (i == 0)
+                return lo;
+            /*
+             * Entry lo - 1 on this level is before the bound and entry lo is
+             * not, so the bound on the level below is past the first of the
+             * entries under lo - 1 and no further than the first under lo.
+             */
+            hi = lo * map->every;
+            if (hi > map->count[i - 1])
+                hi = map->count[i - 1];
+            lo = (lo == 0) ? 0 : (lo - 1) * map->every + 1;
+        }
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_lower_bound}
+ * \index{nsort_map_lower_bound}
+ *
+ * [Verbatim] */
+
+    size_t nsort_map_lower_bound(nsort_map_t * map, void *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_lower_bound() function returns the place of the first record
+ * in ``map'' that is not less than ``key'', or map->number if there isn't one.
+ * Like the compare function of a sort, ``key'' points at data of the kind the
+ * records hold.  Records are numbered from 0; use nsort_map_record() to get
+ * at one.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_map_bound(map, key, FALSE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_upper_bound}
+ * \index{nsort_map_upper_bound}
+ *
+ * [Verbatim] */
+
+    size_t nsort_map_upper_bound(nsort_map_t * map, void *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_upper_bound() function returns the place of the first record
+ * in ``map'' that is greater than ``key'', or map->number if there isn't one.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_map_bound(map, key, TRUE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_record}
+ * \index{nsort_map_record}
+ *
+ * [Verbatim] */
+
+    void *nsort_map_record(nsort_map_t * map, size_t i)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_record() function returns a pointer to record ``i'' of
+ * ``map'', where it lies in the mapping, or NULL if there are not that many
+ * records.
+ *
+ * [EndDoc]
+ */
+    {
+        if (i >= map->number)
+            return 0;
+        return map->level[0] + i * map->size;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_find}
+ * \index{nsort_map_find}
+ *
+ * [Verbatim] */
+
+    void *nsort_map_find(nsort_map_t * map, void *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_find() function returns a pointer to the first record of
+ * ``map'' that compares equal to ``key'', where it lies in the mapping, or
+ * NULL if there isn't one.
+ *
+ * [EndDoc]
+ */
+    {
+        char *rec;
+
+        rec = (char *) nsort_map_record(map, nsort_map_bound(map, key, FALSE));
+        if (rec == 0 || map->compare(rec, key) != 0)
+            return 0;
+        return rec;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_map_close}
+ * \index{nsort_map_close}
+ *
+ * [Verbatim] */
+
+    int nsort_map_close(nsort_map_t * map)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_map_close() function lets go of the file that ``map'' was set up
+ * on by nsort_map_open().  The records it pointed to can not be used after
+ * this.  It returns _OK_, or _ERROR_ with the global error set to SORT_PARAM
+ * if ``map'' is not open.
+ *
+ * [EndDoc]
+ */
+    {
+        if (map == 0 || map->base == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        nsort_unmap_file(map->base, map->length);
+        memset(map, 0, sizeof(nsort_map_t));
+        return _OK_;
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ *
+ * nsort_get() or nsort_get_arena() of a file written by nsort_save_var(),
+ * with ``fd'' just past the nsort_store_t.  The table of where each record
+ * starts is read into a buffer of its own, the records are read in one piece
+ * into the arena of the sort and the links are laid out after them, pointing
+ * at the records the table says.
+ */
+    static int nsort_retrieve_var(nsort_t * srt, nsort_store_t * ts, int fd,
+                                  int inArena) {
+        size_t *off;
+        char *base;
+        size_t num, i;
+        int status = _ERROR_;
+
+        if (ts->number < 0) {
+            srt->sortError = SORT_LIST_BADFILE;
+            return _ERROR_;
+        }
+        num = (size_t) ts->number;
+        off = (size_t *) malloc((num + 1) * sizeof(size_t));
+        if (off == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        if (nsort_read_all(fd, off, (num + 1) * sizeof(size_t)) == _ERROR_) {
+            srt->sortError = get_sortError();
+            goto done;
+        }
+        for (i = 0; i <= num; i++)
+            if (off[i] % NSORT_VAR_ALIGN != 0 ||
+                (i < num && off[i] > off[i + 1]))
+                break;
+        if (i <= num || off[0] != 0) {
+            srt->sortError = SORT_LIST_BADFILE;
+            goto done;
+        }
+        if (nsort_build_shell(srt, num, NSORT_ARENA_ROUND(off[num])) ==
+            _ERROR_)
+            goto done;
+        base = (char *) nsort_arena_alloc(srt->lh->arena, off[num]);
+        if (base == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            goto done;
+        }
+        if (nsort_read_all(fd, base, off[num]) == _ERROR_) {
+            srt->sortError = get_sortError();
+            goto done;
+        }
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+        status = nsort_build_links(srt, 0, base, 0, off, num, !inArena);
+      done:
+        set_sortError(SORT_NOERROR);
+        free(off);
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save_var}
+ * \index{nsort_save_var}
+ *
+ * [Verbatim] */
+
+    int nsort_save_var(nsort_t * srt, const char *desc,
+                       size_t (*reclen)(void *), char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save_var() function saves the contents of the sort object
+ * ``srt'' to the file ``fname'' like nsort_save() does, except that the
+ * records do not have to be the same length.  The ``reclen'' function is
+ * called with the data of each link and returns the number of bytes of it
+ * to save, which for a structure that ends in a string buffer can be the
+ * offset of the buffer plus the length of the string and its terminator.
+ * The other parameters are the same as the ones for nsort_save().
+ *
+ * The file has an nsort_store_t at the top whose thisMagic is
+ * NSORT_VAR_MAGIC and whose size is 0, then a table of number + 1 size_t
+ * offsets of the records from the start of the record area (the last being
+ * its length), then the records.  Each record is padded to a multiple of
+ * NSORT_VAR_ALIGN bytes (8 unless it is defined otherwise) so that it can be
+ * used in place once it is read back.  The file is as big as the data in it rather than as big as the
+ * biggest record times the number of records, and so is the time it takes
+ * to write and read.
+ *
+ * A file written this way is read back with nsort_get() or nsort_get_all(),
+ * which tell it from a file written by nsort_save() by its magic number.  The
+ * data of each link that comes back is only as long as what was saved, so an
+ * application that saves part of a structure must not use the rest of it in
+ * the links it gets back.
+ *
+ * nsort_save_var() returns _OK_ if it is successful or _ERROR_ if an error
+ * occurs, in which case srt->sortError will contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t ts;
+        nsort_writer_t w;
+        nsort_link_t *lnk;
+        size_t *off;
+        size_t num, i, len;
+        char *tmpName;
+        nsort_error_t error;
+        int fd = -1, status = _OK_;
+
+        num = srt->lh->number;
+        if (reclen == 0 || num > (size_t) 0x7fffffff) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        nsort_store_stamp(&ts, NSORT_VAR_MAGIC, desc);
+        ts.isUnique = srt->isUnique;
+        ts.manageAllocs = srt->manageAllocs;
+        ts.number = (int) num;
+        ts.size = 0;
+        off = (size_t *) malloc((num + 1) * sizeof(size_t));
+        if (off == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        off[0] = 0;
+        for (lnk = srt->lh->head->next, i = 0; i < num; lnk = lnk->next, i++)
+            off[i + 1] = off[i] + (reclen(lnk->data) + NSORT_VAR_ALIGN - 1) /
+                NSORT_VAR_ALIGN * NSORT_VAR_ALIGN;
+
+        tmpName = nsort_save_name(fname);
+        if (tmpName == 0)
+            set_sortError(SORT_NOMEMORY);
+        else
+            nsort_file_create(tmpName, fd);
+        if (!nsort_check_error() && nsort_writer_open(&w, fd, 0) == _OK_) {
+            status = nsort_writer_put(&w, &ts, sizeof(nsort_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, off, (num + 1) * sizeof(size_t));
+            for (lnk = srt->lh->head->next, i = 0; i < num && status == _OK_;
+                 lnk = lnk->next, i++) {
+                len = reclen(lnk->data);
+                status = nsort_writer_put(&w, lnk->data, len);
+                if (status == _OK_ && off[i + 1] - off[i] > len)
+                    status = nsort_writer_put(&w, 0, off[i + 1] - off[i] - len);
+            }
+            if (nsort_writer_close(&w, srt->lh->syncPolicy) == _ERROR_)
+                status = _ERROR_;
+        }
+        if (fd >= 0)
+            nsort_file_close(fd);
+        free(off);
+        error = nsort_save_finish(tmpName, fname,
+                                  !nsort_check_error() && status == _OK_);
+        if (error != SORT_NOERROR)
+            set_sortError(error);
+        if (nsort_check_error() || status == _ERROR_) {
+            srt->sortError = nsort_check_error() ? get_sortError() :
+                SORT_FRDWR;
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+#ifndef NSORT_FRONT_LOCAL
+#define NSORT_FRONT_LOCAL 1024
+#endif
+
+/* where the block table starts in a front-coded file */
+#define NSORT_FRONT_HDR \
+    NSORT_ARENA_ROUND(sizeof(nsort_store_t) + sizeof(nsort_front_store_t))
+
+/*
+ * Put ``v'' in ``out'' 7 bits at a time, low bits first, with the top bit
+ * set on all but the last byte, and return the number of bytes it takes.
+ * ``out'' must have room for 10 bytes.
+ */
+    static size_t nsort_front_varint(unsigned char *out, size_t v) {
+        size_t n = 0;
+
+        while (v >= 0x80) {
+            out[n++] = (unsigned char) (v | 0x80);
+            v >>= 7;
+        }
+        out[n++] = (unsigned char) v;
+        return n;
+    }
+
+/*
+ * Decode the key at ``p'' into ``buf'', which holds the key before it (*len
+ * bytes long) unless ``first'' is set, in which case the key is stored whole.
+ * *len is set to the length of the new key.  The place after the key is
+ * returned, or NULL if the key runs past ``end'' or is longer than
+ * ``maxLength'' with its terminator, which means the keys are corrupt.
+ */
+    static const char *nsort_front_next(const char *p, const char *end,
+                                        char *buf, size_t * len,
+                                        size_t maxLength, int first) {
+        const char *q;
+        size_t pre = 0, n;
+        unsigned char c;
+        int shift = 0;
+
+        if (!first) {
+            do {
+                if (p >= end || shift > 63)
+                    return 0;
+                c = (unsigned char) *p++;
+                pre |= (size_t) (c & 0x7f) << shift;
+                shift += 7;
+            } while (c & 0x80);
+            if (pre > *len)
+                return 0;
+        }
+        if (p >= end)
+            return 0;
+        q = (const char *) memchr(p, '\0', (size_t) (end - p));
+        if (q == 0)
+            return 0;
+        n = (size_t) (q - p);
+        if (pre + n >= maxLength)
+            return 0;
+        memcpy(buf + pre, p, n + 1);
+        *len = pre + n;
+        return q + 1;
+    }
+
+/*
+ * Front-code the keys of ``srt'', in blocks of fs->every, and return the
+ * length of the key area.  If ``block'' is not NULL, where each block starts
+ * is put in it and fs->maxLength and fs->rawLength are worked out.  The key
+ * area goes to ``w'' if it is not NULL, or else to ``out'' if that is not
+ * NULL; (size_t)_ERROR_ is returned, with the global error set, if it can't
+ * be written.
+ */
+    static size_t nsort_front_emit(nsort_t * srt, nsort_front_store_t * fs,
+                                   size_t * block, nsort_writer_t * w,
+                                   char *out) {
+        unsigned char hdr[16];
+        nsort_link_t *lnk;
+        const char *key, *prev = 0;
+        size_t i, pre, n, len, where = 0;
+
+        for (lnk = srt->lh->head->next, i = 0; lnk != srt->lh->tail;
+             lnk = lnk->next, i++) {
+            key = (const char *) lnk->data;
+            pre = n = 0;
+            if (i % fs->every == 0) {
+                if (block != 0)
+                    block[i / fs->every] = where;
+            }
+            else {
+                while (prev[pre] != '\0' && prev[pre] == key[pre])
+                    pre++;
+                n = nsort_front_varint(hdr, pre);
+            }
+            len = strlen(key + pre) + 1;
+            if (block != 0) {
+                if (pre + len > fs->maxLength)
+                    fs->maxLength = pre + len;
+                fs->rawLength += pre + len;
+            }
+            if (w != 0) {
+                if (nsort_writer_put(w, hdr, n) == _ERROR_ ||
+                    nsort_writer_put(w, key + pre, len) == _ERROR_)
+                    return (size_t) _ERROR_;
+            }
+            else if (out != 0) {
+                memcpy(out + where, hdr, n);
+                memcpy(out + where + n, key + pre, len);
+            }
+            where += n + len;
+            prev = key;
+        }
+        return where;
+    }
+
+/*
+ * Check the headers of the front-coded keys of ``length'' bytes at ``base''
+ * and fill in ``fc'' from them.  SORT_LIST_BADFILE is returned if they were
+ * not written by nsort_save_front() or have been cut short.  The keys
+ * themselves are checked as they are decoded.
+ */
+    static nsort_error_t nsort_front_setup(nsort_front_t * fc, char *base,
+                                           size_t length) {
+        nsort_front_store_t fs;
+        size_t b;
+
+        if (length < NSORT_FRONT_HDR)
+            return SORT_LIST_BADFILE;
+        memcpy(&fc->store, base, sizeof(nsort_store_t));
+        memcpy(&fs, base + sizeof(nsort_store_t), sizeof(nsort_front_store_t));
+        if (fc->store.thisMagic != NSORT_FRONT_MAGIC || fs.every == 0 ||
+            fs.numBlocks != fs.number / fs.every +
+            (fs.number % fs.every != 0) ||
+            fs.numBlocks > (length - NSORT_FRONT_HDR) / sizeof(size_t) ||
+            fs.length != length - NSORT_FRONT_HDR -
+            fs.numBlocks * sizeof(size_t))
+            return SORT_LIST_BADFILE;
+        fc->block = (size_t *) (base + NSORT_FRONT_HDR);
+        fc->keys = (char *) (fc->block + fs.numBlocks);
+        if (fs.number > 0 && (fs.maxLength == 0 || fc->block[0] != 0 ||
+                              fc->keys[fs.length - 1] != '\0'))
+            return SORT_LIST_BADFILE;
+        for (b = 1; b < fs.numBlocks; b++)
+            if (fc->block[b] <= fc->block[b - 1] ||
+                fc->block[b] >= fs.length)
+                return SORT_LIST_BADFILE;
+        fc->base = base;
+        fc->length = length;
+        fc->number = fs.number;
+        fc->every = fs.every;
+        fc->numBlocks = fs.numBlocks;
+        fc->maxLength = fs.maxLength;
+        fc->rawLength = fs.rawLength;
+        fc->keyLength = fs.length;
+        return SORT_NOERROR;
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ *
+ * nsort_get() or nsort_get_arena() of a file written by nsort_save_front().
+ * The file is mapped and the keys are decoded one after the other into the
+ * arena of the sort, whole, and the links are laid out after them.
+ */
+    static int nsort_retrieve_front(nsort_t * srt, nsort_store_t * ts,
+                                    const char *fname, int inArena) {
+        nsort_front_t fc;
+        nsort_error_t err;
+        const char *p, *end;
+        char *map, *base, *buf = 0;
+        size_t *off = 0;
+        size_t length = 0, i, len = 0;
+        int status = _ERROR_;
+
+        memset(&fc, 0, sizeof(nsort_front_t));
+        map = (char *) nsort_map_file(fname, &length, FALSE);
+        if (map == 0) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        err = nsort_front_setup(&fc, map, length);
+        if (err != SORT_NOERROR || fc.number > (size_t) 0x7fffffff) {
+            srt->sortError = SORT_LIST_BADFILE;
+            goto done;
+        }
+        memcpy(ts, &fc.store, sizeof(nsort_store_t));
+        off = (size_t *) malloc((fc.number + 1) * sizeof(size_t));
+        buf = (char *) malloc(fc.maxLength + 1);
+        if (off == 0 || buf == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            goto done;
+        }
+        if (nsort_build_shell(srt, fc.number,
+                              NSORT_ARENA_ROUND(fc.rawLength)) == _ERROR_)
+            goto done;
+        base = (char *) nsort_arena_alloc(srt->lh->arena, fc.rawLength + 1);
+        if (base == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            goto done;
+        }
+        off[0] = 0;
+        p = fc.keys;
+        end = fc.keys + fc.keyLength;
+        for (i = 0; i < fc.number; i++) {
+            p = nsort_front_next(p, end, buf, &len, fc.maxLength,
+                                 i % fc.every == 0);
+            if (p == 0 || off[i] + len + 1 > fc.rawLength) {
+                srt->sortError = SORT_LIST_BADFILE;
+                goto done;
+            }
+            memcpy(base + off[i], buf, len + 1);
+            off[i + 1] = off[i] + len + 1;
+        }
+        srt->isUnique = ts->isUnique;
+        srt->manageAllocs = ts->manageAllocs;
+        status =
+            nsort_build_links(srt, 0, base, 0, off, fc.number, !inArena);
+      done:
+        set_sortError(SORT_NOERROR);
+        nsort_unmap_file(map, length);
+        free(buf);
+        free(off);
+        return status;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_save_front}
+ * \index{nsort_save_front}
+ *
+ * [Verbatim] */
+
+    int nsort_save_front(nsort_t * srt, const char *desc, char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_save_front() function saves the contents of the sort object
+ * ``srt'', whose data must be strings, to the file ``fname'' with the keys
+ * front-coded (see nsort_front_store_t).  Each key is stored as the number of
+ * bytes it shares with the key before it and the rest of it, and every
+ * NSORT_FRONT_BLOCK keys one is stored whole so that the file can be searched
+ * without decoding all of it.  Sorted paths and words share long prefixes
+ * with their neighbours, so the file is several times smaller than one
+ * written by nsort_save() or nsort_save_var().  The other parameters are the
+ * same as the ones for nsort_save().
+ *
+ * A file written this way can be read back with nsort_get() or
+ * nsort_get_all(), which tell it from a file written by nsort_save() by its
+ * magic number and give back the keys whole, or it can be searched as it is
+ * with nsort_front_open().
+ *
+ * nsort_save_front() returns _OK_ if it is successful or _ERROR_ if an error
+ * occurs, in which case srt->sortError will contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t ts;
+        nsort_front_store_t fs;
+        nsort_writer_t w;
+        size_t *block;
+        char *tmpName;
+        nsort_error_t error;
+        int fd = -1, status = _OK_;
+
+        if (srt->lh->number > (size_t) 0x7fffffff) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        memset(&fs, 0, sizeof(nsort_front_store_t));
+        fs.number = srt->lh->number;
+        fs.every = NSORT_FRONT_BLOCK;
+        fs.numBlocks = (fs.number + fs.every - 1) / fs.every;
+        block = (size_t *) malloc((fs.numBlocks + 1) * sizeof(size_t));
+        if (block == 0) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        fs.length = nsort_front_emit(srt, &fs, block, 0, 0);
+        nsort_store_stamp(&ts, NSORT_FRONT_MAGIC, desc);
+        ts.isUnique = srt->isUnique;
+        ts.manageAllocs = srt->manageAllocs;
+        ts.number = (int) fs.number;
+        ts.size = 0;
+
+        tmpName = nsort_save_name(fname);
+        if (tmpName == 0)
+            set_sortError(SORT_NOMEMORY);
+        else
+            nsort_file_create(tmpName, fd);
+        if (!nsort_check_error() && nsort_writer_open(&w, fd, 0) == _OK_) {
+            status = nsort_writer_put(&w, &ts, sizeof(nsort_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, &fs,
+                                          sizeof(nsort_front_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, 0, NSORT_FRONT_HDR -
+                                          sizeof(nsort_store_t) -
+                                          sizeof(nsort_front_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, block,
+                                          fs.numBlocks * sizeof(size_t));
+            if (status == _OK_ &&
+                nsort_front_emit(srt, &fs, 0, &w, 0) == (size_t) _ERROR_)
+                status = _ERROR_;
+            if (nsort_writer_close(&w, srt->lh->syncPolicy) == _ERROR_)
+                status = _ERROR_;
+        }
+        if (fd >= 0)
+            nsort_file_close(fd);
+        free(block);
+        error = nsort_save_finish(tmpName, fname,
+                                  !nsort_check_error() && status == _OK_);
+        if (error != SORT_NOERROR)
+            set_sortError(error);
+        if (nsort_check_error() || status == _ERROR_) {
+            srt->sortError = nsort_check_error() ? get_sortError() :
+                SORT_FRDWR;
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_build}
+ * \index{nsort_front_build}
+ *
+ * [Verbatim] */
+
+    int nsort_front_build(nsort_front_t * fc, nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_build() function front-codes the keys of the sort object
+ * ``srt'', whose data must be strings, into one block of memory and sets up
+ * ``fc'' to search them with the compare function of the sort.  The block
+ * holds just what nsort_save_front() would write to a file, so the keys take
+ * a fraction of the memory they take in the sort and are packed together, and
+ * the sort can be deleted once this is done.  The keys are searched with
+ * nsort_front_lower_bound(), nsort_front_upper_bound() and nsort_front_find(),
+ * and got at with nsort_front_key().
+ *
+ * The nsort_front_build() function returns _OK_ if it is successful or
+ * _ERROR_ if there is an error, in which case the global error is set.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_store_t ts;
+        nsort_front_store_t fs;
+        nsort_error_t err;
+        size_t *block, length;
+        char *base;
+
+        if (fc == 0 || srt == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        memset(fc, 0, sizeof(nsort_front_t));
+        memset(&fs, 0, sizeof(nsort_front_store_t));
+        fs.number = srt->lh->number;
+        fs.every = NSORT_FRONT_BLOCK;
+        fs.numBlocks = (fs.number + fs.every - 1) / fs.every;
+        block = (size_t *) malloc((fs.numBlocks + 1) * sizeof(size_t));
+        if (block == 0) {
+            set_sortError(SORT_NOMEMORY);
+            return _ERROR_;
+        }
+        fs.length = nsort_front_emit(srt, &fs, block, 0, 0);
+        length = NSORT_FRONT_HDR + fs.numBlocks * sizeof(size_t) + fs.length;
+        base = (char *) malloc(length);
+        if (base == 0) {
+            free(block);
+            set_sortError(SORT_NOMEMORY);
+            return _ERROR_;
+        }
+        memset(base, 0, NSORT_FRONT_HDR);
+        nsort_store_stamp(&ts, NSORT_FRONT_MAGIC, "");
+        ts.isUnique = srt->isUnique;
+        ts.number = (fs.number > (size_t) 0x7fffffff) ? -1 : (int) fs.number;
+        ts.size = 0;
+        memcpy(base, &ts, sizeof(nsort_store_t));
+        memcpy(base + sizeof(nsort_store_t), &fs, sizeof(nsort_front_store_t));
+        memcpy(base + NSORT_FRONT_HDR, block, fs.numBlocks * sizeof(size_t));
+        nsort_front_emit(srt, &fs, 0, 0,
+                         base + NSORT_FRONT_HDR +
+                         fs.numBlocks * sizeof(size_t));
+        free(block);
+        err = nsort_front_setup(fc, base, length);
+        if (err != SORT_NOERROR) {
+            free(base);
+            memset(fc, 0, sizeof(nsort_front_t));
+            set_sortError(err);
+            return _ERROR_;
+        }
+        fc->compare = srt->compare;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_open}
+ * \index{nsort_front_open}
+ *
+ * [Verbatim] */
+
+    int nsort_front_open(nsort_front_t * fc, int (*compare)(void *, void *),
+                         const char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_open() function maps the file ``fname'', which must have
+ * been written by nsort_save_front(), into memory and sets up ``fc'' to
+ * search it with ``compare'', which should be the compare function the sort
+ * was made with.  Only the headers and the block table are read; the keys
+ * are read in by the system as searches touch them.
+ *
+ * The nsort_front_open() function returns _OK_ if it is successful or
+ * _ERROR_ if there is an error, in which case the global error is set.  A
+ * file that was not written by nsort_save_front() gives SORT_LIST_BADFILE.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_error_t err;
+        size_t length = 0;
+        char *base;
+
+        if (fc == 0 || compare == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        memset(fc, 0, sizeof(nsort_front_t));
+        base = (char *) nsort_map_file(fname, &length, FALSE);
+        if (base == 0)
+            return _ERROR_;
+        err = nsort_front_setup(fc, base, length);
+        if (err != SORT_NOERROR) {
+            nsort_unmap_file(base, length);
+            memset(fc, 0, sizeof(nsort_front_t));
+            set_sortError(err);
+            return _ERROR_;
+        }
+        fc->mapped = TRUE;
+        fc->compare = compare;
+        return _OK_;
+    }
+
+/*
+ * The number of keys of ``fc'' that are less than ``key'' (or, if ``upper''
+ * is set, not greater than it).  The first keys of the blocks are stored
+ * whole, so they are searched where they lie to find the block the bound is
+ * in, and only the keys of that block are decoded.
+ */
+    static size_t nsort_front_bound(nsort_front_t * fc, const char *key,
+                                    int upper) {
+        char local[NSORT_FRONT_LOCAL], *buf = local;
+        const char *p, *end;
+        size_t lo = 0, hi, mid, i, last, len = 0;
+        int status;
+
+        hi = fc->numBlocks;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            status = fc->compare(fc->keys + fc->block[mid], (void *) key);
+            if (status < 0 || (upper && status == 0))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            return 0;
+        /*
+         * The first key of block lo - 1 is before the bound and the first
+         * key of block lo is not.
+         */
+        i = (lo - 1) * fc->every;
+        last = lo * fc->every;
+        if (last > fc->number)
+            last = fc->number;
+        if (fc->maxLength > NSORT_FRONT_LOCAL) {
+            buf = (char *) malloc(fc->maxLength);
+            if (buf == 0) {
+                set_sortError(SORT_NOMEMORY);
+                return last;
+            }
+        }
+        end = fc->keys + fc->keyLength;
+        p = nsort_front_next(fc->keys + fc->block[lo - 1], end, buf, &len,
+                             fc->maxLength, TRUE);
+        for (i++; i < last && p != 0; i++) {
+            p = nsort_front_next(p, end, buf, &len, fc->maxLength, FALSE);
+            if (p == 0)
+                set_sortError(SORT_LIST_BADFILE);
+            else {
+                status = fc->compare(buf, (void *) key);
+                if (status > 0 || (!upper && status == 0))
+                    break;
+            }
+        }
+        if (buf != local)
+            free(buf);
+        return i;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_lower_bound}
+ * \index{nsort_front_lower_bound}
+ *
+ * [Verbatim] */
+
+    size_t nsort_front_lower_bound(nsort_front_t * fc, const char *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_lower_bound() function returns the place of the first key
+ * in ``fc'' that is not less than ``key'', or fc->number if there isn't one.
+ * Keys are numbered from 0; use nsort_front_key() to get at one.  If a
+ * corrupt block is found, the global error is set to SORT_LIST_BADFILE.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_front_bound(fc, key, FALSE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_upper_bound}
+ * \index{nsort_front_upper_bound}
+ *
+ * [Verbatim] */
+
+    size_t nsort_front_upper_bound(nsort_front_t * fc, const char *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_upper_bound() function returns the place of the first key
+ * in ``fc'' that is greater than ``key'', or fc->number if there isn't one.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_front_bound(fc, key, TRUE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_find}
+ * \index{nsort_front_find}
+ *
+ * [Verbatim] */
+
+    size_t nsort_front_find(nsort_front_t * fc, const char *key)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_find() function returns the place of the first key of
+ * ``fc'' that compares equal to ``key'', or fc->number if there isn't one.
+ *
+ * [EndDoc]
+ */
+    {
+        size_t i;
+
+        i = nsort_front_bound(fc, key, FALSE);
+        if (i == fc->number || nsort_front_bound(fc, key, TRUE) == i)
+            return fc->number;
+        return i;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_key}
+ * \index{nsort_front_key}
+ *
+ * [Verbatim] */
+
+    char *nsort_front_key(nsort_front_t * fc, size_t i, char *buf)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_key() function decodes key ``i'' of ``fc'' into ``buf'',
+ * which must have room for fc->maxLength bytes, and returns ``buf''.  The
+ * keys from the start of the block that key ``i'' is in are decoded to get
+ * to it, so walking through the keys in order this way costs a few keys of
+ * decoding each.  NULL is returned if there are not that many keys, or with
+ * the global error set to SORT_LIST_BADFILE if the block is corrupt.
+ *
+ * [EndDoc]
+ */
+    {
+        const char *p, *end;
+        size_t j, len = 0;
+
+        if (i >= fc->number)
+            return 0;
+        end = fc->keys + fc->keyLength;
+        p = fc->keys + fc->block[i / fc->every];
+        for (j = i - i % fc->every; p != 0 && j <= i; j++)
+            p = nsort_front_next(p, end, buf, &len, fc->maxLength,
+                                 j % fc->every == 0);
+        if (p == 0) {
+            set_sortError(SORT_LIST_BADFILE);
+            return 0;
+        }
+        return buf;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_front_close}
+ * \index{nsort_front_close}
+ *
+ * [Verbatim] */
+
+    int nsort_front_close(nsort_front_t * fc)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_front_close() function lets go of the keys that ``fc'' was set
+ * up on by nsort_front_build() or nsort_front_open().  It returns _OK_, or
+ * _ERROR_ with the global error set to SORT_PARAM if ``fc'' is not set up.
+ *
+ * [EndDoc]
+ */
+    {
+        if (fc == 0 || fc->base == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        if (fc->mapped)
+            nsort_unmap_file(fc->base, fc->length);
+        else
+            free(fc->base);
+        memset(fc, 0, sizeof(nsort_front_t));
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_remove_item}
+ * \index{nsort_remove_item}
+ *
+ * [Verbatim] */
+
+    nsort_link_t *nsort_remove_item(nsort_t * srt, nsort_link_t * lnk)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_remove_item() removes the item lnk->data from the list
+ * in srt->lh.  If it is successful, it removes the item and returns
+ * the link that points to it.  If it is not successful, it returns
+ * NULL and srt->sortError points to the error.  A global error will
+ * be set if srt == 0, srt->lh == 0 or lnk == 0.
+ * If a node of the index is on the link, the node is moved to a
+ * neighboring link or dropped, so the index is never rebuilt because of
+ * a remove and a remove costs about what a query does.
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
+        if (srt != 0 && srt->sync != 0)
+            return nsort_sync_remove_item(srt, lnk);
+#endif
+        return nsort_remove_item_nolock(srt, lnk);
+    }
+
+/*
+ * This function is not part of the API.  Don't document it.
+ */
+    static nsort_link_t *nsort_remove_item_nolock(nsort_t * srt,
+                                                  nsort_link_t * lnk)
+    {
+        nsort_link_t *link, *found;
+#ifdef NSORT_STATS
+        double t1, t2;
+#endif
+
+        if (srt != 0 && srt->isFrozen) {
+            srt->sortError = SORT_FROZEN;
+            return 0;
+        }
+        if (srt->sync == 0 && nsort_restructure_check(srt) == _ERROR_)
+            return 0;
+        srt->numCompares = 0;
+
+        if (srt == 0 || srt->lh == 0 || lnk == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+
+        // BUGBUG
+        // Remove this and test with it gone.  Basically, we use the same algorithm
+        // whether this is a unique index or not, which should be OK.  It protects us from having
+        // performance issues with having to nsort_restructure_nodes().
+        // BUGBUG
+#if 0
+        if (srt->isUnique) {
+            // traversal_time will have the find time.
+            if (0 == found) {
+                srt->sortError = SORT_CORRUPT;
+                return 0;
+            }
+#ifdef NSORT_STATS
+            nsort_elapsed(&t1);
+#endif
+            if (lnk == srt->current->here) {
+                srt->lh->current = lnk;
+                link = nsort_list_remove_link(srt->lh);
+                if (link == 0) {
+                    srt->sortError = srt->lh->listError;
+                    return 0;
+                }
+                // XXX: Fix this - find some way to insure that this doesn't have to
+                // happen on every remove.  The issue I have is that I don't want
+                // to slow down processing on adds, so I feel that right now this is
+                // a fair trade off.  If I have an application that needs to delete
+                // stuff from sorted items, though, this will have to be resolved.
+                nsort_restructure_nolock(srt);
+#ifdef NSORT_STATS
+                nsort_elapsed(&t2);
+                srt->traversal_time += (t2 - t1);
+#endif
+                return link;
+            }
+            else {
+                srt->lh->current = lnk;
+                link = nsort_list_remove_link(srt->lh);
+                if (link == 0) {
+                    srt->sortError = srt->lh->listError;
+                    return 0;
+                }
+                // XXX - Ditto here.
+#ifdef NSORT_STATS
+                nsort_elapsed(&t2);
+                srt->traversal_time += (t2 - t1);
+#endif
+                nsort_restructure_nolock(srt);
+                return link;
+            }
+        }
+        /*
+         * Not unique - have to jump through some hoops.
+         */
+#endif
+        found = nsort_query_item_nolock(srt, lnk);
+        if (found == 0) {
+            srt->sortError = SORT_CORRUPT;
+            return 0;
+        }
+#ifdef NSORT_STATS
+        nsort_elapsed(&t1);
+#endif
+        if (nsort_snapshot_keep(srt, lnk) == _ERROR_)
+            return 0;
+        /*
+         * If a node is on the link, move it to a neighbor or drop it.
+         */
+        nsort_unindex_link(srt, lnk);
+        srt->lh->current = lnk;
+        link = nsort_list_remove_link(srt->lh);
+        if (0 == link) {
+            srt->sortError = SORT_CORRUPT;
+            return 0;
+        }
+#ifdef NSORT_STATS
+        nsort_elapsed(&t2);
+        srt->traversal_time += (t2 - t1);
+#endif
+        return link;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_node_levels}
+ * \index{nsort_node_levels}
+ *
+ * [Verbatim] */
+
+    int nsort_node_levels(nsort_t * srt, nsort_node_level_t * lvl)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_node_levels() function gathers information about the indexes
+ * that are managed by the sort object ``srt'' and puts it in the
+ * ``lvl'' variable.  This can be used to determine how many nodes are in
+ * the higher level indexes.  Currently, this only returns _OK_.
+ *
+ * [EndDoc]
+ */
+    {
+        int counter;
+        nsort_node_t *node;
+        int i;
+
+        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
+            node = srt->head->next;
+            if (node == srt->tail || node->level[i] == srt->tail)
+                lvl->lvl[i] = 0;
+            else {
+                counter = 0;
+                while (node->level[i] != srt->tail) {
+                    node = node->level[i];
+                    counter++;
+                }
+                lvl->lvl[i] = counter;
+            }
+        }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_sort_to_list}
+ * \index{nsort_sort_to_list}
+ *
+ * [Verbatim] */
+
+    nsort_list_t *nsort_sort_to_list(nsort_t * srt)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_sort_to_list() function dismantles the nsort object ``srt''
+ * and returns the list in srt->lh.  Everything is freed except the
+ * srt object itself.  If it was created with a call to nsort_create(),
+ * it will need to be freed by calling nsort_destroy().  If it is
+ * successful, it returns a pointer to the list header that is used to
+ * manage the list.  If it fails, it returns NULL.  The only possible
+ * failure is that the function parameter is invalid, so the error
+ * is put in the global variable.  You can look at a description of the
+ * error with a call to nsort_show_error().
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_list_t *lh;
+
+        if (srt == 0 || srt->lh == 0) {
+            set_sortError(SORT_CORRUPT);
+            return 0;
+        }
+        nsort_save_wait(srt);
+        /*
+         * Now, just dismantle the shell and return the list.
+         */
+        nsort_rebuild_cancel(srt);
+        nsort_release_nodes(srt);
+        lh = srt->lh;
+        srt->lh = 0;
+        free(srt->head);
+        free(srt->tail);
+        return lh;
+    }
+
+/*
+ * Set up the list, arena and sentinels of ``srt'' for a sort that is going
+ * to be built from ``n'' items that are already in order.  The first slab of
+ * the arena is made big enough for ``extra'' bytes (the records, if the
+ * caller is going to put them there), the links and the index nodes, so
+ * they all end up in one piece of memory.  If this fails, srt->lh is left
+ * NULL and srt->sortError has the error.
+ */
+    static int nsort_build_shell(nsort_t * srt, size_t n, size_t extra) {
+        size_t slabSize;
+
+        slabSize = extra + NSORT_ARENA_ROUND(n * sizeof(nsort_link_t)) +
+            (n / (size_t) srt->geometry.fanout + 2) *
+            NSORT_ARENA_ROUND(NSORT_NODE_SIZE(2)) +
+            NSORT_ARENA_ROUND(NSORT_NODE_SIZE(NSORT_NODE_LEVEL));
+        srt->lh = nsort_list_create();
+        if (srt->lh == 0) {
+            srt->sortError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        srt->head = (nsort_node_t *) malloc(sizeof(nsort_node_t));
+        srt->tail = (nsort_node_t *) malloc(sizeof(nsort_node_t));
+        if (srt->head == 0 || srt->tail == 0 ||
+            nsort_list_init(srt->lh) == _ERROR_ ||
+            nsort_list_use_arena(srt->lh, slabSize) == _ERROR_) {
+            free(srt->head);
+            free(srt->tail);
+            nsort_list_del(srt->lh);
+            nsort_list_destroy(srt->lh);
+            srt->lh = 0;
+            srt->head = srt->tail = 0;
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(srt->head, 0, sizeof(nsort_node_t));
+        memset(srt->tail, 0, sizeof(nsort_node_t));
+        srt->head->next = srt->tail;
+        srt->tail->prev = srt->head;
+        srt->current = srt->head;
+        return _OK_;
+    }
+
+/*
+ * Lay out the links for ``n'' items that are in order in one block of the
+ * arena of srt->lh, chain them together and build the index over them in
+ * one pass.  The data of item i is data[i] or, if data is NULL, the record
+ * at base + off[i] or, if off is NULL as well, base + i * recSize.  If
+ * ``copy'' is TRUE, the records are copied out of the arena instead (see
+ * nsort_copy_links()).
+ */
+    static int nsort_build_links(nsort_t * srt, void **data, char *base,
+                                 size_t recSize, const size_t * off,
+                                 size_t n, int copy) {
+        nsort_list_t *lh = srt->lh;
+        nsort_link_t *lnks = 0, *prev = lh->head;
+        size_t i;
+
+        if (copy)
+            return nsort_copy_links(srt, base, recSize, off, n);
+        if (n > 0) {
+            lnks = (nsort_link_t *) nsort_arena_alloc(lh->arena,
+                                                      n *
+                                                      sizeof(nsort_link_t));
+            if (lnks == 0) {
+                set_sortError(SORT_NOERROR);
+                srt->sortError = SORT_NOMEMORY;
+                return _ERROR_;
+            }
+        }
+        for (i = 0; i < n; i++) {
+            if (data != 0)
+                lnks[i].data = data[i];
+            else
+                lnks[i].data = base + ((off != 0) ? off[i] : i * recSize);
+            lnks[i].number = 0;
+            lnks[i].prev = prev;
+            prev->next = &lnks[i];
+            prev = &lnks[i];
+        }
+        prev->next = lh->tail;
+        lh->tail->prev = prev;
+        lh->current = lh->head;
+        lh->number = n;
+        return nsort_restructure_nolock(srt);
+    }
+
+/*
+ * Copy the ``n'' records that nsort_build_links() would have pointed at to
+ * a link and a record of their own each, from malloc(), and put them on
+ * srt->lh in order.  Record i is off[i + 1] - off[i] bytes long, or recSize
+ * bytes if off is NULL.  The arena the records were read into is let go
+ * before the index is built, so nothing of the sort is left in it and
+ * nsort_del() and the callers free the links and records one at a time,
+ * as they do for any sort that did not come from an arena.
+ */
+    static int nsort_copy_links(nsort_t * srt, char *base, size_t recSize,
+                                const size_t * off, size_t n) {
+        nsort_list_t *lh = srt->lh;
+        nsort_arena_t *ar = lh->arena;
+        nsort_link_t *lnk;
+        size_t i, len;
+
+        /* a record of no bytes gets NULL data, not a pointer into the arena */
+        lh->arena = 0;
+        for (i = 0; i < n; i++) {
+            len = (off != 0) ? off[i + 1] - off[i] : recSize;
+            lnk = nsort_list_new_link(lh, (len == 0) ? 0 : base +
+                                      ((off != 0) ? off[i] : i * recSize),
+                                      len);
+            if (lnk == 0) {
+                while ((lnk = nsort_list_remove_link(lh)) != 0) {
+                    free(lnk->data);
+                    free(lnk);
+                }
+                lh->arena = ar;
+                srt->sortError = SORT_NOMEMORY;
+                return _ERROR_;
+            }
+            lh->current = lh->tail->prev;
+            nsort_list_insert_link(lh, lnk);
+        }
+        nsort_arena_del(ar);
+        free(ar);
+        return nsort_restructure_nolock(srt);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_build_sorted}
+ * \index{nsort_build_sorted}
+ *
+ * [Verbatim] */
+
+    int nsort_build_sorted(nsort_t * srt, void **data, size_t n,
+                           int (*cmp)(void *, void *), int check)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_build_sorted() function builds the sort object ``srt'' from the
+ * ``n'' items that the array ``data'' points to, which must already be in the
+ * order ``cmp'' sorts them in.  Like nsort_list_to_sort(), ``srt'' should come
+ * from nsort_create() (or be an automatic variable) and not be initialized;
+ * everything it needs is set up here.  The links are laid out in order in one
+ * block of an arena (see nsort_use_arena()) and the index nodes right after
+ * them, and the index is built in a single pass over the links, so there are
+ * no compares, no searches and only a few allocations however many items
+ * there are.
+ *
+ * If ``check'' is TRUE, the items are compared with their neighbors first
+ * (n - 1 compares) and the function fails with SORT_PARAM if any of them is
+ * out of order.  Otherwise the order is taken on faith; dire things will
+ * happen if it is wrong.
+ *
+ * The items themselves still belong to the application: the object is set
+ * up with isUnique and manageAllocs FALSE, so nsort_del() frees the links
+ * and nodes but leaves the data alone.  Since the links are in an arena,
+ * anything added later has to follow the rules in nsort_use_arena(), and a
+ * link that is removed has to be let go with nsort_free_link(), not free().
+ *
+ * This function returns _OK_ on success or _ERROR_ with the error in
+ * srt->sortError.
+ *
+ * [EndDoc]
+ */
+    {
+        size_t i;
+
+        memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
+        srt->compare = cmp;
+        if (cmp == 0 || (data == 0 && n > 0)) {
+            srt->sortError = SORT_PARAM;
+            return _ERROR_;
+        }
+        if (check)
+            for (i = 1; i < n; i++)
+                if (cmp(data[i - 1], data[i]) > 0) {
+                    srt->sortError = SORT_PARAM;
+                    return _ERROR_;
+                }
+        if (nsort_build_shell(srt, n, 0) == _ERROR_)
+            return _ERROR_;
+        if (nsort_build_links(srt, data, 0, 0, 0, n, FALSE) == _ERROR_) {
+            nsort_del(srt, 0);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_to_sort}
+ * \index{nsort_list_to_sort}
+ *
+ * [Verbatim] */
+
+    int nsort_list_to_sort(nsort_t * srt, nsort_list_t * lh,
+                           int (*cmp)(void *, void *))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_to_sort() function takes the list given by ``lh'' and builds
+ * the management objects around it needed to maintain a sorted object.  The
+ * parameters of this function are as follows:
+ *
+ * \begin{itemize}
+ *
+ * \item [srt] This parameter is an nsort_t object that has been allocated
+ * on the heap with a call to nsort_create() or allocated on the stack
+ * as an automatic variable.  There is no need to call nsort_init() on this
+ * item as all the necessary parts are built into the srt object by this
+ * function.
+ *
+ * \item [lh] This parameter is the list header of a list that contains
+ * sorted data.  Dire things will happen if the data contained by this list
+ * is not sorted.  The list header lh needs to be created on the heap by
+ * a call to nsort_list_create(); it should not be an item allocated on the
+ * stack as a local variable.
+ *
+ * \item [cmp] This is the compare function that the sort object will
+ * use for further adds and for finds.  It should be the same compare function
+ * that was used to sort the items in the list.
+ *
+ * \end{itemize}
+ *
+ * This function returns _OK_ if it succeeds and _ERROR_ if there is an
+ * error.  If there is an error, srt->sortError contains the error.
+ *
+ * [EndDoc]
+ */
+    {
+        int status;
+
+        memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
+        srt->compare = (int (*)(void *, void *)) cmp;
+
+        srt->lh = lh;
+        srt->head = (nsort_node_t *) malloc(sizeof(nsort_node_t));
+        if (0 == srt->head) {
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(srt->head, 0, sizeof(nsort_node_t));
+        srt->tail = (nsort_node_t *) malloc(sizeof(nsort_node_t));
+        if (0 == srt->tail) {
+            free(srt->head);
+            srt->sortError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(srt->tail, 0, sizeof(nsort_node_t));
+        srt->current = srt->head;
+        srt->isUnique = FALSE;
+        srt->manageAllocs = TRUE;
+        srt->head->next = srt->tail;
+        srt->tail->prev = srt->head;
+        srt->head->prev = 0;
+        srt->tail->next = 0;
+
+        status = nsort_restructure_nodes(srt);
+        if (_ERROR_ == status) {
+            /* error is set */
+            nsort_del(srt, 0);
+            return _ERROR_;
+        }
+        return _OK_;
+    }
+
+/*
+ * These sh functions are not API functions.  Don't document them.
+ *
+ * Make sure one of them and only one is called nsort_hash_function()
+ */
+/* unsigned long nsort_hash_function (register const unsigned char *key) */
+    unsigned long nsort_hash_function(register const unsigned char *key) {
+        unsigned long val = 0;
+
+        while (*key != '\0') {
+            unsigned int tmp;
+            val = (val << 4) + (*key);
+            tmp = (val & 0xf0000000);
+            if (tmp) {
+                val = val ^ (tmp >> 24);
+                val = val ^ tmp;
+            }
+            key++;
+        }
+        return val;
+    }
+
+#define mix(a,b,c) \
+{ \
+    a -= b; a -= c; a ^= (c>>13); \
+    b -= c; b -= a; b ^= (a<<8); \
+    c -= a; c -= b; c ^= (b>>13); \
+    a -= b; a -= c; a ^= (c>>12);  \
+    b -= c; b -= a; b ^= (a<<16); \
+    c -= a; c -= b; c ^= (b>>5); \
+    a -= b; a -= c; a ^= (c>>3);  \
+    b -= c; b -= a; b ^= (a<<10); \
+    c -= a; c -= b; c ^= (b>>15); \
+}
+
+/*
+#define mix2(a,b,c) \
+{ \
+a -= b; a -= c; a ^= (c>>13); \
+b -= c; b -= a; b ^= (a<< 8); \
+c -= a; c -= b; c ^= ((b&0xffffffff)>>13); \
+a -= b; a -= c; a ^= ((c&0xffffffff)>>12); \
+b -= c; b -= a; b = (b ^ (a<<16)) & 0xffffffff; \
+c -= a; c -= b; c = (c ^ (b>> 5)) & 0xffffffff; \
+a -= b; a -= c; a = (a ^ (c>> 3)) & 0xffffffff; \
+b -= c; b -= a; b = (b ^ (a<<10)) & 0xffffffff; \
+c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
+}
+*/
+
+/* register unsigned char *k; */
+/* unsigned long nsort_hash_function_jenkins ( register const unsigned char *k ) */
+    unsigned long nsort_hash_function_jenkins(register const unsigned char
+                                              *k) {
+        register unsigned long length = strlen((const char *) k);   /* the length of the key */
+        register unsigned long initval = (2 << 16) - 1; /* the previous hash, or an arbitrary value */
+        register unsigned long a, b, c, len;
+
+        /* Set up the internal state */
+        len = length;
+        a = b = 0x9e3779b9;     /* the golden ratio; an arbitrary value */
+        c = initval;            /* the previous hash value */
+
+    /*---------------------------------------- handle most of the key */
+        while (len >= 12) {
+            a += (k[0] + ((unsigned long) k[1] << 8) +
+                  ((unsigned long) k[2] << 16) +
+                  ((unsigned long) k[3] << 24));
+            b += (k[4] + ((unsigned long) k[5] << 8) +
+                  ((unsigned long) k[6] << 16) +
+                  ((unsigned long) k[7] << 24));
+            c += (k[8] + ((unsigned long) k[9] << 8) +
+                  ((unsigned long) k[10] << 16) +
+                  ((unsigned long) k[11] << 24));
+            mix(a, b, c);
+            k += 12;
+            len -= 12;
+        }
+
+    /*------------------------------------- handle the last 11 bytes */
+        c += length;
+        switch (len) {          /* all the case statements fall through */
+        case 11:
+            c += ((unsigned long) k[10] << 24);
+        case 10:
+            c += ((unsigned long) k[9] << 16);
+        case 9:
+            c += ((unsigned long) k[8] << 8);
+            /* the first byte of c is reserved for the length */
+        case 8:
+            b += ((unsigned long) k[7] << 24);
+        case 7:
+            b += ((unsigned long) k[6] << 16);
+        case 6:
+            b += ((unsigned long) k[5] << 8);
+        case 5:
+            b += k[4];
+        case 4:
+            a += ((unsigned long) k[3] << 24);
+        case 3:
+            a += ((unsigned long) k[2] << 16);
+        case 2:
+            a += ((unsigned long) k[1] << 8);
+        case 1:
+            a += k[0];
+            /* case 0: nothing left to add */
+        }
+        mix(a, b, c);
+    /*-------------------------------------------- report the result */
+        return c;
+    }
+
+
+/* the room a copy of a key of ``len'' bytes takes in an arena or a file */
+#define NSORT_HASH_KEYSIZE(len) \
+    (sizeof(size_t) + (((len) + sizeof(size_t)) & ~(sizeof(size_t) - 1)))
+
+/*
+ * Mix the bits of a hash value so the low bits (the control byte) and the
+ * bits above them (the group) are both spread well.  This is the finalizer of
+ * MurmurHash3.
+ */
+    static uint64_t nsort_hash_mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+/*
+ * A mask with a bit set for each of the NSORT_HASH_GROUP control bytes at
+ * ``ctrl'' that is ``tag''.
+ */
+    static unsigned int nsort_hash_match(const unsigned char *ctrl,
+                                         unsigned char tag) {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+        return (unsigned int)
+            _mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                             _mm_set1_epi8((char) tag)));
+#else
+        unsigned int mask = 0;
+        int i;
+
+        for (i = 0; i < NSORT_HASH_GROUP; i++)
+            if (ctrl[i] == tag)
+                mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+/*
+ * The place of the lowest bit set in ``mask'', which isn't 0.
+ */
+    static int nsort_hash_first(unsigned int mask) {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        int i = 0;
+
+        while ((mask & 1) == 0) {
+            mask >>= 1;
+            i++;
+        }
+        return i;
+#endif
+    }
+
+/*
+ * Look for ``key'', ``len'' bytes long, whose hash is ``hash'', in the table.
+ * The groups are probed starting with the one the hash picks and going on by
+ * 1, 2, 3... groups, which gets to every group of a table that is a power of
+ * 2 in size, until one with an empty slot is found.  Returns the slot the key
+ * is in or hsh->capacity if it isn't there.
+ */
+    static size_t nsort_hash_probe(nsort_hash_t * hsh, const void *key,
+                                   size_t len, uint64_t hash) {
+        size_t mask = hsh->capacity / NSORT_HASH_GROUP - 1;
+        size_t group = (size_t) (hash >> 7) & mask;
+        size_t step = 0, i;
+        unsigned char *ctrl;
+        unsigned int bits;
+
+        for (;;) {
+            ctrl = hsh->ctrl + group * NSORT_HASH_GROUP;
+            bits = nsort_hash_match(ctrl, (unsigned char) (hash & 0x7f));
+            while (bits != 0) {
+                i = group * NSORT_HASH_GROUP + nsort_hash_first(bits);
+                if (hsh->slots[i].hash == hash &&
+                    NSORT_HASH_KEYLEN(hsh->slots[i].key) == len) {
+                    hsh->numCompares++;
+                    if (hsh->compare != 0 ?
+                        hsh->compare((void *) hsh->slots[i].key,
+                                     (void *) key) == 0 :
+                        memcmp(hsh->slots[i].key, key, len) == 0)
+                        return i;
+                }
+                bits &= bits - 1;
+            }
+            if (nsort_hash_match(ctrl, NSORT_HASH_EMPTY) != 0)
+                return hsh->capacity;
+            group = (group + ++step) & mask;
+        }
+    }
+
+/*
+ * The first empty or removed slot on the probe path of ``hash''.  There always
+ * is one, since the table grows before it is full.  Both have the top bit of
+ * their control bytes set, and a key's control byte never does.
+ */
+    static size_t nsort_hash_free_slot(nsort_hash_t * hsh, uint64_t hash) {
+        size_t mask = hsh->capacity / NSORT_HASH_GROUP - 1;
+        size_t group = (size_t) (hash >> 7) & mask;
+        size_t step = 0;
+        unsigned int bits;
+#if !defined(__SSE2__)
+        int i;
+#endif
+
+        for (;;) {
+#if defined(__SSE2__)
+            bits = (unsigned int)
+                _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)
+                                                  (hsh->ctrl + group *
+                                                   NSORT_HASH_GROUP)));
+#else
+            bits = 0;
+            for (i = 0; i < NSORT_HASH_GROUP; i++)
+                if (hsh->ctrl[group * NSORT_HASH_GROUP + i] & 0x80)
+                    bits |= 1u << i;
+#endif
+            if (bits != 0)
+                return group * NSORT_HASH_GROUP + nsort_hash_first(bits);
+            group = (group + ++step) & mask;
+        }
+    }
+
+/*
+ * Make the table ``capacity'' slots, which is a power of 2 no less than
+ * NSORT_HASH_GROUP, and move the items that are in it now, if any, to the
+ * new table by their stored hashes.  The removed slots are left behind.
+ */
+    static int nsort_hash_resize(nsort_hash_t * hsh, size_t capacity) {
+        nsort_hash_t old = *hsh;
+        unsigned char *ctrl;
+        nsort_hash_slot_t *slots;
+        size_t i, j;
+
+        if (capacity > ((size_t) -1) / sizeof(nsort_hash_slot_t)) {
+            hsh->hashError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        ctrl = (unsigned char *) malloc(capacity);
+        slots = (nsort_hash_slot_t *)
+            malloc(capacity * sizeof(nsort_hash_slot_t));
+        if (ctrl == 0 || slots == 0) {
+            free(ctrl);
+            free(slots);
+            hsh->hashError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(ctrl, NSORT_HASH_EMPTY, capacity);
+        hsh->ctrl = ctrl;
+        hsh->slots = slots;
+        hsh->capacity = capacity;
+        hsh->deleted = 0;
+        hsh->grow = (size_t) ((double) capacity * hsh->maxLoad);
+        if (hsh->grow >= capacity)
+            hsh->grow = capacity - 1;
+        if (hsh->grow < 1)
+            hsh->grow = 1;
+        for (i = 0; i < old.capacity; i++) {
+            if (old.ctrl[i] & 0x80)
+                continue;
+            j = nsort_hash_free_slot(hsh, old.slots[i].hash);
+            hsh->ctrl[j] = old.ctrl[i];
+            hsh->slots[j] = old.slots[i];
+        }
+        if (!nsort_hash_mapped(hsh, old.ctrl))
+            free(old.ctrl);
+        if (!nsort_hash_mapped(hsh, old.slots))
+            free(old.slots);
+        return _OK_;
+    }
+
+/*
+ * The hash of a string item, with the string hash function if there is one.
+ */
+    static uint64_t nsort_hash_item_hash(nsort_hash_t * hsh,
+                                         const char *item, size_t len) {
+        if (hsh->hash != 0)
+            return nsort_hash_mix(hsh->hash(item));
+        return hsh->hash64(item, len);
+    }
+
+/*
+ * Add ``key'', ``len'' bytes long, whose hash is ``hash'', to the table with
+ * ``value''.  If the key is there already, its value is set if ``replace'' is
+ * TRUE, or SORT_UNIQUE is the error if it isn't.
+ */
+    static int nsort_hash_insert(nsort_hash_t * hsh, const void *key,
+                                 size_t len, uint64_t hash, void *value,
+                                 int replace) {
+        size_t i;
+
+        hsh->numCompares = 0;
+        i = nsort_hash_probe(hsh, key, len, hash);
+        if (i != hsh->capacity) {
+            if (!replace) {
+                hsh->hashError = SORT_UNIQUE;
+                return _ERROR_;
+            }
+            hsh->slots[i].value = value;
+            return _OK_;
+        }
+        return nsort_hash_place(hsh, key, len, hash, value);
+    }
+
+/*
+ * Put a copy of ``key'', which is known not to be in the table, in a slot.
+ * The table is rebuilt first if it is as full as it is allowed to get, counting
+ * the removed slots: it is doubled if half of that is keys, and otherwise it
+ * is rebuilt the same size, which just clears out the removed slots.
+ */
+    static int nsort_hash_place(nsort_hash_t * hsh, const void *key,
+                                size_t len, uint64_t hash, void *value) {
+        size_t i;
+        char *copy;
+        nsort_error_t error;
+
+        if (len > ((size_t) -1) - sizeof(size_t) - 1) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        while ((size_t) hsh->number + hsh->deleted >= hsh->grow)
+            if (nsort_hash_resize(hsh, (size_t) hsh->number >= hsh->grow / 2 ?
+                                  hsh->capacity * 2 : hsh->capacity) ==
+                _ERROR_)
+                return _ERROR_;
+        if (hsh->arena != 0) {
+            /* the error goes in hsh->hashError, not the global error */
+            error = get_sortError();
+            copy = (char *) nsort_arena_carve(hsh->arena,
+                                              NSORT_HASH_KEYSIZE(len),
+                                              sizeof(size_t));
+            set_sortError(error);
+        }
+        else
+            copy = (char *) malloc(sizeof(size_t) + len + 1);
+        if (0 == copy) {
+            hsh->hashError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        *(size_t *) copy = len;
+        copy += sizeof(size_t);
+        if (len > 0)
+            memcpy(copy, key, len);
+        copy[len] = '\0';
+        i = nsort_hash_free_slot(hsh, hash);
+        if (hsh->ctrl[i] == NSORT_HASH_DELETED)
+            hsh->deleted--;
+        hsh->ctrl[i] = (unsigned char) (hash & 0x7f);
+        hsh->slots[i].hash = hash;
+        hsh->slots[i].key = copy;
+        hsh->slots[i].value = value;
+        hsh->number++;
+        return _OK_;
+    }
+
+/*
+ * TRUE if ``p'' lies in the file the hash was read from, in which case it
+ * isn't freed.
+ */
+    static int nsort_hash_mapped(nsort_hash_t * hsh, const void *p) {
+        return hsh->map != 0 && (const char *) p >= hsh->map &&
+            (const char *) p < hsh->map + hsh->mapLength;
+    }
+
+/*
+ * Free the copy of a key that is taken out of the hash.  A key in the file
+ * the hash was read from is left there, and one in the arena is only given
+ * back if it was the last thing allocated from it.
+ */
+    static void nsort_hash_free_key(nsort_hash_t * hsh, char *key) {
+        if (nsort_hash_mapped(hsh, key))
+            return;
+        if (hsh->arena != 0)
+            nsort_arena_give_back(hsh->arena, key - sizeof(size_t),
+                                  NSORT_HASH_KEYSIZE(NSORT_HASH_KEYLEN(key)));
+        else
+            free(key - sizeof(size_t));
+    }
+
+/*
+ * Take the key out of slot ``i''.  A probe only goes on past a group that has
+ * no empty slot, so if the group of the slot has one already, no probe goes
+ * through it and the slot can be made empty.  Otherwise it is marked removed,
+ * so that the probes that go through it still go on.
+ */
+    static void nsort_hash_remove_slot(nsort_hash_t * hsh, size_t i) {
+        size_t group = i & ~((size_t) NSORT_HASH_GROUP - 1);
+
+        nsort_hash_free_key(hsh, hsh->slots[i].key);
+        if (nsort_hash_match(hsh->ctrl + group, NSORT_HASH_EMPTY) != 0)
+            hsh->ctrl[i] = NSORT_HASH_EMPTY;
+        else {
+            hsh->ctrl[i] = NSORT_HASH_DELETED;
+            hsh->deleted++;
+        }
+        hsh->slots[i].key = 0;
+        hsh->number--;
+    }
+
+/* where the control bytes start in a hash file */
+#define NSORT_HASH_HDR \
+    NSORT_ARENA_ROUND(sizeof(nsort_store_t) + sizeof(nsort_hash_store_t))
+
+/*
+ * Check the headers of a file written by nsort_hash_save() of ``length''
+ * bytes at ``base'', which is writable, and point the table of ``hsh'' at
+ * the table in it, turning the places of the keys into pointers.  Every slot
+ * is checked, so a file that is cut short or not a hash file is turned down
+ * with SORT_LIST_BADFILE before it is used.
+ */
+    static nsort_error_t nsort_hash_setup(nsort_hash_t * hsh, char *base,
+                                          size_t length) {
+        nsort_store_t ts;
+        nsort_hash_store_t hs;
+        nsort_hash_slot_t *slots;
+        unsigned char *ctrl;
+        char *keys;
+        size_t i, off, len, number = 0, deleted = 0;
+
+        if (length < NSORT_HASH_HDR)
+            return SORT_LIST_BADFILE;
+        memcpy(&ts, base, sizeof(nsort_store_t));
+        memcpy(&hs, base + sizeof(nsort_store_t), sizeof(nsort_hash_store_t));
+        if (ts.thisMagic != NSORT_HASH_MAGIC ||
+            ts.size != (int) sizeof(nsort_hash_slot_t) ||
+            hs.capacity < NSORT_HASH_GROUP ||
+            (hs.capacity & (hs.capacity - 1)) != 0 ||
+            hs.capacity > (length - NSORT_HASH_HDR) /
+            (1 + sizeof(nsort_hash_slot_t)) ||
+            hs.keyLength != length - NSORT_HASH_HDR -
+            hs.capacity * (1 + sizeof(nsort_hash_slot_t)) ||
+            hs.number >= hs.capacity ||
+            hs.deleted >= hs.capacity - hs.number ||
+            hs.number > (size_t) 0x7fffffff ||
+            !(hs.maxLoad > 0.0 && hs.maxLoad < 1.0))
+            return SORT_LIST_BADFILE;
+        ctrl = (unsigned char *) (base + NSORT_HASH_HDR);
+        slots = (nsort_hash_slot_t *) (ctrl + hs.capacity);
+        keys = (char *) (slots + hs.capacity);
+        for (i = 0; i < hs.capacity; i++) {
+            if (ctrl[i] == NSORT_HASH_DELETED)
+                deleted++;
+            if (ctrl[i] & 0x80)
+                continue;
+            off = (size_t) slots[i].key;
+            if (off < sizeof(size_t) || off >= hs.keyLength ||
+                off % sizeof(size_t) != 0 ||
+                ctrl[i] != (unsigned char) (slots[i].hash & 0x7f))
+                return SORT_LIST_BADFILE;
+            len = NSORT_HASH_KEYLEN(keys + off);
+            if (len >= hs.keyLength - off || keys[off + len] != '\0')
+                return SORT_LIST_BADFILE;
+            slots[i].key = keys + off;
+            number++;
+        }
+        if (number != hs.number || deleted != hs.deleted)
+            return SORT_LIST_BADFILE;
+        hsh->number = (int) hs.number;
+        hsh->deleted = hs.deleted;
+        hsh->maxLoad = hs.maxLoad;
+        hsh->capacity = hs.capacity;
+        hsh->grow = (size_t) ((double) hs.capacity * hs.maxLoad);
+        if (hsh->grow >= hs.capacity)
+            hsh->grow = hs.capacity - 1;
+        if (hsh->grow < 1)
+            hsh->grow = 1;
+        hsh->ctrl = ctrl;
+        hsh->slots = slots;
+        hsh->map = base;
+        hsh->mapLength = length;
+        return SORT_NOERROR;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{Nsort Hash Functions}
+ *
+ * The nsort hash functions provide the capabilities of a hash implementation
+ * that goes along with the nsort functionality.  The hash is an open
+ * addressing table that starts out big enough for the number of items it is
+ * initialized for and doubles in size whenever it gets too full, so there is
+ * no fixed number of buckets to outgrow.  A search hashes the item, goes to
+ * the group of slots the hash picks and checks the control bytes of the whole
+ * group at once, comparing only the items whose control byte and stored hash
+ * match the item, so it seldom takes more than one compare.
+ *
+ * Error handling for the hash functions is slightly different than it is for
+ * the other nsort functions.  Basically, if an error occurs, the hash object
+ * has an item called hashError that is set to the error.  You can get a 
+ * description of this error by looking at sortErrorString[hsh->hashError].
+ * This is thread safe because the sortErrorString array is read-only and
+ * the hsh->hashError is local to the object.  Therefore, neither is likely
+ * to be altered by another thread as you are gathering the data.
+ *
+ * \subsubsection{nsort_hash_create}
+ * \index{nsort_hash_create}
+ *
+ * [Verbatim] */
+
+    nsort_hash_t *nsort_hash_create(void)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_create() function allocates an nsort hash item on the
+ * heap and returns a pointer to it.  It returns NULL if it fails and you
+ * can look at a description of the error with nsort_show_error().
+ * The hash item doesn't have to be created on the heap.  It can be allocated
+ * as an automatic variable on the stack, in which case this function needn't
+ * be called.
+ *
+ * [EndDoc]
+ */
+    {
+        nsort_hash_t *hsh;
+        hsh = (nsort_hash_t *) malloc(sizeof(nsort_hash_t));
+        if (0 == hsh) {
+            set_sortError(SORT_NOMEMORY);
+            return 0;
+        }
+        return hsh;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_destroy}
+ * \index{nsort_hash_destroy}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_destroy(nsort_hash_t * hsh)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_destroy() function deallocates a hash object that was
+ * created with nsort_hash_create().  The only error occurs if the
+ * parameter to the function is invalid.  In that case, you can get a 
+ * description of the error using nsort_show_error().  nsort_hash_destroy()
+ * returns _OK_ if it succeeds.
+ *
+ * [EndDoc]
+ */
+    {
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        check_pointer(hsh);
+        free(hsh);
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_init}
+ * \index{nsort_hash_init}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_init(nsort_hash_t * hsh,
+                        int (*compare)(void *, void *),
+                        unsigned int (*hash)(const char *))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_init() function initializes a hash object so it can
+ * be used by the hash functions.  The following are the parameters to
+ * this function:
+ *
+ * \begin{itemize}
+ *
+ * \item [hsh] This is the hash object.  It can be allocated on the heap
+ * with a call to nsort_hash_create() or on the stack as an automatic
+ * variable.
+ *
+ * \item [compare] This is a pointer to a compare function.  It is used to
+ * tell whether a key in the hash that has the same hash and length as the key
+ * being added or searched for is that key, which it is if the function returns
+ * 0.  It is called with the key in the hash first, and the other key is only
+ * NUL terminated if it was given as a string.  If it is NULL, the bytes of the
+ * keys are compared, which is what is wanted most of the time.
+ *
+ * \item [hash] This is the pointer to a string hash function.  If it not NULL,
+ * it should be a function that ``hashes well'' for the application that you
+ * are implementing, and it is only used by nsort_hash_add_item() and
+ * nsort_hash_find_item(); the functions that take keys and lengths can't be
+ * used with it.  If you set this parameter to NULL, the keys are hashed with
+ * XXH3 (see nsort_hash_xxh3()), or with the function set by
+ * nsort_hash_set_function(), which works for all of the functions.
+ * 
+ * \end{itemize}
+ *
+ * The table is made big enough for NSORT_HASH_CAPACITY items and a maximum load
+ * of NSORT_HASH_LOAD; use nsort_hash_init_size() to pick these.
+ *
+ * This function returns _OK_ on success or _ERROR_ on error.  If there is an
+ * error, hsh->hashError will contain the error.  You can get a
+ * a description of the error from the read-only string
+ * sortErrorString[hsh->hashError].
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_hash_init_size(hsh, compare, hash, NSORT_HASH_CAPACITY,
+                                    NSORT_HASH_LOAD);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_init_size}
+ * \index{nsort_hash_init_size}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_init_size(nsort_hash_t * hsh,
+                             int (*compare)(void *, void *),
+                             unsigned int (*hash)(const char *),
+                             size_t capacity, double maxLoad)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_init_size() function initializes a hash object like
+ * nsort_hash_init() does, with two more parameters:
+ *
+ * \begin{itemize}
+ *
+ * \item [capacity] This is the number of items the table is made big enough
+ * for to start with, so that it doesn't have to grow until more than that are
+ * added.  If it is 0, NSORT_HASH_CAPACITY is used.
+ *
+ * \item [maxLoad] This is the share of the slots of the table that can be used
+ * before the table is doubled in size.  It has to be more than 0 and less than
+ * 1, or 0 to use NSORT_HASH_LOAD.  A higher load takes less memory and longer
+ * probes.
+ *
+ * \end{itemize}
+ *
+ * This function returns _OK_ on success or _ERROR_ on error.  If there is an
+ * error, hsh->hashError will contain the error.
+ *
+ * [EndDoc]
+ */
+    {
+        size_t slots = NSORT_HASH_GROUP;
+
+        if (maxLoad < 0.0 || maxLoad >= 1.0) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        if (capacity == 0)
+            capacity = NSORT_HASH_CAPACITY;
+        if (maxLoad == 0.0)
+            maxLoad = NSORT_HASH_LOAD;
+        // Set reasonable defaults.
+        memset(hsh, 0, sizeof(nsort_hash_t));
+        hsh->hash = hash;
+        hsh->hash64 = nsort_hash_xxh3;
+        hsh->compare = compare;
+        hsh->maxLoad = maxLoad;
+        while ((double) slots * maxLoad < (double) capacity) {
+            if (slots > ((size_t) -1) / 4) {
+                hsh->hashError = SORT_PARAM;
+                return _ERROR_;
+            }
+            slots <<= 1;
+        }
+        return nsort_hash_resize(hsh, slots);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_xxh3}
+ * \index{nsort_hash_xxh3}
+ *
+ * [Verbatim] */
+
+    uint64_t nsort_hash_xxh3(const void *key, size_t len)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_xxh3() function returns the 64-bit XXH3 hash (from xxhash.h)
+ * of the ``len'' bytes at ``key''.  It is the hash function the keys of a hash
+ * are hashed with unless another one is picked.
+ *
+ * [EndDoc]
+ */
+    {
+        return (uint64_t) XXH3_64bits(key, len);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_set_function}
+ * \index{nsort_hash_set_function}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_set_function(nsort_hash_t * hsh,
+                                uint64_t (*hash)(const void *, size_t))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_set_function() function sets the 64-bit hash function the
+ * keys of the hash object ``hsh'' are hashed with to ``hash'', which is
+ * called with a key and its length.  If ``hash'' is NULL, nsort_hash_xxh3()
+ * is used.  This takes the place of a string hash function given to
+ * nsort_hash_init().  The hash has to be empty, since the keys that are in it
+ * are not hashed again.  It returns _OK_ or _ERROR_, with hsh->hashError set
+ * to SORT_PARAM, if the hash is not empty.
+ *
+ * [EndDoc]
+ */
+    {
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        if (hsh->number != 0) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        hsh->hash = 0;
+        hsh->hash64 = (hash != 0) ? hash : nsort_hash_xxh3;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_add_item}
+ * \index{nsort_hash_add_item}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_add_item(nsort_hash_t * hsh, const char *item)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_add_item() adds the item given by ``item'' to the hash
+ * managed by the hsh object.  It returns _OK_ if it succeeds and
+ * _ERROR_ if not.  If there is an error, hsh->hashError will contain the
+ * error, which is SORT_UNIQUE if the item is in the hash already.  The
+ * string that is being added to the hash is copied into
+ * a buffer that is allocated on the heap and added there.  From that
+ * point on, it is managed by the nsort hash functions.  The item is the same
+ * key as the bytes of the string without the NUL, so it can be searched for
+ * with nsort_hash_find_key() as well, and its value is NULL.
+ *
+ * [EndDoc]
+ */
+    {
+        size_t len;
+
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        if (item == 0 || item[0] == '\0') {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        len = strlen(item);
+        return nsort_hash_insert(hsh, item, len,
+                                 nsort_hash_item_hash(hsh, item, len), 0,
+                                 FALSE);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_find_item}
+ * \index{nsort_hash_find_item}
+ *
+ * [Verbatim] */
+
+    char *nsort_hash_find_item(nsort_hash_t * hsh, const char *item)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_find_item() will search the hash object for the
+ * item given by ``item''.  If it finds it, it will return a read only
+ * pointer to it.  Otherwise, it will return NULL.  If NULL is returned, 
+ * hsh->hashError should be checked to insure there was no error.  An error
+ * condition is defined by hsh->hashError > 0 (SORT_NOERROR is 0).
+ *
+ * [EndDoc]
+ */
+    {
+        size_t i, len;
+
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        if (item == 0 || item[0] == '\0') {
+            hsh->hashError = SORT_PARAM;
+            return 0;
+        }
+        len = strlen(item);
+        hsh->numCompares = 0;
+        i = nsort_hash_probe(hsh, item, len,
+                             nsort_hash_item_hash(hsh, item, len));
+        if (i == hsh->capacity) {
+            hsh->hashError = SORT_NOERROR;
+            return 0;
+        }
+        return hsh->slots[i].key;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_save}
- * \index{nsort_save}
+ * \subsubsection{nsort_hash_add_key}
+ * \index{nsort_hash_add_key}
  *
  * [Verbatim] */
 
-    int nsort_save(nsort_t * srt, const char *desc, int reclen,
-                   char *fname)
+    int nsort_hash_add_key(nsort_hash_t * hsh, const void *key, size_t len,
+                           void *value)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_save() funciton saves the contents of the list managed by
- * ``srt'' to a file.  The parameters to this function are as follows:
- *
- * \begin{itemize}
- *
- * \item [srt] This parameter is an nsort header object that is to be
- * saved to disk.  The data contained in the srt->lh list is stored
- * in the file.
- *
- * \item [desc] The desc item is the same as the desc parameter for the
- * nsort_list_save() function.  It is a string that can be up to 127 bytes
- * long.
- *
- * \item [reclen] This parameter is the length of each record that is to
- * be saved.
- *
- * \item [fname] This is the name of the file to save the data to.  This
- * file will be created if it doesn't exist.  If another file exists with that
- * name, it will be destroyed and the data irrevocably lost.
- *
- * \end{itemize}
- *
- * nsort_save() returns _OK_ if it is successful or _ERROR_ if an error
- * occurs.  If there is an error, srt->sortError will contain the error.
+ * The nsort_hash_add_key() function adds the key given by the ``len'' bytes
+ * at ``key'', which can be any bytes, to the hash managed by the hsh object,
+ * with ``value'' as the value that goes with it.  The key is copied (with a
+ * NUL after it) and managed by the nsort hash functions from then on; the
+ * value is just kept.  It returns _OK_ if it succeeds and _ERROR_ if not, in
+ * which case hsh->hashError will contain the error.  It is SORT_UNIQUE if the
+ * key is in the hash already, and SORT_PARAM if a string hash function was
+ * given to nsort_hash_init().
  *
  * [EndDoc]
  */
     {
-        time_t now;
-        struct tm result;
-        nsort_store_t *ts;
-        char tstamp[27];
-        char *cp;
-        int status;
-
-        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
-        if (0 == ts) {
-            srt->sortError = SORT_NOMEMORY;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-        memset(ts, 0, sizeof(nsort_store_t));
-
-        ts->thisMagic = DEFAULT_MAGIC;
-        if (desc)
-            strncpy(ts->description, desc, 127);
-        time(&now);
-        localtime_r(&now, &result);
-        asctime_r(&result, tstamp);
-        cp = strchr(tstamp, '\n');
-        if (cp != 0)
-            *cp = '\0';
-        strcpy(ts->timeStamp, tstamp);
-        status = nsort_store(srt, ts, reclen, fname);
-        free(ts);
-        return status;
+        if ((key == 0 && len != 0) || hsh->hash != 0) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        return nsort_hash_insert(hsh, key, len, hsh->hash64(key, len), value,
+                                 FALSE);
     }
 
 /*
- * Do not document this as part of the API.
- */
-    int nsort_retrieve(nsort_t * srt, nsort_store_t * ts,
-                       const char *fname, long magic) {
-        int status;
-        int i;
-#ifndef __MIRC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
-#endif                          /* __MIRC__ */
-        int ctr_lvl[NSORT_NODE_LEVEL];
-#ifndef __MIRC__
-#pragma GCC diagnostic pop
-#endif                          /* __MIRC__ */
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_put_key}
+ * \index{nsort_hash_put_key}
+ *
+ * [Verbatim] */
 
-        for (i = 0; i < NSORT_NODE_LEVEL; i++)
-            ctr_lvl[i] = 0;
-        srt->lh = nsort_list_create();
-        if (nsort_check_error()) {
-            srt->sortError = get_sortError();
-            set_sortError(SORT_NOERROR);
-            return _ERROR_;
-        }
-        status = nsort_list_retrieve(srt->lh, ts, fname, magic);
-        if (srt->lh == 0) {
-            if (nsort_check_list_error(srt->lh))
-                srt->sortError = srt->lh->listError;
-            else if (nsort_check_error())
-                srt->sortError = get_sortError();
-            else
-                srt->sortError = SORT_UNSPECIFIED;
-            return _ERROR_;
-        }
-        srt->head = (nsort_node_t *) malloc(sizeof(nsort_node_t));
-        if (0 == srt->head) {
-            srt->sortError = SORT_NOMEMORY;
+    int nsort_hash_put_key(nsort_hash_t * hsh, const void *key, size_t len,
+                           void *value)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_put_key() function is like nsort_hash_add_key(), except
+ * that if the key is in the hash already, its value is set to ``value''
+ * instead of that being an error.
+ *
+ * [EndDoc]
+ */
+    {
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-        memset(srt->head, 0, sizeof(nsort_node_t));
-        srt->tail = (nsort_node_t *) malloc(sizeof(nsort_node_t));
-        if (0 == srt->tail) {
-            free(srt->head);
-            srt->sortError = SORT_NOMEMORY;
+        if ((key == 0 && len != 0) || hsh->hash != 0) {
+            hsh->hashError = SORT_PARAM;
             return _ERROR_;
         }
-        memset(srt->tail, 0, sizeof(nsort_node_t));
-        srt->current = srt->head;
-        srt->isUnique = ts->isUnique;
-        srt->manageAllocs = ts->manageAllocs;
-        srt->head->next = srt->tail;
-        srt->tail->prev = srt->head;
-        srt->head->prev = 0;
-        srt->tail->next = 0;
-
-        status = nsort_restructure_nodes(srt);
-        if (status == _ERROR_)
-            nsort_del(srt, 0);
-        return status;
+        return nsort_hash_insert(hsh, key, len, hsh->hash64(key, len), value,
+                                 TRUE);
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_get}
- * \index{nsort_get}
+ * \subsubsection{nsort_hash_find_key}
+ * \index{nsort_hash_find_key}
  *
  * [Verbatim] */
 
-    int nsort_get(nsort_t * srt, int (*compare)(void *, void *),
-                  const char *fname)
+    const char *nsort_hash_find_key(nsort_hash_t * hsh, const void *key,
+                                    size_t len, void **value)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_get() function reads populates the nsort object ``srt'' with
- * the contents of the data in the file given by  ``fname''.  The following
- * are the parameters for this function:
+ * The nsort_hash_find_key() function searches the hash object for the key
+ * given by the ``len'' bytes at ``key''.  If it finds it, it returns a read
+ * only pointer to the copy of the key in the hash and, if ``value'' is not
+ * NULL, puts the value of the key in it.  Otherwise, it returns NULL, and
+ * hsh->hashError should be checked to insure there was no error.
  *
- * \begin{itemize}
+ * [EndDoc]
+ */
+    {
+        size_t i;
+
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return 0;
+        }
+        if ((key == 0 && len != 0) || hsh->hash != 0) {
+            hsh->hashError = SORT_PARAM;
+            return 0;
+        }
+        hsh->numCompares = 0;
+        i = nsort_hash_probe(hsh, key, len, hsh->hash64(key, len));
+        if (i == hsh->capacity) {
+            hsh->hashError = SORT_NOERROR;
+            return 0;
+        }
+        if (value != 0)
+            *value = hsh->slots[i].value;
+        return hsh->slots[i].key;
+    }
+
+/*
+ * [BeginDoc]
  *
- * \item [srt] This parameter is the nsort object.  It should be created
- * with a call to nsort_create() just for the purpose of storing the data
- * that is retrieved from the file by this function.  It will be initialized
- * here.
+ * \subsubsection{nsort_hash_use_arena}
+ * \index{nsort_hash_use_arena}
  *
- * \item [compare] This is the compare function that will determine the sort
- * order.  It should be the same compare function that was used to sort the
- * data that was stored in the file in the first place.
+ * [Verbatim] */
+
+    int nsort_hash_use_arena(nsort_hash_t * hsh, size_t slabSize)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
  *
- * \item [fname] This parameter is the name of the file to read the data
- * from.  The file is opened read-only and the data is read and used to
- * populate the in memory objects.
+ * The nsort_hash_use_arena() function attaches an arena to the hash object
+ * given by ``hsh'' (see nsort_arena_t).  From then on, the copies of the keys
+ * that are added, each with its length in front of it and a NUL after it, are
+ * packed one after the other into the slabs of the arena, at the alignment of
+ * a size_t, instead of being allocated with malloc() one at a time.  That takes less memory for short
+ * keys and no call to malloc() or its lock for each key, and nsort_hash_del()
+ * frees the keys a slab at a time.  The ``slabSize'' parameter is the size of
+ * the first slab; 0 selects NSORT_ARENA_SLAB.
  *
- * \end{itemize}
+ * The arena is append only, so the room of a key that is removed is not used
+ * again (unless it was the last key added) until the hash is deleted.  A hash
+ * whose keys are removed and added all the time is better off without one.
  *
- * The nsort_get() function returns _OK_ if it is successful or _ERROR_
- * if there is an error.  On error, you can get a description of the
- * error by calling nsort_show_sort_error().
+ * This has to be called after nsort_hash_init() or nsort_hash_get() and
+ * before keys are added.  Calling it for a hash that has an arena already does
+ * nothing.  It returns _OK_ on success or _ERROR_ with hsh->hashError set to
+ * SORT_LIST_NOTEMPTY, if keys have been added, or SORT_NOMEMORY.
  *
  * [EndDoc]
  */
     {
-        nsort_store_t *ts;
-        int status;
-
-        memset(srt, 0, sizeof(nsort_t));
-        srt->compare = compare;
+        size_t i;
 
-        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
-        if (0 == ts) {
-            srt->sortError = SORT_NOMEMORY;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-
-        status = nsort_retrieve(srt, ts, fname, DEFAULT_MAGIC);
-        srt->isUnique = ts->isUnique;
-        srt->manageAllocs = ts->manageAllocs;
-        free(ts);
-        if (status == _ERROR_) {
-            nsort_del(srt, 0);
+        if (hsh->arena != 0)
+            return _OK_;
+        for (i = 0; i < hsh->capacity; i++)
+            if ((hsh->ctrl[i] & 0x80) == 0 &&
+                !nsort_hash_mapped(hsh, hsh->slots[i].key)) {
+                hsh->hashError = SORT_LIST_NOTEMPTY;
+                return _ERROR_;
+            }
+        hsh->arena = (nsort_arena_t *) malloc(sizeof(nsort_arena_t));
+        if (hsh->arena == 0) {
+            hsh->hashError = SORT_NOMEMORY;
             return _ERROR_;
         }
+        nsort_arena_init(hsh->arena, slabSize);
         return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_get_all}
- * \index{nsort_get_all}
+ * \subsubsection{nsort_hash_remove_item}
+ * \index{nsort_hash_remove_item}
  *
  * [Verbatim] */
 
-    int nsort_get_all(nsort_t * srt, int (*compare)(void *, void *),
-                      const char *fname, char *desc, char *timestamp)
+    int nsort_hash_remove_item(nsort_hash_t * hsh, const char *item)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_get_all() function is similar to the nsort_get function except
- * that it copies the description and the time stamp that are stored in the
- * file to ``desc'' and ``timestamp'' respectively.  The following are the
- * parameters for this function:
- *
- * \begin{itemize}
- *
- * \item [srt] This parameter is the nsort object.  It should be created
- * with a call to nsort_create() just for the purpose of storing the data
- * that is retrieved from the file by this function.  It will be initialized
- * here.
- *
- * \item [compare] This is the compare function that will determine the sort
- * order.  It should be the same compare function that was used to sort the
- * data that was stored in the file in the first place.
- *
- * \item [fname] This parameter is the name of the file to read the data
- * from.  The file is opened read-only and the data is read and used to
- * populate the in memory objects.
- *
- * \item [desc] This parameter should be a character array with enough
- * storage to hold 127 characters.  The description that was put in the
- * file when it was stored will be copied to this.
- *
- * \item [timestamp] This parameter should be a character array with
- * enough storage to hold 26 characters.  The time stamp that was put
- * in the file when it was stored will be copied to this.
- *
- * \end{itemize}
- *
- * The nsort_get_all() function returns _OK_ if it succeeds and _ERROR_ if there
- * is an error.  On error, you can get a description of what went wrong
- * by calling the nsort_show_sort_error() function.
+ * The nsort_hash_remove_item() function takes the item given by ``item'' out
+ * of the hash object and frees the copy of it.  It returns _OK_ if the item
+ * was in the hash and _ERROR_ if not.  If _ERROR_ is returned, hsh->hashError
+ * should be checked; it is SORT_NOERROR if the item just wasn't there.
  *
  * [EndDoc]
  */
     {
-        nsort_store_t *ts;
-        int status;
-
-        memset(srt, 0, sizeof(nsort_t));
-        srt->compare = compare;
+        size_t i, len;
 
-        ts = (nsort_store_t *) malloc(sizeof(nsort_store_t));
-        if (0 == ts) {
-            srt->sortError = SORT_NOMEMORY;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-
-        status = nsort_retrieve(srt, ts, fname, DEFAULT_MAGIC);
-        srt->isUnique = ts->isUnique;
-        srt->manageAllocs = ts->manageAllocs;
-#ifndef __clang__
-#if defined (__GNUC__)
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstringop-truncation"
-#endif
-#endif
-        strncpy(desc, ts->description, 127);
-        strncpy(timestamp, ts->timeStamp, 26);
-#ifndef __clang__
-#if defined (__GNUC__)
-#pragma GCC diagnostic pop
-#endif
-#endif
-        free(ts);
-        if (status == _ERROR_) {
-            nsort_del(srt, 0);
+        if (item == 0 || item[0] == '\0') {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        len = strlen(item);
+        hsh->numCompares = 0;
+        i = nsort_hash_probe(hsh, item, len,
+                             nsort_hash_item_hash(hsh, item, len));
+        if (i == hsh->capacity) {
+            hsh->hashError = SORT_NOERROR;
             return _ERROR_;
         }
+        nsort_hash_remove_slot(hsh, i);
         return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_remove_item}
- * \index{nsort_remove_item}
+ * \subsubsection{nsort_hash_remove_key}
+ * \index{nsort_hash_remove_key}
  *
  * [Verbatim] */
 
-    nsort_link_t *nsort_remove_item(nsort_t * srt, nsort_link_t * lnk)
+    int nsort_hash_remove_key(nsort_hash_t * hsh, const void *key, size_t len,
+                              void **value)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_remove_item() removes the item lnk->data from the list
- * in srt->lh.  If it is successful, it removes the item and returns
- * the link that points to it.  If it is not successful, it returns
- * NULL and srt->sortError points to the error.  A global error will
- * be set if srt == 0, srt->lh == 0 or lnk == 0.
- * (\emph{Note: removes are very inefficient with nsorts, which are
- * optimized for adds.  Use this function sparingly.})
+ * The nsort_hash_remove_key() function takes the key given by the ``len''
+ * bytes at ``key'' out of the hash object and frees the copy of it.  If
+ * ``value'' is not NULL, the value of the key is put in it, since it is the
+ * caller's to free.  It returns _OK_ if the key was in the hash and _ERROR_ if
+ * not, with hsh->hashError SORT_NOERROR if the key just wasn't there.
+ *
+ * The slot of a removed key is marked so that searches go on past it, and it
+ * is used again by a key that is added later.  When the keys and the removed
+ * slots fill the table up to its maximum load, the table is rebuilt without
+ * the removed slots (see nsort_hash_t).
  *
  * [EndDoc]
  */
     {
-        nsort_node_t *node, *nextNode;
-        nsort_link_t *link, *found;
-        int status;
-#ifdef NSORT_STATS
-        double t1, t2;
-#endif
-
-        if (srt->numCompares > NSORT_CRIT_THRESH) {
-            srt->thresh = 0;
-            status = nsort_restructure_nodes(srt);
-            if (status == _ERROR_)
-                return 0;
-        }
-        else if (srt->numCompares > NSORT_OUTPOINT_THRESH) {
-            ++srt->thresh;
-            if (srt->thresh > NSORT_RSTRUCT_THRESH) {
-                srt->thresh = 0;
-                status = nsort_restructure_nodes(srt);
-                if (status == _ERROR_)
-                    return 0;
-            }
-        }
-        srt->numCompares = 0;
+        size_t i;
 
-        if (srt == 0 || srt->lh == 0 || lnk == 0) {
+        if (hsh == 0) {
             set_sortError(SORT_PARAM);
-            return 0;
-        }
-
-        // BUGBUG
-        // Remove this and test with it gone.  Basically, we use the same algorithm
-        // whether this is a unique index or not, which should be OK.  It protects us from having
-        // performance issues with having to nsort_restructure_nodes().
-        // BUGBUG
-#if 0
-        if (srt->isUnique) {
-            // traversal_time will have the find time.
-            if (0 == found) {
-                srt->sortError = SORT_CORRUPT;
-                return 0;
-            }
-#ifdef NSORT_STATS
-            nsort_elapsed(&t1);
-#endif
-            if (lnk == srt->current->here) {
-                srt->lh->current = lnk;
-                link = nsort_list_remove_link(srt->lh);
-                if (link == 0) {
-                    srt->sortError = srt->lh->listError;
-                    return 0;
-                }
-                // XXX: Fix this - find some way to insure that this doesn't have to
-                // happen on every remove.  The issue I have is that I don't want
-                // to slow down processing on adds, so I feel that right now this is
-                // a fair trade off.  If I have an application that needs to delete
-                // stuff from sorted items, though, this will have to be resolved.
-                nsort_restructure_nodes(srt);
-#ifdef NSORT_STATS
-                nsort_elapsed(&t2);
-                srt->traversal_time += (t2 - t1);
-#endif
-                return link;
-            }
-            else {
-                srt->lh->current = lnk;
-                link = nsort_list_remove_link(srt->lh);
-                if (link == 0) {
-                    srt->sortError = srt->lh->listError;
-                    return 0;
-                }
-                // XXX - Ditto here.
-#ifdef NSORT_STATS
-                nsort_elapsed(&t2);
-                srt->traversal_time += (t2 - t1);
-#endif
-                nsort_restructure_nodes(srt);
-                return link;
-            }
-        }
-        /*
-         * Not unique - have to jump through some hoops.
-         */
-#endif
-        found = nsort_query_item(srt, lnk);
-        if (found == 0) {
-            srt->sortError = SORT_CORRUPT;
-            return 0;
-        }
-#ifdef NSORT_STATS
-        nsort_elapsed(&t1);
-#endif
-        node = srt->current;
-        if (node->here == lnk) {
-            /*
-             * We are on a node
-             */
-            srt->lh->current = lnk;
-            link = nsort_list_remove_link(srt->lh);
-            if (link == 0) {
-                srt->sortError = srt->lh->listError;
-                return 0;
-            }
-            status = nsort_restructure_nodes(srt);
-            if (status == _ERROR_)
-                return 0;
-#ifdef NSORT_STATS
-            nsort_elapsed(&t2);
-            srt->traversal_time += (t2 - t1);
-#endif
-            return link;
+            return _ERROR_;
         }
-        nextNode = node->next;
-        if (nextNode->here != 0) {
-            status = srt->compare(lnk->data, nextNode->here->data);
-            srt->numCompares++;
-            while (status == 0) {
-                if (nextNode->here == lnk) {
-                    srt->lh->current = lnk;
-                    link = nsort_list_remove_link(srt->lh);
-                    if (0 == link) {
-                        srt->sortError = srt->lh->listError;
-                        return 0;
-                    }
-                    status = nsort_restructure_nodes(srt);
-                    if (status == _ERROR_)
-                        return 0;
-#ifdef NSORT_STATS
-                    nsort_elapsed(&t2);
-                    srt->traversal_time += (t2 - t1);
-#endif
-                    return link;
-                }
-                nextNode = nextNode->next;
-                if (nextNode == srt->tail || nextNode->here == 0)
-                    break;
-                else {
-                    status = srt->compare(lnk->data, nextNode->here->data);
-                    srt->numCompares++;
-                }
-            }
+        if ((key == 0 && len != 0) || hsh->hash != 0) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
         }
-        /*
-         * It looks like the link is not on a node; just remove it.
-         */
-        srt->lh->current = lnk;
-        link = nsort_list_remove_link(srt->lh);
-        if (0 == link) {
-            srt->sortError = SORT_CORRUPT;
-            return 0;
+        hsh->numCompares = 0;
+        i = nsort_hash_probe(hsh, key, len, hsh->hash64(key, len));
+        if (i == hsh->capacity) {
+            hsh->hashError = SORT_NOERROR;
+            return _ERROR_;
         }
-        return link;
+        if (value != 0)
+            *value = hsh->slots[i].value;
+        nsort_hash_remove_slot(hsh, i);
+        return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_node_levels}
- * \index{nsort_node_levels}
+ * \subsubsection{nsort_hash_cursor_init}
+ * \index{nsort_hash_cursor_init}
  *
  * [Verbatim] */
 
-    int nsort_node_levels(nsort_t * srt, nsort_node_level_t * lvl)
+    int nsort_hash_cursor_init(nsort_hash_cursor_t * cur, nsort_hash_t * hsh)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_node_levels() function gathers information about the indexes
- * that are managed by the sort object ``srt'' and puts it in the
- * ``lvl'' variable.  This can be used to determine how many nodes are in
- * the higher level indexes.  Currently, this only returns _OK_.
+ * The nsort_hash_cursor_init() function sets up the cursor ``cur'' to go
+ * through the keys of the hash object ``hsh'' from the first one.  Nothing is
+ * allocated, so there is nothing to free when the cursor is done with.  It
+ * returns _OK_, or _ERROR_ with the global error set to SORT_PARAM if either of
+ * them is NULL.
  *
  * [EndDoc]
  */
     {
-        int counter;
-        nsort_node_t *node;
-        int i;
-
-        for (i = NSORT_NODE_LEVEL - 1; i >= 0; i--) {
-            node = srt->head->next;
-            if (node->level[i] == srt->tail)
-                lvl->lvl[i] = 0;
-            else {
-                counter = 0;
-                while (node->level[i] != srt->tail) {
-                    node = node->level[i];
-                    counter++;
-                }
-                lvl->lvl[i] = counter;
-            }
+        if (cur == 0 || hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
         }
+        cur->hsh = hsh;
+        cur->slot = 0;
         return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_sort_to_list}
- * \index{nsort_sort_to_list}
+ * \subsubsection{nsort_hash_cursor_next}
+ * \index{nsort_hash_cursor_next}
  *
  * [Verbatim] */
 
-    nsort_list_t *nsort_sort_to_list(nsort_t * srt)
+    const char *nsort_hash_cursor_next(nsort_hash_cursor_t * cur,
+                                       size_t * len, void **value)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_sort_to_list() function dismantles the nsort object ``srt''
- * and returns the list in srt->lh.  Everything is freed except the
- * srt object itself.  If it was created with a call to nsort_create(),
- * it will need to be freed by calling nsort_destroy().  If it is
- * successful, it returns a pointer to the list header that is used to
- * manage the list.  If it fails, it returns NULL.  The only possible
- * failure is that the function parameter is invalid, so the error
- * is put in the global variable.  You can look at a description of the
- * error with a call to nsort_show_error().
+ * The nsort_hash_cursor_next() function returns a read only pointer to the
+ * next key of the hash, or NULL once all of them have been returned.  If
+ * ``len'' is not NULL, the length of the key is put in it, and if ``value'' is
+ * not NULL, its value is.  The keys come in the order of the slots they are
+ * in, which has nothing to do with the order they were added in.
+ *
+ * The key that was just returned can be taken out of the hash with
+ * nsort_hash_remove_key() without upsetting the cursor, so a hash can be
+ * pruned as it is gone through.  Adding a key can rebuild the table, though,
+ * after which the cursor has to be set up again.
  *
  * [EndDoc]
  */
     {
-        nsort_list_t *lh;
-        nsort_node_t *node, *nextNode;
+        nsort_hash_t *hsh;
+        size_t i;
 
-        if (srt == 0 || srt->lh == 0) {
-            set_sortError(SORT_CORRUPT);
+        if (cur == 0 || cur->hsh == 0)
+            return 0;
+        hsh = cur->hsh;
+        for (i = cur->slot; i < hsh->capacity; i++)
+            if ((hsh->ctrl[i] & 0x80) == 0)
+                break;
+        if (i >= hsh->capacity) {
+            cur->slot = hsh->capacity;
             return 0;
         }
-        lh = srt->lh;
-        srt->lh = 0;
-
-        /*
-         * Now, just dismantle the shell and return the list.
-         */
-        if (srt->head->next != srt->tail) {
-            node = srt->head->next;
-            nextNode = node->next;
-            while (TRUE) {
-                free(node);
-                if (nextNode == srt->tail)
-                    break;
-                node = nextNode;
-                nextNode = node->next;
-            }
-        }
-        free(srt->head);
-        free(srt->tail);
-        return lh;
+        cur->slot = i + 1;
+        if (len != 0)
+            *len = NSORT_HASH_KEYLEN(hsh->slots[i].key);
+        if (value != 0)
+            *value = hsh->slots[i].value;
+        return hsh->slots[i].key;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_list_to_sort}
- * \index{nsort_list_to_sort}
+ * \subsubsection{nsort_hash_save}
+ * \index{nsort_hash_save}
  *
  * [Verbatim] */
 
-    int nsort_list_to_sort(nsort_t * srt, nsort_list_t * lh,
-                           int (*cmp)(void *, void *))
+    int nsort_hash_save(nsort_hash_t * hsh, const char *desc,
+                        const char *fname)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_list_to_sort() function takes the list given by ``lh'' and builds
- * the management objects around it needed to maintain a sorted object.  The
- * parameters of this function are as follows:
- *
- * \begin{itemize}
- *
- * \item [srt] This parameter is an nsort_t object that has been allocated
- * on the heap with a call to nsort_create() or allocated on the stack
- * as an automatic variable.  There is no need to call nsort_init() on this
- * item as all the necessary parts are built into the srt object by this
- * function.
- *
- * \item [lh] This parameter is the list header of a list that contains
- * sorted data.  Dire things will happen if the data contained by this list
- * is not sorted.  The list header lh needs to be created on the heap by
- * a call to nsort_list_create(); it should not be an item allocated on the
- * stack as a local variable.
- *
- * \item [cmp] This is the compare function that the sort object will
- * use for further adds and for finds.  It should be the same compare function
- * that was used to sort the items in the list.
- *
- * \end{itemize}
- *
- * This function returns _OK_ if it succeeds and _ERROR_ if there is an
- * error.  If there is an error, srt->sortError contains the error.
+ * The nsort_hash_save() function writes the hash object ``hsh'' to the file
+ * ``fname'', with ``desc'' as the description in the header, so that it can
+ * be read back with nsort_hash_get() without hashing or copying a single key.
+ * The table is written just as it is in memory and the keys are packed in
+ * after it (see nsort_hash_store_t).  The values are written as they are, so
+ * they are only any good in the file if they are numbers (or offsets) rather
+ * than pointers.
+ *
+ * The hash has to use a 64-bit hash function, since the hashes are kept in
+ * the file; one made with a string hash function given to nsort_hash_init()
+ * can't be saved.  The file is not synced, and it can only be read back on a
+ * machine with the same word size and byte order.  The hash is written to
+ * ``fname'' with ``.tmp'' on the end, which is renamed to ``fname'' when it
+ * is done, so a hash can be saved to the file nsort_hash_get() mapped it
+ * from.  nsort_hash_save() returns _OK_ if it is successful or _ERROR_ if
+ * not, in which case hsh->hashError will contain the error.
  *
  * [EndDoc]
  */
     {
-        int status;
-
-        memset(srt, 0, sizeof(nsort_t));
-        srt->compare = (int (*)(void *, void *)) cmp;
+        nsort_store_t ts;
+        nsort_hash_store_t hs;
+        nsort_hash_slot_t slot;
+        nsort_writer_t w;
+        size_t i, len, off;
+        char *tmpName;
+        nsort_error_t error;
+        int fd = -1, status = _OK_;
 
-        srt->lh = lh;
-        srt->head = (nsort_node_t *) malloc(sizeof(nsort_node_t));
-        if (0 == srt->head) {
-            srt->sortError = SORT_NOMEMORY;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-        memset(srt->head, 0, sizeof(nsort_node_t));
-        srt->tail = (nsort_node_t *) malloc(sizeof(nsort_node_t));
-        if (0 == srt->tail) {
-            free(srt->head);
-            srt->sortError = SORT_NOMEMORY;
+        if (fname == 0 || hsh->hash != 0) {
+            hsh->hashError = SORT_PARAM;
             return _ERROR_;
         }
-        memset(srt->tail, 0, sizeof(nsort_node_t));
-        srt->current = srt->head;
-        srt->isUnique = FALSE;
-        srt->manageAllocs = TRUE;
-        srt->head->next = srt->tail;
-        srt->tail->prev = srt->head;
-        srt->head->prev = 0;
-        srt->tail->next = 0;
-
-        status = nsort_restructure_nodes(srt);
-        if (_ERROR_ == status) {
-            /* error is set */
-            nsort_del(srt, 0);
+        memset(&hs, 0, sizeof(nsort_hash_store_t));
+        hs.number = (size_t) hsh->number;
+        hs.capacity = hsh->capacity;
+        hs.deleted = hsh->deleted;
+        hs.maxLoad = hsh->maxLoad;
+        for (i = 0; i < hsh->capacity; i++)
+            if ((hsh->ctrl[i] & 0x80) == 0)
+                hs.keyLength +=
+                    NSORT_HASH_KEYSIZE(NSORT_HASH_KEYLEN(hsh->slots[i].key));
+        nsort_store_stamp(&ts, NSORT_HASH_MAGIC, desc);
+        ts.isUnique = TRUE;
+        ts.number = hsh->number;
+        ts.size = (int) sizeof(nsort_hash_slot_t);
+
+        tmpName = nsort_save_name(fname);
+        if (tmpName == 0)
+            set_sortError(SORT_NOMEMORY);
+        else
+            nsort_file_create(tmpName, fd);
+        if (!nsort_check_error() && nsort_writer_open(&w, fd, 0) == _OK_) {
+            status = nsort_writer_put(&w, &ts, sizeof(nsort_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, &hs,
+                                          sizeof(nsort_hash_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, 0, NSORT_HASH_HDR -
+                                          sizeof(nsort_store_t) -
+                                          sizeof(nsort_hash_store_t));
+            if (status == _OK_)
+                status = nsort_writer_put(&w, hsh->ctrl, hsh->capacity);
+            off = 0;
+            for (i = 0; i < hsh->capacity && status == _OK_; i++) {
+                memset(&slot, 0, sizeof(nsort_hash_slot_t));
+                if ((hsh->ctrl[i] & 0x80) == 0) {
+                    len = NSORT_HASH_KEYLEN(hsh->slots[i].key);
+                    slot = hsh->slots[i];
+                    slot.key = (char *) (off + sizeof(size_t));
+                    off += NSORT_HASH_KEYSIZE(len);
+                }
+                status = nsort_writer_put(&w, &slot,
+                                          sizeof(nsort_hash_slot_t));
+            }
+            for (i = 0; i < hsh->capacity && status == _OK_; i++) {
+                if (hsh->ctrl[i] & 0x80)
+                    continue;
+                len = NSORT_HASH_KEYLEN(hsh->slots[i].key);
+                status = nsort_writer_put(&w, hsh->slots[i].key -
+                                          sizeof(size_t),
+                                          sizeof(size_t) + len + 1);
+                if (status == _OK_)
+                    status = nsort_writer_put(&w, 0,
+                                              NSORT_HASH_KEYSIZE(len) -
+                                              sizeof(size_t) - len - 1);
+            }
+            if (nsort_writer_close(&w, NSORT_SYNC_NONE) == _ERROR_)
+                status = _ERROR_;
+        }
+        if (fd >= 0)
+            nsort_file_close(fd);
+        error = nsort_save_finish(tmpName, fname,
+                                  !nsort_check_error() && status == _OK_);
+        if (error != SORT_NOERROR)
+            set_sortError(error);
+        if (nsort_check_error() || status == _ERROR_) {
+            hsh->hashError = nsort_check_error() ? get_sortError() :
+                SORT_FRDWR;
+            set_sortError(SORT_NOERROR);
             return _ERROR_;
         }
         return _OK_;
     }
 
 /*
- * These sh functions are not API functions.  Don't document them.
+ * [BeginDoc]
  *
- * Make sure one of them and only one is called nsort_hash_function()
+ * \subsubsection{nsort_hash_get}
+ * \index{nsort_hash_get}
+ *
+ * [Verbatim] */
+
+    int nsort_hash_get(nsort_hash_t * hsh, int (*compare)(void *, void *),
+                       uint64_t (*hash)(const void *, size_t),
+                       const char *fname)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_get() function initializes the hash object ``hsh'' from the
+ * file ``fname'' written by nsort_hash_save().  ``compare'' is the compare
+ * function, as for nsort_hash_init(), and ``hash'' is the 64-bit hash
+ * function the keys were hashed with when the hash was saved, or NULL for
+ * nsort_hash_xxh3().  The first key is hashed again to check that it is the
+ * same function; if it is not, the error is SORT_PARAM.
+ *
+ * The file is mapped into memory (with a private mapping, so changes to the
+ * hash don't get to the file) and the table and the keys are used where they
+ * lie in it, so nothing is allocated for each key and the pages of the file are
+ * only read in as they are touched.  Where there is no mmap(), the file is
+ * read in with one read instead.  Keys can be added to and removed from the
+ * hash as usual; the mapping is let go by nsort_hash_del().
+ *
+ * nsort_hash_get() returns _OK_ if it is successful or _ERROR_ if not, in
+ * which case hsh->hashError will contain the error, which is
+ * SORT_LIST_BADFILE if the file is not a hash file or is cut short.
+ *
+ * [EndDoc]
  */
-/* unsigned long nsort_hash_function (register const unsigned char *key) */
-    unsigned long nsort_hash_function(register const unsigned char *key) {
-        unsigned long val = 0;
+    {
+        nsort_error_t err;
+        size_t length = 0, i;
+        char *base;
 
-        while (*key != '\0') {
-            unsigned int tmp;
-            val = (val << 4) + (*key);
-            tmp = (val & 0xf0000000);
-            if (tmp) {
-                val = val ^ (tmp >> 24);
-                val = val ^ tmp;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
+        }
+        if (fname == 0) {
+            hsh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        memset(hsh, 0, sizeof(nsort_hash_t));
+        hsh->compare = compare;
+        hsh->hash64 = (hash != 0) ? hash : nsort_hash_xxh3;
+        base = (char *) nsort_map_file(fname, &length, TRUE);
+        if (base == 0) {
+            hsh->hashError = get_sortError();
+            set_sortError(SORT_NOERROR);
+            return _ERROR_;
+        }
+        err = nsort_hash_setup(hsh, base, length);
+        for (i = 0; err == SORT_NOERROR && i < hsh->capacity; i++)
+            if ((hsh->ctrl[i] & 0x80) == 0) {
+                if (hsh->hash64(hsh->slots[i].key,
+                                NSORT_HASH_KEYLEN(hsh->slots[i].key)) !=
+                    hsh->slots[i].hash)
+                    err = SORT_PARAM;
+                break;
             }
-            key++;
+        if (err != SORT_NOERROR) {
+            nsort_unmap_file(base, length);
+            memset(hsh, 0, sizeof(nsort_hash_t));
+            hsh->hashError = err;
+            return _ERROR_;
         }
-        return val % NSORT_HASH_SIZE;
+        return _OK_;
     }
 
-#define mix(a,b,c) \
-{ \
-    a -= b; a -= c; a ^= (c>>13); \
-    b -= c; b -= a; b ^= (a<<8); \
-    c -= a; c -= b; c ^= (b>>13); \
-    a -= b; a -= c; a ^= (c>>12);  \
-    b -= c; b -= a; b ^= (a<<16); \
-    c -= a; c -= b; c ^= (b>>5); \
-    a -= b; a -= c; a ^= (c>>3);  \
-    b -= c; b -= a; b ^= (a<<10); \
-    c -= a; c -= b; c ^= (b>>15); \
-}
-
 /*
-#define mix2(a,b,c) \
-{ \
-a -= b; a -= c; a ^= (c>>13); \
-b -= c; b -= a; b ^= (a<< 8); \
-c -= a; c -= b; c ^= ((b&0xffffffff)>>13); \
-a -= b; a -= c; a ^= ((c&0xffffffff)>>12); \
-b -= c; b -= a; b = (b ^ (a<<16)) & 0xffffffff; \
-c -= a; c -= b; c = (c ^ (b>> 5)) & 0xffffffff; \
-a -= b; a -= c; a = (a ^ (c>> 3)) & 0xffffffff; \
-b -= c; b -= a; b = (b ^ (a<<10)) & 0xffffffff; \
-c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
-}
-*/
-
-/* register unsigned char *k; */
-/* unsigned long nsort_hash_function_jenkins ( register const unsigned char *k ) */
-    unsigned long nsort_hash_function_jenkins(register const unsigned char
-                                              *k) {
-        register unsigned long length = strlen((const char *) k);   /* the length of the key */
-        register unsigned long initval = (2 << 16) - 1; /* the previous hash, or an arbitrary value */
-        register unsigned long a, b, c, len;
-
-        /* Set up the internal state */
-        len = length;
-        a = b = 0x9e3779b9;     /* the golden ratio; an arbitrary value */
-        c = initval;            /* the previous hash value */
-
-    /*---------------------------------------- handle most of the key */
-        while (len >= 12) {
-            a += (k[0] + ((unsigned long) k[1] << 8) +
-                  ((unsigned long) k[2] << 16) +
-                  ((unsigned long) k[3] << 24));
-            b += (k[4] + ((unsigned long) k[5] << 8) +
-                  ((unsigned long) k[6] << 16) +
-                  ((unsigned long) k[7] << 24));
-            c += (k[8] + ((unsigned long) k[9] << 8) +
-                  ((unsigned long) k[10] << 16) +
-                  ((unsigned long) k[11] << 24));
-            mix(a, b, c);
-            k += 12;
-            len -= 12;
-        }
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_hash_del}
+ * \index{nsort_hash_del}
+ *
+ * [Verbatim] */
 
-    /*------------------------------------- handle the last 11 bytes */
-        c += length;
-        switch (len) {          /* all the case statements fall through */
-        case 11:
-            c += ((unsigned long) k[10] << 24);
-        case 10:
-            c += ((unsigned long) k[9] << 16);
-        case 9:
-            c += ((unsigned long) k[8] << 8);
-            /* the first byte of c is reserved for the length */
-        case 8:
-            b += ((unsigned long) k[7] << 24);
-        case 7:
-            b += ((unsigned long) k[6] << 16);
-        case 6:
-            b += ((unsigned long) k[5] << 8);
-        case 5:
-            b += k[4];
-        case 4:
-            a += ((unsigned long) k[3] << 24);
-        case 3:
-            a += ((unsigned long) k[2] << 16);
-        case 2:
-            a += ((unsigned long) k[1] << 8);
-        case 1:
-            a += k[0];
-            /* case 0: nothing left to add */
+    int nsort_hash_del(nsort_hash_t * hsh)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_hash_del() function will clear the hash table and the
+ * hashed items and free up all the memory associated with the hash,
+ * letting go of the file it was read from by nsort_hash_get(), if any.  If
+ * the hash has an arena, the keys are freed with it a slab at a time.  If
+ * the hsh object was allocated with nsort_hash_create(), it will need to
+ * be freed with nsort_hash_destroy().
+ *
+ * [EndDoc]
+ */
+    {
+        size_t i;
+        if (hsh == 0) {
+            set_sortError(SORT_PARAM);
+            return _ERROR_;
         }
-        mix(a, b, c);
-    /*-------------------------------------------- report the result */
-        return c % NSORT_HASH_SIZE;
+        for (i = 0; i < hsh->capacity && hsh->arena == 0; i++)
+            if ((hsh->ctrl[i] & 0x80) == 0 &&
+                !nsort_hash_mapped(hsh, hsh->slots[i].key))
+                free(hsh->slots[i].key - sizeof(size_t));
+        if (hsh->arena != 0) {
+            nsort_arena_del(hsh->arena);
+            free(hsh->arena);
+            hsh->arena = 0;
+        }
+        if (!nsort_hash_mapped(hsh, hsh->ctrl))
+            free(hsh->ctrl);
+        if (!nsort_hash_mapped(hsh, hsh->slots))
+            free(hsh->slots);
+        if (hsh->map != 0)
+            nsort_unmap_file(hsh->map, hsh->mapLength);
+        hsh->ctrl = 0;
+        hsh->slots = 0;
+        hsh->map = 0;
+        hsh->mapLength = 0;
+        hsh->capacity = 0;
+        hsh->grow = 0;
+        hsh->deleted = 0;
+        hsh->number = 0;
+        return _OK_;
     }
 
-
 /*
  * [BeginDoc]
  *
- * \subsection{Nsort Hash Functions}
- *
- * The nsort hash functions provide the capabilities of a hash implementation
- * built on the nsort functionality.  Basically, the buckets for the hash
- * implementation are nsort sort objects.  The hash implementation herein is
- * high performance, but is overkill for a few number of items (say, less than
- * 100,000 items or so).
+ * \subsection{Nsort Sharded Hash Functions}
  *
- * Error handling for the hash functions is slightly different than it is for
- * the other nsort functions.  Basically, if an error occurs, the hash object
- * has an item called hashError that is set to the error.  You can get a 
- * description of this error by looking at sortErrorString[hsh->hashError].
- * This is thread safe because the sortErrorString array is read-only and
- * the hsh->hashError is local to the object.  Therefore, neither is likely
- * to be altered by another thread as you are gathering the data.
+ * The nsort sharded hash functions let any number of threads add keys to and
+ * search for keys in one hash at the same time.  The keys and values are like
+ * the ones of nsort_hash_add_key() and nsort_hash_find_key().  Adding a key is
+ * an insert if it is not there already, so threads can take out duplicates
+ * from what they are given without a lock around the hash.  nsort_shash_init(),
+ * nsort_shash_set_function(), nsort_shash_use_arena() and nsort_shash_del()
+ * have to be called while no other thread is using the hash.
  *
- * \subsubsection{nsort_hash_create}
- * \index{nsort_hash_create}
+ * \subsubsection{nsort_shash_create}
+ * \index{nsort_shash_create}
  *
  * [Verbatim] */
 
-    nsort_hash_t *nsort_hash_create(void)
+    nsort_shash_t *nsort_shash_create(void)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_create() function allocates an nsort hash item on the
- * heap and returns a pointer to it.  It returns NULL if it fails and you
- * can look at a description of the error with nsort_show_error().
- * The hash item doesn't have to be created on the heap.  It can be allocated
- * as an automatic variable on the stack, in which case this function needn't
- * be called.
+ * The nsort_shash_create() function allocates a sharded hash object on the
+ * heap and returns a pointer to it, or NULL if it fails, in which case you can
+ * look at a description of the error with nsort_show_error().  Like a hash
+ * object, it can be an automatic variable instead.
  *
  * [EndDoc]
  */
     {
-        nsort_hash_t *hsh;
-        hsh = (nsort_hash_t *) malloc(sizeof(nsort_hash_t));
-        if (0 == hsh) {
+        nsort_shash_t *sh;
+        sh = (nsort_shash_t *) malloc(sizeof(nsort_shash_t));
+        if (0 == sh) {
             set_sortError(SORT_NOMEMORY);
             return 0;
         }
-        return hsh;
+        memset(sh, 0, sizeof(nsort_shash_t));
+        return sh;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_hash_destroy}
- * \index{nsort_hash_destroy}
+ * \subsubsection{nsort_shash_destroy}
+ * \index{nsort_shash_destroy}
  *
  * [Verbatim] */
 
-    int nsort_hash_destroy(nsort_hash_t * hsh)
+    int nsort_shash_destroy(nsort_shash_t * sh)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_destroy() function deallocates a hash object that was
- * created with nsort_hash_create().  The only error occurs if the
- * parameter to the function is invalid.  In that case, you can get a 
- * description of the error using nsort_show_error().  nsort_hash_destroy()
- * returns _OK_ if it succeeds.
+ * The nsort_shash_destroy() function deallocates a sharded hash object that
+ * was created with nsort_shash_create().  It returns _OK_, or _ERROR_ if the
+ * parameter is invalid.
  *
  * [EndDoc]
  */
     {
-        if (hsh == 0) {
+        if (sh == 0) {
             set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-        check_pointer(hsh);
-        free(hsh);
+        check_pointer(sh);
+        free(sh);
         return _OK_;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_hash_init}
- * \index{nsort_hash_init}
+ * \subsubsection{nsort_shash_init}
+ * \index{nsort_shash_init}
  *
  * [Verbatim] */
 
-    int nsort_hash_init(nsort_hash_t * hsh,
-                        int (*compare)(void *, void *),
-                        unsigned int (*hash)(const char *))
+    int nsort_shash_init(nsort_shash_t * sh, int (*compare)(void *, void *),
+                         int numShards, size_t capacity, double maxLoad)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_init() function initializes a hash object so it can
- * be used by the hash functions.  The following are the parameters to
- * this function:
+ * The nsort_shash_init() function initializes a sharded hash object.  The
+ * ``compare'', ``capacity'' and ``maxLoad'' parameters are the ones of
+ * nsort_hash_init_size(), with ``capacity'' being the number of keys for the
+ * whole hash, which is split among the shards.  The keys are hashed with XXH3
+ * unless another function is set with nsort_shash_set_function().  The
+ * ``numShards'' parameter is the number of shards, which is rounded up to a
+ * power of 2; if it is 0, NSORT_SHASH_SHARDS is used.  A few times as many
+ * shards as there are threads keeps them from waiting for each other much.
  *
- * \begin{itemize}
+ * This function returns _OK_ on success or _ERROR_ on error, in which case
+ * sh->hashError will contain the error.
  *
- * \item [hsh] This is the hash object.  It can be allocated on the heap
- * with a call to nsort_hash_create() or on the stack as an automatic
- * variable.
+ * [EndDoc]
+ */
+    {
+        int i, n = 1;
+
+        if (numShards < 0 || numShards > NSORT_SHASH_MAX) {
+            sh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        if (numShards == 0)
+            numShards = NSORT_SHASH_SHARDS;
+        while (n < numShards)
+            n <<= 1;
+        memset(sh, 0, sizeof(nsort_shash_t));
+        sh->shards = (nsort_shash_shard_t *)
+            malloc((size_t) n * sizeof(nsort_shash_shard_t));
+        if (sh->shards == 0) {
+            sh->hashError = SORT_NOMEMORY;
+            return _ERROR_;
+        }
+        memset(sh->shards, 0, (size_t) n * sizeof(nsort_shash_shard_t));
+        for (i = 0; i < n; i++) {
+            if (nsort_hash_init_size(&sh->shards[i].hsh, compare, 0,
+                                     capacity / (size_t) n, maxLoad) ==
+                _ERROR_)
+                sh->hashError = sh->shards[i].hsh.hashError;
+#ifdef HAVE_PTHREAD_H
+            else if (pthread_mutex_init(&sh->shards[i].lock, 0) != 0) {
+                nsort_hash_del(&sh->shards[i].hsh);
+                sh->hashError = SORT_FNOLOCK;
+            }
+#endif
+            if (sh->hashError != SORT_NOERROR) {
+                sh->numShards = i;
+                nsort_shash_del(sh);
+                return _ERROR_;
+            }
+        }
+        sh->numShards = n;
+        sh->hash64 = nsort_hash_xxh3;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_shash_set_function}
+ * \index{nsort_shash_set_function}
+ *
+ * [Verbatim] */
+
+    int nsort_shash_set_function(nsort_shash_t * sh,
+                                 uint64_t (*hash)(const void *, size_t))
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_shash_set_function() function sets the 64-bit hash function of
+ * the keys of a sharded hash, like nsort_hash_set_function() does for a hash.
+ * The hash has to be empty.  It returns _OK_, or _ERROR_ with sh->hashError
+ * set if it isn't.
+ *
+ * [EndDoc]
+ */
+    {
+        int i;
+
+        if (nsort_shash_number(sh) != 0) {
+            sh->hashError = SORT_PARAM;
+            return _ERROR_;
+        }
+        for (i = 0; i < sh->numShards; i++)
+            nsort_hash_set_function(&sh->shards[i].hsh, hash);
+        sh->hash64 = (hash != 0) ? hash : nsort_hash_xxh3;
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_shash_use_arena}
+ * \index{nsort_shash_use_arena}
+ *
+ * [Verbatim] */
+
+    int nsort_shash_use_arena(nsort_shash_t * sh, size_t slabSize)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_shash_use_arena() function attaches an arena to each shard of a
+ * sharded hash, like nsort_hash_use_arena() does for a hash.  Each arena is
+ * only used under the lock of its shard, so threads that add keys to
+ * different shards don't wait on each other or on the lock of malloc().  The
+ * hash has to be empty.  It returns _OK_, or _ERROR_ with sh->hashError set.
+ *
+ * [EndDoc]
+ */
+    {
+        int i;
+
+        if (nsort_shash_number(sh) != 0) {
+            sh->hashError = SORT_LIST_NOTEMPTY;
+            return _ERROR_;
+        }
+        for (i = 0; i < sh->numShards; i++)
+            if (nsort_hash_use_arena(&sh->shards[i].hsh, slabSize) ==
+                _ERROR_) {
+                sh->hashError = sh->shards[i].hsh.hashError;
+                return _ERROR_;
+            }
+        return _OK_;
+    }
+
+/*
+ * [BeginDoc]
  *
- * \item [compare] This is a pointer to a compare function.  It will be used
- * in the nsort sort buckets to determine sort order.
+ * \subsubsection{nsort_shash_add_key}
+ * \index{nsort_shash_add_key}
  *
- * \item [hash] This is the pointer to a hash function.  If it not NULL, it
- * should be a function that ``hashes well'' for the application that you are
- * implementing.  A good hash function will fairly evenly divide the elements
- * in the application domain across the buckets.  If you set this parameter to
- * NULL, a default hash function will be used which is known to be good for
- * strings.
- * 
- * \end{itemize}
+ * [Verbatim] */
+
+    nsort_error_t nsort_shash_add_key(nsort_shash_t * sh, const void *key,
+                                      size_t len, void *value,
+                                      void **existing)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
  *
- * This function returns _OK_ on success or _ERROR_ on error.  If there is an
- * error, hsh->hashError will contain the error.  You can get a
- * a description of the error from the read-only string
- * sortErrorString[hsh->hashError].
+ * The nsort_shash_add_key() function adds the key given by the ``len'' bytes
+ * at ``key'' to the sharded hash ``sh'' with ``value'', if it is not there
+ * already.  It returns SORT_NOERROR if the key was added, SORT_UNIQUE if it was
+ * there already, in which case the value of the key in the hash is put in
+ * ``existing'' if that is not NULL, or the error that kept it from being added.
+ * The error is returned, rather than kept in the object, so that it is the
+ * error of the thread that called the function.
  *
  * [EndDoc]
  */
     {
-        int i, j;
-        int status;
-
-        if (compare == 0) {
-            hsh->hashError = SORT_PARAM;
-            return _ERROR_;;
+        nsort_shash_shard_t *shard;
+        nsort_error_t error = SORT_NOERROR;
+        uint64_t hash;
+        size_t i;
+
+        if (sh == 0 || sh->shards == 0 || (key == 0 && len != 0))
+            return SORT_PARAM;
+        hash = sh->hash64(key, len);
+        shard = sh->shards +
+            ((size_t) (hash >> 48) & (size_t) (sh->numShards - 1));
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&shard->lock);
+#endif
+        i = nsort_hash_probe(&shard->hsh, key, len, hash);
+        if (i != shard->hsh.capacity) {
+            error = SORT_UNIQUE;
+            if (existing != 0)
+                *existing = shard->hsh.slots[i].value;
         }
-        // Set reasonable defaults.
-        memset(hsh, 0, sizeof(nsort_hash_t));
-        if (hash == 0)
-            hsh->hash =
-                (unsigned int (*)(const char *)) nsort_hash_function;
-        else
-            hsh->hash = hash;
-        for (i = 0; i < NSORT_HASH_SIZE; i++) {
-            hsh->srts[i] = nsort_create();
-            if (hsh->srts[i] == 0) {
-                for (j = 0; j < i; j++) {
-                    nsort_del(hsh->srts[j], 0);
-                }
-                hsh->hashError = SORT_NOMEMORY;
-                return _ERROR_;;
-            }
-            status = nsort_init(hsh->srts[i], compare, TRUE, TRUE);
-            if (status == _ERROR_) {
-                if (hsh->srts[i]->sortError != SORT_NOERROR)
-                    hsh->hashError = hsh->srts[i]->sortError;
-                else if (nsort_check_error())
-                    hsh->hashError = get_sortError();
-                else
-                    // shouldn't get here, but...
-                    hsh->hashError = SORT_UNSPECIFIED;
-                for (j = 0; j < i; j++) {
-                    nsort_del(hsh->srts[j], 0);
-                }
-                return _ERROR_;;
-            }
+        else if (nsort_hash_place(&shard->hsh, key, len, hash, value) ==
+                 _ERROR_) {
+            error = shard->hsh.hashError;
+            shard->hsh.hashError = SORT_NOERROR;
         }
-        return _OK_;
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&shard->lock);
+#endif
+        return error;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_hash_add_item}
- * \index{nsort_hash_add_item}
+ * \subsubsection{nsort_shash_find_key}
+ * \index{nsort_shash_find_key}
  *
  * [Verbatim] */
 
-    int nsort_hash_add_item(nsort_hash_t * hsh, const char *item)
+    const char *nsort_shash_find_key(nsort_shash_t * sh, const void *key,
+                                     size_t len, void **value)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_add_item() adds the item given by ``item'' to the hash
- * managed by the hsh object.  It returns _OK_ if it succeeds and
- * _ERROR_ if not.  If there is an error, hsh->hashError will contain the
- * error.  The string that is being added to the hash is copied into
- * a buffer that is allocated on the heap and added there.  From that
- * point on, it is managed by the nsort hash functions.
+ * The nsort_shash_find_key() function searches the sharded hash ``sh'' for
+ * the key given by the ``len'' bytes at ``key''.  If it finds it, it returns a
+ * read only pointer to the copy of the key in the hash and, if ``value'' is
+ * not NULL, puts the value of the key in it.  Otherwise, it returns NULL.
  *
  * [EndDoc]
  */
     {
-        int status;
-        unsigned int hash_offset;
-        nsort_link_t *lnk;
-        char *data;
+        nsort_shash_shard_t *shard;
+        const char *found = 0;
+        uint64_t hash;
+        size_t i;
 
-        if (hsh == 0 || item == 0 || item[0] == '\0') {
-            hsh->hashError = SORT_PARAM;
-            return _ERROR_;
-        }
-        hash_offset = hsh->hash(item);
-        lnk = (nsort_link_t *) malloc(sizeof(nsort_link_t));
-        if (0 == lnk) {
-            hsh->hashError = SORT_NOMEMORY;
-            return _ERROR_;
-        }
-        data = (char *) malloc(strlen(item) + 1);
-        if (0 == data) {
-            hsh->hashError = SORT_NOMEMORY;
-            free(lnk);
-            return _ERROR_;
-        }
-        strcpy(data, item);
-        lnk->data = data;
-        hsh->numCompares = 0;
-        status = nsort_add_item(hsh->srts[hash_offset], lnk);
-        if (status != _ERROR_) {
-            hsh->number++;
-            hsh->numCompares = hsh->srts[hash_offset]->numCompares;
-        }
-        if (status == _ERROR_) {
-            if (hsh->srts[hash_offset]->sortError != SORT_NOERROR) {
-                hsh->hashError = hsh->srts[hash_offset]->sortError;
-                hsh->srts[hash_offset]->sortError = SORT_NOERROR;
-            }
-            else if (nsort_check_error())
-                hsh->hashError = get_sortError();
-            else
-                hsh->hashError = SORT_UNSPECIFIED;
+        if (sh == 0 || sh->shards == 0 || (key == 0 && len != 0))
+            return 0;
+        hash = sh->hash64(key, len);
+        shard = sh->shards +
+            ((size_t) (hash >> 48) & (size_t) (sh->numShards - 1));
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_lock(&shard->lock);
+#endif
+        i = nsort_hash_probe(&shard->hsh, key, len, hash);
+        if (i != shard->hsh.capacity) {
+            found = shard->hsh.slots[i].key;
+            if (value != 0)
+                *value = shard->hsh.slots[i].value;
         }
-        return status;
+#ifdef HAVE_PTHREAD_H
+        pthread_mutex_unlock(&shard->lock);
+#endif
+        return found;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_hash_find_item}
- * \index{nsort_hash_find_item}
+ * \subsubsection{nsort_shash_number}
+ * \index{nsort_shash_number}
  *
  * [Verbatim] */
 
-    char *nsort_hash_find_item(nsort_hash_t * hsh, const char *item)
+    size_t nsort_shash_number(nsort_shash_t * sh)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_find_item() will search the hash object for the
- * item given by ``item''.  If it finds it, it will return a read only
- * pointer to it.  Otherwise, it will return NULL.  If NULL is returned, 
- * hsh->hashError should be checked to insure there was no error.  An error
- * condition is defined by hsh->hashError > 0 (SORT_NOERROR is 0).
+ * The nsort_shash_number() function returns the number of keys in the sharded
+ * hash ``sh''.  If other threads are adding keys, it is the number there was
+ * at some point while it was counting.
  *
  * [EndDoc]
  */
     {
-        nsort_link_t *found;
-        nsort_link_t *lnk;
-        register char *data;
-        unsigned int hash_offset;
+        size_t number = 0;
+        int i;
 
-        if (hsh == 0 || item == 0 || item[0] == '\0') {
-            hsh->hashError = SORT_PARAM;
-            return 0;
-        }
-        hash_offset = hsh->hash(item);
-        lnk = (nsort_link_t *) malloc(sizeof(nsort_link_t));
-        if (0 == lnk) {
-            hsh->hashError = SORT_NOMEMORY;
+        if (sh == 0)
             return 0;
+        for (i = 0; i < sh->numShards; i++) {
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_lock(&sh->shards[i].lock);
+#endif
+            number += (size_t) sh->shards[i].hsh.number;
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_unlock(&sh->shards[i].lock);
+#endif
         }
-        data = (char *) malloc(strlen(item) + 1);
-        if (0 == data) {
-            hsh->hashError = SORT_NOMEMORY;
-            free(lnk);
-            return 0;
-        }
-        strcpy(data, item);
-        lnk->data = data;
-        hsh->numCompares = 0;
-        found = nsort_find_item(hsh->srts[hash_offset], lnk);
-        hsh->numCompares = hsh->srts[hash_offset]->numCompares;
-        free(data);
-        free(lnk);
-        if (found != 0)
-            return (char *) found->data;
-        else {
-            if (hsh->srts[hash_offset]->sortError != SORT_NOERROR) {
-                hsh->hashError = hsh->srts[hash_offset]->sortError;
-                hsh->srts[hash_offset]->sortError = SORT_NOERROR;
-            }
-            else if (nsort_check_error())
-                hsh->hashError = get_sortError();
-            else
-                hsh->hashError = SORT_NOERROR;
-        }
-        return 0;
+        return number;
     }
 
 /*
  * [BeginDoc]
  *
- * \subsubsection{nsort_hash_del}
- * \index{nsort_hash_del}
+ * \subsubsection{nsort_shash_del}
+ * \index{nsort_shash_del}
  *
  * [Verbatim] */
 
-    int nsort_hash_del(nsort_hash_t * hsh)
+    int nsort_shash_del(nsort_shash_t * sh)
 /* [EndDoc] */
 /*
  * [BeginDoc]
  *
- * The nsort_hash_del() function will clear all the hash buckets and
- * hashed items and free up all the memory associated with the hash.  If
- * the hsh object was allocated with nsort_hash_create(), it will need to
- * be freed with nsort_hash_destroy().
+ * The nsort_shash_del() function clears the shards of a sharded hash and
+ * frees the keys and all of the memory of the hash.  If the object was
+ * allocated with nsort_shash_create(), it will need to be freed with
+ * nsort_shash_destroy().
  *
  * [EndDoc]
  */
     {
         int i;
-        if (hsh == 0) {
-            hsh->hashError = SORT_PARAM;
+
+        if (sh == 0) {
+            set_sortError(SORT_PARAM);
             return _ERROR_;
         }
-        for (i = 0; i < NSORT_HASH_SIZE; i++) {
-            nsort_del(hsh->srts[i], 0);
-            nsort_destroy(hsh->srts[i]);
-            hsh->srts[i] = 0;
+        for (i = 0; i < sh->numShards; i++) {
+            nsort_hash_del(&sh->shards[i].hsh);
+#ifdef HAVE_PTHREAD_H
+            pthread_mutex_destroy(&sh->shards[i].lock);
+#endif
         }
+        free(sh->shards);
+        sh->shards = 0;
+        sh->numShards = 0;
         return _OK_;
     }
 
@@ -5968,208 +14244,629 @@ c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
 /* Envoke the comparison function, returns either 0, < 0, or > 0. */
 #define CMP(A,B) ((*cmp)((A),(B)))
 
-#define min(a,b)        ((a)<(b)?(a):(b))
-
-/* Byte-wise swap two items of size SIZE. */
-#define SWAP(A,B,SIZE) do {int sz=(int)(SIZE); char *a = (A); char *b = (B); \
-    do { char _temp = *a;*a++ = *b;*b++ = _temp;} while (--sz);} while (0)
-
-/* Copy SIZE bytes from item B to item A. */
-#define COPY(A,B,SIZE) {int sz = (int) (SIZE); do { *(A)++ = *(B)++; } while (--sz); }
-
-/* This should be replaced by a standard ANSI macro. */
-#define BYTES_PER_WORD 8
-
-/* The next 4 #defines implement a very fast in-line stack abstraction. */
-#define STACK_SIZE (BYTES_PER_WORD * sizeof (long))
-#define PUSH(LOW,HIGH) do {top->lo = LOW;top++->hi = HIGH;} while (0)
-#define POP(LOW,HIGH)  do {LOW = (--top)->lo;HIGH = top->hi;} while (0)
-#define STACK_NOT_EMPTY (stack < top)
+/*
+ * How two records are swapped is picked once per sort from the record size.
+ * Records of one or two words (8 and 16 bytes on a 64 bit machine, pointers
+ * and pairs of them) are swapped as words, other multiples of a word a word
+ * at a time, big records a block at a time with memcpy() and anything else a
+ * byte at a time.  The words are moved with memcpy() of a constant size,
+ * which the compiler turns into plain loads and stores, so the records don't
+ * have to be aligned.
+ */
+#define BQ_WORD sizeof(size_t)
+#define BQ_SWAP_WORD 0
+#define BQ_SWAP_WORD2 1
+#define BQ_SWAP_WORDS 2
+#define BQ_SWAP_BLOCK 3
+#define BQ_SWAP_BYTES 4
+#define BQ_BLOCK 64
+
+#define BQ_SWAPTYPE(size) \
+    ((size) == BQ_WORD ? BQ_SWAP_WORD : \
+     (size) == 2 * BQ_WORD ? BQ_SWAP_WORD2 : \
+     (size) >= BQ_BLOCK ? BQ_SWAP_BLOCK : \
+     (size) % BQ_WORD == 0 ? BQ_SWAP_WORDS : BQ_SWAP_BYTES)
+
+#define BQ_SWAP(A,B) do { \
+    if (swaptype == BQ_SWAP_WORD) { \
+        size_t _t; \
+        memcpy(&_t, (A), BQ_WORD); \
+        memcpy((A), (B), BQ_WORD); \
+        memcpy((B), &_t, BQ_WORD); \
+    } \
+    else \
+        bq_swap((A), (B), size, swaptype); \
+} while (0)
 
 /* Discontinue quicksort algorithm when partition gets below this size.
    This particular magic number was chosen to work best on a Sparc SLC. */
 #define MAX_THRESH 12
 
+/* Partitions bigger than this take their pivot from a ninther (the median
+   of the medians of three sets of three) instead of the median of three. */
+#define BQ_NINTHER 40
+
+/* The explicit stack only ever holds the larger side of each partition, so
+   it never needs more entries than there are bits in a size_t. */
+#define BQ_STACK_SIZE (8 * sizeof (size_t))
+
 /* Stack node declarations used to store unfulfilled partition obligations. */
     typedef struct {
         char *lo;
         char *hi;
+        int depth;
     } stack_node;
 
-/* Order size using quicksort.  This implementation incorporates
-   four optimizations discussed in Sedgewick:
-
-   1. Non-recursive, using an explicit stack of pointer that store the
-   next array partition to sort.  To save time, this maximum amount
-   of space required to store an array of MAX_INT is allocated on the
-   stack.  Assuming a 32-bit integer, this needs only 32 *
-   sizeof (stack_node) == 136 bits.  Pretty cheap, actually.
+/*
+ * Swap two records of ``size'' bytes the way ``swaptype'' says to (see
+ * BQ_SWAPTYPE).  The single word case is done in line by BQ_SWAP.
+ */
+    static void bq_swap(char *a, char *b, size_t size, int swaptype) {
+        char tmp[BQ_BLOCK];
+        size_t t[2];
+        size_t n;
+
+        switch (swaptype) {
+        case BQ_SWAP_WORD2:
+            memcpy(t, a, 2 * BQ_WORD);
+            memcpy(a, b, 2 * BQ_WORD);
+            memcpy(b, t, 2 * BQ_WORD);
+            break;
+        case BQ_SWAP_WORDS:
+            for (n = size; n > 0; n -= BQ_WORD, a += BQ_WORD, b += BQ_WORD) {
+                memcpy(t, a, BQ_WORD);
+                memcpy(a, b, BQ_WORD);
+                memcpy(b, t, BQ_WORD);
+            }
+            break;
+        case BQ_SWAP_BLOCK:
+            for (n = size; n > 0;) {
+                size_t len = (n < BQ_BLOCK) ? n : BQ_BLOCK;
+                memcpy(tmp, a, len);
+                memcpy(a, b, len);
+                memcpy(b, tmp, len);
+                a += len;
+                b += len;
+                n -= len;
+            }
+            break;
+        default:
+            for (n = size; n > 0; n--) {
+                char c = *a;
+                *a++ = *b;
+                *b++ = c;
+            }
+            break;
+        }
+    }
 
-   2. Chose the pivot element using a median-of-three decision tree.
-   This reduces the probability of selecting a bad pivot value and
-   eliminates certain extraneous comparisons.
+/*
+ * The one of a, b and c that is in the middle.  Nothing is moved.
+ */
+    static char *bq_med3(char *a, char *b, char *c,
+                         int (*cmp)(void *, void *)) {
+        return CMP(a, b) < 0 ?
+            (CMP(b, c) < 0 ? b : (CMP(a, c) < 0 ? c : a)) :
+            (CMP(b, c) > 0 ? b : (CMP(a, c) < 0 ? a : c));
+    }
 
-   3. Only quicksorts TOTAL_ELEMS / MAX_THRESH partitions, leaving
-   insertion sort to order the MAX_THRESH items within each partition.
-   This is a big win, since insertion sort is faster for small, mostly
-   sorted array segements.
+/*
+ * Sort the ``n'' records at lo with a heapsort.  This is where a partition
+ * goes when quicksort has split too many times to get to it, which keeps
+ * the worst case at n log n compares.
+ */
+    static void bq_heapsort(char *lo, size_t n, size_t size, int swaptype,
+                            int (*cmp)(void *, void *)) {
+        size_t i, root, child;
+
+        for (i = n / 2; i-- > 0;)
+            for (root = i; (child = 2 * root + 1) < n; root = child) {
+                if (child + 1 < n &&
+                    CMP(lo + child * size, lo + (child + 1) * size) < 0)
+                    child++;
+                if (CMP(lo + root * size, lo + child * size) >= 0)
+                    break;
+                BQ_SWAP(lo + root * size, lo + child * size);
+            }
+        for (i = n - 1; i > 0; i--) {
+            BQ_SWAP(lo, lo + i * size);
+            for (root = 0; (child = 2 * root + 1) < i; root = child) {
+                if (child + 1 < i &&
+                    CMP(lo + child * size, lo + (child + 1) * size) < 0)
+                    child++;
+                if (CMP(lo + root * size, lo + child * size) >= 0)
+                    break;
+                BQ_SWAP(lo + root * size, lo + child * size);
+            }
+        }
+    }
 
-   4. The larger of the two sub-partitions is always pushed onto the
-   stack first, with the algorithm then concentrating on the
-   smaller partition.  This *guarantees* no more than log (n)
-   stack size is needed (actually O(1) in this case)! */
+/*
+ * Insertion sort of the records from lo to hi (hi being the last one, not
+ * one past it), for the small partitions quicksort leaves.
+ */
+    static void bq_insertion(char *lo, char *hi, size_t size, int swaptype,
+                             int (*cmp)(void *, void *)) {
+        char *run_ptr, *tmp_ptr;
+
+        for (run_ptr = lo + size; run_ptr <= hi; run_ptr += size)
+            for (tmp_ptr = run_ptr;
+                 tmp_ptr > lo && CMP(tmp_ptr - size, tmp_ptr) > 0;
+                 tmp_ptr -= size)
+                BQ_SWAP(tmp_ptr - size, tmp_ptr);
+    }
 
-#if defined(QSORT_TYPE_IS_VOID)
-#define SORT_RETURN return
-#else
-#define SORT_RETURN return 0
-#endif
+/*
+ * TRUE if the records from lo to hi are already in order.  If ``reverse''
+ * is TRUE and they are in reverse order instead, they are turned around and
+ * TRUE is returned as well.  Either way the scan stops at the first record
+ * that is out of place, so it costs next to nothing on data that isn't.
+ */
+    static int bq_presorted(char *lo, char *hi, size_t size, int swaptype,
+                            int (*cmp)(void *, void *), int reverse) {
+        char *p = lo;
 
-    int bqsort(void *base_ptr, int total_elems, int size,
-               int (*cmp)(void *, void *)) {
-        /* Allocating SIZE bytes for a pivot buffer facilitates a better
-         * algorithm below since we can do comparisons directly on the pivot.
-         */
-        int max_thresh = (int)(MAX_THRESH * size);
-        if (total_elems <= 1)
-            SORT_RETURN;        /* Crashes on MSDOS if continues */
+        while (p < hi && CMP(p, p + size) <= 0)
+            p += size;
+        if (p >= hi)
+            return TRUE;
+        if (!reverse || p != lo)
+            return FALSE;
+        while (p < hi && CMP(p, p + size) >= 0)
+            p += size;
+        if (p < hi)
+            return FALSE;
+        for (p = hi; lo < p; lo += size, p -= size)
+            BQ_SWAP(lo, p);
+        return TRUE;
+    }
 
-        if (total_elems > MAX_THRESH) {
-            char *lo = (char *) base_ptr;
-            char *hi = lo + size * (total_elems - 1);
-            stack_node stack[STACK_SIZE];   /* Largest size needed for 32-bit int!!! */
-            stack_node *top = stack + 1;
-            char *pivot_buffer = (char *) malloc((int) size);
-
-            while (STACK_NOT_EMPTY) {
-                char *left_ptr;
-                char *right_ptr;
-                {
-                    char *pivot = pivot_buffer;
-                    {
-                        /* Select median value from among LO, MID, and HI. Rearrange
-                         * LO and HI so the three values are sorted. This lowers the
-                         * probability of picking a pathological pivot value and
-                         * skips a comparison for both the LEFT_PTR and RIGHT_PTR. */
-
-                        char *mid =
-                            lo +
-                            size *
-                            (((unsigned int) (hi -
-                                              lo) /
-                              (unsigned int) size) >> 1);
-
-                        if (CMP(hi, lo) < 0)
-                            SWAP(hi, lo, size);
-                        if (CMP(mid, lo) < 0)
-                            SWAP(mid, lo, size);
-                        else if (CMP(hi, mid) < 0)
-                            SWAP(mid, hi, size);
-                        COPY(pivot, mid, size);
-                        pivot = pivot_buffer;
-                    }
-                    left_ptr = lo + size;
-                    right_ptr = hi - size;
-
-                    /* Here's the famous ``collapse the walls'' section of quicksort.
-                     * Gotta like those tight inner loops!  They are the main reason
-                     * that this algorithm runs much faster than others. */
-                    do {
-                        while (CMP(left_ptr, pivot) < 0)
-                            left_ptr += size;
-
-                        while (CMP(pivot, right_ptr) < 0)
-                            right_ptr -= size;
-
-                        if (left_ptr < right_ptr) {
-                            SWAP(left_ptr, right_ptr, size);
-                            left_ptr += size;
-                            right_ptr -= size;
-                        }
-                        else if (left_ptr == right_ptr) {
-                            left_ptr += size;
-                            right_ptr -= size;
-                            break;
-                        }
-                    }
-                    while (left_ptr <= right_ptr);
+/*
+ * Split the partition in ``part'' once, the way bqsort() does: the side to
+ * go on with is left in part and, if there is another side to do, it is
+ * put in ``other'' and TRUE is returned.  The partition must be bigger than
+ * MAX_THRESH and have some depth left.  What a split does only depends on
+ * the records in the partition and on the one in front of it, which is a
+ * pivot that is already in its place, so partitions can be split in any
+ * order (or at the same time) and the records end up the same.
+ */
+    static int bq_split(char *base, stack_node * part, stack_node * other,
+                        size_t size, int swaptype,
+                        int (*cmp)(void *, void *)) {
+        char *lo = part->lo, *hi = part->hi;
+        char *pm, *left_ptr, *right_ptr;
+        size_t n = (size_t) (hi - lo) / size + 1, k;
+        int swaps = 0;
+
+        part->depth--;
+
+        /* Pick the pivot and swap it to the front. */
+        pm = lo + size * (n / 2);
+        if (n > BQ_NINTHER) {
+            k = size * (n / 8);
+            pm = bq_med3(bq_med3(lo, lo + k, lo + 2 * k, cmp),
+                         bq_med3(pm - k, pm, pm + k, cmp),
+                         bq_med3(hi - 2 * k, hi - k, hi, cmp), cmp);
+        }
+        else
+            pm = bq_med3(lo, pm, hi, cmp);
+        if (pm != lo)
+            BQ_SWAP(lo, pm);
+
+        /* If the pivot is the same as the record in front of the
+         * partition, it is the smallest in it; pull everything equal
+         * to it to the front and go on with the rest. */
+        if (lo != base && CMP(lo - size, lo) == 0) {
+            left_ptr = lo;
+            for (right_ptr = lo + size; right_ptr <= hi; right_ptr += size)
+                if (CMP(right_ptr, lo) <= 0) {
+                    left_ptr += size;
+                    if (left_ptr != right_ptr)
+                        BQ_SWAP(left_ptr, right_ptr);
                 }
+            part->lo = left_ptr + size;
+            return FALSE;
+        }
+
+        /* Here's the famous ``collapse the walls'' section of
+         * quicksort.  Both walls stop on records equal to the pivot,
+         * which keeps the partitions even when there are duplicates. */
+        left_ptr = lo;
+        right_ptr = hi + size;
+        for (;;) {
+            do
+                left_ptr += size;
+            while (left_ptr <= hi && CMP(left_ptr, lo) < 0);
+            do
+                right_ptr -= size;
+            while (CMP(lo, right_ptr) < 0);
+            if (left_ptr >= right_ptr)
+                break;
+            BQ_SWAP(left_ptr, right_ptr);
+            swaps++;
+        }
+        if (right_ptr != lo)
+            BQ_SWAP(lo, right_ptr);
+
+        /* The pivot is now at right_ptr.  A partition that needed no
+         * swaps may well be sorted already, so check each side. */
+        left_ptr = right_ptr + size;
+        right_ptr -= size;
+        if (swaps == 0) {
+            if (right_ptr > lo &&
+                bq_presorted(lo, right_ptr, size, swaptype, cmp, FALSE))
+                right_ptr = lo;
+            if (left_ptr < hi &&
+                bq_presorted(left_ptr, hi, size, swaptype, cmp, FALSE))
+                left_ptr = hi;
+        }
+
+        /* Hand back the larger side and go on with the smaller one. */
+        other->depth = part->depth;
+        if (right_ptr - lo > hi - left_ptr) {
+            other->lo = lo;
+            other->hi = right_ptr;
+            part->lo = left_ptr;
+        }
+        else {
+            other->lo = left_ptr;
+            other->hi = hi;
+            part->hi = right_ptr;
+        }
+        return TRUE;
+    }
 
-                /* Set up pointers for next iteration.  First determine whether
-                 * left and right partitions are below the threshold size. If so,
-                 * ignore one or both.  Otherwise, push the larger partition's
-                 * bounds on the stack and continue sorting the smaller one. */
-
-                if ((right_ptr - lo) <= max_thresh) {
-                    if ((hi - left_ptr) <= max_thresh)  /* Ignore both small parts. */
-                        POP(lo, hi);
-                    else        /* Ignore small left part. */
-                        lo = left_ptr;
-                }
-                else if ((hi - left_ptr) <= max_thresh) /* Ignore small right part. */
-                    hi = right_ptr;
-                else if ((right_ptr - lo) > (hi - left_ptr)) {  /* Push larger left part */
-                    PUSH(lo, right_ptr);
-                    lo = left_ptr;
-                }
-                else {          /* Push larger right part */
-                    PUSH(left_ptr, hi);
-                    hi = right_ptr;
-                }
+/*
+ * Sort the partition in ``part'' (of the array at ``base'') all the way.
+ * Partitions that are small or out of depth are finished here and the
+ * larger side of each split goes on the stack.
+ */
+    static void bq_sort_range(char *base, stack_node * part, size_t size,
+                              int swaptype, int (*cmp)(void *, void *)) {
+        stack_node stack[BQ_STACK_SIZE];
+        stack_node *top = stack;
+        stack_node cur = *part;
+        size_t n;
+
+        for (;;) {
+            n = (cur.hi > cur.lo) ? (size_t) (cur.hi - cur.lo) / size + 1 : 1;
+            if (n <= MAX_THRESH || cur.depth == 0) {
+                if (n > MAX_THRESH)
+                    bq_heapsort(cur.lo, n, size, swaptype, cmp);
+                else if (n > 1)
+                    bq_insertion(cur.lo, cur.hi, size, swaptype, cmp);
+                if (top == stack)
+                    break;
+                cur = *--top;
+                continue;
             }
-            free(pivot_buffer);
+            if (bq_split(base, &cur, top, size, swaptype, cmp))
+                top++;
         }
+    }
+
+/* Order size using introsort, which is quicksort with these changes to
+   the one that was here:
 
-        /* Once the BASE_PTR array is partially sorted by quicksort the rest
-         * is completely sorted using insertion sort, since this is efficient
-         * for partitions below MAX_THRESH size. BASE_PTR points to the beginning
-         * of the array to sort, and END_PTR points at the very last element in
-         * the array (*not* one beyond it!). */
+   1. The pivot is the median of three for small partitions and a ninther
+   for big ones, and it is swapped to the front of the partition, so no
+   pivot buffer has to be allocated.
 
-        {
-            char *end_ptr = (char *) base_ptr + size * (total_elems - 1);
-            char *run_ptr;
-            char *tmp_ptr = (char *) base_ptr;
-            char *thresh = min(end_ptr, (char *) base_ptr + max_thresh);
+   2. Each partition has a depth budget of 2 log (n) splits.  A partition
+   that runs out is heapsorted, so no input (organ pipes, median-of-3
+   killers) can make the sort quadratic.
 
-            /* Find smallest element in first threshold and place it at the
-             * array's beginning.  This is the smallest array element,
-             * and the operation speeds up insertion sort's inner loop. */
+   3. Records are swapped a word or a block at a time instead of a byte at
+   a time (see BQ_SWAPTYPE).
 
-            for (run_ptr = tmp_ptr + size; run_ptr <= thresh;
-                 run_ptr += size)
-                if (CMP(run_ptr, tmp_ptr) < 0)
-                    tmp_ptr = run_ptr;
+   4. Input that is already sorted (or all equal) or sorted backwards is
+   found with one pass and takes n compares.  A partition that was split
+   without any swaps is checked the same way, and when the pivot is equal
+   to the record in front of the partition (which is not greater than any
+   record in it), the records equal to the pivot are put at the front in
+   one pass and left there, so runs of duplicates cost n compares.
 
-            if (tmp_ptr != (char *) base_ptr)
-                SWAP(tmp_ptr, (char *) base_ptr, size);
+   As before, the sort is non-recursive, the larger of the two partitions
+   is pushed on the stack and the smaller one is done first, so the stack
+   never holds more than log (n) of them, and partitions smaller than
+   MAX_THRESH are insertion sorted. */
+
+#if defined(QSORT_TYPE_IS_VOID)
+#define SORT_RETURN return
+#else
+#define SORT_RETURN return 0
+#endif
 
-            /* Insertion sort, running from left-hand-side up to `right-hand-side.'
-             * Pretty much straight out of the original GNU qsort routine. */
+    int bqsort(void *base_ptr, int total_elems, int elem_size,
+               int (*cmp)(void *, void *)) {
+        char *base = (char *) base_ptr;
+        size_t size = (size_t) elem_size;
+        size_t k;
+        stack_node part;
+        int swaptype;
 
-            for (run_ptr = (char *) base_ptr + size;
-                 (tmp_ptr = run_ptr += size) <= end_ptr;) {
-                while (CMP(run_ptr, tmp_ptr -= size) < 0) ;
+        if (total_elems <= 1 || elem_size <= 0)
+            SORT_RETURN;        /* Crashes on MSDOS if continues */
+        swaptype = BQ_SWAPTYPE(size);
+        part.lo = base;
+        part.hi = base + size * (size_t) (total_elems - 1);
+        if (bq_presorted(part.lo, part.hi, size, swaptype, cmp, TRUE))
+            SORT_RETURN;
+        part.depth = 0;
+        for (k = (size_t) total_elems; k > 1; k >>= 1)
+            part.depth += 2;
+        bq_sort_range(base, &part, size, swaptype, cmp);
+        SORT_RETURN;
+    }
 
-                if ((tmp_ptr += size) != run_ptr) {
-                    char *trav;
+#ifdef HAVE_PTHREAD_H
+/*
+ * The work-stealing pool bqsort_parallel() runs on.  Each worker has a deque
+ * of partitions it has split off; it takes from the top of its own and, when
+ * that is empty, steals from the bottom of another's, where the biggest
+ * partitions are.  The counts are kept under the pool lock: queued is the
+ * number of partitions in the deques (an idle worker sleeps until it is not
+ * 0) and outstanding the number that are queued or being sorted (the sort
+ * is done when it gets to 0).
+ */
+#ifndef BQ_PARALLEL_CUTOFF
+#define BQ_PARALLEL_CUTOFF 8192
+#endif
 
-                    for (trav = run_ptr + size; --trav >= run_ptr;) {
-                        char c = *trav;
-                        char *hi, *lo;
+    typedef struct _bq_worker_t {
+        pthread_mutex_t lock;
+        stack_node tasks[BQ_STACK_SIZE];
+        int bottom;
+        int top;
+        struct _bq_pool_t *pool;
+        int id;
+    } bq_worker_t;
+
+    typedef struct _bq_pool_t {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        size_t queued;
+        size_t outstanding;
+        int nthreads;
+        bq_worker_t *workers;
+        char *base;
+        size_t size;
+        size_t cutoff;
+        int swaptype;
+        int (*cmp)(void *, void *);
+    } bq_pool_t;
+
+/*
+ * Put a partition on the worker's own deque and wake a worker to steal it.
+ * It is counted before it goes on the deque, so the count can't get to 0
+ * while it is being sorted.  FALSE is returned if the deque is full, in
+ * which case the caller sorts the partition itself.
+ */
+    static int bq_push(bq_worker_t * w, stack_node * part) {
+        bq_pool_t *pool = w->pool;
+
+        pthread_mutex_lock(&w->lock);
+        if (w->top == BQ_STACK_SIZE) {
+            if (w->bottom == 0) {
+                pthread_mutex_unlock(&w->lock);
+                return FALSE;
+            }
+            memmove(w->tasks, w->tasks + w->bottom,
+                    (size_t) (w->top - w->bottom) * sizeof(stack_node));
+            w->top -= w->bottom;
+            w->bottom = 0;
+        }
+        pthread_mutex_lock(&pool->lock);
+        pool->queued++;
+        pool->outstanding++;
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        w->tasks[w->top++] = *part;
+        pthread_mutex_unlock(&w->lock);
+        return TRUE;
+    }
 
-                        for (hi = lo = trav; (lo -= size) >= tmp_ptr;
-                             hi = lo)
-                            *hi = *lo;
-                        *hi = c;
-                    }
-                }
+/*
+ * Take a partition to sort: the newest one on the worker's own deque or
+ * else the oldest one on someone else's.  FALSE if there is none.
+ */
+    static int bq_take(bq_worker_t * w, stack_node * part) {
+        bq_pool_t *pool = w->pool;
+        bq_worker_t *v;
+        int i, found = FALSE;
+
+        pthread_mutex_lock(&w->lock);
+        if (w->top > w->bottom) {
+            *part = w->tasks[--w->top];
+            found = TRUE;
+        }
+        pthread_mutex_unlock(&w->lock);
+        for (i = 1; !found && i < pool->nthreads; i++) {
+            v = &pool->workers[(w->id + i) % pool->nthreads];
+            pthread_mutex_lock(&v->lock);
+            if (v->top > v->bottom) {
+                *part = v->tasks[v->bottom++];
+                found = TRUE;
+            }
+            pthread_mutex_unlock(&v->lock);
+        }
+        if (found) {
+            pthread_mutex_lock(&pool->lock);
+            pool->queued--;
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return found;
+    }
+
+/*
+ * Sort one partition taken from the pool.  It is split the way bqsort()
+ * splits it; sides that are big enough are pushed for other workers and
+ * the rest are sorted here.
+ */
+    static void bq_run(bq_worker_t * w, stack_node * part) {
+        bq_pool_t *pool = w->pool;
+        stack_node cur = *part, other;
+        size_t n;
+
+        for (;;) {
+            n = (cur.hi > cur.lo) ?
+                (size_t) (cur.hi - cur.lo) / pool->size + 1 : 1;
+            if (n < pool->cutoff || cur.depth == 0) {
+                bq_sort_range(pool->base, &cur, pool->size, pool->swaptype,
+                              pool->cmp);
+                break;
+            }
+            if (bq_split(pool->base, &cur, &other, pool->size,
+                         pool->swaptype, pool->cmp)) {
+                n = (other.hi > other.lo) ?
+                    (size_t) (other.hi - other.lo) / pool->size + 1 : 1;
+                if (n < pool->cutoff || !bq_push(w, &other))
+                    bq_sort_range(pool->base, &other, pool->size,
+                                  pool->swaptype, pool->cmp);
+            }
+        }
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->outstanding == 0)
+            pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
 
+/*
+ * The loop each worker runs until there is nothing left to sort.
+ */
+    static void *bq_worker(void *arg) {
+        bq_worker_t *w = (bq_worker_t *) arg;
+        bq_pool_t *pool = w->pool;
+        stack_node part;
+
+        for (;;) {
+            if (bq_take(w, &part)) {
+                bq_run(w, &part);
+                continue;
             }
+            pthread_mutex_lock(&pool->lock);
+            while (pool->outstanding > 0 && pool->queued == 0)
+                pthread_cond_wait(&pool->cond, &pool->lock);
+            if (pool->outstanding == 0) {
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return 0;
+    }
+#endif
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{bqsort_parallel}
+ * \index{bqsort_parallel}
+ *
+ * [Verbatim] */
+
+    int bqsort_parallel(void *base_ptr, int total_elems, int elem_size,
+                        int (*cmp)(void *, void *), int nthreads)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The bqsort_parallel() function sorts the ``total_elems'' records of
+ * ``elem_size'' bytes at ``base_ptr'' like bqsort() does, using ``nthreads''
+ * threads (the calling thread being one of them), or one for each processor
+ * if nthreads is 0 or less.  The first split is done by the calling thread;
+ * from then on, each partition of more than BQ_PARALLEL_CUTOFF records that a
+ * thread splits off goes on its own queue, where an idle thread can steal it.
+ * Partitions are split exactly the way bqsort() splits them, only not in the
+ * same order, so the records come out byte for byte the same as they do from
+ * bqsort(), even the ones that compare equal.  That does mean the compare
+ * function has to be safe to call from more than one thread at once.  If the
+ * threads can't be started, the sort is finished by the ones that could.
+ * The function returns 0, like bqsort().
+ *
+ * [EndDoc]
+ */
+    {
+#ifdef HAVE_PTHREAD_H
+        char *base = (char *) base_ptr;
+        size_t k;
+        stack_node part;
+        bq_pool_t pool;
+        pthread_t *threads;
+        int i, started;
+
+        if (nthreads <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+            nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+            if (nthreads <= 0)
+                nthreads = 1;
+        }
+        if (nthreads == 1 || total_elems < 2 * BQ_PARALLEL_CUTOFF ||
+            elem_size <= 0)
+            return bqsort(base_ptr, total_elems, elem_size, cmp);
+
+        memset(&pool, 0, sizeof(pool));
+        pool.base = base;
+        pool.size = (size_t) elem_size;
+        pool.cutoff = BQ_PARALLEL_CUTOFF;
+        pool.swaptype = BQ_SWAPTYPE(pool.size);
+        pool.cmp = cmp;
+        part.lo = base;
+        part.hi = base + pool.size * (size_t) (total_elems - 1);
+        if (bq_presorted(part.lo, part.hi, pool.size, pool.swaptype, cmp,
+                         TRUE))
+            return 0;
+        part.depth = 0;
+        for (k = (size_t) total_elems; k > 1; k >>= 1)
+            part.depth += 2;
+
+        pool.workers = (bq_worker_t *) malloc((size_t) nthreads *
+                                              sizeof(bq_worker_t));
+        threads = (pthread_t *) malloc((size_t) nthreads * sizeof(pthread_t));
+        if (pool.workers == 0 || threads == 0) {
+            free(pool.workers);
+            free(threads);
+            bq_sort_range(base, &part, pool.size, pool.swaptype, cmp);
+            return 0;
+        }
+        pool.nthreads = nthreads;
+        pthread_mutex_init(&pool.lock, 0);
+        pthread_cond_init(&pool.cond, 0);
+        for (i = 0; i < nthreads; i++) {
+            pthread_mutex_init(&pool.workers[i].lock, 0);
+            pool.workers[i].bottom = pool.workers[i].top = 0;
+            pool.workers[i].pool = &pool;
+            pool.workers[i].id = i;
         }
+
+        pool.outstanding = 1;
+        for (started = 1; started < nthreads; started++)
+            if (pthread_create(&threads[started], 0, bq_worker,
+                               &pool.workers[started]) != 0)
+                break;
+        bq_run(&pool.workers[0], &part);
+        bq_worker(&pool.workers[0]);
+        for (i = 1; i < started; i++)
+            pthread_join(threads[i], 0);
+
+        for (i = 0; i < nthreads; i++)
+            pthread_mutex_destroy(&pool.workers[i].lock);
+        pthread_cond_destroy(&pool.cond);
+        pthread_mutex_destroy(&pool.lock);
+        free(pool.workers);
+        free(threads);
         return 0;
+#else
+        return bqsort(base_ptr, total_elems, elem_size, cmp);
+#endif
     }
 
+/*
+ * nsort_qsort() sets ``srt'' up from scratch, so it never has an arena, and
+ * the links point at the caller's items, which callers free a link at a
+ * time with free() (see flogsrtq).  The links are malloc()ed for them.
+ */
     int nsort_qsort(nsort_t * srt, void *base, size_t numItems,
                     size_t recSize, int (*qcompare)(void *, void *),
                     int (*scompare)(void *, void *)) {
@@ -6181,6 +14878,7 @@ c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
         bqsort(base, numItems, recSize, qcompare);
 
         memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
         srt->compare = scompare;
 
         srt->lh = nsort_list_create();
@@ -6240,6 +14938,43 @@ c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
 
     int nsort_list_qsort(nsort_t * srt, nsort_list_t * lh, size_t recSize,
                          int (*compare)(void *, void *)) {
+        return nsort_list_qsort_threads(srt, lh, recSize, compare, 1);
+    }
+
+/*
+ * [BeginDoc]
+ *
+ * \subsubsection{nsort_list_qsort_parallel}
+ * \index{nsort_list_qsort_parallel}
+ *
+ * [Verbatim] */
+
+    int nsort_list_qsort_parallel(nsort_t * srt, nsort_list_t * lh,
+                                  size_t recSize,
+                                  int (*compare)(void *, void *),
+                                  int nthreads)
+/* [EndDoc] */
+/*
+ * [BeginDoc]
+ *
+ * The nsort_list_qsort_parallel() function does what nsort_list_qsort() does,
+ * but the records are sorted with bqsort_parallel() on ``nthreads'' threads
+ * (one for each processor if nthreads is 0 or less).  The sort that comes out
+ * is the same as the one nsort_list_qsort() makes.
+ *
+ * [EndDoc]
+ */
+    {
+        return nsort_list_qsort_threads(srt, lh, recSize, compare, nthreads);
+    }
+
+/*
+ * The body of nsort_list_qsort() and nsort_list_qsort_parallel().
+ */
+    static int nsort_list_qsort_threads(nsort_t * srt, nsort_list_t * lh,
+                                        size_t recSize,
+                                        int (*compare)(void *, void *),
+                                        int nthreads) {
         char *sortArray = 0;
         nsort_link_t *lnk;
         int status;
@@ -6266,7 +15001,8 @@ c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
             counter++;
             lnk = lnk->next;
         }
-        bqsort((void *) sortArray, lh->number, recSize, compare);
+        bqsort_parallel((void *) sortArray, lh->number, recSize, compare,
+                        nthreads);
         /*
          * Now, put the sorted data back into the list and build the shell.
          */
@@ -6284,6 +15020,7 @@ c -= a; c -= b; c = (c ^ (b>>15)) & 0xffffffff; \
         }
 
         memset(srt, 0, sizeof(nsort_t));
+        nsort_geometry_defaults(&srt->geometry);
         srt->compare = (int (*)(void *, void *)) compare;
 
         srt->lh = lh;
@@ -0,0 +1,284 @@
+/* Source File: flogasync.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogasync.c}
+ *
+ * Program: flogasync.c
+ * Script: flogasync.sh
+ *
+ * This program tests nsort_save_async().  It adds the first half of the items
+ * in a file to a synchronized nsort, each in a record of its own, and saves it
+ * with nsort_save() and then with nsort_save_async().  While the second save
+ * is going on, it removes the last items of the sort, which are the last to
+ * be written, and then adds the rest of the items and removes half of the
+ * first ones, freeing each of them as soon as it is removed.  Once the save is
+ * done, it checks that the callback was called and that the file holds the
+ * sort as it was when the save was started, and that a save can't be started
+ * while another one is going on.  It prints the time the caller is held up by
+ * each save and the time the adds and removes take.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define RECLEN 64
+#define NUM_LAST 1000
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+static int numCallbacks = 0;
+static nsort_error_t callbackError = SORT_UNSPECIFIED;
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+void saveDone (nsort_t *srt, nsort_error_t error, void *arg)
+{
+  (void)srt;
+  (void)arg;
+  numCallbacks++;
+  callbackError = error;
+}
+
+//
+// Add a record holding item to the sort.
+//
+int addItem (nsort_t *srt, char *item)
+{
+  nsort_link_t *lnk;
+  char *rec;
+
+  rec = malloc (RECLEN);
+  lnk = malloc (sizeof (nsort_link_t));
+  if (rec == 0 || lnk == 0) {
+    printf ("\n\n***Error: critical memory error allocating a record\n");
+    return _ERROR_;
+  }
+  memset (rec, 0, RECLEN);
+  strncpy (rec, item, RECLEN - 1);
+  memset (lnk, 0, sizeof (nsort_link_t));
+  lnk->data = rec;
+  if (nsort_add_item (srt, lnk) == _ERROR_) {
+    free (lnk);
+    free (rec);
+    if (srt->sortError == SORT_UNIQUE)
+      return _OK_;
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+void freeItems (nsort_t *srt)
+{
+  nsort_link_t *lnk;
+
+  while ((lnk = nsort_list_remove_link (srt->lh)) != 0) {
+    free (lnk->data);
+    free (lnk);
+  }
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp, *expected;
+  char **cpp;
+  char str[ERROR_LEN+1];
+  char rec[RECLEN];
+  nsort_t *srt, *back;
+  nsort_link_t *lnk, find;
+  double t1, t2, t3;
+  size_t number;
+  int num, half, i, removed = 0;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  num = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < num && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  num = i;
+  if (num < 4) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  half = num / 2;
+
+  srt = nsort_create ();
+  back = nsort_create ();
+  if (srt == 0 || back == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, TRUE, FALSE) == _ERROR_ ||
+      nsort_sync_init (srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  for (i = 0; i < half; i++)
+    if (addItem (srt, cpp[i]) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+  number = srt->lh->number;
+  expected = malloc (number * RECLEN);
+  if (expected == 0) {
+    printf ("\n\n***Error: critical memory error allocating records\n");
+    return _ERROR_;
+  }
+  for (lnk = srt->lh->head->next, i = 0; lnk != srt->lh->tail;
+      lnk = lnk->next, i++)
+    memcpy (expected + (size_t)i * RECLEN, lnk->data, RECLEN);
+  printf ("\n%zu items of %d bytes\n", number, RECLEN);
+
+  // the time the caller is held up by each save
+  nsort_elapsed (&t1);
+  if (nsort_save (srt, "flogasync", RECLEN, "flogasync.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  if (nsort_save_async (srt, "flogasync", RECLEN, "flogasync.dat", saveDone,
+        0) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_async(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t3);
+  printf ("  nsort_save()       held the caller %f seconds\n", t2 - t1);
+  printf ("  nsort_save_async() held the caller %f seconds\n", t3 - t2);
+  if (nsort_save_async (srt, "flogasync", RECLEN, "flogasync.tmp", saveDone,
+        0) != _ERROR_ || srt->sortError != SORT_BUSY) {
+    printf ("\n\n***Error: a second save was started\n");
+    return _ERROR_;
+  }
+  srt->sortError = SORT_NOERROR;
+
+  // adds and removes while the save goes on
+  nsort_elapsed (&t1);
+  for (i = 0; i < NUM_LAST && srt->lh->number > 0; i++) {
+    lnk = nsort_remove_item (srt, srt->lh->tail->prev);
+    if (lnk == 0) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: removing the last item: %s\n", str);
+      return _ERROR_;
+    }
+    memset (lnk->data, 0, RECLEN);
+    free (lnk->data);
+    free (lnk);
+    removed++;
+  }
+  for (i = 0; i < half; i++) {
+    if (addItem (srt, cpp[half + i]) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", half + i, str);
+      return _ERROR_;
+    }
+    if (i % 2 == 0) {
+      memset (rec, 0, RECLEN);
+      strncpy (rec, cpp[i], RECLEN - 1);
+      find.data = rec;
+      lnk = nsort_find_item (srt, &find);
+      if (lnk != 0) {
+        lnk = nsort_remove_item (srt, lnk);
+        if (lnk == 0) {
+          nsort_show_sort_error (srt, str, ERROR_LEN);
+          printf ("\n\n***Error: removing item %d: %s\n", i, str);
+          return _ERROR_;
+        }
+        memset (lnk->data, 0, RECLEN);
+        free (lnk->data);
+        free (lnk);
+        removed++;
+      }
+    }
+  }
+  nsort_elapsed (&t2);
+  if (nsort_save_wait (srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_wait(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t3);
+  printf ("  %d adds and %d removes during the save took %f seconds\n",
+      half, removed, t2 - t1);
+  printf ("  nsort_save_wait() waited %f seconds more\n", t3 - t2);
+  if (numCallbacks != 1 || callbackError != SORT_NOERROR) {
+    printf ("\n\n***Error: the callback was called %d times\n",
+        numCallbacks);
+    return _ERROR_;
+  }
+
+  // the file holds the sort as it was
+  if (nsort_get (back, testCompare, "flogasync.dat") == _ERROR_) {
+    nsort_show_sort_error (back, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get(): %s\n", str);
+    return _ERROR_;
+  }
+  if (back->lh->number != number) {
+    printf ("\n\n***Error: the file has %zu items, expected %zu\n",
+        back->lh->number, number);
+    return _ERROR_;
+  }
+  for (lnk = back->lh->head->next, i = 0; lnk != back->lh->tail;
+      lnk = lnk->next, i++)
+    if (memcmp (lnk->data, expected + (size_t)i * RECLEN, RECLEN) != 0) {
+      printf ("\n\n***Error: item %d of the file is wrong\n", i);
+      return _ERROR_;
+    }
+  back->manageAllocs = TRUE;
+  nsort_del (back, 0);
+  nsort_destroy (back);
+
+  freeItems (srt);
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  unlink ("flogasync.dat");
+  free (expected);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
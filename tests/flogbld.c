@@ -0,0 +1,304 @@
+/* Source File: flogbld.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogbld.c}
+ *
+ * Program: flogbld.c
+ * Script: flogbld.sh
+ *
+ * This program tests nsort_build_sorted() and nsort_get().  It sorts the items
+ * in a file, checks that nsort_build_sorted() turns down the items when they
+ * are not in order, then builds a sort from the sorted items and checks every
+ * item can be found and selected.  It times the build against putting the same
+ * items in a list of allocated links and calling nsort_list_to_sort().  Then it
+ * saves a sort of fixed size records, gets it back with nsort_get() and with
+ * nsort_get_arena() and checks it, printing the time each takes, and checks
+ * that nsort_del() frees the links that were added to the arena sort.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define DATASIZE 40
+#define ERROR_LEN 256
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// Check the sort has the items in sorted, in order, and that each of them
+// can be found and selected.
+//
+int checkSort (nsort_t *srt, char **sorted, int number, const char *what)
+{
+  nsort_link_t *lnk, find;
+  int i = 0;
+
+  if (srt->lh->number != (size_t)number) {
+    printf ("\n\n***Error: %s: %zu items, expected %d\n", what,
+        srt->lh->number, number);
+    return _ERROR_;
+  }
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next, i++)
+    if (i >= number || lnk->prev->next != lnk ||
+        testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: item %d is wrong\n", what, i);
+      return _ERROR_;
+    }
+  for (i = 0; i < number; i++) {
+    find.data = sorted[i];
+    lnk = nsort_find_item (srt, &find);
+    if (lnk == 0 || testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: didn't find %s\n", what, sorted[i]);
+      return _ERROR_;
+    }
+    lnk = nsort_select (srt, (size_t)i);
+    if (lnk == 0 || testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: nsort_select() of %d is wrong\n", what, i);
+      return _ERROR_;
+    }
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp, *records;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  nsort_t *srt;
+  nsort_list_t *lh;
+  nsort_link_t *lnk, *lnks;
+  nsort_node_level_t lvl;
+  double t1, t2;
+  int number, i, j, status;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+  printf ("\n%d items\n", number);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+
+  // the items as they are in the file should be turned down
+  for (i = 1; i < number && testCompare (cpp[i-1], cpp[i]) <= 0; i++)
+    ;
+  if (i < number) {
+    status = nsort_build_sorted (srt, (void **)cpp, (size_t)number,
+        testCompare, TRUE);
+    if (status != _ERROR_ || srt->sortError != SORT_PARAM) {
+      printf ("\n\n***Error: nsort_build_sorted() took items out of order\n");
+      return _ERROR_;
+    }
+  }
+
+  // the sorted items
+  nsort_elapsed (&t1);
+  status = nsort_build_sorted (srt, (void **)sorted, (size_t)number,
+      testCompare, TRUE);
+  nsort_elapsed (&t2);
+  if (status == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_build_sorted(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_node_levels (srt, &lvl);
+  printf ("  nsort_build_sorted()  %f seconds, %zu nodes, levels ",
+      t2 - t1, srt->numNodes);
+  for (i = 0; i < NSORT_NODE_LEVEL && lvl.lvl[i] != 0; i++)
+    printf ("%d ", lvl.lvl[i]);
+  printf ("\n");
+  if (checkSort (srt, sorted, number, "nsort_build_sorted()") == _ERROR_)
+    return _ERROR_;
+  nsort_del (srt, 0);
+
+  // the same items in allocated links
+  nsort_elapsed (&t1);
+  lh = nsort_list_create ();
+  lnks = malloc ((size_t)number * sizeof (nsort_link_t));
+  if (lh == 0 || lnks == 0 || nsort_list_init (lh) == _ERROR_) {
+    printf ("\n\n***Error: critical memory error allocating the list\n");
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    lnks[i].data = sorted[i];
+    nsort_list_insert_link (lh, &lnks[i]);
+  }
+  status = nsort_list_to_sort (srt, lh, testCompare);
+  nsort_elapsed (&t2);
+  if (status == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_list_to_sort(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  nsort_list_to_sort()  %f seconds, %zu nodes\n", t2 - t1,
+      srt->numNodes);
+  if (checkSort (srt, sorted, number, "nsort_list_to_sort()") == _ERROR_)
+    return _ERROR_;
+  while (nsort_list_remove_link (srt->lh) != 0)
+    ;
+  nsort_del (srt, 0);
+  free (lnks);
+
+  // fixed size records saved and gotten back
+  records = malloc ((size_t)number * DATASIZE);
+  if (records == 0) {
+    printf ("\n\n***Error: critical memory error allocating records\n");
+    return _ERROR_;
+  }
+  memset (records, 0, (size_t)number * DATASIZE);
+  for (i = 0; i < number; i++) {
+    strncpy (records + (size_t)i * DATASIZE, sorted[i], DATASIZE - 1);
+    sorted[i] = records + (size_t)i * DATASIZE;
+  }
+  if (nsort_build_sorted (srt, (void **)sorted, (size_t)number, testCompare,
+        FALSE) == _ERROR_ ||
+      nsort_save (srt, "flogbld", DATASIZE, "flogbld.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: saving the records: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_del (srt, 0);
+  nsort_elapsed (&t1);
+  status = nsort_get (srt, testCompare, "flogbld.dat");
+  nsort_elapsed (&t2);
+  if (status == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  nsort_get()           %f seconds, %zu nodes\n", t2 - t1,
+      srt->numNodes);
+  if (checkSort (srt, sorted, number, "nsort_get()") == _ERROR_)
+    return _ERROR_;
+
+  // items taken out of the sort that came from the file, which are the
+  // sort's own to free
+  srt->manageAllocs = TRUE;
+  for (i = 0, j = number; i < 100 && j > 1; i++, j--) {
+    lnk = nsort_remove_item (srt, srt->lh->head->next);
+    if (lnk == 0) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_remove_item(): %s\n", str);
+      return _ERROR_;
+    }
+    free (lnk->data);
+    free (lnk);
+  }
+  if (checkSort (srt, sorted + i, number - i, "nsort_remove_item()") ==
+      _ERROR_)
+    return _ERROR_;
+  nsort_del (srt, free);
+
+  // the same file gotten back into an arena
+  nsort_elapsed (&t1);
+  status = nsort_get_arena (srt, testCompare, "flogbld.dat");
+  nsort_elapsed (&t2);
+  if (status == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get_arena(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  nsort_get_arena()     %f seconds, %zu nodes\n", t2 - t1,
+      srt->numNodes);
+  if (checkSort (srt, sorted, number, "nsort_get_arena()") == _ERROR_)
+    return _ERROR_;
+  srt->manageAllocs = TRUE;
+  for (i = 0; i < 100 && i < number; i++) {
+    lnk = nsort_remove_item (srt, srt->lh->head->next);
+    if (lnk == 0) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_remove_item(): %s\n", str);
+      return _ERROR_;
+    }
+    nsort_free_link (srt, lnk, DATASIZE);
+  }
+
+  // links from malloc() put back, which nsort_del() has to free
+  for (j = 0; j < i; j++) {
+    lnk = malloc (sizeof (nsort_link_t));
+    if (lnk == 0 || (lnk->data = malloc (DATASIZE)) == 0) {
+      printf ("\n\n***Error: critical memory error allocating a link\n");
+      return _ERROR_;
+    }
+    memcpy (lnk->data, sorted[j], DATASIZE);
+    if (nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_add_item(): %s\n", str);
+      return _ERROR_;
+    }
+  }
+  if (checkSort (srt, sorted, number, "nsort_add_item()") == _ERROR_)
+    return _ERROR_;
+  nsort_del (srt, free);
+  nsort_destroy (srt);
+  unlink ("flogbld.dat");
+
+  free (records);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
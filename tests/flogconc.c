@@ -0,0 +1,338 @@
+/* Source File: flogconc.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogconc.c}
+ *
+ * Program: flogconc.c
+ * Script: flogconc.sh
+ *
+ * This program shows how an nsort that has been set up with nsort_sync_init()
+ * can be searched and changed by many threads at once.  It loads half of a
+ * file into an nsort and keeps the other half to add later.  Then 1, 2, 4, ...
+ * up to the number of threads given on the command line each do a mix of
+ * operations on the sort: mostly nsort_find_item() on the items that were
+ * loaded, with the given percentage of the operations alternately adding one
+ * of the held back items and removing it again.  One search in 16 is an
+ * nsort_count_range() of the item instead.  Every search has to find its
+ * item, every remove has to return the link that was added, and the sort
+ * has to be in order with the right number of items at the end of each run.
+ * The same runs are then done on a sort without nsort_sync_init(), with the
+ * threads taking turns with a mutex, so the scaling of the two can be
+ * compared.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_THREAD 64
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define OPS_PER_ITEM 4
+
+typedef struct _thread_data {
+  nsort_t *srt;                  /* the sort to use */
+  pthread_mutex_t *mutex;        /* NULL if the sort is synchronized */
+  int writePct;                  /* percentage of operations that write */
+  int ops;                       /* number of operations to do */
+  unsigned int seed;             /* for rand_r() */
+  int numResident;               /* number of items in resident */
+  char **resident;               /* items that are always in the sort */
+  int numExtra;                  /* number of items in extra */
+  char **extra;                  /* items this thread adds and removes */
+  nsort_link_t *added;           /* the link this thread has in the sort */
+  int missed;                    /* searches that failed */
+  int failed;                    /* adds or removes that failed */
+} threadData;
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+//
+// Do the operations.  A write adds the next of this thread's extra items if
+// it doesn't have one in the sort and removes it if it does.
+//
+void *mixSort (void *tt)
+{
+  threadData *t = (threadData *)tt;
+  nsort_link_t lnk, *found;
+  size_t count;
+  int next = 0;
+  int i;
+
+  for (i = 0; i < t->ops; i++) {
+    if ((int)(rand_r (&t->seed) % 100) < t->writePct && t->numExtra > 0) {
+      if (t->mutex)
+        pthread_mutex_lock (t->mutex);
+      if (t->added == 0) {
+        t->added = nsort_new_link (t->srt, t->extra[next], 0);
+        if (t->added == 0 || nsort_add_item (t->srt, t->added) == _ERROR_) {
+          t->failed++;
+          t->added = 0;
+        }
+        if (++next == t->numExtra)
+          next = 0;
+      }
+      else {
+        found = nsort_remove_item (t->srt, t->added);
+        if (found != t->added)
+          t->failed++;
+        else
+          nsort_free_link (t->srt, found, 0);
+        t->added = 0;
+      }
+      if (t->mutex)
+        pthread_mutex_unlock (t->mutex);
+      continue;
+    }
+    lnk.data = t->resident[rand_r (&t->seed) % t->numResident];
+    if (i % 16 == 0) {
+      if (t->mutex)
+        pthread_mutex_lock (t->mutex);
+      if (nsort_count_range (t->srt, &lnk, &lnk, &count) == _ERROR_)
+        count = 0;
+      if (t->mutex)
+        pthread_mutex_unlock (t->mutex);
+      if (count == 0)
+        t->missed++;
+      continue;
+    }
+    if (t->mutex)
+      pthread_mutex_lock (t->mutex);
+    found = nsort_find_item (t->srt, &lnk);
+    if (t->mutex)
+      pthread_mutex_unlock (t->mutex);
+    if (found == 0 || testCompare (found->data, lnk.data) != 0)
+      t->missed++;
+  }
+  return (void*)0;
+}
+
+//
+// Make sure the sort is in order and has the expected number of items.
+//
+int checkSort (nsort_t *srt, size_t expected)
+{
+  nsort_link_t *lnk;
+  size_t count = 0;
+
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next) {
+    if (lnk->next != srt->lh->tail && testCompare (lnk->data, lnk->next->data) > 0) {
+      printf ("\n\n***Error: sort is out of order at item %zu\n", count);
+      return _ERROR_;
+    }
+    count++;
+  }
+  if (count != expected || srt->lh->number != expected) {
+    printf ("\n\n***Error: sort has %zu items (number is %zu), expected %zu\n",
+        count, srt->lh->number, expected);
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+//
+// Run the operations with nthreads threads and return the elapsed time,
+// or a negative number if something went wrong.
+//
+double runThreads (nsort_t *srt, pthread_mutex_t *mutex, char **resident,
+    int numResident, char **extra, int numExtra, int writePct, int totalOps,
+    int nthreads)
+{
+  threadData tt[MAX_THREAD];
+  pthread_t th[MAX_THREAD];
+  double t1, t2;
+  size_t expected = (size_t)numResident;
+  int i, status;
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < nthreads; i++) {
+    tt[i].srt = srt;
+    tt[i].mutex = mutex;
+    tt[i].writePct = writePct;
+    tt[i].ops = totalOps / nthreads;
+    tt[i].seed = (unsigned int)(i + 1);
+    tt[i].numResident = numResident;
+    tt[i].resident = resident;
+    tt[i].numExtra = numExtra / nthreads;
+    tt[i].extra = extra + i * (numExtra / nthreads);
+    tt[i].added = 0;
+    tt[i].missed = 0;
+    tt[i].failed = 0;
+    status = pthread_create (&th[i], 0, mixSort, &tt[i]);
+    if (status) {
+      printf ("\n\n***Error: pthread_create returned %d\n", status);
+      return -1.0;
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    status = pthread_join (th[i], 0);
+    if (status) {
+      printf ("\n\n***Error: joining thread %d\n", i);
+      return -1.0;
+    }
+  }
+  nsort_elapsed (&t2);
+  for (i = 0; i < nthreads; i++) {
+    if (tt[i].missed != 0 || tt[i].failed != 0) {
+      printf ("\n\n***Error: thread %d missed %d searches, %d writes failed\n",
+          i, tt[i].missed, tt[i].failed);
+      return -1.0;
+    }
+    if (tt[i].added != 0)
+      expected++;
+  }
+  if (checkSort (srt, expected) == _ERROR_)
+    return -1.0;
+  // put the sort back the way it was for the next run
+  for (i = 0; i < nthreads; i++) {
+    if (tt[i].added != 0) {
+      if (nsort_remove_item (srt, tt[i].added) != tt[i].added) {
+        printf ("\n\n***Error: removing the items left by thread %d\n", i);
+        return -1.0;
+      }
+      nsort_free_link (srt, tt[i].added, 0);
+    }
+  }
+  return t2 - t1;
+}
+
+int main (int argc, char *argv[])
+{
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  nsort_t *srt;
+  nsort_link_t *lnk;
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  char str[ERROR_LEN+1];
+  double base, secs;
+  int totalcount, number, numResident, totalOps;
+  int maxThreads = 8;
+  int writePct = 5;
+  int sync;
+  int i, n;
+
+  if (argc < 2 || argc > 4) {
+    printf ("\n\nUsage: %s <file> [max_threads [write_pct]]\n", argv[0]);
+    printf ("\twhere <file> is the file to load and search,\n");
+    printf ("\t  max_threads is the most threads to use (default 8)\n");
+    printf ("\t  and write_pct is the percentage of writes (default 5)\n");
+    return 1;
+  }
+  if (argc >= 3) {
+    maxThreads = atoi (argv[2]);
+    if (maxThreads < 1 || maxThreads > MAX_THREAD) {
+      printf ("\n\n***Error: max_threads should be from 1 to %d\n", MAX_THREAD);
+      return _ERROR_;
+    }
+  }
+  if (argc == 4) {
+    writePct = atoi (argv[3]);
+    if (writePct < 0 || writePct > 100) {
+      printf ("\n\n***Error: write_pct should be from 0 to 100\n");
+      return _ERROR_;
+    }
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp) {
+    printf ("\n\n***Error: critical memory error allocating char array\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  totalcount = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (number = 0; number < totalcount && cpp[number] != 0
+      && cpp[number][0] != '\0'; number++)
+    ;
+  numResident = number / 2;
+  if (numResident == 0) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  totalOps = number * OPS_PER_ITEM;
+
+  for (sync = TRUE; sync >= FALSE; sync--) {
+    srt = nsort_create ();
+    if (srt == 0) {
+      nsort_show_error (str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_create(): %s\n", str);
+      return _ERROR_;
+    }
+    if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_init(): %s\n", str);
+      return _ERROR_;
+    }
+    if (sync && nsort_sync_init (srt) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_sync_init(): %s\n", str);
+      return _ERROR_;
+    }
+    for (i = 0; i < numResident; i++) {
+      lnk = nsort_new_link (srt, cpp[i], 0);
+      if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+        nsort_show_sort_error (srt, str, ERROR_LEN);
+        printf ("\n\n***Error: adding item %d: %s\n", i, str);
+        return _ERROR_;
+      }
+    }
+    if (sync)
+      printf ("\nLoaded %zu items, %d operations per run, %d%% writes\n",
+          srt->lh->number, totalOps, writePct);
+    printf (sync ? "\nSynchronized with nsort_sync_init():\n" :
+        "\nSerialized with a mutex:\n");
+    base = 0.0;
+    for (n = 1; n <= maxThreads; n *= 2) {
+      secs = runThreads (srt, sync ? 0 : &mutex, cpp, numResident,
+          cpp + numResident, number - numResident, writePct, totalOps, n);
+      if (secs < 0.0)
+        return _ERROR_;
+      if (n == 1)
+        base = secs;
+      printf ("  %2d threads: %f seconds, %.0f ops/sec, speedup %.2f, "
+          "%zu restructures\n", n, secs, (double)(totalOps / n) * n / secs,
+          base / secs, srt->numRestruct);
+    }
+    lnk = nsort_list_remove_link (srt->lh);
+    while (lnk != 0) {
+      free (lnk);
+      lnk = nsort_list_remove_link (srt->lh);
+    }
+    nsort_del (srt, 0);
+    nsort_destroy (srt);
+  }
+
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,266 @@
+/* Source File: flogcur.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogcur.c}
+ *
+ * Program: flogcur.c
+ * Script: flogcur.sh
+ *
+ * This program tests the cursor functions.  It loads the items in a file into
+ * an nsort, freezes it, and reads the whole sort with nsort_cursor_read() in
+ * batches and backward with nsort_cursor_prev(), checking both against a sorted
+ * copy of the items.  Then it seeks to the lower and upper bounds of items in
+ * the file and of keys made by cutting items short (which are mostly not in
+ * the sort), checking where the cursor lands and scanning a few items from
+ * there.  It prints the time a scan of the sort takes with the cursor and with a
+ * walk of the list that looks at the data of each item.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define NUM_SEEKS 100000
+#define BATCH 256
+#define SCAN 10
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// The place in the sorted array of the first item not less than (or, if
+// upper is set, greater than) key.
+//
+int bound (char **sorted, int number, char *key, int upper)
+{
+  int lo = 0, hi = number, mid, status;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    status = testCompare (sorted[mid], key);
+    if (status < 0 || (upper && status == 0))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//
+// Seek to a bound of key and check the cursor lands where it should and
+// scans the items after it.
+//
+int checkSeek (nsort_cursor_t *cur, char **sorted, int number, char *key,
+    int upper)
+{
+  nsort_link_t find, *lnk;
+  int i, j;
+
+  find.data = key;
+  i = bound (sorted, number, key, upper);
+  lnk = upper ? nsort_cursor_upper_bound (cur, &find) :
+    nsort_cursor_lower_bound (cur, &find);
+  for (j = 0; j < SCAN && i + j < number; j++) {
+    if (lnk == 0 || testCompare (lnk->data, sorted[i + j]) != 0) {
+      printf ("\n\n***Error: %s bound of %s: item %d is %s, expected %s\n",
+          upper ? "upper" : "lower", key, j, lnk ? (char *)lnk->data : "NULL",
+          sorted[i + j]);
+      return _ERROR_;
+    }
+    lnk = nsort_cursor_next (cur);
+  }
+  if (i + j == number && lnk != 0) {
+    printf ("\n\n***Error: %s bound of %s didn't stop at the end\n",
+        upper ? "upper" : "lower", key);
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  char key[ERROR_LEN+1];
+  void *buf[BATCH];
+  nsort_t *srt;
+  nsort_cursor_t cur;
+  nsort_link_t *lnk;
+  unsigned int seed = 1;
+  double t1, t2;
+  size_t n, len;
+  unsigned long sum1 = 0, sum2 = 0;
+  int number, i, j;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    lnk = nsort_new_link (srt, cpp[i], 0);
+    if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+  }
+  if (nsort_freeze (srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_freeze(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("\n%d items\n", number);
+
+  // the whole sort, forward in batches and then backward
+  if (nsort_cursor_init (&cur, srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_cursor_init(): %s\n", str);
+    return _ERROR_;
+  }
+  i = 0;
+  while ((n = nsort_cursor_read (&cur, buf, BATCH)) > 0) {
+    for (j = 0; j < (int)n; j++, i++)
+      if (i >= number || testCompare (buf[j], sorted[i]) != 0) {
+        printf ("\n\n***Error: nsort_cursor_read() item %d is wrong\n", i);
+        return _ERROR_;
+      }
+  }
+  if (i != number || nsort_cursor_next (&cur) != 0) {
+    printf ("\n\n***Error: nsort_cursor_read() read %d items, expected %d\n",
+        i, number);
+    return _ERROR_;
+  }
+  for (lnk = nsort_cursor_last (&cur), i = number - 1; lnk != 0;
+      lnk = nsort_cursor_prev (&cur), i--)
+    if (i < 0 || testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: nsort_cursor_prev() item %d is wrong\n", i);
+      return _ERROR_;
+    }
+  if (i != -1 || nsort_cursor_prev (&cur) != 0 ||
+      (lnk = nsort_cursor_next (&cur)) == 0 ||
+      testCompare (lnk->data, sorted[0]) != 0) {
+    printf ("\n\n***Error: nsort_cursor_prev() stopped at %d\n", i);
+    return _ERROR_;
+  }
+
+  // seeks to the items and to keys cut short
+  for (i = 0; i < NUM_SEEKS; i++) {
+    j = (int)(rand_r (&seed) % (unsigned int)number);
+    strncpy (key, cpp[j], ERROR_LEN);
+    key[ERROR_LEN] = '\0';
+    if (checkSeek (&cur, sorted, number, key, FALSE) == _ERROR_ ||
+        checkSeek (&cur, sorted, number, key, TRUE) == _ERROR_)
+      return _ERROR_;
+    len = strlen (key);
+    if (len > 5) {
+      key[5 + rand_r (&seed) % (len - 5)] = '\0';
+      if (checkSeek (&cur, sorted, number, key, FALSE) == _ERROR_ ||
+          checkSeek (&cur, sorted, number, key, TRUE) == _ERROR_)
+        return _ERROR_;
+    }
+  }
+  if (checkSeek (&cur, sorted, number, sorted[number - 1], TRUE) == _ERROR_ ||
+      checkSeek (&cur, sorted, number, sorted[0], FALSE) == _ERROR_)
+    return _ERROR_;
+  printf ("  %d seeks checked\n", NUM_SEEKS * 4);
+
+  // a scan that looks at the data with the cursor and with the list
+  nsort_elapsed (&t1);
+  nsort_cursor_first (&cur);
+  while ((n = nsort_cursor_read (&cur, buf, BATCH)) > 0)
+    for (j = 0; j < (int)n; j++)
+      sum1 += (unsigned char)((char *)buf[j])[0];
+  nsort_elapsed (&t2);
+  printf ("  cursor scan %f seconds\n", t2 - t1);
+  nsort_elapsed (&t1);
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next)
+    sum2 += (unsigned char)((char *)lnk->data)[0];
+  nsort_elapsed (&t2);
+  printf ("  list scan   %f seconds\n", t2 - t1);
+  if (sum1 != sum2) {
+    printf ("\n\n***Error: the scans don't agree\n");
+    return _ERROR_;
+  }
+
+  nsort_thaw (srt);
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,26 @@
+cnt=1
+keys=200000
+length=38
+endhere=100
+
+if [ "$1" != "" ]; then
+  endhere="$1"
+fi
+
+echo "Testing cursors..."
+echo ""
+
+while [ $cnt -le $endhere ]; do
+ echo "$keys keys for #$cnt ..."
+ ./words $keys $length > input
+ echo "running #$cnt ..."
+ ./flogcur input
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "input producing the failure is left in \"input\""
+  exit 1
+ fi
+ echo "Passed!"
+
+ cnt=`expr $cnt + 1`
+done
@@ -0,0 +1,296 @@
+/* Source File: flogfront.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogfront.c}
+ *
+ * Program: flogfront.c
+ * Script: flogfront.sh
+ *
+ * This program tests the front-coded keys of nsort_save_front() and
+ * nsort_front_build().  It makes a sort of the items in a file, saves it with
+ * nsort_save_var() and with nsort_save_front(), and prints the size of each
+ * file.  It gets the front-coded file back with nsort_get() and checks the
+ * sort, and opens it with nsort_front_open() and checks every key and the
+ * bounds of items in the file and of keys made by cutting items short against a
+ * sorted copy of the items.  Then it does the same with keys front-coded in
+ * memory by nsort_front_build(), printing the memory they take and the time
+ * searches take against the same searches of the sort.  Last, it checks that
+ * a file that has been cut short is turned down.  The script runs it on a list
+ * of words and on a list of paths like the ones fmd keeps.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define NUM_SEEKS 100000
+
+int testCompare (void *p1, void *p2)
+{
+  return strcmp ((char *) p1, (char *) p2);
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+size_t testLength (void *p)
+{
+  return strlen ((char *) p) + 1;
+}
+
+//
+// The place in the sorted array of the first item not less than (or, if
+// upper is set, greater than) key.
+//
+size_t bound (char **sorted, int number, char *key, int upper)
+{
+  int lo = 0, hi = number, mid, status;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    status = testCompare (sorted[mid], key);
+    if (status < 0 || (upper && status == 0))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return (size_t)lo;
+}
+
+//
+// Check every key of fc and the bounds of the items and of keys cut short.
+//
+int checkFront (nsort_front_t *fc, char **sorted, char **cpp, int number,
+    const char *what)
+{
+  char *buf, key[ERROR_LEN+1];
+  unsigned int seed = 1;
+  size_t i, j, len;
+  int k;
+
+  if (fc->number != (size_t)number) {
+    printf ("\n\n***Error: %s: %zu keys, expected %d\n", what, fc->number,
+        number);
+    return _ERROR_;
+  }
+  buf = malloc (fc->maxLength);
+  if (buf == 0) {
+    printf ("\n\n***Error: critical memory error allocating a key\n");
+    return _ERROR_;
+  }
+  for (i = 0; i < fc->number; i++)
+    if (nsort_front_key (fc, i, buf) == 0 || strcmp (buf, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: key %zu is wrong\n", what, i);
+      return _ERROR_;
+    }
+  if (nsort_front_key (fc, fc->number, buf) != 0) {
+    printf ("\n\n***Error: %s: got a key past the end\n", what);
+    return _ERROR_;
+  }
+  for (k = 0; k < NUM_SEEKS; k++) {
+    strncpy (key, cpp[rand_r (&seed) % (unsigned int)number], ERROR_LEN);
+    key[ERROR_LEN] = '\0';
+    i = nsort_front_find (fc, key);
+    if (i == fc->number || i != bound (sorted, number, key, FALSE)) {
+      printf ("\n\n***Error: %s: didn't find %s\n", what, key);
+      return _ERROR_;
+    }
+    len = strlen (key);
+    if (len > 1)
+      key[1 + rand_r (&seed) % (len - 1)] = '\0';
+    i = nsort_front_lower_bound (fc, key);
+    j = nsort_front_upper_bound (fc, key);
+    if (i != bound (sorted, number, key, FALSE) ||
+        j != bound (sorted, number, key, TRUE)) {
+      printf ("\n\n***Error: %s: bounds of %s are %zu and %zu\n", what, key,
+          i, j);
+      return _ERROR_;
+    }
+    if ((nsort_front_find (fc, key) == fc->number) != (i == j)) {
+      printf ("\n\n***Error: %s: nsort_front_find() of %s is wrong\n", what,
+          key);
+      return _ERROR_;
+    }
+  }
+  free (buf);
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  nsort_t *srt;
+  nsort_front_t fc;
+  nsort_link_t *lnk, find;
+  double t1, t2, t3;
+  size_t varSize, raw = 0;
+  int number, i;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    raw += strlen (cpp[i]) + 1;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+  printf ("\n%d items, %zu bytes\n", number, raw);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_build_sorted (srt, (void **)sorted, (size_t)number, testCompare,
+        FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_build_sorted(): %s\n", str);
+    return _ERROR_;
+  }
+
+  // the sizes of the files
+  if (nsort_save_var (srt, "flogfront", testLength, "flogfront.var") ==
+      _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_var(): %s\n", str);
+    return _ERROR_;
+  }
+  stat ("flogfront.var", &sbuf);
+  varSize = (size_t)sbuf.st_size;
+  nsort_elapsed (&t1);
+  if (nsort_save_front (srt, "flogfront", "flogfront.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_front(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  stat ("flogfront.dat", &sbuf);
+  printf ("  nsort_save_var()   %10zu bytes\n", varSize);
+  printf ("  nsort_save_front() %10zu bytes, %.1f times smaller, "
+      "save %f seconds\n", (size_t)sbuf.st_size,
+      (double)varSize / (double)sbuf.st_size, t2 - t1);
+
+  // the memory the keys take front-coded and the time searches take
+  if (nsort_front_build (&fc, srt) == _ERROR_) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_front_build(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  nsort_front_build() %9zu bytes for %zu bytes of keys\n",
+      fc.length, fc.rawLength);
+  nsort_elapsed (&t1);
+  for (i = 0; i < number; i++) {
+    find.data = cpp[i];
+    if (nsort_find_item (srt, &find) == 0) {
+      printf ("\n\n***Error: nsort_find_item() didn't find %s\n", cpp[i]);
+      return _ERROR_;
+    }
+  }
+  nsort_elapsed (&t2);
+  for (i = 0; i < number; i++)
+    if (nsort_front_find (&fc, cpp[i]) == fc.number) {
+      printf ("\n\n***Error: nsort_front_find() didn't find %s\n", cpp[i]);
+      return _ERROR_;
+    }
+  nsort_elapsed (&t3);
+  printf ("  %d finds: sort %f, front-coded %f seconds\n", number,
+      t2 - t1, t3 - t2);
+  if (checkFront (&fc, sorted, cpp, number, "nsort_front_build()") == _ERROR_)
+    return _ERROR_;
+  nsort_front_close (&fc);
+  nsort_del (srt, 0);
+
+  // the file, read back and searched where it lies
+  nsort_elapsed (&t1);
+  if (nsort_get (srt, testCompare, "flogfront.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  nsort_get() %f seconds\n", t2 - t1);
+  i = 0;
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next, i++)
+    if (i >= number || strcmp (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: nsort_get(): item %d is wrong\n", i);
+      return _ERROR_;
+    }
+  if (i != number) {
+    printf ("\n\n***Error: nsort_get(): %d items, expected %d\n", i, number);
+    return _ERROR_;
+  }
+  srt->manageAllocs = TRUE;
+  nsort_del (srt, 0);
+  if (nsort_front_open (&fc, testCompare, "flogfront.dat") == _ERROR_) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_front_open(): %s\n", str);
+    return _ERROR_;
+  }
+  if (checkFront (&fc, sorted, cpp, number, "nsort_front_open()") == _ERROR_)
+    return _ERROR_;
+  nsort_front_close (&fc);
+  printf ("  %d keys and %d seeks checked\n", number * 2, NUM_SEEKS * 8);
+
+  // a file that is cut short
+  stat ("flogfront.dat", &sbuf);
+  if (truncate ("flogfront.dat", sbuf.st_size - 1) != 0) {
+    printf ("\n\n***Error: couldn't truncate flogfront.dat\n");
+    return _ERROR_;
+  }
+  if (nsort_get (srt, testCompare, "flogfront.dat") != _ERROR_ ||
+      srt->sortError != SORT_LIST_BADFILE ||
+      nsort_front_open (&fc, testCompare, "flogfront.dat") != _ERROR_) {
+    printf ("\n\n***Error: a file cut short wasn't turned down\n");
+    return _ERROR_;
+  }
+  set_sortError (SORT_NOERROR);
+  nsort_destroy (srt);
+  unlink ("flogfront.dat");
+  unlink ("flogfront.var");
+
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,39 @@
+cnt=1
+keys=200000
+length=38
+endhere=100
+
+if [ "$1" != "" ]; then
+  endhere="$1"
+fi
+
+echo "Testing nsort_save_front()..."
+echo ""
+
+while [ $cnt -le $endhere ]; do
+ echo "$keys keys for #$cnt ..."
+ ./words $keys $length > input
+ echo "running #$cnt ..."
+ ./flogfront input
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "input producing the failure is left in \"input\""
+  exit 1
+ fi
+ echo "Passed!"
+
+ cnt=`expr $cnt + 1`
+done
+
+echo "paths of the files under /usr ..."
+find /usr -type f 2> /dev/null | head -n $keys > input.paths
+if [ -s input.paths ]; then
+ ./flogfront input.paths
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "input producing the failure is left in \"input.paths\""
+  exit 1
+ fi
+ echo "Passed!"
+fi
+rm -f input.paths
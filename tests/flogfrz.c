@@ -0,0 +1,246 @@
+/* Source File: flogfrz.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogfrz.c}
+ *
+ * Program: flogfrz.c
+ * Script: flogfrz.sh
+ *
+ * This program shows how a frozen nsort can be searched by many threads
+ * at once.  It loads a file into an nsort, freezes it with nsort_freeze()
+ * and then has 1, 2, 4, ... up to the number of threads given on the
+ * command line search for every item in the file.  The same searches are
+ * then done on the sort after it is thawed with nsort_thaw(), in which
+ * case the threads have to take turns with a mutex because
+ * nsort_find_item() updates the statistics in the sort object.  The time
+ * for each run and the speedup over one thread are printed, so the
+ * scaling of the two can be compared.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_THREAD 64
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define NUM_PASSES 2
+
+typedef struct _thread_data {
+  nsort_t *srt;                  /* the sort to search */
+  pthread_mutex_t *mutex;        /* NULL if the sort is frozen */
+  int number;                    /* number of items in cpp */
+  int start;                     /* where this thread starts in cpp */
+  char **cpp;                    /* items to search for */
+  int missed;                    /* items that weren't found */
+} threadData;
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+//
+// Search for every item, NUM_PASSES times.  Each thread starts at a
+// different place in the array so they aren't all walking the same part
+// of the sort at the same time.
+//
+void *searchSort (void *tt)
+{
+  threadData *t = (threadData *)tt;
+  nsort_link_t lnk, *found;
+  int i, j, k;
+
+  for (k = 0; k < NUM_PASSES; k++) {
+    for (i = 0, j = t->start; i < t->number; i++, j++) {
+      if (j == t->number)
+        j = 0;
+      lnk.data = t->cpp[j];
+      if (t->mutex)
+        pthread_mutex_lock (t->mutex);
+      found = nsort_find_item (t->srt, &lnk);
+      if (t->mutex)
+        pthread_mutex_unlock (t->mutex);
+      if (found == 0 || testCompare (found->data, lnk.data) != 0)
+        t->missed++;
+    }
+  }
+  return (void*)0;
+}
+
+//
+// Run the searches with nthreads threads and return the elapsed time,
+// or a negative number if something went wrong.
+//
+double runThreads (nsort_t *srt, pthread_mutex_t *mutex, char **cpp,
+    int number, int nthreads)
+{
+  threadData tt[MAX_THREAD];
+  pthread_t th[MAX_THREAD];
+  double t1, t2;
+  int i, status;
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < nthreads; i++) {
+    tt[i].srt = srt;
+    tt[i].mutex = mutex;
+    tt[i].number = number / nthreads;
+    tt[i].start = (number / nthreads) / 2;
+    tt[i].cpp = cpp + i * (number / nthreads);
+    tt[i].missed = 0;
+    status = pthread_create (&th[i], 0, searchSort, &tt[i]);
+    if (status) {
+      printf ("\n\n***Error: pthread_create returned %d\n", status);
+      return -1.0;
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    status = pthread_join (th[i], 0);
+    if (status) {
+      printf ("\n\n***Error: joining thread %d\n", i);
+      return -1.0;
+    }
+  }
+  nsort_elapsed (&t2);
+  for (i = 0; i < nthreads; i++) {
+    if (tt[i].missed != 0) {
+      printf ("\n\n***Error: thread %d missed %d items\n", i, tt[i].missed);
+      return -1.0;
+    }
+  }
+  return t2 - t1;
+}
+
+int main (int argc, char *argv[])
+{
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  nsort_t *srt;
+  nsort_link_t *lnk;
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  char str[ERROR_LEN+1];
+  double base, secs;
+  int totalcount, number;
+  int maxThreads = 8;
+  int frozen;
+  int i, n;
+
+  if (argc != 2 && argc != 3) {
+    printf ("\n\nUsage: %s <file> [max_threads]\n", argv[0]);
+    printf ("\twhere <file> is the file to load and search\n");
+    printf ("\t  and max_threads is the most threads to use (default 8)\n");
+    return 1;
+  }
+  if (argc == 3) {
+    maxThreads = atoi (argv[2]);
+    if (maxThreads < 1 || maxThreads > MAX_THREAD) {
+      printf ("\n\n***Error: max_threads should be from 1 to %d\n", MAX_THREAD);
+      return _ERROR_;
+    }
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp) {
+    printf ("\n\n***Error: critical memory error allocating char array\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  totalcount = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (number = 0; number < totalcount && cpp[number] != 0
+      && cpp[number][0] != '\0'; number++)
+    ;
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    lnk = nsort_new_link (srt, cpp[i], 0);
+    if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+  }
+  printf ("\nLoaded %zu items, %d searches per run\n", srt->lh->number,
+      number * NUM_PASSES);
+
+  for (frozen = TRUE; frozen >= FALSE; frozen--) {
+    if (frozen) {
+      if (nsort_freeze (srt) == _ERROR_) {
+        nsort_show_sort_error (srt, str, ERROR_LEN);
+        printf ("\n\n***Error: nsort_freeze(): %s\n", str);
+        return _ERROR_;
+      }
+      lnk = nsort_new_link (srt, cpp[0], 0);
+      if (nsort_add_item (srt, lnk) != _ERROR_ ||
+          srt->sortError != SORT_FROZEN) {
+        printf ("\n\n***Error: nsort_add_item() on a frozen sort\n");
+        return _ERROR_;
+      }
+      srt->sortError = SORT_NOERROR;
+      free (lnk);
+      printf ("\nFrozen, no locking:\n");
+    }
+    else {
+      nsort_thaw (srt);
+      printf ("\nThawed, serialized with a mutex:\n");
+    }
+    base = 0.0;
+    for (n = 1; n <= maxThreads; n *= 2) {
+      secs = runThreads (srt, frozen ? 0 : &mutex, cpp, number, n);
+      if (secs < 0.0)
+        return _ERROR_;
+      if (n == 1)
+        base = secs;
+      printf ("  %2d threads: %f seconds, %.0f searches/sec, speedup %.2f\n",
+          n, secs, (double)(number / n) * n * NUM_PASSES / secs, base / secs);
+    }
+  }
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
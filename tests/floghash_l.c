@@ -47,8 +47,6 @@ int main (int argc, char *argv[])
   char *tmp;
   int counter;
   int totalcount = 0;
-  int min = MAXDATA,
-      max = 0;
 
   if (totalcount) {}
   if (argc != 2) {
@@ -157,21 +155,8 @@ int main (int argc, char *argv[])
   /*
    * Open test file and search for each item in the hash
    */
-  for (i = 0; i < NSORT_HASH_SIZE; i++) {
-    status = nsort_restructure_nodes (hsh.srts[i]);
-    if (_ERROR_ == status) {
-      nsort_show_sort_error(hsh.srts[i], str, ERROR_LEN);
-      printf ("\n\n***Error: nsort_restructure_nodes(): %s\n", str);
-      return _ERROR_;
-    }
-    num = hsh.srts[i]->lh->number;
-    if (num < min)
-      min = num;
-    if (num > max)
-      max = num;
-  }
-  printf ("There are %d shells, min num = %d, max num = %d\n",
-      NSORT_HASH_SIZE, min, max);
+  printf ("The table has %zu slots, %.3f of them used\n",
+      hsh.capacity, (double)hsh.number / (double)hsh.capacity);
   num = 0;
   nsort_elapsed (&t1);
   lnk = lh.head->next;
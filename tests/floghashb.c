@@ -0,0 +1,170 @@
+/* Source File: floghashb.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{floghashb.c}
+ *
+ * Program: floghashb.c
+ * Script: floghashb.sh
+ *
+ * This program times the nsort hash with a large number of keys.  The keys are
+ * made up from their numbers as they are needed (lower case strings of 8 to
+ * 40 characters), so there is no file to read and no copy of them to keep
+ * around, and millions of them can be hashed.  It adds the keys to a hash
+ * that is initialized with nsort_hash_init_size() with nsort_hash_add_key(),
+ * with the number of each key as its value, searches for each of them with
+ * nsort_hash_find_key(), checking the value, and for as many keys that are
+ * known not to be there, and prints the time and the rate of each, the
+ * size of the table and the most memory the program had.  The keys can be
+ * kept in an arena (see nsort_hash_use_arena()) to see what that saves.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+#include <sys/resource.h>
+
+#define ERROR_LEN 256
+#define KEY_LEN 40
+
+//
+// The next value of a splitmix64 generator.
+//
+uint64_t nextRandom (uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//
+// Make key number i and return its length.  The bogus keys start with an
+// upper case letter, so they are never one of the keys that were added.
+//
+size_t makeKey (char *key, size_t i, int bogus)
+{
+  uint64_t state = (uint64_t)i, r;
+  int len, j;
+
+  r = nextRandom (&state);
+  len = 8 + (int)(r % (KEY_LEN - 7));
+  for (j = 0; j < len; j++) {
+    if (j % 8 == 0)
+      r = nextRandom (&state);
+    key[j] = (char)('a' + (r & 0xff) % 26);
+    r >>= 8;
+  }
+  key[len] = '\0';
+  if (bogus)
+    key[0] = (char)(key[0] - 'a' + 'A');
+  return (size_t)len;
+}
+
+int main (int argc, char *argv[])
+{
+  nsort_hash_t *hsh;
+  char key[KEY_LEN+1];
+  char other[KEY_LEN+1];
+  void *value;
+  struct rusage usage;
+  double t1, t2, maxLoad = 0.0;
+  size_t number, capacity = 0, i, len, dups = 0;
+  int arena = FALSE;
+
+  if (argc < 2 || argc > 5) {
+    printf ("\n\nUsage: %s <keys> [<capacity> [<load> [<arena>]]]\n",
+        argv[0]);
+    printf ("\twhere <keys> is the number of keys to hash, <capacity> is\n");
+    printf ("\tthe number of keys to size the table for, <load> is the\n");
+    printf ("\tmaximum load of the table and <arena> is 1 to keep the keys\n");
+    printf ("\tin an arena\n");
+    return 1;
+  }
+  number = (size_t)strtoul (argv[1], 0, 10);
+  if (argc > 2)
+    capacity = (size_t)strtoul (argv[2], 0, 10);
+  if (argc > 3)
+    maxLoad = atof (argv[3]);
+  if (argc > 4)
+    arena = atoi (argv[4]);
+
+  hsh = nsort_hash_create ();
+  if (hsh == 0) {
+    printf ("\n\n***Error: nsort_hash_create()\n");
+    return _ERROR_;
+  }
+  if (nsort_hash_init_size (hsh, 0, 0, capacity, maxLoad) ==
+      _ERROR_ || (arena && nsort_hash_use_arena (hsh, 0) == _ERROR_)) {
+    printf ("\n\n***Error: nsort_hash_init_size(): %s\n",
+        sortErrorString[hsh->hashError]);
+    return _ERROR_;
+  }
+  printf ("\n%zu keys, table sized for %zu, maximum load %.3f%s\n", number,
+      capacity ? capacity : (size_t)NSORT_HASH_CAPACITY, hsh->maxLoad,
+      arena ? ", keys in an arena" : "");
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < number; i++) {
+    len = makeKey (key, i, FALSE);
+    if (nsort_hash_add_key (hsh, key, len, (void *)(i + 1)) == _ERROR_) {
+      if (hsh->hashError != SORT_UNIQUE) {
+        printf ("\n\n***Error: nsort_hash_add_key (hsh, %s): %s\n", key,
+            sortErrorString[hsh->hashError]);
+        return _ERROR_;
+      }
+      hsh->hashError = SORT_NOERROR;
+      dups++;
+    }
+  }
+  nsort_elapsed (&t2);
+  printf ("  add    %f seconds, %.0f keys/second (%zu duplicates)\n",
+      t2 - t1, (double)number / (t2 - t1), dups);
+  if ((size_t)hsh->number + dups != number) {
+    printf ("\n\n***Error: the hash has %d keys, expected %zu\n",
+        hsh->number, number - dups);
+    return _ERROR_;
+  }
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < number; i++) {
+    len = makeKey (key, i, FALSE);
+    if (nsort_hash_find_key (hsh, key, len, &value) == 0) {
+      printf ("\n\n***Error: didn't find %s\n", key);
+      return _ERROR_;
+    }
+    // a duplicate has the value of the first key like it
+    if (value != (void *)(i + 1) && (value == 0 ||
+          makeKey (other, (size_t)value - 1, FALSE) != len ||
+          memcmp (other, key, len) != 0)) {
+      printf ("\n\n***Error: %s has the wrong value\n", key);
+      return _ERROR_;
+    }
+  }
+  nsort_elapsed (&t2);
+  printf ("  find   %f seconds, %.0f keys/second\n", t2 - t1,
+      (double)number / (t2 - t1));
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < number; i++) {
+    len = makeKey (key, i, TRUE);
+    if (nsort_hash_find_key (hsh, key, len, 0) != 0) {
+      printf ("\n\n***Error: found bogus key %s\n", key);
+      return _ERROR_;
+    }
+  }
+  nsort_elapsed (&t2);
+  printf ("  bogus  %f seconds, %.0f keys/second\n", t2 - t1,
+      (double)number / (t2 - t1));
+  printf ("  %zu slots, %.3f used, %zu bytes of table\n", hsh->capacity,
+      (double)hsh->number / (double)hsh->capacity,
+      hsh->capacity * (sizeof (nsort_hash_slot_t) + 1));
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    printf ("  %ld KB resident at most\n", usage.ru_maxrss);
+
+  nsort_hash_del (hsh);
+  nsort_hash_destroy (hsh);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,34 @@
+keys=1000000
+
+if [ "$1" != "" ]; then
+  keys="$1"
+fi
+
+echo "Timing the nsort hash..."
+echo ""
+
+echo "$keys keys, growing from the default size ..."
+./floghashb $keys
+if [ $? != 0 ]; then
+ echo " failed!"
+ exit 1
+fi
+echo "$keys keys, sized for them ..."
+./floghashb $keys $keys
+if [ $? != 0 ]; then
+ echo " failed!"
+ exit 1
+fi
+echo "$keys keys, sized for them with a load of 0.5 ..."
+./floghashb $keys $keys 0.5
+if [ $? != 0 ]; then
+ echo " failed!"
+ exit 1
+fi
+echo "$keys keys, sized for them with the keys in an arena ..."
+./floghashb $keys $keys 0 1
+if [ $? != 0 ]; then
+ echo " failed!"
+ exit 1
+fi
+echo "Passed!"
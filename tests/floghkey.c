@@ -0,0 +1,255 @@
+/* Source File: floghkey.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{floghkey.c}
+ *
+ * Program: floghkey.c
+ * Script: floghkey.sh
+ *
+ * This program tests the nsort hash functions that take keys and lengths.  It
+ * adds the items in a file to a hash as keys with nsort_hash_add_key(), each
+ * with its line number as its value, along with a binary key made from each
+ * item (the item with a NUL and the bytes of the line number after it), and
+ * checks that all of them are found with the right values, that the items
+ * cut short and the items searched for as strings are found or not as they
+ * should be, and that nsort_hash_put_key() replaces values.  Then it does it
+ * again with the keys kept in an arena, and with a hash function that puts
+ * every key of the same length in the same place, so the keys have to be told
+ * apart by compares.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+
+//
+// A bad hash function, to make the keys collide.
+//
+uint64_t lengthHash (const void *key, size_t len)
+{
+  (void)key;
+  return (uint64_t)len;
+}
+
+//
+// The old string hash function, which only goes with the string functions.
+//
+unsigned int stringHash (const char *item)
+{
+  return (unsigned int)nsort_hash_function ((const unsigned char *)item);
+}
+
+//
+// Make the binary key of item i, which is the item, a NUL and i, and return
+// its length.
+//
+size_t binaryKey (char *buf, char *item, int i)
+{
+  size_t len = strlen (item);
+
+  memcpy (buf, item, len + 1);
+  memcpy (buf + len + 1, &i, sizeof (int));
+  return len + 1 + sizeof (int);
+}
+
+int runTest (char **cpp, int number, uint64_t (*hash)(const void *, size_t),
+    int arena)
+{
+  nsort_hash_t hsh;
+  char buf[ERROR_LEN+sizeof(int)+1];
+  const char *found;
+  void *value;
+  size_t len;
+  int i, added = 0, status;
+
+  if (nsort_hash_init_size (&hsh, 0, 0, 0, 0.0) == _ERROR_ ||
+      nsort_hash_set_function (&hsh, hash) == _ERROR_ ||
+      (arena && nsort_hash_use_arena (&hsh, 0) == _ERROR_)) {
+    printf ("\n\n***Error: initializing the hash: %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    status = nsort_hash_add_key (&hsh, cpp[i], strlen (cpp[i]),
+        (void *)(size_t)(i + 1));
+    if (status == _ERROR_ && hsh.hashError != SORT_UNIQUE) {
+      printf ("\n\n***Error: nsort_hash_add_key (%s): %s\n", cpp[i],
+          sortErrorString[hsh.hashError]);
+      return _ERROR_;
+    }
+    if (status == _OK_)
+      added++;
+    hsh.hashError = SORT_NOERROR;
+    len = binaryKey (buf, cpp[i], i);
+    if (nsort_hash_add_key (&hsh, buf, len, (void *)(size_t)(i + 1)) ==
+        _ERROR_) {
+      printf ("\n\n***Error: nsort_hash_add_key (%s + %d): %s\n", cpp[i], i,
+          sortErrorString[hsh.hashError]);
+      return _ERROR_;
+    }
+  }
+  if (hsh.number != added + number) {
+    printf ("\n\n***Error: the hash has %d keys, expected %d\n", hsh.number,
+        added + number);
+    return _ERROR_;
+  }
+
+  for (i = 0; i < number; i++) {
+    // the item, as a key and as a string
+    len = strlen (cpp[i]);
+    found = nsort_hash_find_key (&hsh, cpp[i], len, &value);
+    if (found == 0 || strcmp (found, cpp[i]) != 0 || value == 0 ||
+        strcmp (cpp[(size_t)value - 1], cpp[i]) != 0 ||
+        nsort_hash_find_item (&hsh, cpp[i]) != found) {
+      printf ("\n\n***Error: didn't find %s\n", cpp[i]);
+      return _ERROR_;
+    }
+    // the binary key
+    len = binaryKey (buf, cpp[i], i);
+    found = nsort_hash_find_key (&hsh, buf, len, &value);
+    if (found == 0 || memcmp (found, buf, len) != 0 || found[len] != '\0' ||
+        NSORT_HASH_KEYLEN(found) != len || value != (void *)(size_t)(i + 1)) {
+      printf ("\n\n***Error: didn't find %s + %d\n", cpp[i], i);
+      return _ERROR_;
+    }
+    // the item cut short is only there if it is another item
+    len = strlen (cpp[i]) - 1;
+    found = nsort_hash_find_key (&hsh, cpp[i], len, 0);
+    if (found != 0 && (strlen (found) != len || memcmp (found, cpp[i], len))) {
+      printf ("\n\n***Error: found %s for %.*s\n", found, (int)len, cpp[i]);
+      return _ERROR_;
+    }
+    if (hsh.hashError != SORT_NOERROR) {
+      printf ("\n\n***Error: nsort_hash_find_key (): %s\n",
+          sortErrorString[hsh.hashError]);
+      return _ERROR_;
+    }
+  }
+
+  // replacing values
+  for (i = 0; i < number; i++) {
+    len = binaryKey (buf, cpp[i], i);
+    if (nsort_hash_put_key (&hsh, buf, len, (void *)(size_t)(number - i)) ==
+        _ERROR_ || nsort_hash_add_key (&hsh, buf, len, 0) != _ERROR_ ||
+        hsh.hashError != SORT_UNIQUE) {
+      printf ("\n\n***Error: nsort_hash_put_key (%s + %d)\n", cpp[i], i);
+      return _ERROR_;
+    }
+    hsh.hashError = SORT_NOERROR;
+  }
+  for (i = 0; i < number; i++) {
+    len = binaryKey (buf, cpp[i], i);
+    if (nsort_hash_find_key (&hsh, buf, len, &value) == 0 ||
+        value != (void *)(size_t)(number - i)) {
+      printf ("\n\n***Error: %s + %d has the wrong value\n", cpp[i], i);
+      return _ERROR_;
+    }
+  }
+  if (hsh.number != added + number) {
+    printf ("\n\n***Error: the hash has %d keys, expected %d\n", hsh.number,
+        added + number);
+    return _ERROR_;
+  }
+  nsort_hash_del (&hsh);
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  nsort_hash_t hsh;
+  double t1, t2;
+  int number, collide, i;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0' &&
+      strlen (cpp[i]) < ERROR_LEN; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  // the colliding hash makes every search a scan, so it gets fewer items
+  collide = number < 2000 ? number : 2000;
+  printf ("\n%d items\n", number);
+
+  nsort_elapsed (&t1);
+  if (runTest (cpp, number, 0, FALSE) == _ERROR_)
+    return _ERROR_;
+  nsort_elapsed (&t2);
+  printf ("  with XXH3              %f seconds\n", t2 - t1);
+  nsort_elapsed (&t1);
+  if (runTest (cpp, number, 0, TRUE) == _ERROR_)
+    return _ERROR_;
+  nsort_elapsed (&t2);
+  printf ("  with XXH3 and an arena %f seconds\n", t2 - t1);
+  nsort_elapsed (&t1);
+  if (runTest (cpp, collide, lengthHash, FALSE) == _ERROR_)
+    return _ERROR_;
+  nsort_elapsed (&t2);
+  printf ("  %d items colliding   %f seconds\n", collide, t2 - t1);
+
+  // the key functions don't go with a string hash function
+  if (nsort_hash_init (&hsh, 0, stringHash) == _ERROR_ ||
+      nsort_hash_add_item (&hsh, cpp[0]) == _ERROR_ ||
+      nsort_hash_find_item (&hsh, cpp[0]) == 0 ||
+      nsort_hash_add_key (&hsh, cpp[0], strlen (cpp[0]), 0) != _ERROR_ ||
+      hsh.hashError != SORT_PARAM ||
+      nsort_hash_set_function (&hsh, 0) != _ERROR_) {
+    printf ("\n\n***Error: a string hash function was taken wrong\n");
+    return _ERROR_;
+  }
+  nsort_hash_del (&hsh);
+
+  // no hash at all
+  if (nsort_hash_add_key (0, cpp[0], strlen (cpp[0]), 0) != _ERROR_ ||
+      get_sortError () != SORT_PARAM ||
+      nsort_hash_put_key (0, cpp[0], strlen (cpp[0]), 0) != _ERROR_ ||
+      nsort_hash_find_key (0, cpp[0], strlen (cpp[0]), 0) != 0 ||
+      nsort_hash_set_function (0, 0) != _ERROR_ ||
+      get_sortError () != SORT_PARAM) {
+    printf ("\n\n***Error: a NULL hash was taken wrong\n");
+    return _ERROR_;
+  }
+  set_sortError (SORT_NOERROR);
+
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,380 @@
+/* Source File: floghsave.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{floghsave.c}
+ *
+ * Program: floghsave.c
+ * Script: floghsave.sh
+ *
+ * This program tests nsort_hash_remove_key(), the hash cursor and
+ * nsort_hash_save() and nsort_hash_get().  It adds the items in a file to a
+ * hash as keys, each with its line number as its value, and removes and adds
+ * back half of them over and over, checking that the right keys are found and
+ * that the table doesn't keep growing.  It goes through the hash with a
+ * cursor, checking every key, and again removing some of the keys as it goes.
+ * Then it saves the hash, reads it back and checks it, adds keys to it and
+ * removes keys from it, with the keys that are added kept in an arena, saves
+ * it over the file it was read from and reads that back, and checks that
+ * files that are not hash files, or that go with another hash function, are
+ * turned down.  It prints the time it takes to build the hash from the items
+ * and to read it back from the file.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define SAVE_FILE "floghsave.dat"
+#define CHURN 8
+
+//
+// Another hash function, which the saved hash doesn't go with.
+//
+uint64_t otherHash (const void *key, size_t len)
+{
+  return nsort_hash_xxh3 (key, len) ^ 1;
+}
+
+//
+// The old string hash function, which only goes with the string functions.
+//
+unsigned int stringHash (const char *item)
+{
+  return (unsigned int)nsort_hash_function ((const unsigned char *)item);
+}
+
+//
+// Check that the items whose flag is set are in the hash with their line
+// numbers as their values and the others aren't, and that there are number
+// of them.
+//
+int checkHash (nsort_hash_t *hsh, char **cpp, char *in, int count, int number)
+{
+  const char *found;
+  void *value;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    found = nsort_hash_find_key (hsh, cpp[i], strlen (cpp[i]), &value);
+    if (in[i] && (found == 0 || strcmp (found, cpp[i]) != 0 ||
+          value != (void *)(size_t)(i + 1))) {
+      printf ("\n\n***Error: didn't find %s\n", cpp[i]);
+      return _ERROR_;
+    }
+    if (!in[i] && found != 0) {
+      printf ("\n\n***Error: found %s, which was removed\n", cpp[i]);
+      return _ERROR_;
+    }
+    if (hsh->hashError != SORT_NOERROR) {
+      printf ("\n\n***Error: nsort_hash_find_key (): %s\n",
+          sortErrorString[hsh->hashError]);
+      return _ERROR_;
+    }
+  }
+  if (hsh->number != number) {
+    printf ("\n\n***Error: the hash has %d keys, expected %d\n", hsh->number,
+        number);
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+//
+// Remove every so many items, which are there if their flags are set, and
+// clear their flags.
+//
+int removeItems (nsort_hash_t *hsh, char **cpp, char *in, int count,
+    int *number, int every, int from)
+{
+  void *value;
+  int i, status;
+
+  for (i = from; i < count; i += every) {
+    status = nsort_hash_remove_key (hsh, cpp[i], strlen (cpp[i]), &value);
+    if (in[i] && (status == _ERROR_ || value != (void *)(size_t)(i + 1))) {
+      printf ("\n\n***Error: nsort_hash_remove_key (%s): %s\n", cpp[i],
+          sortErrorString[hsh->hashError]);
+      return _ERROR_;
+    }
+    if (!in[i] && (status != _ERROR_ || hsh->hashError != SORT_NOERROR)) {
+      printf ("\n\n***Error: removed %s, which wasn't there\n", cpp[i]);
+      return _ERROR_;
+    }
+    if (in[i]) {
+      in[i] = 0;
+      (*number)--;
+    }
+  }
+  return _OK_;
+}
+
+//
+// Add every so many items, which are there already if their flags are set,
+// and set their flags.
+//
+int addItems (nsort_hash_t *hsh, char **cpp, char *in, int count, int *number,
+    int every, int from)
+{
+  int i;
+
+  for (i = from; i < count; i += every) {
+    if (nsort_hash_add_key (hsh, cpp[i], strlen (cpp[i]),
+          (void *)(size_t)(i + 1)) == _ERROR_) {
+      if (!in[i] || hsh->hashError != SORT_UNIQUE) {
+        printf ("\n\n***Error: nsort_hash_add_key (%s): %s\n", cpp[i],
+            sortErrorString[hsh->hashError]);
+        return _ERROR_;
+      }
+      hsh->hashError = SORT_NOERROR;
+      continue;
+    }
+    if (in[i]) {
+      printf ("\n\n***Error: added %s, which was there\n", cpp[i]);
+      return _ERROR_;
+    }
+    in[i] = 1;
+    (*number)++;
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  char *in;
+  char str[ERROR_LEN+1];
+  nsort_hash_t hsh;
+  nsort_hash_cursor_t cur;
+  const char *key;
+  void *value;
+  size_t len, capacity;
+  double t1, t2;
+  int count, number = 0, seen, i;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  nsort_elapsed (&t1);
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  in = malloc (MAX_DATA);
+  if (0 == cpp || 0 == in) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  memset (in, 0, MAX_DATA);
+  count = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < count && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  count = i;
+
+  // build the hash from the text, leaving out the dups
+  if (nsort_hash_init_size (&hsh, 0, 0, 0, 0.0) == _ERROR_)
+    return _ERROR_;
+  for (i = 0; i < count; i++) {
+    if (nsort_hash_add_key (&hsh, cpp[i], strlen (cpp[i]),
+          (void *)(size_t)(number + 1)) == _ERROR_) {
+      if (hsh.hashError != SORT_UNIQUE) {
+        printf ("\n\n***Error: nsort_hash_add_key (%s): %s\n", cpp[i],
+            sortErrorString[hsh.hashError]);
+        return _ERROR_;
+      }
+      hsh.hashError = SORT_NOERROR;
+      continue;
+    }
+    cpp[number] = cpp[i];
+    in[number++] = 1;
+  }
+  nsort_elapsed (&t2);
+  printf ("\n%d items, %d keys\n", count, number);
+  printf ("  built from the text    %f seconds\n", t2 - t1);
+  count = number;
+  if (count < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  if (checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+
+  // remove half of the keys and add them back, over and over
+  capacity = hsh.capacity;
+  nsort_elapsed (&t1);
+  for (i = 0; i < CHURN; i++) {
+    if (removeItems (&hsh, cpp, in, count, &number, 2, i % 2) == _ERROR_ ||
+        checkHash (&hsh, cpp, in, count, number) == _ERROR_ ||
+        addItems (&hsh, cpp, in, count, &number, 2, i % 2) == _ERROR_ ||
+        checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+      return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  %d removes and adds of half of them  %f seconds\n", CHURN,
+      t2 - t1);
+  if (hsh.capacity > capacity * 2) {
+    printf ("\n\n***Error: the table grew from %zu to %zu slots\n", capacity,
+        hsh.capacity);
+    return _ERROR_;
+  }
+
+  // the cursor, checking each key and then removing every third one
+  nsort_hash_cursor_init (&cur, &hsh);
+  for (seen = 0; (key = nsort_hash_cursor_next (&cur, &len, &value)) != 0;
+      seen++)
+    if (value == 0 || (size_t)value > (size_t)count ||
+        !in[(size_t)value - 1] || strlen (key) != len ||
+        strcmp (key, cpp[(size_t)value - 1]) != 0) {
+      printf ("\n\n***Error: the cursor gave %s\n", key);
+      return _ERROR_;
+    }
+  if (seen != number) {
+    printf ("\n\n***Error: the cursor gave %d keys, expected %d\n", seen,
+        number);
+    return _ERROR_;
+  }
+  nsort_hash_cursor_init (&cur, &hsh);
+  for (seen = 0; (key = nsort_hash_cursor_next (&cur, &len, &value)) != 0;
+      seen++)
+    if (seen % 3 == 0) {
+      if (nsort_hash_remove_key (&hsh, key, len, 0) == _ERROR_) {
+        printf ("\n\n***Error: removing %s with the cursor\n", key);
+        return _ERROR_;
+      }
+      in[(size_t)value - 1] = 0;
+      number--;
+    }
+  if (checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+
+  // save it and read it back
+  nsort_elapsed (&t1);
+  if (nsort_hash_save (&hsh, "floghsave", SAVE_FILE) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_save (): %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  saved                  %f seconds\n", t2 - t1);
+  nsort_hash_del (&hsh);
+  nsort_elapsed (&t1);
+  if (nsort_hash_get (&hsh, 0, 0, SAVE_FILE) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_get (): %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  read back              %f seconds\n", t2 - t1);
+  if (checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+
+  // keys that were read back can be removed, and others added to an arena
+  if (nsort_hash_use_arena (&hsh, 0) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_use_arena (): %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  if (removeItems (&hsh, cpp, in, count, &number, 2, 0) == _ERROR_ ||
+      addItems (&hsh, cpp, in, count, &number, 1, 0) == _ERROR_ ||
+      checkHash (&hsh, cpp, in, count, number) == _ERROR_ ||
+      removeItems (&hsh, cpp, in, count, &number, 3, 1) == _ERROR_ ||
+      checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+
+  // saved over the file it was read from, while that is still mapped
+  if (nsort_hash_save (&hsh, "floghsave", SAVE_FILE) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_save () over %s: %s\n", SAVE_FILE,
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  if (checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+  nsort_hash_del (&hsh);
+  if (nsort_hash_get (&hsh, 0, 0, SAVE_FILE) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_get () after saving over it: %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  if (checkHash (&hsh, cpp, in, count, number) == _ERROR_)
+    return _ERROR_;
+  nsort_hash_del (&hsh);
+
+  // files that don't go with the hash
+  if (nsort_hash_get (&hsh, 0, otherHash, SAVE_FILE) != _ERROR_ ||
+      hsh.hashError != SORT_PARAM) {
+    printf ("\n\n***Error: read back with another hash function\n");
+    return _ERROR_;
+  }
+  if (nsort_hash_get (&hsh, 0, 0, argv[1]) != _ERROR_ ||
+      hsh.hashError != SORT_LIST_BADFILE) {
+    printf ("\n\n***Error: read back %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (SAVE_FILE, &sbuf);
+  if (truncate (SAVE_FILE, sbuf.st_size - 1) != 0) {
+    printf ("\n\n***Error: couldn't cut %s short\n", SAVE_FILE);
+    return _ERROR_;
+  }
+  if (nsort_hash_get (&hsh, 0, 0, SAVE_FILE) != _ERROR_ ||
+      hsh.hashError != SORT_LIST_BADFILE) {
+    printf ("\n\n***Error: read back %s cut short\n", SAVE_FILE);
+    return _ERROR_;
+  }
+  if (nsort_hash_init (&hsh, 0, stringHash) == _ERROR_ ||
+      nsort_hash_add_item (&hsh, cpp[0]) == _ERROR_ ||
+      nsort_hash_save (&hsh, 0, SAVE_FILE) != _ERROR_ ||
+      hsh.hashError != SORT_PARAM ||
+      nsort_hash_use_arena (&hsh, 0) != _ERROR_ ||
+      hsh.hashError != SORT_LIST_NOTEMPTY ||
+      nsort_hash_remove_item (&hsh, cpp[0]) == _ERROR_ ||
+      nsort_hash_find_item (&hsh, cpp[0]) != 0 || hsh.number != 0 ||
+      nsort_hash_use_arena (&hsh, 0) == _ERROR_ ||
+      nsort_hash_add_item (&hsh, cpp[1]) == _ERROR_ ||
+      nsort_hash_remove_item (&hsh, cpp[1]) == _ERROR_ ||
+      hsh.arena->bytesUsed != 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: a string hash was taken wrong: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_hash_del (&hsh);
+
+  // no hash at all
+  if (nsort_hash_remove_item (0, cpp[0]) != _ERROR_ ||
+      get_sortError () != SORT_PARAM ||
+      nsort_hash_remove_key (0, cpp[0], strlen (cpp[0]), 0) != _ERROR_ ||
+      nsort_hash_save (0, 0, SAVE_FILE) != _ERROR_ ||
+      nsort_hash_get (0, 0, 0, SAVE_FILE) != _ERROR_ ||
+      get_sortError () != SORT_PARAM) {
+    printf ("\n\n***Error: a NULL hash was taken wrong\n");
+    return _ERROR_;
+  }
+  set_sortError (SORT_NOERROR);
+
+  unlink (SAVE_FILE);
+  free (in);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
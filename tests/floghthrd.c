@@ -0,0 +1,271 @@
+/* Source File: floghthrd.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{floghthrd.c}
+ *
+ * Program: floghthrd.c
+ * Script: floghthrd.sh
+ *
+ * This program is the threaded version of floghash.  It splits the items in
+ * a file among a number of threads, which add them (taking out duplicates) to
+ * one sharded hash with nsort_shash_add_key() and then search for them with
+ * nsort_shash_find_key().  It checks that the hash ends up with each item
+ * once and that the value of each item is the number of one of the lines it
+ * is on.  The same is done with one nsort_hash_t behind a mutex, which is the
+ * way to share a hash without shards, and with a sharded hash whose shards
+ * keep their keys in arenas.  It does this for 1, 2, 4... threads up to the
+ * number it is given and prints the operations per second of each.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define NUM_THREAD 16
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+
+typedef struct _thread_data {
+  nsort_shash_t *sh;             /* the sharded hash, or NULL */
+  nsort_hash_t *hsh;             /* the hash behind the mutex */
+  pthread_mutex_t *lock;         /* the mutex */
+  int threadnum;                 /* number of this thread */
+  int numThreads;                /* number of threads */
+  int number;                    /* number of items in cpp */
+  int added;                     /* number of items this thread added */
+  int status;                    /* status of this thread */
+  char **cpp;                    /* the items */
+} threadData;
+
+//
+// Add the items of this thread, which are every numThreads-th one.
+//
+void *addItems (void *arg)
+{
+  threadData *td = (threadData *)arg;
+  nsort_error_t error;
+  int i, status;
+
+  for (i = td->threadnum; i < td->number; i += td->numThreads) {
+    if (td->sh != 0)
+      error = nsort_shash_add_key (td->sh, td->cpp[i], strlen (td->cpp[i]),
+          (void *)(size_t)(i + 1), 0);
+    else {
+      pthread_mutex_lock (td->lock);
+      status = nsort_hash_add_key (td->hsh, td->cpp[i], strlen (td->cpp[i]),
+          (void *)(size_t)(i + 1));
+      error = (status == _OK_) ? SORT_NOERROR : td->hsh->hashError;
+      td->hsh->hashError = SORT_NOERROR;
+      pthread_mutex_unlock (td->lock);
+    }
+    if (error == SORT_NOERROR)
+      td->added++;
+    else if (error != SORT_UNIQUE) {
+      printf ("\n\n***Error: adding %s: %s\n", td->cpp[i],
+          sortErrorString[error]);
+      td->status = _ERROR_;
+      return 0;
+    }
+  }
+  return 0;
+}
+
+//
+// Search for the items of this thread and check their values.
+//
+void *findItems (void *arg)
+{
+  threadData *td = (threadData *)arg;
+  const char *found;
+  void *value = 0;
+  int i;
+
+  for (i = td->threadnum; i < td->number; i += td->numThreads) {
+    if (td->sh != 0)
+      found = nsort_shash_find_key (td->sh, td->cpp[i], strlen (td->cpp[i]),
+          &value);
+    else {
+      pthread_mutex_lock (td->lock);
+      found = nsort_hash_find_key (td->hsh, td->cpp[i], strlen (td->cpp[i]),
+          &value);
+      pthread_mutex_unlock (td->lock);
+    }
+    if (found == 0 || strcmp (found, td->cpp[i]) != 0 || value == 0 ||
+        strcmp (td->cpp[(size_t)value - 1], td->cpp[i]) != 0) {
+      printf ("\n\n***Error: didn't find %s\n", td->cpp[i]);
+      td->status = _ERROR_;
+      return 0;
+    }
+  }
+  return 0;
+}
+
+//
+// Run the threads and return the seconds they took, or -1 if one of them
+// failed.
+//
+double runThreads (threadData *td, int numThreads, void *(*func)(void *))
+{
+  pthread_t thread[NUM_THREAD];
+  double t1, t2;
+  int i;
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < numThreads; i++)
+    if (pthread_create (&thread[i], 0, func, &td[i]) != 0) {
+      printf ("\n\n***Error: couldn't start thread %d\n", i);
+      return -1.0;
+    }
+  for (i = 0; i < numThreads; i++)
+    pthread_join (thread[i], 0);
+  nsort_elapsed (&t2);
+  for (i = 0; i < numThreads; i++)
+    if (td[i].status == _ERROR_)
+      return -1.0;
+  return t2 - t1;
+}
+
+//
+// Add and find the items with numThreads threads, using the sharded hash if
+// sh is not NULL or the hash behind a mutex if it is.
+//
+int runTest (char **cpp, int number, int unique, int numThreads,
+    nsort_shash_t *sh, nsort_hash_t *hsh, const char *name)
+{
+  threadData td[NUM_THREAD];
+  pthread_mutex_t lock;
+  double addTime, findTime;
+  int i, added = 0;
+
+  pthread_mutex_init (&lock, 0);
+  memset (td, 0, sizeof (td));
+  for (i = 0; i < numThreads; i++) {
+    td[i].sh = sh;
+    td[i].hsh = hsh;
+    td[i].lock = &lock;
+    td[i].threadnum = i;
+    td[i].numThreads = numThreads;
+    td[i].number = number;
+    td[i].status = _OK_;
+    td[i].cpp = cpp;
+  }
+  addTime = runThreads (td, numThreads, addItems);
+  if (addTime < 0.0)
+    return _ERROR_;
+  for (i = 0; i < numThreads; i++)
+    added += td[i].added;
+  if (added != unique ||
+      (sh != 0 ? nsort_shash_number (sh) : (size_t)hsh->number) !=
+      (size_t)unique) {
+    printf ("\n\n***Error: %d items were added, expected %d\n", added,
+        unique);
+    return _ERROR_;
+  }
+  findTime = runThreads (td, numThreads, findItems);
+  if (findTime < 0.0)
+    return _ERROR_;
+  printf ("  %2d threads, %-7s  add %10.0f ops/second, find %10.0f ops/second\n",
+      numThreads, name, (double)number / addTime, (double)number / findTime);
+  pthread_mutex_destroy (&lock);
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  nsort_shash_t sh;
+  nsort_hash_t hsh;
+  int number, unique = 0, maxThreads = 4, numThreads, i;
+
+  if (argc != 2 && argc != 3) {
+    printf ("\n\nUsage: %s <file> [<threads>]\n", argv[0]);
+    printf ("\twhere <file> is the file to load and <threads> is the most\n");
+    printf ("\tthreads to use (up to %d)\n", NUM_THREAD);
+    return 1;
+  }
+  if (argc == 3) {
+    maxThreads = atoi (argv[2]);
+    if (maxThreads < 1 || maxThreads > NUM_THREAD) {
+      printf ("\n\n***Error: the number of threads is 1 to %d\n",
+          NUM_THREAD);
+      return 1;
+    }
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+
+  // the number of different items, from one thread
+  if (nsort_hash_init_size (&hsh, 0, 0, (size_t)number, 0.0) == _ERROR_) {
+    printf ("\n\n***Error: nsort_hash_init_size(): %s\n",
+        sortErrorString[hsh.hashError]);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++)
+    if (nsort_hash_add_key (&hsh, cpp[i], strlen (cpp[i]), 0) == _OK_)
+      unique++;
+  nsort_hash_del (&hsh);
+  printf ("\n%d items, %d different\n", number, unique);
+
+  for (numThreads = 1; numThreads <= maxThreads; numThreads *= 2) {
+    if (nsort_shash_init (&sh, 0, 0, 0, 0.0) == _ERROR_) {
+      printf ("\n\n***Error: nsort_shash_init(): %s\n",
+          sortErrorString[sh.hashError]);
+      return _ERROR_;
+    }
+    if (runTest (cpp, number, unique, numThreads, &sh, 0, "sharded") ==
+        _ERROR_)
+      return _ERROR_;
+    nsort_shash_del (&sh);
+    if (nsort_shash_init (&sh, 0, 0, 0, 0.0) == _ERROR_ ||
+        nsort_shash_use_arena (&sh, 0) == _ERROR_) {
+      printf ("\n\n***Error: nsort_shash_use_arena(): %s\n",
+          sortErrorString[sh.hashError]);
+      return _ERROR_;
+    }
+    if (runTest (cpp, number, unique, numThreads, &sh, 0, "arena") == _ERROR_)
+      return _ERROR_;
+    nsort_shash_del (&sh);
+    if (nsort_hash_init (&hsh, 0, 0) == _ERROR_) {
+      printf ("\n\n***Error: nsort_hash_init(): %s\n",
+          sortErrorString[hsh.hashError]);
+      return _ERROR_;
+    }
+    if (runTest (cpp, number, unique, numThreads, 0, &hsh, "mutex") ==
+        _ERROR_)
+      return _ERROR_;
+    nsort_hash_del (&hsh);
+  }
+
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,333 @@
+/* Source File: flogksrt.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogksrt.c}
+ *
+ * Program: flogksrt.c
+ * Script: flogksrt.sh
+ *
+ * This program measures how nsort_add_item() does when the items come in
+ * nearly the order they are sorted in, the way log time stamps or the output
+ * of find do.  It sorts the items in a file and then loads them into an nsort
+ * in sorted order, in reverse sorted order, k-sorted (every item is less than
+ * k places from where it goes, k being given on the command line), in sorted
+ * runs that start at random places and in random order.  For each one, the
+ * time, the number of adds per second, the average number of compares per add
+ * and the number of times the index was rebuilt are printed.  Since an add
+ * starts from where the last one went, an item near the last one should take
+ * a few compares no matter how big the sort is.  After each load the sort is
+ * checked to be in order and every item is searched for.
+ *
+ * Last, a unique sort is loaded with three times as many items drawn at
+ * random from the file, so most of the adds are turned down as duplicates
+ * part of the way down the index.  The sort is checked the same way, and
+ * for having just the items that were let in.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define RUN_LENGTH 100
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// Load the items in cpp into a new sort in the order given and print how
+// it went.
+//
+int loadSort (const char *what, char **cpp, int number)
+{
+  nsort_t *srt;
+  nsort_link_t *lnk, found;
+  char str[ERROR_LEN+1];
+  double t1, t2;
+  size_t compares = 0;
+  int i;
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t1);
+  for (i = 0; i < number; i++) {
+    lnk = nsort_new_link (srt, cpp[i], 0);
+    if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+    compares += srt->numCompares;
+  }
+  nsort_elapsed (&t2);
+  printf ("  %-9s %f seconds, %8.0f adds/sec, %6.2f compares/add, "
+      "%zu restructures\n", what, t2 - t1, number / (t2 - t1),
+      (double)compares / number, srt->numRestruct);
+
+  for (lnk = srt->lh->head->next; lnk->next != srt->lh->tail; lnk = lnk->next)
+    if (testCompare (lnk->data, lnk->next->data) > 0) {
+      printf ("\n\n***Error: %s sort is out of order at %s\n", what,
+          (char *)lnk->data);
+      return _ERROR_;
+    }
+  if (srt->lh->number != (size_t)number) {
+    printf ("\n\n***Error: %s sort has %zu items, expected %d\n", what,
+        srt->lh->number, number);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    found.data = cpp[i];
+    lnk = nsort_find_item (srt, &found);
+    if (lnk == 0 || testCompare (lnk->data, cpp[i]) != 0) {
+      printf ("\n\n***Error: item %d (%s) was not found\n", i, cpp[i]);
+      return _ERROR_;
+    }
+  }
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  return _OK_;
+}
+
+//
+// Load 3 * number items drawn at random from cpp into a new unique sort.
+// The duplicates must be turned down without throwing off the adds after
+// them.
+//
+int loadUnique (char **cpp, int number, unsigned int *seed)
+{
+  nsort_t *srt;
+  nsort_link_t *lnk, found;
+  char str[ERROR_LEN+1];
+  double t1, t2;
+  size_t added = 0, rejected = 0;
+  char *drawn;
+  int i, j;
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, TRUE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  drawn = calloc ((size_t)number, 1);
+  if (drawn == 0) {
+    printf ("\n\n***Error: critical memory error allocating drawn\n");
+    return _ERROR_;
+  }
+  nsort_elapsed (&t1);
+  for (i = 0; i < 3 * number; i++) {
+    j = (int)(rand_r (seed) % (unsigned int)number);
+    drawn[j] = 1;
+    lnk = nsort_new_link (srt, cpp[j], 0);
+    if (lnk == 0) {
+      printf ("\n\n***Error: critical memory error adding item %d\n", i);
+      return _ERROR_;
+    }
+    if (nsort_add_item (srt, lnk) == _OK_) {
+      added++;
+      continue;
+    }
+    if (srt->sortError != SORT_UNIQUE) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+    free (lnk);
+    rejected++;
+  }
+  nsort_elapsed (&t2);
+  printf ("  %-9s %f seconds, %8.0f adds/sec, %zu added, %zu duplicates\n",
+      "unique", t2 - t1, 3 * number / (t2 - t1), added, rejected);
+
+  for (lnk = srt->lh->head->next; lnk->next != srt->lh->tail; lnk = lnk->next)
+    if (testCompare (lnk->data, lnk->next->data) >= 0) {
+      printf ("\n\n***Error: unique sort is out of order at %s\n",
+          (char *)lnk->data);
+      return _ERROR_;
+    }
+  if (srt->lh->number != added) {
+    printf ("\n\n***Error: unique sort has %zu items, expected %zu\n",
+        srt->lh->number, added);
+    return _ERROR_;
+  }
+  // an item that was drawn is in the sort whether it was let in or turned
+  // down; one that wasn't drawn isn't
+  for (i = 0; i < number; i++) {
+    found.data = cpp[i];
+    lnk = nsort_find_item (srt, &found);
+    if (drawn[i] && (lnk == 0 || testCompare (lnk->data, cpp[i]) != 0)) {
+      printf ("\n\n***Error: item %d (%s) was not found\n", i, cpp[i]);
+      return _ERROR_;
+    }
+    if (!drawn[i] && lnk != 0 && lnk->data == cpp[i]) {
+      printf ("\n\n***Error: item %d (%s) was never added\n", i, cpp[i]);
+      return _ERROR_;
+    }
+  }
+  free (drawn);
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp, **order;
+  char *tmp;
+  unsigned int seed = 1;
+  int totalcount, number;
+  int k = 16;
+  int i, j, m, n;
+
+  if (argc != 2 && argc != 3) {
+    printf ("\n\nUsage: %s <file> [k]\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    printf ("\t  and k is how far an item can be from its place (default 16)\n");
+    return 1;
+  }
+  if (argc == 3) {
+    k = atoi (argv[2]);
+    if (k < 1) {
+      printf ("\n\n***Error: k should be at least 1\n");
+      return _ERROR_;
+    }
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  order = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == order) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  totalcount = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (number = 0; number < totalcount && cpp[number] != 0
+      && cpp[number][0] != '\0'; number++)
+    ;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  qsort (cpp, (size_t)number, sizeof (char *), qsortCompare);
+  printf ("\n%d items, k = %d\n", number, k);
+
+  if (loadSort ("sorted", cpp, number) == _ERROR_)
+    return _ERROR_;
+
+  for (i = 0; i < number; i++)
+    order[i] = cpp[number - 1 - i];
+  if (loadSort ("reverse", order, number) == _ERROR_)
+    return _ERROR_;
+
+  // shuffling each block of k items keeps every item less than k places
+  // from where it goes
+  memcpy (order, cpp, number * sizeof (char *));
+  for (i = 0; i < number; i += k) {
+    n = (i + k < number) ? k : number - i;
+    for (j = n - 1; j > 0; j--) {
+      m = (int)(rand_r (&seed) % (unsigned int)(j + 1));
+      tmp = order[i + j];
+      order[i + j] = order[i + m];
+      order[i + m] = tmp;
+    }
+  }
+  if (loadSort ("k-sorted", order, number) == _ERROR_)
+    return _ERROR_;
+
+  // runs of RUN_LENGTH items in order, with the runs shuffled
+  memcpy (order, cpp, number * sizeof (char *));
+  for (i = 0; i < number; i += RUN_LENGTH) {
+    j = (int)(rand_r (&seed) % (unsigned int)(number / RUN_LENGTH + 1))
+        * RUN_LENGTH;
+    if (j >= number)
+      continue;
+    for (n = 0; n < RUN_LENGTH && i + n < number && j + n < number; n++) {
+      tmp = order[i + n];
+      order[i + n] = order[j + n];
+      order[j + n] = tmp;
+    }
+  }
+  if (loadSort ("runs", order, number) == _ERROR_)
+    return _ERROR_;
+
+  memcpy (order, cpp, number * sizeof (char *));
+  for (i = number - 1; i > 0; i--) {
+    j = (int)(rand_r (&seed) % (unsigned int)(i + 1));
+    tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  if (loadSort ("random", order, number) == _ERROR_)
+    return _ERROR_;
+
+  if (loadUnique (cpp, number, &seed) == _ERROR_)
+    return _ERROR_;
+
+  free (order);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,230 @@
+/* Source File: floglat.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{floglat.c}
+ *
+ * Program: floglat.c
+ * Script: floglat.sh
+ *
+ * This program measures how long each nsort_add_item() and nsort_find_item()
+ * call takes, rather than how long all of them take together.  It loads a
+ * file into an nsort one item at a time, then searches for every item, timing
+ * each call.  The median, 99th percentile, 99.9th percentile and worst times
+ * are printed for each, along with the number of times the index was rebuilt.
+ * Since the index is rebuilt a step at a time, no single call should take much
+ * longer than the others.  For comparison, the time nsort_restructure_nodes()
+ * takes to rebuild the whole index at once is printed.  Then three out of four
+ * items are removed, with their times printed the same way, which leaves the
+ * index with far too many nodes, so nsort_restructure_step() is called until
+ * it reports that the index is done, as an application would when it is idle.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+#include <time.h>
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int doubleCompare (const void *p1, const void *p2)
+{
+  double d1 = *(const double *)p1, d2 = *(const double *)p2;
+  return (d1 < d2) ? -1 : (d1 > d2) ? 1 : 0;
+}
+
+//
+// Print the distribution of the times in lat (which gets sorted).
+//
+void report (const char *what, double *lat, int number, size_t restructs)
+{
+  qsort (lat, (size_t)number, sizeof (double), doubleCompare);
+  printf ("  %-7s p50 %7.2f us, p99 %7.2f us, p99.9 %8.2f us, max %9.2f us, "
+      "%zu restructures\n", what, lat[number / 2] * 1e6,
+      lat[(int)(number * 0.99)] * 1e6, lat[(int)(number * 0.999)] * 1e6,
+      lat[number - 1] * 1e6, restructs);
+}
+
+int main (int argc, char *argv[])
+{
+  nsort_t *srt;
+  nsort_link_t *lnk, **lnks, found;
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  char str[ERROR_LEN+1];
+  double *lat;
+  double t1, t2;
+  size_t before;
+  int totalcount, number;
+  int status, steps;
+  int i, n;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load and search\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  lat = malloc (MAX_DATA * sizeof (double));
+  lnks = malloc (MAX_DATA * sizeof (nsort_link_t *));
+  if (0 == cpp || 0 == lat || 0 == lnks) {
+    printf ("\n\n***Error: critical memory error allocating arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  totalcount = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (number = 0; number < totalcount && cpp[number] != 0
+      && cpp[number][0] != '\0'; number++)
+    ;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("\n%d items\n", number);
+
+  for (i = 0; i < number; i++) {
+    lnks[i] = malloc (sizeof (nsort_link_t));
+    if (lnks[i] == 0) {
+      printf ("\n\n***Error: critical memory error allocating a link\n");
+      return _ERROR_;
+    }
+    lnks[i]->data = cpp[i];
+    t1 = now ();
+    status = nsort_add_item (srt, lnks[i]);
+    t2 = now ();
+    if (status == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+    lat[i] = t2 - t1;
+  }
+  report ("add", lat, number, srt->numRestruct);
+
+  before = srt->numRestruct;
+  for (i = 0; i < number; i++) {
+    found.data = cpp[i];
+    t1 = now ();
+    lnk = nsort_find_item (srt, &found);
+    t2 = now ();
+    if (lnk == 0 || testCompare (lnk->data, cpp[i]) != 0) {
+      printf ("\n\n***Error: item %d (%s) was not found\n", i, cpp[i]);
+      return _ERROR_;
+    }
+    lat[i] = t2 - t1;
+  }
+  report ("find", lat, number, srt->numRestruct - before);
+
+  t1 = now ();
+  if (nsort_restructure_nodes (srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_restructure_nodes(): %s\n", str);
+    return _ERROR_;
+  }
+  t2 = now ();
+  printf ("  nsort_restructure_nodes() took %.2f us\n", (t2 - t1) * 1e6);
+
+  before = srt->numRestruct;
+  for (i = 0, n = 0; i < number; i++) {
+    if (i % 4 == 0)
+      continue;
+    t1 = now ();
+    lnk = nsort_remove_item (srt, lnks[i]);
+    t2 = now ();
+    if (lnk != lnks[i]) {
+      printf ("\n\n***Error: removing item %d (%s)\n", i, cpp[i]);
+      return _ERROR_;
+    }
+    free (lnk);
+    lat[n++] = t2 - t1;
+  }
+  report ("remove", lat, n, srt->numRestruct - before);
+
+  steps = 0;
+  t1 = now ();
+  while ((status = nsort_restructure_step (srt, 1000)) > 0)
+    steps++;
+  t2 = now ();
+  if (status == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_restructure_step(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  nsort_restructure_step() rebuilt the index in %d steps, "
+      "%.2f us, %zu nodes\n", steps + 1, (t2 - t1) * 1e6, srt->numNodes);
+  for (i = 0; i < number; i += 4) {
+    found.data = cpp[i];
+    lnk = nsort_find_item (srt, &found);
+    if (lnk == 0 || testCompare (lnk->data, cpp[i]) != 0) {
+      printf ("\n\n***Error: item %d (%s) was not found\n", i, cpp[i]);
+      return _ERROR_;
+    }
+  }
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  free (lnks);
+  free (lat);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,333 @@
+/* Source File: flogmap.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogmap.c}
+ *
+ * Program: flogmap.c
+ * Script: flogmap.sh
+ *
+ * This program tests nsort_save_map() and the functions that use the files it
+ * writes.  It makes a sort of fixed size records from the items in a file and
+ * saves it with nsort_save() and with nsort_save_map().  It opens the mapped
+ * file with nsort_map_open() and checks that every item is found and that
+ * the bounds of items and of keys made by cutting items short are right.  Then
+ * it gets both files back with nsort_get(), and the mapped one with
+ * nsort_get_arena() as well, and checks the sorts, adds to and takes from the
+ * one that is mapped and saves it over the file it is mapped from, and checks
+ * that a file that has been cut short is turned down.  It prints the time
+ * each of them takes.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define DATASIZE 40
+#define ERROR_LEN 256
+#define NUM_SEEKS 100000
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// The place in the sorted array of the first item not less than (or, if
+// upper is set, greater than) key.
+//
+int bound (char **sorted, int number, char *key, int upper)
+{
+  int lo = 0, hi = number, mid, status;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    status = testCompare (sorted[mid], key);
+    if (status < 0 || (upper && status == 0))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//
+// Check the sort has the items in sorted, in order, and that each of them
+// can be found.
+//
+int checkSort (nsort_t *srt, char **sorted, int number, const char *what)
+{
+  nsort_link_t *lnk, find;
+  int i = 0;
+
+  if (srt->lh->number != (size_t)number) {
+    printf ("\n\n***Error: %s: %zu items, expected %d\n", what,
+        srt->lh->number, number);
+    return _ERROR_;
+  }
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next, i++)
+    if (i >= number || testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: item %d is wrong\n", what, i);
+      return _ERROR_;
+    }
+  for (i = 0; i < number; i++) {
+    find.data = sorted[i];
+    lnk = nsort_find_item (srt, &find);
+    if (lnk == 0 || testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: didn't find %s\n", what, sorted[i]);
+      return _ERROR_;
+    }
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp, *records, *rec;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  char key[DATASIZE];
+  char desc[128], stamp[27];
+  nsort_t *srt;
+  nsort_map_t map;
+  nsort_link_t *lnk;
+  unsigned int seed = 1;
+  double t1, t2;
+  size_t len;
+  int number, i, j, k, upper;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+
+  // fixed size records, in order
+  records = malloc ((size_t)number * DATASIZE);
+  if (records == 0) {
+    printf ("\n\n***Error: critical memory error allocating records\n");
+    return _ERROR_;
+  }
+  memset (records, 0, (size_t)number * DATASIZE);
+  for (i = 0; i < number; i++) {
+    strncpy (records + (size_t)i * DATASIZE, cpp[i], DATASIZE - 1);
+    cpp[i] = records + (size_t)i * DATASIZE;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+  printf ("\n%d items\n", number);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_build_sorted (srt, (void **)sorted, (size_t)number, testCompare,
+        FALSE) == _ERROR_ ||
+      nsort_save (srt, "flogmap", DATASIZE, "flogmap.dat") == _ERROR_ ||
+      nsort_save_map (srt, "flogmap mapped", DATASIZE, "flogmap.map") ==
+      _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: saving the records: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_del (srt, 0);
+
+  // the mapped file searched where it lies
+  if (nsort_map_open (&map, testCompare, "flogmap.map") == _ERROR_) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_map_open(): %s\n", str);
+    return _ERROR_;
+  }
+  printf ("  %zu records, %d levels\n", map.number, map.numLevels);
+  if (map.number != (size_t)number) {
+    printf ("\n\n***Error: the map has %zu records\n", map.number);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    rec = nsort_map_find (&map, sorted[i]);
+    if (rec == 0 || testCompare (rec, sorted[i]) != 0 ||
+        rec != nsort_map_record (&map, (size_t)bound (sorted, number,
+            sorted[i], FALSE))) {
+      printf ("\n\n***Error: nsort_map_find() of %s is wrong\n", sorted[i]);
+      return _ERROR_;
+    }
+  }
+  for (i = 0; i < NUM_SEEKS; i++) {
+    j = (int)(rand_r (&seed) % (unsigned int)number);
+    strcpy (key, cpp[j]);
+    len = strlen (key);
+    if (i % 2 == 1 && len > 5)
+      key[5 + rand_r (&seed) % (len - 5)] = '\0';
+    for (upper = FALSE; upper <= TRUE; upper++) {
+      k = bound (sorted, number, key, upper);
+      if ((upper ? nsort_map_upper_bound (&map, key) :
+            nsort_map_lower_bound (&map, key)) != (size_t)k) {
+        printf ("\n\n***Error: %s bound of %s is wrong\n",
+            upper ? "upper" : "lower", key);
+        return _ERROR_;
+      }
+    }
+  }
+  if (nsort_map_record (&map, (size_t)number) != 0 ||
+      nsort_map_lower_bound (&map, sorted[number - 1]) != (size_t)number - 1 ||
+      nsort_map_upper_bound (&map, sorted[number - 1]) != (size_t)number) {
+    printf ("\n\n***Error: the end of the map is wrong\n");
+    return _ERROR_;
+  }
+  printf ("  %d seeks checked\n", NUM_SEEKS * 2);
+  nsort_map_close (&map);
+
+  // both files back into a sort
+  nsort_elapsed (&t1);
+  if (nsort_get (srt, testCompare, "flogmap.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get() of flogmap.dat: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  nsort_get() read   %f seconds\n", t2 - t1);
+  if (checkSort (srt, sorted, number, "nsort_get() read") == _ERROR_)
+    return _ERROR_;
+  srt->manageAllocs = TRUE;
+  nsort_del (srt, 0);
+  nsort_elapsed (&t1);
+  if (nsort_get_all (srt, testCompare, "flogmap.map", desc, stamp) ==
+      _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get_all() of flogmap.map: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  nsort_get() copied %f seconds\n", t2 - t1);
+  if (strcmp (desc, "flogmap mapped") != 0) {
+    printf ("\n\n***Error: the description is %s\n", desc);
+    return _ERROR_;
+  }
+  if (checkSort (srt, sorted, number, "nsort_get() copied") == _ERROR_)
+    return _ERROR_;
+  srt->manageAllocs = TRUE;
+  nsort_del (srt, 0);
+  nsort_elapsed (&t1);
+  if (nsort_get_arena (srt, testCompare, "flogmap.map") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get_arena() of flogmap.map: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  printf ("  nsort_get_arena() mapped %f seconds\n", t2 - t1);
+  if (checkSort (srt, sorted, number, "nsort_get_arena() mapped") == _ERROR_)
+    return _ERROR_;
+
+  // the mapped sort can be changed like any other
+  for (i = 0; i < 100; i++) {
+    lnk = nsort_remove_item (srt, srt->lh->head->next);
+    if (lnk == 0) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_remove_item(): %s\n", str);
+      return _ERROR_;
+    }
+    nsort_free_link (srt, lnk, 0);
+  }
+  for (i = 0; i < 100; i++) {
+    lnk = nsort_new_link (srt, sorted[i], DATASIZE);
+    if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_add_item(): %s\n", str);
+      return _ERROR_;
+    }
+  }
+  if (checkSort (srt, sorted, number, "changed") == _ERROR_)
+    return _ERROR_;
+
+  // saved over the file it is mapped from
+  if (nsort_save_map (srt, "flogmap mapped", DATASIZE, "flogmap.map") ==
+      _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_map() over flogmap.map: %s\n", str);
+    return _ERROR_;
+  }
+  if (checkSort (srt, sorted, number, "saved over") == _ERROR_)
+    return _ERROR_;
+  nsort_del (srt, 0);
+  if (nsort_get_arena (srt, testCompare, "flogmap.map") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get_arena() after saving over: %s\n", str);
+    return _ERROR_;
+  }
+  if (checkSort (srt, sorted, number, "read back") == _ERROR_)
+    return _ERROR_;
+  nsort_del (srt, 0);
+
+  // a file that is cut short
+  if (truncate ("flogmap.map", 8192) != 0) {
+    printf ("\n\n***Error: couldn't truncate flogmap.map\n");
+    return _ERROR_;
+  }
+  if (nsort_get (srt, testCompare, "flogmap.map") != _ERROR_ ||
+      srt->sortError != SORT_LIST_BADFILE ||
+      nsort_map_open (&map, testCompare, "flogmap.map") != _ERROR_) {
+    printf ("\n\n***Error: a file cut short wasn't turned down\n");
+    return _ERROR_;
+  }
+  set_sortError (SORT_NOERROR);
+  nsort_destroy (srt);
+  unlink ("flogmap.dat");
+  unlink ("flogmap.map");
+
+  free (records);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
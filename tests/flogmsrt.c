@@ -0,0 +1,240 @@
+/* Source File: flogmsrt.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogmsrt.c}
+ *
+ * Program: flogmsrt.c
+ * Script: flogmsrt.sh
+ *
+ * This program tests nsort_list_msort().  It loads the items in a file into a
+ * list, numbering the links in the order of the file, and sorts the list by
+ * the first two characters of the items only, checking that the items that
+ * tie are still in the order of the file.  Then it sorts the list by the whole
+ * item and checks it against a sorted copy of the items, and sorts it again
+ * once it is in order and once it is in reverse order, checking the number of
+ * compares the sorted list takes.  It prints the time of each sort.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+static long numCompares = 0;
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  numCompares++;
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int prefixCompare (void *p1, void *p2)
+{
+  numCompares++;
+  return strncmp ((char *) p1, (char *) p2, 2);
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// Check the links of the list run both ways and there are number of them.
+//
+int checkLinks (nsort_list_t *lh, int number)
+{
+  nsort_link_t *lnk;
+  int i = 0;
+
+  for (lnk = lh->head->next; lnk != lh->tail; lnk = lnk->next, i++)
+    if (lnk->prev->next != lnk || lnk->next->prev != lnk || i > number) {
+      printf ("\n\n***Error: the list is broken at link %d\n", i);
+      return _ERROR_;
+    }
+  if (i != number) {
+    printf ("\n\n***Error: the list has %d links, expected %d\n", i, number);
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+//
+// Check the list is in the order of the sorted array.
+//
+int checkSorted (nsort_list_t *lh, char **sorted, int number)
+{
+  nsort_link_t *lnk;
+  int i = 0;
+
+  if (checkLinks (lh, number) == _ERROR_)
+    return _ERROR_;
+  for (lnk = lh->head->next; lnk != lh->tail; lnk = lnk->next, i++)
+    if (testCompare (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: item %d is %s, expected %s\n", i,
+          (char *)lnk->data, sorted[i]);
+      return _ERROR_;
+    }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  nsort_list_t *lh;
+  nsort_link_t *lnk, *links;
+  double t1, t2;
+  long compares;
+  int number, i, status;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+
+  lh = nsort_list_create ();
+  if (lh == 0 || nsort_list_init (lh) == _ERROR_) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: creating the list: %s\n", str);
+    return _ERROR_;
+  }
+  links = malloc ((size_t)number * sizeof (nsort_link_t));
+  if (links == 0) {
+    printf ("\n\n***Error: critical memory error allocating links\n");
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    links[i].data = cpp[i];
+    links[i].number = i;
+    nsort_list_insert_link (lh, &links[i]);
+  }
+  printf ("\n%d items\n", number);
+
+  // by the first two characters, which leaves lots of ties
+  numCompares = 0;
+  nsort_elapsed (&t1);
+  status = nsort_list_msort (lh, prefixCompare);
+  nsort_elapsed (&t2);
+  compares = numCompares;
+  if (status == _ERROR_ || checkLinks (lh, number) == _ERROR_) {
+    nsort_show_list_error (lh, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_list_msort() by prefix: %s\n", str);
+    return _ERROR_;
+  }
+  for (lnk = lh->head->next; lnk->next != lh->tail; lnk = lnk->next) {
+    status = prefixCompare (lnk->data, lnk->next->data);
+    if (status > 0 || (status == 0 && lnk->number > lnk->next->number)) {
+      printf ("\n\n***Error: %s (%d) is before %s (%d)\n", (char *)lnk->data,
+          lnk->number, (char *)lnk->next->data, lnk->next->number);
+      return _ERROR_;
+    }
+  }
+  printf ("  by prefix  %f seconds, %ld compares\n", t2 - t1, compares);
+
+  // by the whole item
+  numCompares = 0;
+  nsort_elapsed (&t1);
+  status = nsort_list_msort (lh, testCompare);
+  nsort_elapsed (&t2);
+  compares = numCompares;
+  if (status == _ERROR_ || checkSorted (lh, sorted, number) == _ERROR_)
+    return _ERROR_;
+  printf ("  random     %f seconds, %ld compares\n", t2 - t1, compares);
+
+  // already in order, which should be a single pass
+  numCompares = 0;
+  nsort_elapsed (&t1);
+  status = nsort_list_msort (lh, testCompare);
+  nsort_elapsed (&t2);
+  compares = numCompares;
+  if (status == _ERROR_ || checkSorted (lh, sorted, number) == _ERROR_)
+    return _ERROR_;
+  printf ("  sorted     %f seconds, %ld compares\n", t2 - t1, compares);
+  if (compares != number - 1) {
+    printf ("\n\n***Error: a sorted list took %ld compares\n", compares);
+    return _ERROR_;
+  }
+
+  // in reverse order
+  for (lnk = lh->head; lnk != 0; lnk = lnk->prev) {
+    nsort_link_t *tmp = lnk->next;
+    lnk->next = lnk->prev;
+    lnk->prev = tmp;
+  }
+  lnk = lh->head->prev;
+  lh->head->next = lh->tail->next;
+  lh->tail->prev = lnk;
+  lh->head->prev = lh->tail->next = 0;
+  lh->head->next->prev = lh->head;
+  lh->tail->prev->next = lh->tail;
+  numCompares = 0;
+  nsort_elapsed (&t1);
+  status = nsort_list_msort (lh, testCompare);
+  nsort_elapsed (&t2);
+  compares = numCompares;
+  if (status == _ERROR_ || checkSorted (lh, sorted, number) == _ERROR_)
+    return _ERROR_;
+  printf ("  reverse    %f seconds, %ld compares\n", t2 - t1, compares);
+
+  lh->head->next = lh->tail;
+  lh->tail->prev = lh->head;
+  lh->number = 0;
+  nsort_list_del (lh);
+  nsort_list_destroy (lh);
+  free (links);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
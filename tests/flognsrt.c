@@ -9,7 +9,9 @@
  * The flognsrt program is identical to flogsrt in terms of functionality with the
  * exception that duplicates are handled by flognsrt.  The nsort routine allows you 
  * to determine at the point of initialization whether the initialized sort object
- * will permit duplicates.
+ * will permit duplicates.  Given "arena" as a fourth argument, the links and
+ * their data are carved out of an arena with nsort_new_link() instead of being
+ * allocated one at a time.
  *
  * [EndDoc]
  */
@@ -46,6 +48,33 @@
 #define MAXDATA		1000000
 #define ERROR_SIZE 512
 
+#define BATCHSIZE 50000
+
+/*
+ * Add ``num'' links with nsort_add_items() and free the ones that were
+ * rejected as duplicates.
+ */
+static int add_batch (nsort_t *srt, nsort_link_t **batch,
+    nsort_error_t *errs, int num)
+{
+  int i;
+
+  if (num == 0)
+    return _OK_;
+  if (nsort_add_items (srt, batch, (size_t) num, errs) == _ERROR_) {
+    if (srt->sortError != SORT_UNIQUE)
+      return _ERROR_;
+    srt->sortError = SORT_NOERROR;
+    for (i = 0; i < num; i++) {
+      if (errs[i] == SORT_UNIQUE) {
+        free (batch[i]->data);
+        free (batch[i]);
+      }
+    }
+  }
+  return _OK_;
+}
+
 int main (int argc, char *argv[])
 {
   FILE *fp;
@@ -66,6 +95,11 @@ int main (int argc, char *argv[])
   char data[ERROR_SIZE+1];
   char str[ERROR_SIZE+1];
   int totalcount;
+  int useBatch = FALSE;
+  int useArena = FALSE;
+  nsort_link_t **batch = 0;
+  nsort_error_t *errs = 0;
+  int numBatch;
 #ifdef NSORT_STATS
   double *traversal_times;
   double maxTraversals;
@@ -75,11 +109,17 @@ int main (int argc, char *argv[])
 #ifdef DEBUG_MALLOC
   dmalloc_debug_setup("log_stats,log-non-free,check-fence,lockon=20,log=dmalloc.%p");
 #endif
-  if (argc != 4) {
-    printf ("\nUsage: %s <file> <file.srt> <file.rev.srt>\n", argv[0]);
+  if (argc == 5 && !strcmp (argv[4], "arena"))
+    useArena = TRUE;
+  else if (argc == 5 && !strcmp (argv[4], "batch"))
+    useBatch = TRUE;
+  else if (argc != 4) {
+    printf ("\nUsage: %s <file> <file.srt> <file.rev.srt> [arena|batch]\n", argv[0]);
     printf ("\twhere <file> is the name of the file to read\n");
     printf ("\t  and <file.srt> is a sorted version of <file>\n");
-    printf ("\t  and <file.rev.srt> is in reverse sorted order.\n\n");
+    printf ("\t  and <file.rev.srt> is in reverse sorted order.\n");
+    printf ("\tIf \"arena\" is given, the items are allocated from an arena.\n");
+    printf ("\tIf \"batch\" is given, the items are added with nsort_add_items().\n\n");
     return 1;
   }
 
@@ -163,6 +203,13 @@ int main (int argc, char *argv[])
     nsort_destroy (srt);
     return _ERROR_;
   }
+  if (useArena && nsort_use_arena (srt, 0) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_SIZE);
+    printf ("\n\n***Error: nsort_use_arena(): %s\n", str);
+    nsort_del (srt, 0);
+    nsort_destroy (srt);
+    return _ERROR_;
+  }
 
   /* [EndDoc] */
   /*
@@ -188,11 +235,97 @@ int main (int argc, char *argv[])
 
   nsort_elapsed (&t1);
   counter = 0;
-  while (cpp[counter] != 0 && counter < totalcount) {
+  if (useBatch) {
+    /*
+     * Collect BATCHSIZE items at a time and hand them to nsort_add_items().
+     */
+    batch = (nsort_link_t **)malloc (BATCHSIZE*sizeof(nsort_link_t *));
+    errs = (nsort_error_t *)malloc (BATCHSIZE*sizeof(nsort_error_t));
+    if (batch == 0 || errs == 0) {
+      printf ("\n\n***Error: allocating the batch arrays\n");
+      return _ERROR_;
+    }
+    numBatch = 0;
+    while (cpp[counter] != 0 && counter < totalcount) {
+      compares[counter] = 0;
+      if (strlen (cpp[counter]) == 0) {
+        counter ++;
+        continue;
+      }
+      lnk = (nsort_link_t*)malloc (sizeof (nsort_link_t));
+      ln = (char*)malloc (DATASIZE);
+      if (lnk == 0 || ln == 0) {
+        printf ("\n\n***Error: allocating a link\n");
+        return _ERROR_;
+      }
+      strncpy (ln, cpp[counter], DATASIZE-1);
+      ln[DATASIZE-1] = '\0';
+      lnk->data = ln;
+      batch[numBatch++] = lnk;
+      if (numBatch == BATCHSIZE) {
+        if (add_batch (srt, batch, errs, numBatch) == _ERROR_)
+          break;
+        numBatch = 0;
+      }
+      counter++;
+    }
+    if (add_batch (srt, batch, errs, numBatch) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_SIZE);
+      printf ("\n\n***Error: nsort_add_items() at %d: %s\n", counter, str);
+      nsort_del (srt, 0);
+      free (srt);
+      return _ERROR_;
+    }
+    free (batch);
+    free (errs);
+  }
+  else while (cpp[counter] != 0 && counter < totalcount) {
     if (strlen (cpp[counter]) == 0) {
       counter ++;
       continue;
     }
+    if (useArena) {
+      /*
+       * The link and its DATASIZE bytes of data come from the arena in
+       * one piece.
+       */
+      lnk = nsort_new_link (srt, 0, DATASIZE);
+      if (lnk == 0) {
+        printf ("\n\n***Error: allocating a link from the arena\n");
+        free (cp);
+        free (cpp);
+        free (compares);
+#ifdef NSORT_STATS
+        free (traversal_times);
+#endif
+        nsort_del (srt, 0);
+        nsort_destroy (srt);
+        return _ERROR_;
+      }
+      ln = lnk->data;
+      strncpy (ln, cpp[counter], DATASIZE-1);
+      status = nsort_add_item (srt, lnk);
+      if (status == _ERROR_) {
+        free (cp);
+        free (cpp);
+        free (compares);
+#ifdef NSORT_STATS
+        free (traversal_times);
+#endif
+        nsort_show_sort_error (srt, str, ERROR_SIZE);
+        printf ("\n\n***Error: nsort_add_item() at %d: %s\n",
+            counter, str);
+        nsort_del (srt, 0);
+        nsort_destroy (srt);
+        return _ERROR_;
+      }
+      compares[counter] = srt->numCompares;
+#ifdef NSORT_STATS
+      traversal_times[counter] = srt->traversal_time;
+#endif
+      counter++;
+      continue;
+    }
     lnk = (nsort_link_t*)malloc (sizeof (nsort_link_t));
     if (lnk == 0) {
       printf ("\n\n***Error: allocating a link\n");
@@ -539,8 +672,11 @@ int main (int argc, char *argv[])
 
   printf ("\nDeleting and initializing the sort again\n");
 
+  nsort_elapsed (&t1);
   nsort_del (srt, NULL);
   free (srt);
+  nsort_elapsed (&t2);
+  printf ("Delete Time: %f\n", t2 - t1);
 
   nsort_elapsed (&t1);
   srt = nsort_create ();
@@ -66,6 +66,20 @@ while [ 1 == 1 ]; do
   echo "inputsrt producing the failure is left in \"inputsrt\""
   exit 1
  fi
+ echo "running #$cnt with an arena ..."
+ ./flognsrt inputsrt inputsrt.srt inputsrt.rev.srt arena
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
+ echo "running #$cnt with nsort_add_items() ..."
+ ./flognsrt inputsrt inputsrt.srt inputsrt.rev.srt batch
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
  if [ $cnt == $endhere ]; then
    echo "Finished flognsrt"
    echo ""
@@ -0,0 +1,323 @@
+/* Source File: flogrank.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogrank.c}
+ *
+ * Program: flogrank.c
+ * Script: flogrank.sh
+ *
+ * This program tests nsort_rank(), nsort_select() and nsort_count_range().
+ * It loads the items in a file into an nsort in the order they are in the
+ * file and checks the rank of every item and the item selected at every rank
+ * against a walk of the list, timing both.  Then a third of the items are
+ * removed and added back while the index is rebuilt a step at a time, the
+ * index is rebuilt all at once, and after each of these the ranks, selects
+ * and some counts of ranges are checked again.  The median and the 99th
+ * percentile of the items are printed.  Last, a unique sort is loaded with
+ * three times as many items drawn at random from the file, so most of the
+ * adds are turned down as duplicates, and its ranks, selects and counts of
+ * ranges are checked the same way.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define NUM_RANGES 1000
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+//
+// Check the rank of every item and the item at every rank against the list.
+// The links of the list, in order, are put in lnks.
+//
+int checkRanks (nsort_t *srt, const char *what, nsort_link_t **lnks)
+{
+  nsort_link_t *lnk;
+  char str[ERROR_LEN+1];
+  double t1, t2;
+  size_t i, num = 0, rank;
+
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next)
+    lnks[num++] = lnk;
+  if (num != srt->lh->number) {
+    printf ("\n\n***Error: %s: the list has %zu items, expected %zu\n", what,
+        num, srt->lh->number);
+    return _ERROR_;
+  }
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < num; i++) {
+    if (nsort_rank (srt, lnks[i], &rank) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: %s: nsort_rank(): %s\n", what, str);
+      return _ERROR_;
+    }
+    if (rank != i) {
+      printf ("\n\n***Error: %s: %s has a rank of %zu, expected %zu\n", what,
+          (char *)lnks[i]->data, rank, i);
+      return _ERROR_;
+    }
+  }
+  nsort_elapsed (&t2);
+  printf ("  %-10s %f seconds, %9.0f ranks/sec\n", what, t2 - t1,
+      num / (t2 - t1));
+
+  nsort_elapsed (&t1);
+  for (i = 0; i < num; i++) {
+    lnk = nsort_select (srt, i);
+    if (lnk != lnks[i]) {
+      printf ("\n\n***Error: %s: nsort_select() of %zu is wrong\n", what, i);
+      return _ERROR_;
+    }
+  }
+  nsort_elapsed (&t2);
+  printf ("  %-10s %f seconds, %9.0f selects/sec\n", what, t2 - t1,
+      num / (t2 - t1));
+  if (nsort_select (srt, num) != 0) {
+    printf ("\n\n***Error: %s: nsort_select() past the end didn't fail\n",
+        what);
+    return _ERROR_;
+  }
+  srt->sortError = SORT_NOERROR;
+  return _OK_;
+}
+
+//
+// Check the counts of some ranges against the ranks of their ends.
+//
+int checkRanges (nsort_t *srt, const char *what, nsort_link_t **lnks,
+    unsigned int *seed)
+{
+  nsort_link_t lo, hi;
+  size_t num = srt->lh->number, a, b, first, last, count;
+  int i;
+
+  for (i = 0; i < NUM_RANGES; i++) {
+    a = rand_r (seed) % num;
+    b = rand_r (seed) % num;
+    if (a > b) {
+      first = a;
+      a = b;
+      b = first;
+    }
+    lo.data = lnks[a]->data;
+    hi.data = lnks[b]->data;
+    // the range takes in every item equal to either end
+    for (first = a; first > 0 && testCompare (lnks[first - 1]->data,
+          lo.data) == 0; first--)
+      ;
+    for (last = b + 1; last < num && testCompare (lnks[last]->data,
+          hi.data) == 0; last++)
+      ;
+    if (nsort_count_range (srt, &lo, &hi, &count) == _ERROR_ ||
+        count != last - first) {
+      printf ("\n\n***Error: %s: %zu items from %s to %s, expected %zu\n",
+          what, count, (char *)lo.data, (char *)hi.data, last - first);
+      return _ERROR_;
+    }
+  }
+  if (nsort_count_range (srt, 0, 0, &count) == _ERROR_ || count != num) {
+    printf ("\n\n***Error: %s: the whole sort counts %zu items\n", what,
+        count);
+    return _ERROR_;
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp;
+  char **cpp;
+  char str[ERROR_LEN+1];
+  nsort_t *srt;
+  nsort_link_t *lnk, **lnks, **removed;
+  unsigned int seed = 1;
+  size_t numRemoved = 0;
+  int number, i;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  lnks = malloc (MAX_DATA * sizeof (nsort_link_t *));
+  removed = malloc (MAX_DATA * sizeof (nsort_link_t *));
+  if (0 == cpp || 0 == lnks || 0 == removed) {
+    printf ("\n\n***Error: critical memory error allocating arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, FALSE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  for (i = 0; i < number; i++) {
+    lnk = nsort_new_link (srt, cpp[i], 0);
+    if (lnk == 0 || nsort_add_item (srt, lnk) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+  }
+  printf ("\n%d items, %zu nodes, %zu restructures\n", number, srt->numNodes,
+      srt->numRestruct);
+  if (checkRanks (srt, "added", lnks) == _ERROR_ ||
+      checkRanges (srt, "added", lnks, &seed) == _ERROR_)
+    return _ERROR_;
+
+  // take out a third of the items and put them back while the index is
+  // being rebuilt a step at a time
+  for (i = 0; i < number; i += 3) {
+    if (i % 999 == 0 && nsort_restructure_step (srt, 500) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_restructure_step(): %s\n", str);
+      return _ERROR_;
+    }
+    if (nsort_remove_item (srt, lnks[i]) != lnks[i]) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: removing item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+    removed[numRemoved++] = lnks[i];
+  }
+  if (checkRanks (srt, "removed", lnks) == _ERROR_ ||
+      checkRanges (srt, "removed", lnks, &seed) == _ERROR_)
+    return _ERROR_;
+  for (i = (int)numRemoved - 1; i >= 0; i--) {
+    if (i % 999 == 0 && nsort_restructure_step (srt, 500) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_restructure_step(): %s\n", str);
+      return _ERROR_;
+    }
+    if (nsort_add_item (srt, removed[i]) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d back: %s\n", i, str);
+      return _ERROR_;
+    }
+  }
+  if (checkRanks (srt, "re-added", lnks) == _ERROR_ ||
+      checkRanges (srt, "re-added", lnks, &seed) == _ERROR_)
+    return _ERROR_;
+
+  if (nsort_restructure_nodes (srt) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_restructure_nodes(): %s\n", str);
+    return _ERROR_;
+  }
+  if (checkRanks (srt, "rebuilt", lnks) == _ERROR_ ||
+      checkRanges (srt, "rebuilt", lnks, &seed) == _ERROR_)
+    return _ERROR_;
+  printf ("  median %s, p99 %s\n",
+      (char *)nsort_select (srt, (srt->lh->number - 1) * 50 / 100)->data,
+      (char *)nsort_select (srt, (srt->lh->number - 1) * 99 / 100)->data);
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+
+  // a duplicate turned down part of the way down the index must not leave
+  // the counts or spans off
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_init (srt, testCompare, TRUE, FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_init(): %s\n", str);
+    return _ERROR_;
+  }
+  numRemoved = 0;
+  for (i = 0; i < 3 * number; i++) {
+    lnk = nsort_new_link (srt, cpp[rand_r (&seed) % (unsigned int)number], 0);
+    if (lnk == 0) {
+      printf ("\n\n***Error: critical memory error adding item %d\n", i);
+      return _ERROR_;
+    }
+    if (nsort_add_item (srt, lnk) == _OK_)
+      continue;
+    if (srt->sortError != SORT_UNIQUE) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: adding item %d: %s\n", i, str);
+      return _ERROR_;
+    }
+    free (lnk);
+    numRemoved++;
+  }
+  srt->sortError = SORT_NOERROR;
+  printf ("\n%zu unique items, %zu duplicates turned down\n",
+      srt->lh->number, numRemoved);
+  if (checkRanks (srt, "unique", lnks) == _ERROR_ ||
+      checkRanges (srt, "unique", lnks, &seed) == _ERROR_)
+    return _ERROR_;
+
+  lnk = nsort_list_remove_link (srt->lh);
+  while (lnk != 0) {
+    free (lnk);
+    lnk = nsort_list_remove_link (srt->lh);
+  }
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  free (removed);
+  free (lnks);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -102,6 +102,34 @@ int testCompare (void *p1, void *p2)
  *
  * [EndDoc]
  */
+/*
+ * A prefix for nsort_set_prefix() that agrees with testCompare(): the
+ * HASH_STR() value, followed (if there is room) by the first characters of
+ * the string, which is what breaks ties.
+ */
+unsigned long testPrefix (void *p)
+{
+  unsigned long pfx = (unsigned int)HASH_STR((char*)p);
+
+  if (sizeof (unsigned long) > 4)
+    pfx = (pfx << 32) |
+      (nsort_prefix_string (p) >> (8 * (sizeof (unsigned long) - 4)));
+  return pfx;
+}
+
+/*
+ * The bytes taken by the nodes of the index, for each item in the sort.
+ */
+double indexBytes (nsort_t *srt)
+{
+  nsort_node_t *node;
+  size_t bytes = 0;
+
+  for (node = srt->head->next; node != srt->tail; node = node->next)
+    bytes += NSORT_NODE_SIZE(node->height);
+  return srt->lh->number ? (double)bytes / (double)srt->lh->number : 0.0;
+}
+
  void printDump (void *data)
 {
   printf ("%s\n", (char *) data);
@@ -111,6 +139,33 @@ int testCompare (void *p1, void *p2)
 #define MAXDATA		1000000
 #define ERROR_SIZE 512
 
+#define BATCHSIZE 50000
+
+/*
+ * Add ``num'' links with nsort_add_items() and free the ones that were
+ * rejected as duplicates.
+ */
+static int add_batch (nsort_t *srt, nsort_link_t **batch,
+    nsort_error_t *errs, int num)
+{
+  int i;
+
+  if (num == 0)
+    return _OK_;
+  if (nsort_add_items (srt, batch, (size_t) num, errs) == _ERROR_) {
+    if (srt->sortError != SORT_UNIQUE)
+      return _ERROR_;
+    srt->sortError = SORT_NOERROR;
+    for (i = 0; i < num; i++) {
+      if (errs[i] == SORT_UNIQUE) {
+        free (batch[i]->data);
+        free (batch[i]);
+      }
+    }
+  }
+  return _OK_;
+}
+
 int main (int argc, char *argv[])
 {
   FILE *fp;
@@ -131,6 +186,14 @@ int main (int argc, char *argv[])
   char data[ERROR_SIZE+1];
   char str[ERROR_SIZE+1];
   int totalcount;
+  int useBatch = FALSE;
+  nsort_link_t **batch = 0;
+  nsort_error_t *errs = 0;
+  int numBatch;
+  int useArena = FALSE;
+  int usePrefix = FALSE;
+  int useTune = FALSE;
+  nsort_geometry_t geo;
 #ifdef NSORT_STATS
   double *traversal_times;
   double maxTraversals;
@@ -140,11 +203,23 @@ int main (int argc, char *argv[])
 #ifdef DEBUG_MALLOC
   dmalloc_debug_setup("log_stats,log-non-free,check-fence,lockon=20,log=dmalloc.%p");
 #endif
-  if (argc != 4) {
-    printf ("\nUsage: %s <file> <file.srt> <file.rev.srt>\n", argv[0]);
+  if (argc == 5 && !strcmp (argv[4], "arena"))
+    useArena = TRUE;
+  else if (argc == 5 && !strcmp (argv[4], "batch"))
+    useBatch = TRUE;
+  else if (argc == 5 && !strcmp (argv[4], "prefix"))
+    usePrefix = TRUE;
+  else if (argc == 5 && !strcmp (argv[4], "tune"))
+    useTune = TRUE;
+  else if (argc != 4) {
+    printf ("\nUsage: %s <file> <file.srt> <file.rev.srt> [arena|batch|prefix|tune]\n", argv[0]);
     printf ("\twhere <file> is the name of the file to read\n");
     printf ("\t  and <file.srt> is a sorted version of <file>\n");
-    printf ("\t  and <file.rev.srt> is in reverse sorted order.\n\n");
+    printf ("\t  and <file.rev.srt> is in reverse sorted order.\n");
+    printf ("\tIf \"arena\" is given, the items are allocated from an arena.\n");
+    printf ("\tIf \"batch\" is given, the items are added with nsort_add_items().\n");
+    printf ("\tIf \"prefix\" is given, the index keeps a prefix of each item.\n");
+    printf ("\tIf \"tune\" is given, the geometry of the index is auto-tuned.\n\n");
     return 1;
   }
 
@@ -238,14 +313,126 @@ int main (int argc, char *argv[])
     nsort_destroy (srt);
     return _ERROR_;
   }
+  if (useArena && nsort_use_arena (srt, 0) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_SIZE);
+    printf ("\n\n***Error: nsort_use_arena(): %s\n", str);
+    nsort_del (srt, 0);
+    nsort_destroy (srt);
+    return _ERROR_;
+  }
+  if (usePrefix)
+    nsort_set_prefix (srt, testPrefix);
+  if (useTune) {
+    nsort_geometry_defaults (&geo);
+    geo.autoTune = TRUE;
+    if (nsort_set_geometry (srt, &geo) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_SIZE);
+      printf ("\n\n***Error: nsort_set_geometry(): %s\n", str);
+      nsort_del (srt, 0);
+      nsort_destroy (srt);
+      return _ERROR_;
+    }
+  }
 
   nsort_elapsed (&t1);
   counter = 0;
-  while (cpp[counter] != 0 && counter < totalcount) {
+  if (useBatch) {
+    /*
+     * Collect BATCHSIZE items at a time and hand them to nsort_add_items().
+     */
+    batch = (nsort_link_t **)malloc (BATCHSIZE*sizeof(nsort_link_t *));
+    errs = (nsort_error_t *)malloc (BATCHSIZE*sizeof(nsort_error_t));
+    if (batch == 0 || errs == 0) {
+      printf ("\n\n***Error: allocating the batch arrays\n");
+      return _ERROR_;
+    }
+    numBatch = 0;
+    while (cpp[counter] != 0 && counter < totalcount) {
+      compares[counter] = 0;
+      if (strlen (cpp[counter]) == 0) {
+        counter ++;
+        continue;
+      }
+      lnk = (nsort_link_t*)malloc (sizeof (nsort_link_t));
+      ln = (char*)malloc (DATASIZE);
+      if (lnk == 0 || ln == 0) {
+        printf ("\n\n***Error: allocating a link\n");
+        return _ERROR_;
+      }
+      strncpy (ln, cpp[counter], DATASIZE-1);
+      ln[DATASIZE-1] = '\0';
+      lnk->data = ln;
+      batch[numBatch++] = lnk;
+      if (numBatch == BATCHSIZE) {
+        if (add_batch (srt, batch, errs, numBatch) == _ERROR_)
+          break;
+        numBatch = 0;
+      }
+      counter++;
+    }
+    if (add_batch (srt, batch, errs, numBatch) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_SIZE);
+      printf ("\n\n***Error: nsort_add_items() at %d: %s\n", counter, str);
+      nsort_del (srt, 0);
+      nsort_destroy (srt);
+      return _ERROR_;
+    }
+    free (batch);
+    free (errs);
+  }
+  else while (cpp[counter] != 0 && counter < totalcount) {
     if (strlen (cpp[counter]) == 0) {
       counter ++;
       continue;
     }
+    if (useArena) {
+      /*
+       * The link and its DATASIZE bytes of data come from the arena in
+       * one piece.
+       */
+      lnk = nsort_new_link (srt, 0, DATASIZE);
+      if (lnk == 0) {
+        printf ("\n\n***Error: allocating a link from the arena\n");
+        free (cp);
+        free (cpp);
+        free (compares);
+#ifdef NSORT_STATS
+        free (traversal_times);
+#endif
+        nsort_del (srt, 0);
+        nsort_destroy (srt);
+        return _ERROR_;
+      }
+      ln = lnk->data;
+      strncpy (ln, cpp[counter], DATASIZE-1);
+      status = nsort_add_item (srt, lnk);
+      if (status == _ERROR_) {
+        if (srt->sortError == SORT_UNIQUE) {
+          srt->sortError = SORT_NOERROR;
+          nsort_free_link (srt, lnk, DATASIZE);
+          counter++;
+          continue;
+        }
+        free (cp);
+        free (cpp);
+        free (compares);
+#ifdef NSORT_STATS
+        free (traversal_times);
+#endif
+        nsort_show_sort_error (srt, str, ERROR_SIZE);
+        printf ("\n\n***Error: nsort_add_item() at %d: %s\n",
+            counter, str);
+        nsort_del (srt, 0);
+        nsort_destroy (srt);
+        return _ERROR_;
+      }
+      compares[counter] = srt->numCompares;
+#ifdef NSORT_STATS
+      traversal_times[counter] = srt->traversal_time;
+#endif
+      counter++;
+      continue;
+    }
     lnk = (nsort_link_t*)malloc (sizeof (nsort_link_t));
     if (lnk == 0) {
       printf ("\n\n***Error: allocating a link\n");
@@ -336,6 +523,10 @@ int main (int argc, char *argv[])
   printf ("\nSucceeded...%zu lines stored\n", srt->lh->number);
   printf ("  Total add time: %f\n", t2 - t1);
   printf ("  Number of nodes = %zu\n", srt->numNodes);
+  printf ("  Index bytes per item = %.2f\n", indexBytes (srt));
+  printf ("  Geometry: %d levels, fanout %d, outThresh %zu, critThresh %zu\n",
+      srt->geometry.levels, srt->geometry.fanout, srt->geometry.outThresh,
+      srt->geometry.critThresh);
   printf ("  Node levels: ");
   for (i = 0; i < NSORT_NODE_LEVEL; i++)
     printf ("%d %d, ", i, lvl.lvl[i]);
@@ -627,8 +818,11 @@ int main (int argc, char *argv[])
 
   printf ("\nDeleting and initializing the sort again\n");
 
+  nsort_elapsed (&t1);
   nsort_del (srt, NULL);
   nsort_destroy (srt);
+  nsort_elapsed (&t2);
+  printf ("Delete Time: %f\n", t2 - t1);
 
   nsort_elapsed (&t1);
   srt = nsort_create ();
@@ -648,6 +842,8 @@ int main (int argc, char *argv[])
 #endif
     return _ERROR_;
   }
+  if (usePrefix)
+    nsort_set_prefix (srt, testPrefix);
 
   /* [EndDoc] */
   nsort_elapsed (&t2);
@@ -29,6 +29,34 @@ while [ 1 == 1 ]; do
   echo "inputsrt producing the failure is left in \"inputsrt\""
   exit 1
  fi
+ echo "running #$cnt with nsort_add_items() ..."
+ ./flogsrt inputsrt inputsrt.srt inputsrt.rev.srt batch
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
+ echo "running #$cnt with an arena ..."
+ ./flogsrt inputsrt inputsrt.srt inputsrt.rev.srt arena
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
+ echo "running #$cnt with a prefix ..."
+ ./flogsrt inputsrt inputsrt.srt inputsrt.rev.srt prefix
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
+ echo "running #$cnt with auto-tuning ..."
+ ./flogsrt inputsrt inputsrt.srt inputsrt.rev.srt tune
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "inputsrt producing the failure is left in \"inputsrt\""
+  exit 1
+ fi
  if [ $cnt == $endhere ]; then
    echo "Finished flogsrt"
    echo ""
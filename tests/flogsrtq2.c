@@ -8,7 +8,9 @@
  * Program: flogsrtq2.c
  * Script: flogsrtq2.sh
  *
- * This program is designed to test the nsort_list_qsort() function.
+ * This program is designed to test the nsort_list_qsort() function.  If a
+ * number of threads is given after the file names, it tests
+ * nsort_list_qsort_parallel() with that many threads instead.
  * [EndDoc]
  */
 #include <stdio.h>
@@ -51,15 +53,20 @@ int main (int argc, char *argv[])
   int isOK = TRUE;
   char str[ERROR_SIZE+1];
   int status = 0;
+  int nthreads = 0;
 
   if (status) {}
 
-  if (argc != 5) {
-    printf ("\nUsage: %s num <file> <file.srt> <file.rev.srt>", argv[0]);
+  if (argc != 5 && argc != 6) {
+    printf ("\nUsage: %s num <file> <file.srt> <file.rev.srt> [threads]",
+        argv[0]);
     printf ("\twhere num is the number of items to work with\n");
     printf ("\t  and <file> is the name of the file to read\n");
+    printf ("\t  and threads is the number of threads to sort with\n");
     return 1;
   }
+  if (argc == 6)
+    nthreads = atoi (argv[5]);
 
   Assert (argv[1] != 0 && argv[1][0] != '\0');
   if (argv[1] == 0 || argv[1][0] == '\0') {
@@ -147,7 +154,11 @@ int main (int argc, char *argv[])
     printf ("\n\n***Error: nsort_create(): %s\n", str);
     return _ERROR_;
   }
-  status = nsort_list_qsort (srt, lh, DATASIZE, testCompare);
+  if (nthreads > 0)
+    status = nsort_list_qsort_parallel (srt, lh, DATASIZE, testCompare,
+        nthreads);
+  else
+    status = nsort_list_qsort (srt, lh, DATASIZE, testCompare);
   nsort_elapsed (&t2);
   if (srt->sortError != SORT_NOERROR) {
     nsort_show_sort_error (srt, str, ERROR_SIZE);
@@ -155,7 +166,10 @@ int main (int argc, char *argv[])
 	    str);
     return _ERROR_;
   }
-  printf ("\n\nTime to sort %zu items: %f sec.\n", srt->lh->number, t2 - t1);
+  printf ("\n\nTime to sort %zu items: %f sec.", srt->lh->number, t2 - t1);
+  if (nthreads > 0)
+    printf (" (%d threads)", nthreads);
+  printf ("\n");
 
   /* do ordered and reverse ordered compares */
   fp = fopen (argv[3], "r");
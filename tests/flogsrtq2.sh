@@ -24,6 +24,13 @@ while [ 1 == 1 ]; do
   echo "input producing the failure is left in \"inputshl\""
   exit 1
  fi
+ echo "running #$cnt with 4 threads ..."
+ ./flogsrtq2 $keys inputsrt inputsrt.srt inputsrt.rev.srt 4
+ if [ $? != 0 ]; then
+  echo " failed!"
+  echo "input producing the failure is left in \"inputshl\""
+  exit 1
+ fi
  if [ $cnt == $endhere ]; then
    echo "Finished flosrtq2"
    echo ""
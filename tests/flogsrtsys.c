@@ -10,7 +10,13 @@
  *
  * This program was written to show the performance of the system qsort function
  * so that it can be used in comparison with the nsort and the non-recursive
- * qsort.
+ * qsort.  It sorts the items with the system qsort() and with bqsort() as
+ * pointers and as records of 16, 40 and 100 bytes, each in the order they are
+ * in the file, sorted, reverse sorted and in organ pipe order (up and then
+ * down), prints the times side by side and checks that both sorts agree.
+ * The same sorts are done with bqsort_parallel(), on as many threads as are
+ * given after the number of items (one for each processor if none are),
+ * which has to put the records in exactly the order bqsort() does.
  * 
  * [EndDoc]
  */
@@ -35,29 +41,82 @@
 }
 
 
-#define	DATASIZE	40
+#define MAXSIZE		100
 #define MAXDATA		1000000
 #define ERROR_LEN 256
+#define NUM_SIZES	4
+#define NUM_ORDERS	4
+
+int sizes[NUM_SIZES] = { sizeof (char *), 16, 40, MAXSIZE };
+const char *orders[NUM_ORDERS] = { "file", "sorted", "reverse", "pipe" };
+
+int recCompare (const void *p1, const void *p2)
+{
+  return testCompare ((void *)p1, (void *)p2);
+}
+
+int bqPtrCompare (void *p1, void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+int ptrCompare (const void *p1, const void *p2)
+{
+  return bqPtrCompare ((void *)p1, (void *)p2);
+}
+
+//
+// Put str in a record of size bytes, or a pointer to it if the record is
+// the size of a pointer.
+//
+void fillRecord (char *rec, int size, char *str)
+{
+  if (size == sizeof (char *)) {
+    memcpy (rec, &str, sizeof (char *));
+    return;
+  }
+  memset (rec, 0, size);
+  strncpy (rec, str, size - 1);
+}
+
+//
+// Turn the num records of size bytes at rec around.
+//
+void reverseRecords (char *rec, int num, int size)
+{
+  char tmp[MAXSIZE];
+  char *lo = rec, *hi = rec + (size_t)(num - 1) * size;
+
+  for (; lo < hi; lo += size, hi -= size) {
+    memcpy (tmp, lo, size);
+    memcpy (lo, hi, size);
+    memcpy (hi, tmp, size);
+  }
+}
 
 int main (int argc, char *argv[])
 {
   FILE *fp;
   char **cpp;
   char *data;
-  char *cp, *sysqsarray;
-  int i, number;
+  char *cp, *sysqsarray, *bqarray, *pqarray;
+  int i, number, s, size, order;
+  int nthreads = 0;
   struct stat statbuf;
-  double t1, t2;
+  double t1, t2, t3, t4, t5, t6;
   int totalcount = 0;
 
   if (totalcount){}
 
-  if (argc != 3)  {
-    printf ("\nUsage: %s <file> <num>\n", argv[0]);
+  if (argc != 3 && argc != 4)  {
+    printf ("\nUsage: %s <file> <num> [threads]\n", argv[0]);
     printf ("\twhere <file> is the name of the file to read\n");
-    printf ("\tand <num> is the number of items to sort\n\n");
+    printf ("\tand <num> is the number of items to sort\n");
+    printf ("\tand threads is the number of threads for bqsort_parallel\n\n");
     return 1;
   }
+  if (argc == 4)
+    nthreads = atoi (argv[3]);
 
   number = atoi (argv[2]);
   if (number < 0 || number > MAXDATA) {
@@ -89,30 +148,77 @@ int main (int argc, char *argv[])
   memset (cpp, 0, MAXDATA*sizeof(char*));
   check_pointer (cpp);
   totalcount = nsort_text_file_split (cpp, MAXDATA, data, '\n');
+  for (i = 0; i < number && i < totalcount && cpp[i] != 0 && cpp[i][0] != '\0';
+      i++)
+    ;
+  number = i;
   /*
-   * Now, use qsort to do the sorting.
+   * Now, sort the data with qsort and bqsort for each record size and
+   * order.
    */
-  sysqsarray = (char*)malloc (number * DATASIZE);
-  if (0 == sysqsarray) {
+  sysqsarray = (char*)malloc ((size_t)number * MAXSIZE);
+  bqarray = (char*)malloc ((size_t)number * MAXSIZE);
+  pqarray = (char*)malloc ((size_t)number * MAXSIZE);
+  if (0 == sysqsarray || 0 == bqarray || 0 == pqarray) {
     free (data);
     printf ("\n\n***Error: memory exhausted allocating qsort array\n");
     return _ERROR_;
   }
-  memset (sysqsarray, 0, number*DATASIZE);
   check_pointer (sysqsarray);
-
-  nsort_elapsed (&t1);
-  for (i = 0; i < number; i++) {
-    cp = sysqsarray+i*DATASIZE;
-    strncpy (cp, cpp[i], DATASIZE);
-    cp[DATASIZE-1] = '\0';
+  check_pointer (bqarray);
+  check_pointer (pqarray);
+
+  printf ("%d items\n", number);
+  printf ("  %-6s %-8s %12s %12s %12s\n", "size", "order", "qsort", "bqsort",
+      "parallel");
+  for (s = 0; s < NUM_SIZES; s++) {
+    size = sizes[s];
+    for (order = 0; order < NUM_ORDERS; order++) {
+      for (i = 0; i < number; i++)
+        fillRecord (sysqsarray + (size_t)i * size, size, cpp[i]);
+      if (order > 0) {
+        qsort ((void*)sysqsarray, number, size, size == sizeof (char *) ?
+            ptrCompare : recCompare);
+        if (order == 2 || order == 3)
+          reverseRecords (sysqsarray + (order == 3 ? (size_t)(number / 2) *
+                size : 0), order == 3 ? number - number / 2 : number, size);
+      }
+      memcpy (bqarray, sysqsarray, (size_t)number * size);
+      memcpy (pqarray, sysqsarray, (size_t)number * size);
+
+      nsort_elapsed (&t1);
+      qsort ((void*)sysqsarray, number, size, size == sizeof (char *) ?
+          ptrCompare : recCompare);
+      nsort_elapsed (&t2);
+      nsort_elapsed (&t3);
+      bqsort ((void*)bqarray, number, size, size == sizeof (char *) ?
+          bqPtrCompare : testCompare);
+      nsort_elapsed (&t4);
+      nsort_elapsed (&t5);
+      bqsort_parallel ((void*)pqarray, number, size, size == sizeof (char *) ?
+          bqPtrCompare : testCompare, nthreads);
+      nsort_elapsed (&t6);
+      printf ("  %-6d %-8s %12.6f %12.6f %12.6f\n", size, orders[order],
+          t2-t1, t4-t3, t6-t5);
+
+      if (memcmp (bqarray, pqarray, (size_t)number * size) != 0) {
+        printf ("\n\n***Error: bqsort_parallel and bqsort differ\n");
+        return _ERROR_;
+      }
+
+      for (i = 0; i < number; i++) {
+        cp = sysqsarray + (size_t)i * size;
+        if ((size == sizeof (char *) ? bqPtrCompare : testCompare)
+            (cp, bqarray + (size_t)i * size) != 0) {
+          printf ("\n\n***Error: bqsort and qsort differ at item %d\n", i);
+          return _ERROR_;
+        }
+      }
+    }
   }
-  qsort ((void*)sysqsarray, number, DATASIZE,
-      (int(*)(const void*, const void*))testCompare);
-  nsort_elapsed (&t2);
-
-  printf ("Added with system qsort in %8.6f seconds\n", t2-t1);
 
+  free (pqarray);
+  free (bqarray);
   free (sysqsarray);
   free (data);
   print_block_list();
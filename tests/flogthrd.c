@@ -16,6 +16,12 @@
  * application, you should study this program as an example of how
  * to do so.
  *
+ * The sorted lists the threads end up with are merged in one pass with
+ * nsort_list_merge_many_parallel().  For comparison, copies of them are also
+ * merged two at a time with nsort_list_merge_sorted(), the way this program
+ * used to do it; the two results are checked against each other and the
+ * times of both merges are printed.
+ *
  * [EndDoc]
  */
 #include "sorthdr.h"
@@ -82,6 +88,64 @@ void *populateSort (void *tt)
   return (void*)0;
 }
 
+//
+// Make a list with new links that point to the data of the links of lh,
+// in the same order.  The links are allocated in one block, returned in lnks.
+//
+nsort_list_t *copyList (nsort_list_t *lh, nsort_link_t **lnks)
+{
+  nsort_list_t *cpy;
+  nsort_link_t *lnk;
+  size_t i = 0;
+
+  cpy = nsort_list_create ();
+  if (cpy == 0 || nsort_list_init (cpy) == _ERROR_)
+    return 0;
+  *lnks = malloc ((lh->number + 1) * sizeof (nsort_link_t));
+  if (*lnks == 0)
+    return 0;
+  for (lnk = lh->head->next; lnk != lh->tail; lnk = lnk->next, i++) {
+    (*lnks)[i].data = lnk->data;
+    nsort_list_insert_link (cpy, &(*lnks)[i]);
+  }
+  return cpy;
+}
+
+//
+// Merge the lists two at a time, each one into the result of merging the
+// ones before it.
+//
+nsort_list_t *pairwiseMerge (nsort_list_t **lhs)
+{
+  nsort_list_t *final_lh, *tmp_lh;
+  char str[ERROR_LEN+1];
+  int status;
+  int i;
+
+  final_lh = lhs[0];
+  for (i = 1; i < NUM_THREAD; i++) {
+    tmp_lh = final_lh;
+    final_lh = nsort_list_create();
+    if (final_lh == 0) {
+      nsort_show_error(str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_list_create(): %s\n", str);
+      return 0;
+    }
+    status = nsort_list_merge_sorted (final_lh, tmp_lh, lhs[i],
+        testCompare);
+    if (status == _ERROR_) {
+      nsort_show_list_error(final_lh, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_list_merge_sorted(): %s\n", str);
+      return 0;
+    }
+    nsort_list_del (tmp_lh);
+    nsort_list_destroy (tmp_lh);
+    nsort_list_del (lhs[i]);
+    nsort_list_destroy (lhs[i]);
+  }
+  return final_lh;
+}
+
 //
 // OK, so we will open the file, read in all the items, split them up among
 // the threadData items and then create the threads and pass on a threadData
@@ -98,16 +162,19 @@ int main (int argc, char *argv[])
   pthread_attr_t attr;
   char *cp;
   char **cpp;
-  double t0, t1, t2;
+  double t0, t1, t2, t3, t4, t5, t6, t7, t8;
   int status;
   int i, j;
   int printUsage = FALSE;
   FILE *fp;
   struct stat sbuf;
   int totalcount, itemcount, thnum;
-  int count[NUM_THREAD];
+  void *count[NUM_THREAD];
   nsort_list_t *lhs[NUM_THREAD];
-  nsort_list_t *final_lh, *tmp_lh;
+  nsort_list_t *copies[NUM_THREAD];
+  nsort_link_t *copyLinks[NUM_THREAD];
+  nsort_list_t *final_lh, *pair_lh;
+  nsort_link_t *plnk;
   nsort_t *final;
   nsort_link_t *lnk;
   char str[ERROR_LEN+1];
@@ -268,7 +335,7 @@ int main (int argc, char *argv[])
   // OK, connect to the threads and wait for them to finish.
   //
   for (i = 0; i < NUM_THREAD; i++) {
-    status = pthread_join (th[i], (void**)&count[i]);
+    status = pthread_join (th[i], &count[i]);
     if (status) {
       printf ("\n\n***Error: joining thread %d\n", i);
       return _ERROR_;
@@ -284,63 +351,37 @@ int main (int argc, char *argv[])
     nsort_destroy (tt[i]->srt);
   }
 
-  if (NUM_THREAD > 2) {
-    final_lh = nsort_list_create();
-    if (final_lh == 0) {
-      nsort_show_error(str, ERROR_LEN);
-      printf ("\n\n***Error: creating final list: %s\n", str);
-      return _ERROR_;
-    }
-    status = nsort_list_merge_sorted (final_lh, lhs[0], lhs[1],
-        testCompare);
-    if (status == _ERROR_) {
-      nsort_show_list_error(final_lh, str, ERROR_LEN);
-      printf ("\n\n***Error: nsort_list_merge_sorted(): %s\n", str);
+  //
+  // Copies of the lists are put aside to merge two at a time later.
+  //
+  nsort_elapsed (&t3);
+  for (i = 0; i < NUM_THREAD; i++) {
+    copies[i] = copyList (lhs[i], &copyLinks[i]);
+    if (copies[i] == 0) {
+      printf ("\n\n***Error: couldn't copy list %d\n", i);
       return _ERROR_;
     }
-    nsort_list_del (lhs[0]);
-    nsort_list_destroy (lhs[0]);
-    nsort_list_del (lhs[1]);
-    nsort_list_destroy (lhs[1]);
-    for (i = 2; i < NUM_THREAD; i++) {
-      tmp_lh = final_lh;
-      final_lh = nsort_list_create();
-      if (final_lh == 0) {
-        nsort_show_error(str, ERROR_LEN);
-        printf ("\n\n***Error: nsort_list_create(): %s\n", str);
-        return _ERROR_;
-      }
-      status = nsort_list_merge_sorted (final_lh, tmp_lh, lhs[i],
-          testCompare);
-      if (status == _ERROR_) {
-        nsort_show_list_error(final_lh, str, ERROR_LEN);
-        printf ("\n\n***Error: nsort_list_merge_sorted(): %s\n", str);
-        return _ERROR_;
-      }
-      nsort_list_del (tmp_lh);
-      nsort_list_destroy (tmp_lh);
-      nsort_list_del (lhs[i]);
-      nsort_list_destroy (lhs[i]);
-    }
   }
-  else {
-    final_lh = nsort_list_create ();
-    if (final_lh == 0) {
-      nsort_show_error (str, ERROR_LEN);
-      printf ("\n\n***Error: nsort_list_create(): %s\n", str);
-      return _ERROR_;
-    }
-    status = nsort_list_merge_sorted (final_lh, lhs[0], lhs[1],
-        testCompare);
-    if (status == _ERROR_) {
-      nsort_show_list_error (final_lh, str, ERROR_LEN);
-      printf ("\n\n***Error: nsort_list_merge_sorted(): %s\n", str);
-      return _ERROR_;
-    }
-    nsort_list_del (lhs[0]);
-    nsort_list_destroy (lhs[0]);
-    nsort_list_del (lhs[1]);
-    nsort_list_destroy (lhs[1]);
+  nsort_elapsed (&t4);
+
+  final_lh = nsort_list_create ();
+  if (final_lh == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_list_create(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t5);
+  status = nsort_list_merge_many_parallel (final_lh, lhs, NUM_THREAD,
+      testCompare, 0);
+  nsort_elapsed (&t6);
+  if (status == _ERROR_) {
+    nsort_show_list_error (final_lh, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_list_merge_many_parallel(): %s\n", str);
+    return _ERROR_;
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    nsort_list_del (lhs[i]);
+    nsort_list_destroy (lhs[i]);
   }
   final = nsort_create();
   if (final == 0) {
@@ -355,6 +396,32 @@ int main (int argc, char *argv[])
     return _ERROR_;
   }
   nsort_elapsed (&t2);
+
+  nsort_elapsed (&t7);
+  pair_lh = pairwiseMerge (copies);
+  nsort_elapsed (&t8);
+  if (pair_lh == 0)
+    return _ERROR_;
+  if (pair_lh->number != final->lh->number) {
+    printf ("\n\n***Error: the merges have %zu and %zu items\n",
+        final->lh->number, pair_lh->number);
+    return _ERROR_;
+  }
+  for (lnk = final->lh->head->next, plnk = pair_lh->head->next;
+      lnk != final->lh->tail; lnk = lnk->next, plnk = plnk->next)
+    if (lnk->data != plnk->data) {
+      printf ("\n\n***Error: the merges differ at %s and %s\n",
+          (char *)lnk->data, (char *)plnk->data);
+      return _ERROR_;
+    }
+  pair_lh->head->next = pair_lh->tail;
+  pair_lh->tail->prev = pair_lh->head;
+  pair_lh->number = 0;
+  nsort_list_del (pair_lh);
+  nsort_list_destroy (pair_lh);
+  for (i = 0; i < NUM_THREAD; i++)
+    free (copyLinks[i]);
+
   for (i = 0; i < NUM_THREAD; i++) {
     if (tt[i]->status == _ERROR_) {
       nsort_show_error(str, ERROR_LEN);
@@ -364,8 +431,13 @@ int main (int argc, char *argv[])
     }
   }
   printf ("\nThere were no errors\n");
-  printf ("\n\nAdded %zu items in %f seconds\n", final->lh->number, t2-t1);
-  printf ("\n\nTotal time: %f seconds (including allocating memory)\n", t2-t0);
+  printf ("\n\nAdded %zu items in %f seconds\n", final->lh->number,
+      t2-t1-(t4-t3));
+  printf ("\nMerged %d lists in %f seconds, %f seconds two at a time"
+      " (%.2fx)\n", NUM_THREAD, t6-t5, t8-t7,
+      t6 > t5 ? (t8-t7)/(t6-t5) : 0.0);
+  printf ("\n\nTotal time: %f seconds (including allocating memory)\n",
+      t2-t0-(t4-t3));
   fp = fopen ("inputsrt.out", "w");
   if (0 == fp) {
     perror ("\n\n***Error: Could not open inputsrt.out");
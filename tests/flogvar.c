@@ -0,0 +1,234 @@
+/* Source File: flogvar.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogvar.c}
+ *
+ * Program: flogvar.c
+ * Script: flogvar.sh
+ *
+ * This program tests nsort_save_var().  It makes a sort of the items in a
+ * file, each of them only as long as the item is, and saves it with
+ * nsort_save_var() and, padded to the longest item, with nsort_save().  It gets
+ * both files back with nsort_get() and checks the sorts, printing the size of
+ * each file and the time each nsort_save() and nsort_get() takes.  Then it
+ * checks that a file that has been cut short is turned down.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+size_t testLength (void *p)
+{
+  return strlen ((char *) p) + 1;
+}
+
+//
+// Check the sort has the items in sorted, in order, and that each of them
+// can be found.
+//
+int checkSort (nsort_t *srt, char **sorted, int number, const char *what)
+{
+  nsort_link_t *lnk, find;
+  int i = 0;
+
+  if (srt->lh->number != (size_t)number) {
+    printf ("\n\n***Error: %s: %zu items, expected %d\n", what,
+        srt->lh->number, number);
+    return _ERROR_;
+  }
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next, i++)
+    if (i >= number || strcmp (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: item %d is wrong\n", what, i);
+      return _ERROR_;
+    }
+  for (i = 0; i < number; i++) {
+    find.data = sorted[i];
+    lnk = nsort_find_item (srt, &find);
+    if (lnk == 0 || strcmp (lnk->data, sorted[i]) != 0) {
+      printf ("\n\n***Error: %s: didn't find %s\n", what, sorted[i]);
+      return _ERROR_;
+    }
+  }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  FILE *fp;
+  struct stat sbuf;
+  char *cp, *records;
+  char **cpp, **sorted, **padded;
+  char str[ERROR_LEN+1];
+  nsort_t *srt;
+  double t1, t2, t3;
+  size_t len, maxLen = 0;
+  int number, i;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  padded = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted || 0 == padded) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  memcpy (sorted, cpp, number * sizeof (char *));
+  qsort (sorted, (size_t)number, sizeof (char *), qsortCompare);
+  for (i = 0; i < number; i++) {
+    len = strlen (sorted[i]) + 1;
+    if (len > maxLen)
+      maxLen = len;
+  }
+  records = malloc ((size_t)number * maxLen);
+  if (records == 0) {
+    printf ("\n\n***Error: critical memory error allocating records\n");
+    return _ERROR_;
+  }
+  memset (records, 0, (size_t)number * maxLen);
+  for (i = 0; i < number; i++) {
+    padded[i] = records + (size_t)i * maxLen;
+    strcpy (padded[i], sorted[i]);
+  }
+  printf ("\n%d items, the longest %zu bytes\n", number, maxLen);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+
+  // the items as long as they are
+  if (nsort_build_sorted (srt, (void **)sorted, (size_t)number, testCompare,
+        FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_build_sorted(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t1);
+  if (nsort_save_var (srt, "flogvar", testLength, "flogvar.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save_var(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  nsort_del (srt, 0);
+  if (nsort_get (srt, testCompare, "flogvar.dat") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get() of flogvar.dat: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t3);
+  stat ("flogvar.dat", &sbuf);
+  printf ("  nsort_save_var() %10zu bytes, save %f, get %f seconds\n",
+      (size_t)sbuf.st_size, t2 - t1, t3 - t2);
+  if (checkSort (srt, sorted, number, "nsort_save_var()") == _ERROR_)
+    return _ERROR_;
+  srt->manageAllocs = TRUE;
+  nsort_del (srt, 0);
+
+  // the items padded to the longest
+  if (nsort_build_sorted (srt, (void **)padded, (size_t)number, testCompare,
+        FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_build_sorted(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t1);
+  if (nsort_save (srt, "flogvar", (int)maxLen, "flogvar.fix") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_save(): %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t2);
+  nsort_del (srt, 0);
+  if (nsort_get (srt, testCompare, "flogvar.fix") == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_get() of flogvar.fix: %s\n", str);
+    return _ERROR_;
+  }
+  nsort_elapsed (&t3);
+  stat ("flogvar.fix", &sbuf);
+  printf ("  nsort_save()     %10zu bytes, save %f, get %f seconds\n",
+      (size_t)sbuf.st_size, t2 - t1, t3 - t2);
+  if (checkSort (srt, sorted, number, "nsort_save()") == _ERROR_)
+    return _ERROR_;
+  srt->manageAllocs = TRUE;
+  nsort_del (srt, 0);
+
+  // a file that is cut short
+  stat ("flogvar.dat", &sbuf);
+  if (truncate ("flogvar.dat", sbuf.st_size - 1) != 0) {
+    printf ("\n\n***Error: couldn't truncate flogvar.dat\n");
+    return _ERROR_;
+  }
+  if (nsort_get (srt, testCompare, "flogvar.dat") != _ERROR_ ||
+      srt->sortError != SORT_FRDWR) {
+    printf ("\n\n***Error: a file cut short wasn't turned down\n");
+    return _ERROR_;
+  }
+  nsort_destroy (srt);
+  unlink ("flogvar.dat");
+  unlink ("flogvar.fix");
+
+  free (records);
+  free (padded);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}
@@ -0,0 +1,228 @@
+/* Source File: flogwrt.c */
+
+/*
+ * [BeginDoc]
+ *
+ * \subsection{flogwrt.c}
+ *
+ * Program: flogwrt.c
+ * Script: flogwrt.sh
+ *
+ * This program tests the streaming writes of nsort_list_write_block().  It
+ * makes a sort of the items in a file, padded to records whose length doesn't
+ * divide the size of the write buffers, and saves it with nsort_save() under
+ * each of the sync policies, getting it back with nsort_get() and checking it
+ * each time.  It does the same with nsort_save_map().  Then it writes the list
+ * with nsort_list_write_block() between a header and a trailer of its own and
+ * checks what is in the file and where the file offset is left.  It prints the
+ * time each save takes and the memory the writes need against what a copy of
+ * the whole list would take.
+ *
+ * [EndDoc]
+ */
+#include "sorthdr.h"
+
+#define MAX_DATA 1000000
+#define ERROR_LEN 256
+#define RECLEN 100
+
+#define HASH_STR(x)  (((x)[0]<<15)+((x)[1]<<10)+((x)[2]<<5)+(x)[3])
+
+int testCompare (void *p1, void *p2)
+{
+  unsigned int v1 = HASH_STR((char*)p1),
+               v2 = HASH_STR((char*)p2);
+  if (v1 < v2)
+    return -1;
+  else if (v1 > v2)
+    return 1;
+  else
+    return (strcmp ((char *) p1, (char *) p2));
+}
+
+int qsortCompare (const void *p1, const void *p2)
+{
+  return testCompare (*(char **)p1, *(char **)p2);
+}
+
+//
+// Check the sort has the records in sorted, in order.
+//
+int checkSort (nsort_t *srt, char **sorted, int number, const char *what)
+{
+  nsort_link_t *lnk;
+  int i = 0;
+
+  if (srt->lh->number != (size_t)number) {
+    printf ("\n\n***Error: %s: %zu items, expected %d\n", what,
+        srt->lh->number, number);
+    return _ERROR_;
+  }
+  for (lnk = srt->lh->head->next; lnk != srt->lh->tail; lnk = lnk->next, i++)
+    if (i >= number || memcmp (lnk->data, sorted[i], RECLEN) != 0) {
+      printf ("\n\n***Error: %s: item %d is wrong\n", what, i);
+      return _ERROR_;
+    }
+  return _OK_;
+}
+
+int main (int argc, char *argv[])
+{
+  static const int policies[] = {
+    NSORT_SYNC_NONE, NSORT_SYNC_DATA, NSORT_SYNC_FULL
+  };
+  static const char *names[] = { "none", "data", "full" };
+  static const char *files[] = { "flogwrt.dat", "flogwrt.map" };
+  FILE *fp;
+  struct stat sbuf;
+  char *cp, *records, *back;
+  char **cpp, **sorted;
+  char str[ERROR_LEN+1];
+  nsort_t *srt;
+  double t1, t2, t3;
+  size_t num;
+  off_t where;
+  int number, i, fd;
+
+  if (argc != 2) {
+    printf ("\n\nUsage: %s <file>\n", argv[0]);
+    printf ("\twhere <file> is the file to load\n");
+    return 1;
+  }
+  fp = fopen (argv[1], "r");
+  if (fp == NULL) {
+    printf ("\n\n***Error: couldn't open %s\n", argv[1]);
+    return _ERROR_;
+  }
+  stat (argv[1], &sbuf);
+  cp = malloc ((size_t)sbuf.st_size+1);
+  if (0 == cp) {
+    printf ("\n\n***Error: critical memory error allocating file buffer\n");
+    fclose (fp);
+    return _ERROR_;
+  }
+  fread (cp, (size_t)sbuf.st_size, 1, fp);
+  cp[sbuf.st_size] = '\0';
+  fclose (fp);
+  cpp = malloc (MAX_DATA * sizeof (char *));
+  sorted = malloc (MAX_DATA * sizeof (char *));
+  if (0 == cpp || 0 == sorted) {
+    printf ("\n\n***Error: critical memory error allocating char arrays\n");
+    free (cp);
+    return _ERROR_;
+  }
+  memset (cpp, 0, MAX_DATA*sizeof(char*));
+  number = nsort_text_file_split (cpp, MAX_DATA, cp, '\n');
+  for (i = 0; i < number && cpp[i] != 0 && cpp[i][0] != '\0'; i++)
+    ;
+  number = i;
+  if (number < 2) {
+    printf ("\n\n***Error: %s doesn't have enough items\n", argv[1]);
+    return _ERROR_;
+  }
+  qsort (cpp, (size_t)number, sizeof (char *), qsortCompare);
+  records = malloc ((size_t)number * RECLEN);
+  back = malloc ((size_t)number * RECLEN);
+  if (records == 0 || back == 0) {
+    printf ("\n\n***Error: critical memory error allocating records\n");
+    return _ERROR_;
+  }
+  memset (records, 0, (size_t)number * RECLEN);
+  for (i = 0; i < number; i++) {
+    sorted[i] = records + (size_t)i * RECLEN;
+    strncpy (sorted[i], cpp[i], RECLEN - 1);
+  }
+  printf ("\n%d items of %d bytes\n", number, RECLEN);
+
+  srt = nsort_create ();
+  if (srt == 0) {
+    nsort_show_error (str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_create(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_build_sorted (srt, (void **)sorted, (size_t)number, testCompare,
+        FALSE) == _ERROR_) {
+    nsort_show_sort_error (srt, str, ERROR_LEN);
+    printf ("\n\n***Error: nsort_build_sorted(): %s\n", str);
+    return _ERROR_;
+  }
+  if (nsort_set_sync (srt, 42) != _ERROR_ || srt->sortError != SORT_PARAM) {
+    printf ("\n\n***Error: nsort_set_sync() took a bad policy\n");
+    return _ERROR_;
+  }
+  srt->sortError = SORT_NOERROR;
+
+  // nsort_save() and nsort_save_map() under each policy, going between two
+  // files as a file written by nsort_save_map() is still in use once it is
+  // got back
+  for (i = 0; i < 6; i++) {
+    if (nsort_set_sync (srt, policies[i % 3]) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_set_sync(): %s\n", str);
+      return _ERROR_;
+    }
+    nsort_elapsed (&t1);
+    if ((i < 3 ? nsort_save (srt, "flogwrt", RECLEN, (char *)files[i % 2]) :
+          nsort_save_map (srt, "flogwrt", RECLEN, (char *)files[i % 2])) ==
+        _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: saving with sync %s: %s\n", names[i % 3], str);
+      return _ERROR_;
+    }
+    nsort_elapsed (&t2);
+    nsort_del (srt, 0);
+    if (nsort_get (srt, testCompare, (char *)files[i % 2]) == _ERROR_) {
+      nsort_show_sort_error (srt, str, ERROR_LEN);
+      printf ("\n\n***Error: nsort_get(): %s\n", str);
+      return _ERROR_;
+    }
+    nsort_elapsed (&t3);
+    srt->manageAllocs = TRUE;
+    printf ("  %-16s sync %s: save %f, get %f seconds\n",
+        i < 3 ? "nsort_save()" : "nsort_save_map()", names[i % 3],
+        t2 - t1, t3 - t2);
+    if (checkSort (srt, sorted, number, names[i % 3]) == _ERROR_)
+      return _ERROR_;
+  }
+
+  // nsort_list_write_block() between a header and a trailer
+  fd = open ("flogwrt.tmp", O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || write (fd, "header\n", 7) != 7) {
+    printf ("\n\n***Error: couldn't write flogwrt.tmp\n");
+    return _ERROR_;
+  }
+  num = nsort_list_write_block (fd, 7, RECLEN, srt->lh);
+  if (num != (size_t)number * RECLEN) {
+    printf ("\n\n***Error: nsort_list_write_block() wrote %zu bytes\n", num);
+    return _ERROR_;
+  }
+  where = lseek (fd, 0, SEEK_CUR);
+  if (where != (off_t)(7 + num) || write (fd, "trailer\n", 8) != 8) {
+    printf ("\n\n***Error: the file offset was left at %ld\n", (long)where);
+    return _ERROR_;
+  }
+  if (pread (fd, str, 7, 0) != 7 || memcmp (str, "header\n", 7) != 0 ||
+      pread (fd, back, num, 7) != (ssize_t)num ||
+      memcmp (back, records, num) != 0 ||
+      pread (fd, str, 8, (off_t)(7 + num)) != 8 ||
+      memcmp (str, "trailer\n", 8) != 0) {
+    printf ("\n\n***Error: nsort_list_write_block() wrote the wrong data\n");
+    return _ERROR_;
+  }
+  close (fd);
+  printf ("  nsort_list_write_block() used %d bytes of buffers for %zu bytes\n",
+      2 * NSORT_WRITE_BUFFER, num);
+
+  nsort_del (srt, 0);
+  nsort_destroy (srt);
+  unlink ("flogwrt.dat");
+  unlink ("flogwrt.map");
+  unlink ("flogwrt.tmp");
+  free (back);
+  free (records);
+  free (sorted);
+  free (cpp);
+  free (cp);
+  printf ("\nThere were no errors\n");
+  return 0;
+}